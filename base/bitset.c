@@ -0,0 +1,413 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <base/bitset.h>
+#include <base/cpu.h>
+#include <base/sys.h>
+#include <base/util.h>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif	// __x86_64__
+
+#define BITSET_WORDS(bits) (((bits) + 63) / 64)
+// rank block: 8 words, one cache line
+#define BITSET_BLOCK_WORDS 8
+#define BITSET_BLOCK_BITS 512
+// one select sample per this many ones
+#define BITSET_SAMPLE 8192
+
+#define BITSET_OP_AND 0
+#define BITSET_OP_OR 1
+#define BITSET_OP_XOR 2
+#define BITSET_OP_ANDNOT 3
+
+typedef u64 BitsetV4 __attribute__((vector_size(32)));
+typedef u64 BitsetV4u __attribute__((vector_size(32), aligned(1), may_alias));
+
+static void bitset_mask_tail(Bitset *b) {
+	if (b->bits % 64) b->words[b->bits / 64] &= (1ULL << (b->bits % 64)) - 1;
+}
+
+int bitset_init(Bitset *b, u64 bits) {
+	b->bits = bits;
+	b->pages = bytes_to_pages(BITSET_WORDS(bits) * sizeof(u64));
+	b->words = NULL;
+	if (b->pages && !(b->words = map(b->pages))) {
+		b->pages = 0;
+		b->bits = 0;
+		return -1;
+	}
+	return 0;
+}
+
+void bitset_cleanup(Bitset *b) {
+	if (b->words) unmap(b->words, b->pages);
+	b->words = NULL;
+	b->pages = 0;
+	b->bits = 0;
+}
+
+int bitset_resize(Bitset *b, u64 bits) {
+	u64 words = BITSET_WORDS(bits), old_words = BITSET_WORDS(b->bits);
+	u64 needed = bytes_to_pages(words * sizeof(u64));
+	if (needed > b->pages) {
+		u64 pages = needed > b->pages * 2 ? needed : b->pages * 2;
+		u64 *n = map(pages);
+		if (!n) return -1;
+		if (b->words) {
+			copy_bytes((byte *)n, (byte *)b->words, old_words * sizeof(u64));
+			unmap(b->words, b->pages);
+		}
+		b->words = n;
+		b->pages = pages;
+	} else if (bits < b->bits) {
+		// keep everything past the new end clear for later growth
+		for (u64 i = words; i < old_words; i++) b->words[i] = 0;
+	}
+	b->bits = bits;
+	if (b->words) bitset_mask_tail(b);
+	return 0;
+}
+
+void bitset_set(Bitset *b, u64 i) {
+	if (i < b->bits) b->words[i / 64] |= 1ULL << (i % 64);
+}
+
+void bitset_clear(Bitset *b, u64 i) {
+	if (i < b->bits) b->words[i / 64] &= ~(1ULL << (i % 64));
+}
+
+bool bitset_test(const Bitset *b, u64 i) {
+	return i < b->bits && (b->words[i / 64] >> (i % 64)) & 1;
+}
+
+void bitset_fill(Bitset *b, bool value) {
+	if (!b->words) return;
+	set_bytes((byte *)b->words, value ? 0xFF : 0,
+			  BITSET_WORDS(b->bits) * sizeof(u64));
+	bitset_mask_tail(b);
+}
+
+// Population counts: __builtin_popcountll is a libgcc call unless the target
+// has POPCNT, so the same loop is also compiled for that target.
+static inline __attribute__((always_inline)) u64
+bitset_count_words(const u64 *w, u64 n) {
+	u64 c0 = 0, c1 = 0, c2 = 0, c3 = 0, i = 0;
+	for (; i + 4 <= n; i += 4) {
+		c0 += __builtin_popcountll(w[i]);
+		c1 += __builtin_popcountll(w[i + 1]);
+		c2 += __builtin_popcountll(w[i + 2]);
+		c3 += __builtin_popcountll(w[i + 3]);
+	}
+	for (; i < n; i++) c0 += __builtin_popcountll(w[i]);
+	return c0 + c1 + c2 + c3;
+}
+
+static u64 bitset_count_generic(const u64 *w, u64 n) {
+	return bitset_count_words(w, n);
+}
+
+#ifdef __x86_64__
+static __attribute__((target("popcnt"))) u64
+bitset_count_popcnt(const u64 *w, u64 n) {
+	return bitset_count_words(w, n);
+}
+
+// Nibble lookups with vpshufb (Mula, Kurz and Lemire 2018): bytes are counted
+// 32 at a time and summed into 64 bit lanes with vpsadbw every 8 vectors,
+// before a byte count could overflow.
+static __attribute__((target("avx2,popcnt"))) u64
+bitset_count_avx2(const u64 *w, u64 n) {
+	const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2,
+										 3, 3, 4, 0, 1, 1, 2, 1, 2, 2, 3, 1, 2,
+										 2, 3, 2, 3, 3, 4);
+	const __m256i low = _mm256_set1_epi8(0x0F);
+	__m256i total = _mm256_setzero_si256();
+	u64 i = 0;
+	while (i + 4 <= n) {
+		__m256i bytes = _mm256_setzero_si256();
+		for (int k = 0; k < 8 && i + 4 <= n; k++, i += 4) {
+			__m256i v = _mm256_loadu_si256((const __m256i *)(w + i));
+			__m256i lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(v, low));
+			__m256i hi = _mm256_shuffle_epi8(
+				lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), low));
+			bytes = _mm256_add_epi8(bytes, _mm256_add_epi8(lo, hi));
+		}
+		total = _mm256_add_epi64(
+			total, _mm256_sad_epu8(bytes, _mm256_setzero_si256()));
+	}
+	u64 count = _mm256_extract_epi64(total, 0) +
+				_mm256_extract_epi64(total, 1) +
+				_mm256_extract_epi64(total, 2) + _mm256_extract_epi64(total, 3);
+	for (; i < n; i++) count += __builtin_popcountll(w[i]);
+	return count;
+}
+#endif	// __x86_64__
+
+static u64 bitset_count_range(const u64 *w, u64 n) {
+#ifdef __x86_64__
+	if (cpu_has(CPU_AVX2 | CPU_POPCNT)) return bitset_count_avx2(w, n);
+	if (cpu_has(CPU_POPCNT)) return bitset_count_popcnt(w, n);
+#endif	// __x86_64__
+	return bitset_count_generic(w, n);
+}
+
+u64 bitset_count(const Bitset *b) {
+	return bitset_count_range(b->words, BITSET_WORDS(b->bits));
+}
+
+u64 bitset_next_set(const Bitset *b, u64 from) {
+	if (from >= b->bits) return b->bits;
+	u64 w = from / 64, n = BITSET_WORDS(b->bits);
+	u64 v = b->words[w] & (~0ULL << (from % 64));
+	while (!v) {
+		if (++w >= n) return b->bits;
+		v = b->words[w];
+	}
+	return w * 64 + __builtin_ctzll(v);
+}
+
+u64 bitset_next_clear(const Bitset *b, u64 from) {
+	if (from >= b->bits) return b->bits;
+	u64 w = from / 64, n = BITSET_WORDS(b->bits);
+	u64 v = ~b->words[w] & (~0ULL << (from % 64));
+	while (!v) {
+		if (++w >= n) return b->bits;
+		v = ~b->words[w];
+	}
+	u64 i = w * 64 + __builtin_ctzll(v);
+	// the clear tail of the last word is not part of the set
+	return i < b->bits ? i : b->bits;
+}
+
+// Binary operations written with vector extensions, compiled for the
+// baseline (two SSE2 operations per vector) and for AVX2 (one).
+static inline __attribute__((always_inline)) void
+bitset_op_words(u64 *dst, const u64 *src, u64 n, int op) {
+	u64 i = 0;
+	for (; i + 4 <= n; i += 4) {
+		BitsetV4 a = *(BitsetV4u *)(dst + i), b = *(BitsetV4u *)(src + i);
+		if (op == BITSET_OP_AND)
+			a &= b;
+		else if (op == BITSET_OP_OR)
+			a |= b;
+		else if (op == BITSET_OP_XOR)
+			a ^= b;
+		else
+			a &= ~b;
+		*(BitsetV4u *)(dst + i) = a;
+	}
+	for (; i < n; i++) {
+		if (op == BITSET_OP_AND)
+			dst[i] &= src[i];
+		else if (op == BITSET_OP_OR)
+			dst[i] |= src[i];
+		else if (op == BITSET_OP_XOR)
+			dst[i] ^= src[i];
+		else
+			dst[i] &= ~src[i];
+	}
+}
+
+static void bitset_op_generic(u64 *dst, const u64 *src, u64 n, int op) {
+	switch (op) {
+		case BITSET_OP_AND:
+			bitset_op_words(dst, src, n, BITSET_OP_AND);
+			break;
+		case BITSET_OP_OR:
+			bitset_op_words(dst, src, n, BITSET_OP_OR);
+			break;
+		case BITSET_OP_XOR:
+			bitset_op_words(dst, src, n, BITSET_OP_XOR);
+			break;
+		default:
+			bitset_op_words(dst, src, n, BITSET_OP_ANDNOT);
+	}
+}
+
+#ifdef __x86_64__
+static __attribute__((target("avx2"))) void
+bitset_op_avx2(u64 *dst, const u64 *src, u64 n, int op) {
+	switch (op) {
+		case BITSET_OP_AND:
+			bitset_op_words(dst, src, n, BITSET_OP_AND);
+			break;
+		case BITSET_OP_OR:
+			bitset_op_words(dst, src, n, BITSET_OP_OR);
+			break;
+		case BITSET_OP_XOR:
+			bitset_op_words(dst, src, n, BITSET_OP_XOR);
+			break;
+		default:
+			bitset_op_words(dst, src, n, BITSET_OP_ANDNOT);
+	}
+}
+#endif	// __x86_64__
+
+static void bitset_op(Bitset *dst, const Bitset *src, int op) {
+	u64 dst_words = BITSET_WORDS(dst->bits);
+	u64 src_words = BITSET_WORDS(src->bits);
+	u64 n = dst_words < src_words ? dst_words : src_words;
+#ifdef __x86_64__
+	if (cpu_has(CPU_AVX2))
+		bitset_op_avx2(dst->words, src->words, n, op);
+	else
+#endif	// __x86_64__
+		bitset_op_generic(dst->words, src->words, n, op);
+	if (op == BITSET_OP_AND)
+		for (u64 i = n; i < dst_words; i++) dst->words[i] = 0;
+	if (dst->words) bitset_mask_tail(dst);
+}
+
+void bitset_and(Bitset *dst, const Bitset *src) {
+	bitset_op(dst, src, BITSET_OP_AND);
+}
+
+void bitset_or(Bitset *dst, const Bitset *src) {
+	bitset_op(dst, src, BITSET_OP_OR);
+}
+
+void bitset_xor(Bitset *dst, const Bitset *src) {
+	bitset_op(dst, src, BITSET_OP_XOR);
+}
+
+void bitset_andnot(Bitset *dst, const Bitset *src) {
+	bitset_op(dst, src, BITSET_OP_ANDNOT);
+}
+
+int bitset_rank_init(BitsetRank *r, const Bitset *b) {
+	u64 words = BITSET_WORDS(b->bits);
+	u64 blocks = (words + BITSET_BLOCK_WORDS - 1) / BITSET_BLOCK_WORDS;
+	u64 ones = bitset_count(b);
+	// cumulative counts with a final total, samples with a sentinel
+	u64 samples = ones / BITSET_SAMPLE + 2;
+	r->pages = bytes_to_pages((blocks + 1 + samples) * sizeof(u64));
+	r->blocks = map(r->pages);
+	if (!r->blocks) return -1;
+	r->samples = r->blocks + blocks + 1;
+	r->words = b->words;
+	r->bits = b->bits;
+	r->ones = ones;
+
+	u64 rank = 0, next = 0;
+	for (u64 i = 0; i < blocks; i++) {
+		u64 w = i * BITSET_BLOCK_WORDS, end = w + BITSET_BLOCK_WORDS;
+		r->blocks[i] = rank;
+		if (end > words) end = words;
+		rank += bitset_count_range(b->words + w, end - w);
+		while (next * BITSET_SAMPLE < rank) r->samples[next++] = i;
+	}
+	r->blocks[blocks] = rank;
+	r->samples[next] = blocks ? blocks - 1 : 0;
+	return 0;
+}
+
+void bitset_rank_cleanup(BitsetRank *r) {
+	if (r->blocks) unmap(r->blocks, r->pages);
+	r->blocks = r->samples = NULL;
+	r->pages = 0;
+}
+
+static inline __attribute__((always_inline)) u64
+bitset_rank_body(const BitsetRank *r, u64 i) {
+	if (i >= r->bits) return r->ones;
+	u64 w = i / BITSET_BLOCK_BITS * BITSET_BLOCK_WORDS, end = i / 64;
+	u64 rank = r->blocks[i / BITSET_BLOCK_BITS];
+	for (; w < end; w++) rank += __builtin_popcountll(r->words[w]);
+	if (i % 64)
+		rank += __builtin_popcountll(r->words[end] & ((1ULL << (i % 64)) - 1));
+	return rank;
+}
+
+// Position of the set bit of rank 'k' in 'w' (k < popcount(w)).
+static inline u64 bitset_select_word(u64 w, u64 k) {
+	u64 shift = 0;
+	for (;;) {
+		u64 c = __builtin_popcountll(w & 0xFF);
+		if (k < c) break;
+		k -= c;
+		w >>= 8;
+		shift += 8;
+	}
+	while (k--) w &= w - 1;
+	return shift + __builtin_ctzll(w);
+}
+
+#ifdef __x86_64__
+static inline __attribute__((target("bmi2"))) u64
+bitset_select_word_pdep(u64 w, u64 k) {
+	return __builtin_ctzll(_pdep_u64(1ULL << k, w));
+}
+#endif	// __x86_64__
+
+static inline __attribute__((always_inline)) u64
+bitset_select_body(const BitsetRank *r, u64 k, bool pdep) {
+	if (k >= r->ones) return r->bits;
+	// the sampled blocks bound the block holding rank k
+	u64 lo = r->samples[k / BITSET_SAMPLE];
+	u64 hi = r->samples[k / BITSET_SAMPLE + 1];
+	while (lo < hi) {
+		u64 mid = lo + (hi - lo + 1) / 2;
+		if (r->blocks[mid] <= k)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	k -= r->blocks[lo];
+	u64 w = lo * BITSET_BLOCK_WORDS;
+	for (;; w++) {
+		u64 c = __builtin_popcountll(r->words[w]);
+		if (k < c) break;
+		k -= c;
+	}
+#ifdef __x86_64__
+	if (pdep) return w * 64 + bitset_select_word_pdep(r->words[w], k);
+#endif	// __x86_64__
+	return w * 64 + bitset_select_word(r->words[w], k);
+}
+
+static u64 bitset_rank_generic(const BitsetRank *r, u64 i) {
+	return bitset_rank_body(r, i);
+}
+
+static u64 bitset_select_generic(const BitsetRank *r, u64 k) {
+	return bitset_select_body(r, k, false);
+}
+
+#ifdef __x86_64__
+static __attribute__((target("popcnt"))) u64
+bitset_rank_popcnt(const BitsetRank *r, u64 i) {
+	return bitset_rank_body(r, i);
+}
+
+static __attribute__((target("popcnt,bmi2"))) u64
+bitset_select_bmi2(const BitsetRank *r, u64 k) {
+	return bitset_select_body(r, k, true);
+}
+#endif	// __x86_64__
+
+u64 bitset_rank(const BitsetRank *r, u64 i) {
+#ifdef __x86_64__
+	if (cpu_has(CPU_POPCNT)) return bitset_rank_popcnt(r, i);
+#endif	// __x86_64__
+	return bitset_rank_generic(r, i);
+}
+
+u64 bitset_select(const BitsetRank *r, u64 k) {
+#ifdef __x86_64__
+	if (cpu_has(CPU_POPCNT | CPU_BMI2)) return bitset_select_bmi2(r, k);
+#endif	// __x86_64__
+	return bitset_select_generic(r, k);
+}
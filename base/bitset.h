@@ -0,0 +1,78 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _BASE_BITSET__
+#define _BASE_BITSET__
+
+#include <base/types.h>
+
+// Dense bitset stored in mapped pages. Bits past 'bits' in the last word are
+// kept clear, so counts and scans never see them.
+typedef struct Bitset {
+	u64 *words;
+	u64 bits;
+	u64 pages;
+} Bitset;
+
+// Initialize with 'bits' clear bits. Returns -1 if the pages can't be mapped.
+int bitset_init(Bitset *b, u64 bits);
+void bitset_cleanup(Bitset *b);
+// Change the length; bits added at the end are clear. Capacity grows
+// geometrically, so appending bit by bit is amortized O(1).
+int bitset_resize(Bitset *b, u64 bits);
+
+void bitset_set(Bitset *b, u64 i);
+void bitset_clear(Bitset *b, u64 i);
+bool bitset_test(const Bitset *b, u64 i);
+// Set or clear every bit.
+void bitset_fill(Bitset *b, bool value);
+
+// Number of set bits; uses AVX2 nibble lookups or POPCNT when available.
+u64 bitset_count(const Bitset *b);
+// First set (clear) bit at or after 'from', or 'bits' if there is none.
+u64 bitset_next_set(const Bitset *b, u64 from);
+u64 bitset_next_clear(const Bitset *b, u64 from);
+
+// dst = dst OP src over the bits of 'dst'. If 'src' is shorter its missing
+// bits count as clear, so bitset_and clears the rest of 'dst' and the others
+// leave it unchanged. Runs 256 bits at a time (AVX2 or two SSE2 registers).
+void bitset_and(Bitset *dst, const Bitset *src);
+void bitset_or(Bitset *dst, const Bitset *src);
+void bitset_xor(Bitset *dst, const Bitset *src);
+void bitset_andnot(Bitset *dst, const Bitset *src);
+
+// Succinct rank/select index over a bitset that no longer changes. Rank keeps
+// the number of ones before each 512 bit (one cache line) block, 12.5% extra
+// space, and counts within the block. Select samples the block holding every
+// 8192nd one, then searches the block counts and selects within a word
+// (with PDEP when BMI2 is available).
+typedef struct BitsetRank {
+	const u64 *words;
+	u64 bits;
+	u64 ones;
+	u64 *blocks;
+	u64 *samples;
+	u64 pages;
+} BitsetRank;
+
+// The index refers to 'b', which must outlive it unchanged.
+int bitset_rank_init(BitsetRank *r, const Bitset *b);
+void bitset_rank_cleanup(BitsetRank *r);
+// Number of set bits before position 'i' (i <= bits).
+u64 bitset_rank(const BitsetRank *r, u64 i);
+// Position of the set bit with rank 'k' (counting from 0), or 'bits' if
+// k >= ones.
+u64 bitset_select(const BitsetRank *r, u64 k);
+
+#endif	// _BASE_BITSET__
@@ -0,0 +1,470 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <base/blake3.h>
+#include <base/cpu.h>
+#include <base/util.h>
+#include <pthread.h>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif	// __x86_64__
+
+#define BLAKE3_CHUNK_START (1 << 0)
+#define BLAKE3_CHUNK_END (1 << 1)
+#define BLAKE3_PARENT (1 << 2)
+#define BLAKE3_ROOT (1 << 3)
+#define BLAKE3_KEYED_HASH (1 << 4)
+
+#define BLAKE3_CHUNK_BLOCKS (BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN)
+// chunks hashed per call in blake3_update's bulk path
+#define BLAKE3_BATCH 16
+// subtrees smaller than this aren't split across threads
+#define BLAKE3_PARALLEL_MIN (128 * 1024)
+
+static const u32 blake3_iv[8] = {0x6A09E667, 0xBB67AE85, 0x3C6EF372,
+								 0xA54FF53A, 0x510E527F, 0x9B05688C,
+								 0x1F83D9AB, 0x5BE0CD19};
+
+// message word order for each of the 7 rounds
+static const byte blake3_schedule[7][16] = {
+	{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+	{2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+	{3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+	{10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+	{12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+	{9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+	{11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13}};
+
+// What's needed to produce a node's chaining value or, for the root, any
+// amount of output.
+typedef struct Blake3Output {
+	u32 cv[8];
+	byte block[BLAKE3_BLOCK_LEN];
+	u32 block_len;
+	u64 counter;
+	u32 flags;
+} Blake3Output;
+
+static inline u32 blake3_rotr(u32 x, int n) {
+	return x >> n | x << (32 - n);
+}
+
+static inline void blake3_g(u32 v[16], int a, int b, int c, int d, u32 x,
+							u32 y) {
+	v[a] += v[b] + x;
+	v[d] = blake3_rotr(v[d] ^ v[a], 16);
+	v[c] += v[d];
+	v[b] = blake3_rotr(v[b] ^ v[c], 12);
+	v[a] += v[b] + y;
+	v[d] = blake3_rotr(v[d] ^ v[a], 8);
+	v[c] += v[d];
+	v[b] = blake3_rotr(v[b] ^ v[c], 7);
+}
+
+static void blake3_compress(const u32 cv[8], const byte *block, u32 block_len,
+							u64 counter, u32 flags, u32 out[16]) {
+	u32 m[16], v[16];
+	copy_bytes((byte *)m, block, BLAKE3_BLOCK_LEN);	 // little endian host
+	for (int i = 0; i < 8; i++) v[i] = cv[i];
+	for (int i = 0; i < 4; i++) v[8 + i] = blake3_iv[i];
+	v[12] = counter;
+	v[13] = counter >> 32;
+	v[14] = block_len;
+	v[15] = flags;
+	for (int r = 0; r < 7; r++) {
+		const byte *s = blake3_schedule[r];
+		blake3_g(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+		blake3_g(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+		blake3_g(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+		blake3_g(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+		blake3_g(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+		blake3_g(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+		blake3_g(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+		blake3_g(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+	}
+	for (int i = 0; i < 8; i++) {
+		out[i] = v[i] ^ v[i + 8];
+		out[i + 8] = v[i + 8] ^ cv[i];
+	}
+}
+
+static void blake3_compress_cv(u32 cv[8], const byte *block, u32 block_len,
+							   u64 counter, u32 flags) {
+	u32 out[16];
+	blake3_compress(cv, block, block_len, counter, flags, out);
+	for (int i = 0; i < 8; i++) cv[i] = out[i];
+}
+
+// flags of block 'b' of a whole chunk
+static inline u32 blake3_block_flags(int b) {
+	return (b == 0 ? BLAKE3_CHUNK_START : 0) |
+		   (b == BLAKE3_CHUNK_BLOCKS - 1 ? BLAKE3_CHUNK_END : 0);
+}
+
+static void blake3_hash_chunk(const u32 key[8], u32 flags, const byte *p,
+							  u64 counter, u32 cv[8]) {
+	for (int i = 0; i < 8; i++) cv[i] = key[i];
+	for (int b = 0; b < BLAKE3_CHUNK_BLOCKS; b++) {
+		u32 f = flags | blake3_block_flags(b);
+		blake3_compress_cv(cv, p + b * BLAKE3_BLOCK_LEN, BLAKE3_BLOCK_LEN,
+						   counter, f);
+	}
+}
+
+#ifdef __x86_64__
+
+#define BLAKE3_ROTR16                                                         \
+	_mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13, 2, \
+					 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13)
+#define BLAKE3_ROTR8                                                          \
+	_mm256_setr_epi8(1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12, 1, \
+					 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12)
+
+static inline __attribute__((target("avx2"))) __m256i
+blake3_rotr_avx2(__m256i x, int n) {
+	return _mm256_or_si256(_mm256_srli_epi32(x, n),
+						   _mm256_slli_epi32(x, 32 - n));
+}
+
+static inline __attribute__((target("avx2"))) void blake3_g_avx2(
+	__m256i v[16], int a, int b, int c, int d, __m256i x, __m256i y) {
+	v[a] = _mm256_add_epi32(_mm256_add_epi32(v[a], v[b]), x);
+	v[d] = _mm256_shuffle_epi8(_mm256_xor_si256(v[d], v[a]), BLAKE3_ROTR16);
+	v[c] = _mm256_add_epi32(v[c], v[d]);
+	v[b] = blake3_rotr_avx2(_mm256_xor_si256(v[b], v[c]), 12);
+	v[a] = _mm256_add_epi32(_mm256_add_epi32(v[a], v[b]), y);
+	v[d] = _mm256_shuffle_epi8(_mm256_xor_si256(v[d], v[a]), BLAKE3_ROTR8);
+	v[c] = _mm256_add_epi32(v[c], v[d]);
+	v[b] = blake3_rotr_avx2(_mm256_xor_si256(v[b], v[c]), 7);
+}
+
+// 8x8 transpose of 32 bit words: word j of v[i] goes to word i of v[j].
+static inline __attribute__((target("avx2"))) void blake3_transpose(
+	__m256i v[8]) {
+	__m256i ab01 = _mm256_unpacklo_epi32(v[0], v[1]);
+	__m256i ab23 = _mm256_unpackhi_epi32(v[0], v[1]);
+	__m256i cd01 = _mm256_unpacklo_epi32(v[2], v[3]);
+	__m256i cd23 = _mm256_unpackhi_epi32(v[2], v[3]);
+	__m256i ef01 = _mm256_unpacklo_epi32(v[4], v[5]);
+	__m256i ef23 = _mm256_unpackhi_epi32(v[4], v[5]);
+	__m256i gh01 = _mm256_unpacklo_epi32(v[6], v[7]);
+	__m256i gh23 = _mm256_unpackhi_epi32(v[6], v[7]);
+	__m256i abcd0 = _mm256_unpacklo_epi64(ab01, cd01);
+	__m256i abcd1 = _mm256_unpackhi_epi64(ab01, cd01);
+	__m256i abcd2 = _mm256_unpacklo_epi64(ab23, cd23);
+	__m256i abcd3 = _mm256_unpackhi_epi64(ab23, cd23);
+	__m256i efgh0 = _mm256_unpacklo_epi64(ef01, gh01);
+	__m256i efgh1 = _mm256_unpackhi_epi64(ef01, gh01);
+	__m256i efgh2 = _mm256_unpacklo_epi64(ef23, gh23);
+	__m256i efgh3 = _mm256_unpackhi_epi64(ef23, gh23);
+	v[0] = _mm256_permute2x128_si256(abcd0, efgh0, 0x20);
+	v[1] = _mm256_permute2x128_si256(abcd1, efgh1, 0x20);
+	v[2] = _mm256_permute2x128_si256(abcd2, efgh2, 0x20);
+	v[3] = _mm256_permute2x128_si256(abcd3, efgh3, 0x20);
+	v[4] = _mm256_permute2x128_si256(abcd0, efgh0, 0x31);
+	v[5] = _mm256_permute2x128_si256(abcd1, efgh1, 0x31);
+	v[6] = _mm256_permute2x128_si256(abcd2, efgh2, 0x31);
+	v[7] = _mm256_permute2x128_si256(abcd3, efgh3, 0x31);
+}
+
+// 8 consecutive chunks at once, chunk i in lane i: the message words of each
+// block are transposed so that m[w] holds word w of every chunk.
+static __attribute__((target("avx2"))) void blake3_hash8_avx2(
+	const u32 key[8], u32 flags, const byte *p, u64 counter, u32 cvs[8][8]) {
+	__m256i h[8], m[16], v[16];
+	u32 lo[8], hi[8];
+	for (int i = 0; i < 8; i++) {
+		h[i] = _mm256_set1_epi32(key[i]);
+		lo[i] = counter + i;
+		hi[i] = (counter + i) >> 32;
+	}
+	__m256i counter_lo = _mm256_loadu_si256((const __m256i *)lo);
+	__m256i counter_hi = _mm256_loadu_si256((const __m256i *)hi);
+
+	for (int b = 0; b < BLAKE3_CHUNK_BLOCKS; b++) {
+		u32 f = flags | blake3_block_flags(b);
+		const byte *block = p + b * BLAKE3_BLOCK_LEN;
+		for (int i = 0; i < 8; i++) {
+			m[i] = _mm256_loadu_si256(
+				(const __m256i *)(block + i * BLAKE3_CHUNK_LEN));
+			m[8 + i] = _mm256_loadu_si256(
+				(const __m256i *)(block + i * BLAKE3_CHUNK_LEN + 32));
+		}
+		blake3_transpose(m);
+		blake3_transpose(m + 8);
+
+		for (int i = 0; i < 8; i++) v[i] = h[i];
+		for (int i = 0; i < 4; i++) v[8 + i] = _mm256_set1_epi32(blake3_iv[i]);
+		v[12] = counter_lo;
+		v[13] = counter_hi;
+		v[14] = _mm256_set1_epi32(BLAKE3_BLOCK_LEN);
+		v[15] = _mm256_set1_epi32(f);
+		for (int r = 0; r < 7; r++) {
+			const byte *s = blake3_schedule[r];
+			blake3_g_avx2(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+			blake3_g_avx2(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+			blake3_g_avx2(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+			blake3_g_avx2(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+			blake3_g_avx2(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+			blake3_g_avx2(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+			blake3_g_avx2(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+			blake3_g_avx2(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+		}
+		for (int i = 0; i < 8; i++) h[i] = _mm256_xor_si256(v[i], v[i + 8]);
+	}
+
+	blake3_transpose(h);
+	for (int i = 0; i < 8; i++) _mm256_storeu_si256((__m256i *)cvs[i], h[i]);
+}
+
+#endif	// __x86_64__
+
+// Chaining values of 'n' whole chunks starting at 'p', the first numbered
+// 'counter'.
+static void blake3_hash_chunks(const u32 key[8], u32 flags, const byte *p,
+							   u64 n, u64 counter, u32 cvs[][8]) {
+	u64 i = 0;
+#ifdef __x86_64__
+	if (cpu_has(CPU_AVX2))
+		for (; i + 8 <= n; i += 8)
+			blake3_hash8_avx2(key, flags, p + i * BLAKE3_CHUNK_LEN,
+							  counter + i, cvs + i);
+#endif	// __x86_64__
+	for (; i < n; i++)
+		blake3_hash_chunk(key, flags, p + i * BLAKE3_CHUNK_LEN, counter + i,
+						  cvs[i]);
+}
+
+static void blake3_output_cv(const Blake3Output *o, u32 cv[8]) {
+	for (int i = 0; i < 8; i++) cv[i] = o->cv[i];
+	blake3_compress_cv(cv, o->block, o->block_len, o->counter, o->flags);
+}
+
+static void blake3_output_root(const Blake3Output *o, byte *out, u64 len) {
+	for (u64 counter = 0; len; counter++) {
+		u32 words[16];
+		blake3_compress(o->cv, o->block, o->block_len, counter,
+						o->flags | BLAKE3_ROOT, words);
+		u64 n = len < BLAKE3_BLOCK_LEN ? len : BLAKE3_BLOCK_LEN;
+		copy_bytes(out, (const byte *)words, n);	// little endian host
+		out += n;
+		len -= n;
+	}
+}
+
+static void blake3_parent_output(const u32 key[8], u32 flags,
+								 const u32 left[8], const u32 right[8],
+								 Blake3Output *o) {
+	for (int i = 0; i < 8; i++) o->cv[i] = key[i];
+	copy_bytes(o->block, (const byte *)left, 32);
+	copy_bytes(o->block + 32, (const byte *)right, 32);
+	o->block_len = BLAKE3_BLOCK_LEN;
+	o->counter = 0;
+	o->flags = flags | BLAKE3_PARENT;
+}
+
+static void blake3_parent_cv(const u32 key[8], u32 flags, const u32 left[8],
+							 const u32 right[8], u32 cv[8]) {
+	Blake3Output o;
+	blake3_parent_output(key, flags, left, right, &o);
+	blake3_output_cv(&o, cv);
+}
+
+static void blake3_chunk_output(const Blake3 *h, Blake3Output *o) {
+	for (int i = 0; i < 8; i++) o->cv[i] = h->cv[i];
+	copy_bytes(o->block, h->block, h->block_len);
+	set_bytes(o->block + h->block_len, 0, BLAKE3_BLOCK_LEN - h->block_len);
+	o->block_len = h->block_len;
+	o->counter = h->chunk;
+	o->flags = h->flags | BLAKE3_CHUNK_END |
+			   (h->blocks == 0 ? BLAKE3_CHUNK_START : 0);
+}
+
+static void blake3_start_chunk(Blake3 *h, u64 chunk) {
+	for (int i = 0; i < 8; i++) h->cv[i] = h->key[i];
+	h->chunk = chunk;
+	h->block_len = 0;
+	h->blocks = 0;
+}
+
+// Add the chaining value of chunk 'chunks - 1', first merging the subtrees
+// it completes. The last chunk is only added once more input follows it, so
+// the stack never holds the root.
+static void blake3_push_cv(Blake3 *h, u32 cv[8], u64 chunks) {
+	for (; !(chunks & 1); chunks >>= 1)
+		blake3_parent_cv(h->key, h->flags, h->stack[--h->stack_len], cv, cv);
+	for (int i = 0; i < 8; i++) h->stack[h->stack_len][i] = cv[i];
+	h->stack_len++;
+}
+
+static void blake3_init_at(Blake3 *h, const u32 key[8], u32 flags,
+						   u64 chunk) {
+	for (int i = 0; i < 8; i++) h->key[i] = key[i];
+	h->flags = flags;
+	h->stack_len = 0;
+	blake3_start_chunk(h, chunk);
+}
+
+void blake3_init(Blake3 *h) {
+	blake3_init_at(h, blake3_iv, 0, 0);
+}
+
+void blake3_init_keyed(Blake3 *h, const byte key[BLAKE3_KEY_LEN]) {
+	u32 words[8];
+	copy_bytes((byte *)words, key, BLAKE3_KEY_LEN);	 // little endian host
+	blake3_init_at(h, words, BLAKE3_KEYED_HASH, 0);
+}
+
+void blake3_update(Blake3 *h, const void *data, u64 len) {
+	const byte *p = data;
+	while (len) {
+		if (h->blocks * BLAKE3_BLOCK_LEN + h->block_len == BLAKE3_CHUNK_LEN) {
+			Blake3Output o;
+			u32 cv[8];
+			blake3_chunk_output(h, &o);
+			blake3_output_cv(&o, cv);
+			blake3_push_cv(h, cv, h->chunk + 1);
+			blake3_start_chunk(h, h->chunk + 1);
+		}
+
+		// whole chunks straight from the input, keeping at least one byte
+		// for the chunk that may turn out to be the last
+		if (h->blocks == 0 && h->block_len == 0 && len > BLAKE3_CHUNK_LEN) {
+			u64 n = (len - 1) / BLAKE3_CHUNK_LEN;
+			if (n > BLAKE3_BATCH) n = BLAKE3_BATCH;
+			u32 cvs[BLAKE3_BATCH][8];
+			blake3_hash_chunks(h->key, h->flags, p, n, h->chunk, cvs);
+			for (u64 i = 0; i < n; i++)
+				blake3_push_cv(h, cvs[i], h->chunk + i + 1);
+			blake3_start_chunk(h, h->chunk + n);
+			p += n * BLAKE3_CHUNK_LEN;
+			len -= n * BLAKE3_CHUNK_LEN;
+			continue;
+		}
+
+		// within a chunk the last block is held back the same way
+		u64 left = BLAKE3_CHUNK_LEN - h->blocks * BLAKE3_BLOCK_LEN -
+				   h->block_len;
+		if (left > len) left = len;
+		len -= left;
+		while (left) {
+			if (h->block_len == BLAKE3_BLOCK_LEN) {
+				blake3_compress_cv(
+					h->cv, h->block, BLAKE3_BLOCK_LEN, h->chunk,
+					h->flags | (h->blocks == 0 ? BLAKE3_CHUNK_START : 0));
+				h->blocks++;
+				h->block_len = 0;
+			}
+			u64 take = BLAKE3_BLOCK_LEN - h->block_len;
+			if (take > left) take = left;
+			copy_bytes(h->block + h->block_len, p, take);
+			h->block_len += take;
+			p += take;
+			left -= take;
+		}
+	}
+}
+
+// The output of the tree built so far: the chunk in progress merged with
+// every subtree on the stack.
+static void blake3_tree_output(const Blake3 *h, Blake3Output *o) {
+	blake3_chunk_output(h, o);
+	for (u32 i = h->stack_len; i > 0; i--) {
+		u32 cv[8];
+		blake3_output_cv(o, cv);
+		blake3_parent_output(h->key, h->flags, h->stack[i - 1], cv, o);
+	}
+}
+
+void blake3_final(const Blake3 *h, byte *out, u64 out_len) {
+	Blake3Output o;
+	blake3_tree_output(h, &o);
+	blake3_output_root(&o, out, out_len);
+}
+
+void blake3(const void *data, u64 len, byte *out, u64 out_len) {
+	Blake3 h;
+	blake3_init(&h);
+	blake3_update(&h, data, len);
+	blake3_final(&h, out, out_len);
+}
+
+// A subtree: 'len' bytes of input from chunk 'counter' on, where 'counter'
+// is a multiple of a power of two at least as large as the chunk count.
+typedef struct Blake3Task {
+	const byte *data;
+	u64 len;
+	u64 counter;
+	u32 threads;
+	u32 cv[8];
+} Blake3Task;
+
+static void *blake3_subtree(void *arg);
+
+// Hash the two children of 't' concurrently. The left one holds the largest
+// power of two number of chunks that leaves at least one byte on the right.
+static void blake3_children(const Blake3Task *t, Blake3Task *left,
+							Blake3Task *right) {
+	u64 chunks = (t->len - 1) / BLAKE3_CHUNK_LEN;
+	u64 left_len = (1ULL << (63 - __builtin_clzll(chunks))) * BLAKE3_CHUNK_LEN;
+	*left = (Blake3Task){.data = t->data,
+						 .len = left_len,
+						 .counter = t->counter,
+						 .threads = (t->threads + 1) / 2};
+	*right = (Blake3Task){.data = t->data + left_len,
+						  .len = t->len - left_len,
+						  .counter = t->counter + left_len / BLAKE3_CHUNK_LEN,
+						  .threads = t->threads / 2};
+	pthread_t id;
+	bool started = !pthread_create(&id, NULL, blake3_subtree, left);
+	blake3_subtree(right);
+	if (started)
+		pthread_join(id, NULL);
+	else
+		blake3_subtree(left);
+}
+
+static void *blake3_subtree(void *arg) {
+	Blake3Task *t = arg;
+	if (t->threads <= 1 || t->len <= BLAKE3_PARALLEL_MIN) {
+		// a hasher started at 'counter' builds exactly this subtree
+		Blake3 h;
+		Blake3Output o;
+		blake3_init_at(&h, blake3_iv, 0, t->counter);
+		blake3_update(&h, t->data, t->len);
+		blake3_tree_output(&h, &o);
+		blake3_output_cv(&o, t->cv);
+	} else {
+		Blake3Task left, right;
+		blake3_children(t, &left, &right);
+		blake3_parent_cv(blake3_iv, 0, left.cv, right.cv, t->cv);
+	}
+	return NULL;
+}
+
+void blake3_parallel(const void *data, u64 len, byte *out, u64 out_len,
+					 u32 threads) {
+	if (threads == 0) threads = cpu_count();
+	if (threads <= 1 || len <= BLAKE3_PARALLEL_MIN) {
+		blake3(data, len, out, out_len);
+		return;
+	}
+	Blake3Task root = {.data = data, .len = len, .threads = threads};
+	Blake3Task left, right;
+	Blake3Output o;
+	blake3_children(&root, &left, &right);
+	blake3_parent_output(blake3_iv, 0, left.cv, right.cv, &o);
+	blake3_output_root(&o, out, out_len);
+}
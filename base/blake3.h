@@ -0,0 +1,58 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _BASE_BLAKE3__
+#define _BASE_BLAKE3__
+
+#include <base/types.h>
+
+// BLAKE3 hashing, plain or keyed, with output of any length. Input is split
+// into 1 KiB chunks that are leaves of a binary tree, so whole chunks are
+// compressed 8 at a time with AVX2 (one per 32 bit lane) when available, and
+// blake3_parallel hashes the subtrees of a large buffer on several threads.
+// All entry points produce the same output for the same input.
+
+#define BLAKE3_OUT_LEN 32
+#define BLAKE3_KEY_LEN 32
+#define BLAKE3_BLOCK_LEN 64
+#define BLAKE3_CHUNK_LEN 1024
+// enough for 2^54 chunks
+#define BLAKE3_MAX_DEPTH 54
+
+typedef struct Blake3 {
+	u32 key[8];
+	// the chunk being hashed
+	u32 cv[8];
+	u64 chunk;
+	byte block[BLAKE3_BLOCK_LEN];
+	u32 block_len;
+	u32 blocks;
+	u32 flags;
+	// chaining values of completed subtrees, largest first
+	u32 stack_len;
+	u32 stack[BLAKE3_MAX_DEPTH][8];
+} Blake3;
+
+void blake3_init(Blake3 *h);
+void blake3_init_keyed(Blake3 *h, const byte key[BLAKE3_KEY_LEN]);
+void blake3_update(Blake3 *h, const void *data, u64 len);
+// Write 'out_len' bytes of output. 'h' is not modified, so more input can
+// be added afterwards.
+void blake3_final(const Blake3 *h, byte *out, u64 out_len);
+void blake3(const void *data, u64 len, byte *out, u64 out_len);
+// Like blake3, on up to 'threads' threads (0 uses every online CPU).
+void blake3_parallel(const void *data, u64 len, byte *out, u64 out_len,
+					 u32 threads);
+
+#endif	// _BASE_BLAKE3__
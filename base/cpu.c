@@ -0,0 +1,56 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <base/cpu.h>
+#include <unistd.h>
+
+static u32 cpu_detected = 0;
+static u32 cpu_active = 0;
+static u32 cpu_online = 1;
+
+static void __attribute__((constructor)) cpu_detect() {
+#ifdef __x86_64__
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2")) cpu_detected |= CPU_SSE42;
+	if (__builtin_cpu_supports("pclmul")) cpu_detected |= CPU_PCLMUL;
+	if (__builtin_cpu_supports("popcnt")) cpu_detected |= CPU_POPCNT;
+	if (__builtin_cpu_supports("bmi2")) cpu_detected |= CPU_BMI2;
+	if (__builtin_cpu_supports("avx2")) cpu_detected |= CPU_AVX2;
+	if (__builtin_cpu_supports("avx512f") &&
+		__builtin_cpu_supports("avx512bw") &&
+		__builtin_cpu_supports("avx512vl"))
+		cpu_detected |= CPU_AVX512;
+	if (__builtin_cpu_supports("vpclmulqdq")) cpu_detected |= CPU_VPCLMUL;
+	if (__builtin_cpu_supports("sha")) cpu_detected |= CPU_SHA;
+#endif	// __x86_64__
+	cpu_active = cpu_detected;
+	long online = sysconf(_SC_NPROCESSORS_ONLN);
+	if (online > 1) cpu_online = online;
+}
+
+u32 cpu_features() {
+	return cpu_active;
+}
+
+bool cpu_has(u32 features) {
+	return (cpu_active & features) == features;
+}
+
+void cpu_override(u32 features) {
+	cpu_active = cpu_detected & features;
+}
+
+u32 cpu_count() {
+	return cpu_online;
+}
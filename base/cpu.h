@@ -0,0 +1,47 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _BASE_CPU__
+#define _BASE_CPU__
+
+#include <base/types.h>
+
+// Instruction set extensions detected at startup. Kernels with an accelerated
+// path are compiled with __attribute__((target(...))) and pick their
+// implementation at runtime with cpu_has, so the binary itself only requires
+// the baseline instruction set. On other architectures no features are
+// reported and the portable code is always used.
+
+#define CPU_SSE42 (1 << 0)
+#define CPU_PCLMUL (1 << 1)
+#define CPU_POPCNT (1 << 2)
+#define CPU_BMI2 (1 << 3)
+#define CPU_AVX2 (1 << 4)
+#define CPU_AVX512 (1 << 5)	 // F, BW and VL
+#define CPU_VPCLMUL (1 << 6)
+#define CPU_SHA (1 << 7)
+
+// The features currently in use.
+u32 cpu_features();
+// True if all of 'features' are available.
+bool cpu_has(u32 features);
+// Restrict the features in use to 'features' (limited to what the CPU
+// supports). Used by tests and benchmarks to exercise each code path;
+// cpu_override(~0U) restores the detected set.
+void cpu_override(u32 features);
+
+// Number of online processors (at least 1).
+u32 cpu_count();
+
+#endif	// _BASE_CPU__
@@ -0,0 +1,299 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <base/cpu.h>
+#include <base/crc32c.h>
+
+// Bit reflected polynomial 0x1EDC6F41. In the reflected representation bit 31
+// is x^0, so 'x^0' below is 1 << 31.
+#define CRC32C_POLY 0x82F63B78U
+#define CRC32C_X0 0x80000000U
+
+// The three way SSE4.2 kernel checksums three adjacent ranges at once (the
+// crc32 instruction has a latency of 3 cycles but a throughput of 1) and
+// merges them with the shift tables below.
+#define CRC32C_LONG 8192
+#define CRC32C_SHORT 256
+
+// Below these sizes the folding setup doesn't pay for itself.
+#define CRC32C_PCLMUL_MIN 512
+#define CRC32C_VPCLMUL_MIN 2048
+
+typedef u64 __attribute__((may_alias, aligned(1))) crc32c_u64u;
+
+static u32 crc32c_table[8][256];
+// x^(2^n) mod p, for crc32c_combine
+static u32 crc32c_x2n[32];
+// operators appending CRC32C_LONG / CRC32C_SHORT zero bytes to a crc
+static u32 crc32c_long[4][256];
+static u32 crc32c_short[4][256];
+
+// a * b mod p (reflected)
+static u32 crc32c_multmodp(u32 a, u32 b) {
+	u32 m = CRC32C_X0, p = 0;
+	for (;;) {
+		if (a & m) {
+			p ^= b;
+			if ((a & (m - 1)) == 0) break;
+		}
+		m >>= 1;
+		b = b & 1 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+	}
+	return p;
+}
+
+// x^(n * 2^k) mod p
+static u32 crc32c_x2nmodp(u64 n, u32 k) {
+	u32 p = CRC32C_X0;
+	while (n) {
+		if (n & 1) p = crc32c_multmodp(crc32c_x2n[k & 31], p);
+		n >>= 1;
+		k++;
+	}
+	return p;
+}
+
+static void crc32c_shift_table(u32 table[4][256], u64 len) {
+	u32 op = crc32c_x2nmodp(len, 3);
+	for (u32 n = 0; n < 256; n++)
+		for (u32 i = 0; i < 4; i++)
+			table[i][n] = crc32c_multmodp(op, n << (8 * i));
+}
+
+static void __attribute__((constructor)) crc32c_init() {
+	for (u32 n = 0; n < 256; n++) {
+		u32 crc = n;
+		for (int k = 0; k < 8; k++)
+			crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+		crc32c_table[0][n] = crc;
+	}
+	for (u32 n = 0; n < 256; n++) {
+		for (int k = 1; k < 8; k++) {
+			u32 prev = crc32c_table[k - 1][n];
+			crc32c_table[k][n] = crc32c_table[0][prev & 0xff] ^ (prev >> 8);
+		}
+	}
+
+	u32 p = CRC32C_X0 >> 1;	 // x^1
+	crc32c_x2n[0] = p;
+	for (int n = 1; n < 32; n++) crc32c_x2n[n] = p = crc32c_multmodp(p, p);
+
+	crc32c_shift_table(crc32c_long, CRC32C_LONG);
+	crc32c_shift_table(crc32c_short, CRC32C_SHORT);
+}
+
+// Slicing-by-8: eight table lookups per 8 bytes instead of one per byte.
+// Assumes a little endian host, like the rest of the tree.
+static u32 crc32c_portable(u32 crc, const byte *p, u64 len) {
+	while (len && ((u64)p & 7)) {
+		crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+		len--;
+	}
+	while (len >= 8) {
+		u64 v = *(const crc32c_u64u *)p ^ crc;
+		crc = crc32c_table[7][v & 0xff] ^ crc32c_table[6][(v >> 8) & 0xff] ^
+			  crc32c_table[5][(v >> 16) & 0xff] ^
+			  crc32c_table[4][(v >> 24) & 0xff] ^
+			  crc32c_table[3][(v >> 32) & 0xff] ^
+			  crc32c_table[2][(v >> 40) & 0xff] ^
+			  crc32c_table[1][(v >> 48) & 0xff] ^ crc32c_table[0][v >> 56];
+		p += 8;
+		len -= 8;
+	}
+	while (len--) crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+#ifdef __x86_64__
+
+static inline u32 crc32c_shift(u32 table[4][256], u32 crc) {
+	return table[0][crc & 0xff] ^ table[1][(crc >> 8) & 0xff] ^
+		   table[2][(crc >> 16) & 0xff] ^ table[3][crc >> 24];
+}
+
+// Checksum as many runs of 3 * size bytes as possible, three streams at a
+// time. Advances '*p' and '*len' past the bytes consumed.
+static inline __attribute__((target("sse4.2"))) u64
+crc32c_streams(u64 c0, const byte **p, u64 *len, u64 size,
+			   u32 shift[4][256]) {
+	const byte *q = *p;
+	for (; *len >= 3 * size; *len -= 3 * size) {
+		u64 c1 = 0, c2 = 0;
+		const byte *end = q + size;
+		do {
+			c0 = __builtin_ia32_crc32di(c0, *(const crc32c_u64u *)q);
+			c1 = __builtin_ia32_crc32di(
+				c1, *(const crc32c_u64u *)(q + size));
+			c2 = __builtin_ia32_crc32di(
+				c2, *(const crc32c_u64u *)(q + 2 * size));
+			q += 8;
+		} while (q < end);
+		c0 = crc32c_shift(shift, c0) ^ c1;
+		c0 = crc32c_shift(shift, c0) ^ c2;
+		q += 2 * size;
+	}
+	*p = q;
+	return c0;
+}
+
+static __attribute__((target("sse4.2"))) u32
+crc32c_sse42(u32 crc, const byte *p, u64 len) {
+	u64 c0 = crc;
+	while (len && ((u64)p & 7)) {
+		c0 = __builtin_ia32_crc32qi(c0, *p++);
+		len--;
+	}
+	c0 = crc32c_streams(c0, &p, &len, CRC32C_LONG, crc32c_long);
+	c0 = crc32c_streams(c0, &p, &len, CRC32C_SHORT, crc32c_short);
+	while (len >= 8) {
+		c0 = __builtin_ia32_crc32di(c0, *(const crc32c_u64u *)p);
+		p += 8;
+		len -= 8;
+	}
+	while (len--) c0 = __builtin_ia32_crc32qi(c0, *p++);
+	return c0;
+}
+
+typedef long long crc32c_v2di __attribute__((vector_size(16)));
+typedef long long crc32c_v2diu
+	__attribute__((vector_size(16), aligned(1), may_alias));
+
+#define CRC32C_LOAD(p) (*(const crc32c_v2diu *)(p))
+
+// Move 'x' 'k' bits further along the message: x.lo * k.lo ^ x.hi * k.hi.
+static inline __attribute__((target("pclmul"))) crc32c_v2di
+crc32c_fold(crc32c_v2di x, crc32c_v2di k) {
+	return __builtin_ia32_pclmulqdq128(x, k, 0x00) ^
+		   __builtin_ia32_pclmulqdq128(x, k, 0x11);
+}
+
+// Carry-less multiplication folding ("Fast CRC Computation Using PCLMULQDQ",
+// Intel 2009): four 128 bit accumulators are folded forward over 64 bytes per
+// iteration, then into one accumulator, which is a 16 byte message with the
+// same crc as everything folded into it and is finished with crc32. The
+// constants are reflect(x^n mod p) << 1 for n = 512 +/- 32 and 128 +/- 32.
+static __attribute__((target("sse4.2,pclmul"))) u32
+crc32c_pclmul(u32 crc, const byte *p, u64 len) {
+	const crc32c_v2di k1k2 = {0x740eef02, 0x9e4addf8};
+	const crc32c_v2di k3k4 = {0xf20c0dfe, 0x14cd00bd6};
+	crc32c_v2di x0 = CRC32C_LOAD(p), x1 = CRC32C_LOAD(p + 16),
+				x2 = CRC32C_LOAD(p + 32), x3 = CRC32C_LOAD(p + 48);
+	x0 ^= (crc32c_v2di){crc, 0};
+	p += 64;
+	len -= 64;
+
+	while (len >= 64) {
+		x0 = crc32c_fold(x0, k1k2) ^ CRC32C_LOAD(p);
+		x1 = crc32c_fold(x1, k1k2) ^ CRC32C_LOAD(p + 16);
+		x2 = crc32c_fold(x2, k1k2) ^ CRC32C_LOAD(p + 32);
+		x3 = crc32c_fold(x3, k1k2) ^ CRC32C_LOAD(p + 48);
+		p += 64;
+		len -= 64;
+	}
+
+	x0 = crc32c_fold(x0, k3k4) ^ x1;
+	x0 = crc32c_fold(x0, k3k4) ^ x2;
+	x0 = crc32c_fold(x0, k3k4) ^ x3;
+	while (len >= 16) {
+		x0 = crc32c_fold(x0, k3k4) ^ CRC32C_LOAD(p);
+		p += 16;
+		len -= 16;
+	}
+
+	u64 c = __builtin_ia32_crc32di(0, x0[0]);
+	c = __builtin_ia32_crc32di(c, x0[1]);
+	return crc32c_sse42(c, p, len);
+}
+
+typedef long long crc32c_v8di __attribute__((vector_size(64)));
+typedef long long crc32c_v8diu
+	__attribute__((vector_size(64), aligned(1), may_alias));
+
+#define CRC32C_LOAD512(p) (*(const crc32c_v8diu *)(p))
+
+#define CRC32C_VPCLMUL_TARGET \
+	"sse4.2,pclmul,avx512f,avx512vl,vpclmulqdq"
+
+static inline __attribute__((target(CRC32C_VPCLMUL_TARGET))) crc32c_v8di
+crc32c_fold512(crc32c_v8di x, crc32c_v8di k) {
+	return __builtin_ia32_vpclmulqdq_v8di(x, k, 0x00) ^
+		   __builtin_ia32_vpclmulqdq_v8di(x, k, 0x11);
+}
+
+// The same folding with 512 bit registers: four accumulators of four 128 bit
+// lanes each cover 256 bytes per iteration (n = 2048 +/- 32). The lanes are
+// then folded together and the last one is finished like crc32c_pclmul.
+static __attribute__((target(CRC32C_VPCLMUL_TARGET))) u32
+crc32c_vpclmul(u32 crc, const byte *p, u64 len) {
+	const crc32c_v8di k2048 = {0xdcb17aa4, 0xb9e02b86, 0xdcb17aa4, 0xb9e02b86,
+							   0xdcb17aa4, 0xb9e02b86, 0xdcb17aa4, 0xb9e02b86};
+	const crc32c_v8di k512 = {0x740eef02, 0x9e4addf8, 0x740eef02, 0x9e4addf8,
+							  0x740eef02, 0x9e4addf8, 0x740eef02, 0x9e4addf8};
+	const crc32c_v2di k3k4 = {0xf20c0dfe, 0x14cd00bd6};
+	crc32c_v8di x0 = CRC32C_LOAD512(p), x1 = CRC32C_LOAD512(p + 64),
+				x2 = CRC32C_LOAD512(p + 128), x3 = CRC32C_LOAD512(p + 192);
+	x0 ^= (crc32c_v8di){crc};
+	p += 256;
+	len -= 256;
+
+	while (len >= 256) {
+		x0 = crc32c_fold512(x0, k2048) ^ CRC32C_LOAD512(p);
+		x1 = crc32c_fold512(x1, k2048) ^ CRC32C_LOAD512(p + 64);
+		x2 = crc32c_fold512(x2, k2048) ^ CRC32C_LOAD512(p + 128);
+		x3 = crc32c_fold512(x3, k2048) ^ CRC32C_LOAD512(p + 192);
+		p += 256;
+		len -= 256;
+	}
+
+	x0 = crc32c_fold512(x0, k512) ^ x1;
+	x0 = crc32c_fold512(x0, k512) ^ x2;
+	x0 = crc32c_fold512(x0, k512) ^ x3;
+	crc32c_v2di x = {x0[0], x0[1]};
+	for (int lane = 1; lane < 4; lane++) {
+		crc32c_v2di next = {x0[2 * lane], x0[2 * lane + 1]};
+		x = crc32c_fold(x, k3k4) ^ next;
+	}
+	while (len >= 16) {
+		x = crc32c_fold(x, k3k4) ^ CRC32C_LOAD(p);
+		p += 16;
+		len -= 16;
+	}
+
+	u64 c = __builtin_ia32_crc32di(0, x[0]);
+	c = __builtin_ia32_crc32di(c, x[1]);
+	return crc32c_sse42(c, p, len);
+}
+
+#endif	// __x86_64__
+
+u32 crc32c(u32 crc, const void *data, u64 len) {
+	const byte *p = data;
+	crc = ~crc;
+#ifdef __x86_64__
+	if (len >= CRC32C_VPCLMUL_MIN &&
+		cpu_has(CPU_SSE42 | CPU_PCLMUL | CPU_AVX512 | CPU_VPCLMUL))
+		crc = crc32c_vpclmul(crc, p, len);
+	else if (len >= CRC32C_PCLMUL_MIN && cpu_has(CPU_SSE42 | CPU_PCLMUL))
+		crc = crc32c_pclmul(crc, p, len);
+	else if (cpu_has(CPU_SSE42))
+		crc = crc32c_sse42(crc, p, len);
+	else
+#endif	// __x86_64__
+		crc = crc32c_portable(crc, p, len);
+	return ~crc;
+}
+
+u32 crc32c_combine(u32 crc1, u32 crc2, u64 len2) {
+	return crc32c_multmodp(crc32c_x2nmodp(len2, 3), crc1) ^ crc2;
+}
@@ -0,0 +1,30 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _BASE_CRC32C__
+#define _BASE_CRC32C__
+
+#include <base/types.h>
+
+// CRC-32C (Castagnoli, as used by iSCSI, ext4 and SSE4.2). Start with crc 0
+// and pass the previous result to continue a running checksum:
+//   crc = crc32c(crc32c(0, a, a_len), b, b_len) == crc32c(0, ab, ab_len)
+u32 crc32c(u32 crc, const void *data, u64 len);
+
+// Checksum of the concatenation of two buffers given the checksum of each and
+// the length of the second, so chunks can be checksummed independently (for
+// instance in parallel) and merged. O(log(len2)).
+u32 crc32c_combine(u32 crc1, u32 crc2, u64 len2);
+
+#endif	// _BASE_CRC32C__
@@ -0,0 +1,156 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <base/decimal.h>
+#include <base/int128.h>
+
+#define DECIMAL_ONE 1000000000000000000ULL
+
+static u64 decimal_pow10[DECIMAL_SCALE + 1];
+static U128Divisor decimal_divisors[DECIMAL_SCALE + 1];
+
+static void __attribute__((constructor)) decimal_init() {
+	u64 p = 1;
+	for (int i = 0; i <= DECIMAL_SCALE; i++, p *= 10) {
+		decimal_pow10[i] = p;
+		u128_divisor_init(&decimal_divisors[i], p);
+	}
+}
+
+static u128 decimal_abs(Decimal d) {
+	return d.raw < 0 ? -(u128)d.raw : (u128)d.raw;
+}
+
+static int decimal_set(u128 mag, bool negative, Decimal *r) {
+	if (mag > (u128)I128_MAX + negative) return -1;
+	r->raw = negative ? (i128)-mag : (i128)mag;
+	return 0;
+}
+
+// 'mag' rounded half up to a multiple of 10^(DECIMAL_SCALE - digits)
+static u128 decimal_round_abs(u128 mag, u32 digits, bool *overflow) {
+	u32 shift = DECIMAL_SCALE - digits;
+	u64 unit = decimal_pow10[shift], frac;
+	u128_div_const(mag, &decimal_divisors[shift], &frac);
+	mag -= frac;
+	if (frac >= unit - frac)
+		*overflow |= __builtin_add_overflow(mag, unit, &mag);
+	return mag;
+}
+
+Decimal decimal_from_i64(i64 v) {
+	return (Decimal){.raw = (i128)v * DECIMAL_ONE};
+}
+
+int decimal_from_scaled(i128 v, u32 scale, Decimal *d) {
+	if (scale > DECIMAL_SCALE) return -1;
+	i128 r;
+	if (__builtin_mul_overflow(v, decimal_pow10[DECIMAL_SCALE - scale], &r))
+		return -1;
+	d->raw = r;
+	return 0;
+}
+
+i128 decimal_trunc(Decimal d) {
+	u128 mag = u128_div_const(decimal_abs(d),
+							  &decimal_divisors[DECIMAL_SCALE], NULL);
+	return d.raw < 0 ? -(i128)mag : (i128)mag;
+}
+
+int decimal_cmp(Decimal a, Decimal b) {
+	return (a.raw > b.raw) - (a.raw < b.raw);
+}
+
+int decimal_add(Decimal a, Decimal b, Decimal *r) {
+	i128 v;
+	if (__builtin_add_overflow(a.raw, b.raw, &v)) return -1;
+	r->raw = v;
+	return 0;
+}
+
+int decimal_sub(Decimal a, Decimal b, Decimal *r) {
+	i128 v;
+	if (__builtin_sub_overflow(a.raw, b.raw, &v)) return -1;
+	r->raw = v;
+	return 0;
+}
+
+int decimal_mul(Decimal a, Decimal b, Decimal *r) {
+	u128 hi, lo = u128_mul_wide(decimal_abs(a), decimal_abs(b), &hi);
+	// round the 36 decimal product back to 18
+	hi += __builtin_add_overflow(lo, DECIMAL_ONE / 2, &lo);
+	if (hi >= DECIMAL_ONE) return -1;
+	u128 mag = u128_div_wide(hi, lo, DECIMAL_ONE, NULL);
+	return decimal_set(mag, (a.raw < 0) != (b.raw < 0), r);
+}
+
+int decimal_div(Decimal a, Decimal b, Decimal *r) {
+	u128 d = decimal_abs(b), rem;
+	if (!d) return -1;
+	u128 hi, lo = u128_mul_wide(decimal_abs(a), DECIMAL_ONE, &hi);
+	if (hi >= d) return -1;
+	u128 mag = u128_div_wide(hi, lo, d, &rem);
+	if (rem >= d - rem && __builtin_add_overflow(mag, 1, &mag)) return -1;
+	return decimal_set(mag, (a.raw < 0) != (b.raw < 0), r);
+}
+
+int decimal_round(Decimal a, u32 digits, Decimal *r) {
+	if (digits > DECIMAL_SCALE) return -1;
+	bool overflow = false;
+	u128 mag = decimal_round_abs(decimal_abs(a), digits, &overflow);
+	if (overflow) return -1;
+	return decimal_set(mag, a.raw < 0, r);
+}
+
+u64 decimal_to_str(Decimal d, u32 digits, char buf[DECIMAL_STR_LEN]) {
+	if (digits > DECIMAL_SCALE) digits = DECIMAL_SCALE;
+	// |I128_MIN| plus rounding still fits in a u128
+	bool overflow = false;
+	u128 mag = decimal_round_abs(decimal_abs(d), digits, &overflow);
+	u64 frac, len = 0;
+	u128 units = u128_div_const(mag, &decimal_divisors[DECIMAL_SCALE], &frac);
+	if (d.raw < 0 && mag) buf[len++] = '-';
+	len += u128_to_str(units, buf + len);
+	if (digits) {
+		frac /= decimal_pow10[DECIMAL_SCALE - digits];
+		buf[len++] = '.';
+		for (u32 i = digits; i > 0; i--, frac /= 10)
+			buf[len + i - 1] = '0' + frac % 10;
+		len += digits;
+	}
+	buf[len] = 0;
+	return len;
+}
+
+int decimal_parse(const char *s, u64 len, Decimal *d) {
+	bool negative = len && s[0] == '-';
+	s += negative;
+	len -= negative;
+	u64 int_len = 0;
+	while (int_len < len && s[int_len] != '.') int_len++;
+	u128 units;
+	if (u128_parse(s, int_len, &units)) return -1;
+	u128 frac = 0;
+	if (int_len < len) {
+		const char *f = s + int_len + 1;
+		u64 frac_len = len - int_len - 1;
+		if (!frac_len || frac_len > DECIMAL_SCALE) return -1;
+		if (u128_parse(f, frac_len, &frac)) return -1;
+		frac *= decimal_pow10[DECIMAL_SCALE - frac_len];
+	}
+	u128 mag;
+	if (__builtin_mul_overflow(units, DECIMAL_ONE, &mag)) return -1;
+	if (__builtin_add_overflow(mag, frac, &mag)) return -1;
+	return decimal_set(mag, negative, d);
+}
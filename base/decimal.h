@@ -0,0 +1,62 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _BASE_DECIMAL__
+#define _BASE_DECIMAL__
+
+#include <base/types.h>
+
+// Fixed point decimal numbers: an i128 count of 10^-18 units, so amounts of
+// money and durations in nanoseconds add, multiply and print exactly without
+// floating point. The range is about +-1.7 * 10^20. Operations that can
+// overflow return -1 and leave the result unset; results that do not fit in
+// 18 decimal places are rounded half away from zero.
+//
+//   Decimal price, total;
+//   decimal_parse("19.99", 5, &price);
+//   decimal_mul(price, decimal_from_i64(3), &total);
+//   decimal_to_str(total, 2, buf);  // "59.97"
+
+#define DECIMAL_SCALE 18
+// sign, 21 integer digits, the point, 18 decimals and the NUL
+#define DECIMAL_STR_LEN 42
+
+typedef struct Decimal {
+	i128 raw;  // value * 10^DECIMAL_SCALE
+} Decimal;
+
+Decimal decimal_from_i64(i64 v);
+// v * 10^-scale, for scale <= DECIMAL_SCALE (decimal_from_scaled(ns, 9, &d)
+// converts nanoseconds to seconds).
+int decimal_from_scaled(i128 v, u32 scale, Decimal *d);
+// The integer part, rounded toward zero.
+i128 decimal_trunc(Decimal d);
+int decimal_cmp(Decimal a, Decimal b);
+
+int decimal_add(Decimal a, Decimal b, Decimal *r);
+int decimal_sub(Decimal a, Decimal b, Decimal *r);
+int decimal_mul(Decimal a, Decimal b, Decimal *r);
+// Fails if 'b' is zero.
+int decimal_div(Decimal a, Decimal b, Decimal *r);
+// Round to 'digits' (<= DECIMAL_SCALE) decimal places.
+int decimal_round(Decimal a, u32 digits, Decimal *r);
+
+// Write 'd' rounded to 'digits' (<= DECIMAL_SCALE) decimal places, like
+// printf("%.*f"), NUL terminated. Returns the length without the NUL.
+u64 decimal_to_str(Decimal d, u32 digits, char buf[DECIMAL_STR_LEN]);
+// Parse exactly 'len' characters of [-]digits[.digits] with at most
+// DECIMAL_SCALE decimals.
+int decimal_parse(const char *s, u64 len, Decimal *d);
+
+#endif	// _BASE_DECIMAL__
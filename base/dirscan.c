@@ -0,0 +1,241 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <base/cpu.h>
+#include <base/dirscan.h>
+#include <base/sys.h>
+#include <base/util.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+long syscall(long number, ...);
+#endif	// __linux__
+
+int dup(int fd);
+
+#define DIRSCAN_MAX_THREADS 64
+#define DIRSCAN_BUF_PAGES 16
+#define DIRSCAN_CHUNK_PAGES 16
+
+// A directory waiting to be read, by its path relative to the root.
+typedef struct DirscanJob {
+	struct DirscanJob *next;
+	u32 len;
+	char path[];
+} DirscanJob;
+
+typedef struct DirscanState {
+	int root_fd;
+	u32 flags;
+	DirscanFn fn;
+	void *ctx;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	DirscanJob *jobs;
+	// jobs queued or being read; the scan is over when it drops to 0
+	u64 pending;
+	int result;
+	// jobs are carved out of chunks that live until the scan ends
+	byte *chunks;
+	byte *chunk_pos;
+	u64 chunk_left;
+} DirscanState;
+
+#ifdef __linux__
+typedef struct DirscanDirent {
+	u64 ino;
+	i64 off;
+	unsigned short reclen;
+	unsigned char type;
+	char name[];
+} DirscanDirent;
+#endif	// __linux__
+
+// Queue 'path' (called with the lock held). Returns -1 if out of memory.
+static int dirscan_push(DirscanState *s, const char *path, u32 len) {
+	u64 size = (sizeof(DirscanJob) + len + 1 + 7) & ~7ULL;
+	if (s->chunk_left < size) {
+		byte *chunk = map(DIRSCAN_CHUNK_PAGES);
+		if (!chunk) return -1;
+		*(byte **)chunk = s->chunks;
+		s->chunks = chunk;
+		s->chunk_pos = chunk + sizeof(byte *);
+		s->chunk_left = DIRSCAN_CHUNK_PAGES * PAGE_SIZE - sizeof(byte *);
+	}
+	DirscanJob *job = (DirscanJob *)s->chunk_pos;
+	s->chunk_pos += size;
+	s->chunk_left -= size;
+	job->len = len;
+	copy_bytes((byte *)job->path, (const byte *)path, len + 1);
+	job->next = s->jobs;
+	s->jobs = job;
+	s->pending++;
+	pthread_cond_signal(&s->cond);
+	return 0;
+}
+
+// Report one entry of the directory open as 'fd' whose path is in 'path'
+// (the directory's own path, 'len' bytes with a trailing '/' unless empty).
+static int dirscan_entry(DirscanState *s, int fd, char *path, u32 len,
+						 const char *name, unsigned char d_type) {
+	DirscanEntry e;
+	u32 name_len = cstring_len(name);
+	if (name[0] == '.' &&
+		(name_len == 1 || (name_len == 2 && name[1] == '.')))
+		return 0;
+	if (len + name_len >= DIRSCAN_PATH_MAX) return -1;
+	copy_bytes((byte *)path + len, (const byte *)name, name_len + 1);
+
+	e.type = d_type == DT_DIR	? DIRSCAN_DIR
+			 : d_type == DT_REG ? DIRSCAN_FILE
+			 : d_type == DT_LNK ? DIRSCAN_LINK
+								: DIRSCAN_OTHER;
+	e.size = 0;
+	bool follow = s->flags & DIRSCAN_FOLLOW;
+	if (d_type == DT_UNKNOWN || (e.type == DIRSCAN_LINK && follow) ||
+		(e.type == DIRSCAN_FILE && s->flags & DIRSCAN_STAT)) {
+		struct stat st;
+		if (fstatat(fd, name, &st, follow ? 0 : AT_SYMLINK_NOFOLLOW))
+			return -1;
+		e.type = S_ISDIR(st.st_mode)   ? DIRSCAN_DIR
+				 : S_ISREG(st.st_mode) ? DIRSCAN_FILE
+				 : S_ISLNK(st.st_mode) ? DIRSCAN_LINK
+									   : DIRSCAN_OTHER;
+		if (e.type == DIRSCAN_FILE && s->flags & DIRSCAN_STAT)
+			e.size = st.st_size;
+	}
+
+	if (e.type == DIRSCAN_DIR) {
+		pthread_mutex_lock(&s->lock);
+		int ret = dirscan_push(s, path, len + name_len);
+		pthread_mutex_unlock(&s->lock);
+		if (ret || !(s->flags & DIRSCAN_DIRS)) return ret;
+	}
+	e.path = path;
+	e.path_len = len + name_len;
+	e.dir_fd = fd;
+	e.name = name;
+	// another worker's callback may already have stopped the scan
+	int result = __atomic_load_n(&s->result, __ATOMIC_RELAXED);
+	return result ? result : s->fn(&e, s->ctx);
+}
+
+static int dirscan_dir(DirscanState *s, DirscanJob *job, byte *buf,
+					   char *path) {
+	int fd = openat(s->root_fd, job->len ? job->path : ".",
+					O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) return -1;
+	u32 len = job->len;
+	copy_bytes((byte *)path, (const byte *)job->path, len);
+	if (len) path[len++] = '/';
+	int ret = 0;
+
+#ifdef __linux__
+	for (;;) {
+		long n = syscall(SYS_getdents64, fd, buf,
+						 DIRSCAN_BUF_PAGES * PAGE_SIZE);
+		if (n <= 0) {
+			if (n < 0) ret = -1;
+			break;
+		}
+		for (long pos = 0; pos < n && !ret;) {
+			DirscanDirent *d = (DirscanDirent *)(buf + pos);
+			ret = dirscan_entry(s, fd, path, len, d->name, d->type);
+			pos += d->reclen;
+		}
+		if (ret) break;
+	}
+	close(fd);
+#else
+	(void)buf;
+	// readdir needs its own fd; 'fd' stays open for the lookups
+	DIR *dir = fdopendir(dup(fd));
+	if (!dir) {
+		close(fd);
+		return -1;
+	}
+	struct dirent *d;
+	while (!ret && (d = readdir(dir)))
+		ret = dirscan_entry(s, fd, path, len, d->d_name, d->d_type);
+	closedir(dir);
+	close(fd);
+#endif	// __linux__
+	return ret;
+}
+
+static void *dirscan_worker(void *arg) {
+	DirscanState *s = arg;
+	u64 pages = DIRSCAN_BUF_PAGES + bytes_to_pages(DIRSCAN_PATH_MAX);
+	byte *buf = map(pages);
+
+	pthread_mutex_lock(&s->lock);
+	for (;;) {
+		while (!s->jobs && s->pending) pthread_cond_wait(&s->cond, &s->lock);
+		if (!s->jobs) break;
+		DirscanJob *job = s->jobs;
+		s->jobs = job->next;
+		// after a failure the remaining jobs are only drained
+		int result = s->result;
+		pthread_mutex_unlock(&s->lock);
+		int ret = 0;
+		if (!result)
+			ret = buf ? dirscan_dir(s, job, buf,
+									(char *)buf + DIRSCAN_BUF_PAGES * PAGE_SIZE)
+					  : -1;
+		pthread_mutex_lock(&s->lock);
+		if (ret && !s->result)
+			__atomic_store_n(&s->result, ret, __ATOMIC_RELAXED);
+		if (!--s->pending) pthread_cond_broadcast(&s->cond);
+	}
+	pthread_mutex_unlock(&s->lock);
+	if (buf) unmap(buf, pages);
+	return NULL;
+}
+
+int dirscan(const char *root, u32 flags, u32 threads, DirscanFn fn,
+			void *ctx) {
+	DirscanState s = {0};
+	s.root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (s.root_fd < 0) return -1;
+	s.flags = flags;
+	s.fn = fn;
+	s.ctx = ctx;
+	pthread_mutex_init(&s.lock, NULL);
+	pthread_cond_init(&s.cond, NULL);
+	if (dirscan_push(&s, "", 0)) s.result = -1;
+
+	if (threads == 0) threads = cpu_count();
+	if (threads > DIRSCAN_MAX_THREADS) threads = DIRSCAN_MAX_THREADS;
+	pthread_t ids[DIRSCAN_MAX_THREADS];
+	bool started[DIRSCAN_MAX_THREADS];
+	for (u32 t = 1; t < threads; t++)
+		started[t] = !pthread_create(&ids[t], NULL, dirscan_worker, &s);
+	dirscan_worker(&s);
+	for (u32 t = 1; t < threads; t++)
+		if (started[t]) pthread_join(ids[t], NULL);
+
+	while (s.chunks) {
+		byte *next = *(byte **)s.chunks;
+		unmap(s.chunks, DIRSCAN_CHUNK_PAGES);
+		s.chunks = next;
+	}
+	pthread_mutex_destroy(&s.lock);
+	pthread_cond_destroy(&s.cond);
+	close(s.root_fd);
+	return s.result;
+}
@@ -0,0 +1,65 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _BASE_DIRSCAN__
+#define _BASE_DIRSCAN__
+
+#include <base/types.h>
+
+// Recursive directory traversal. Directories are read with getdents64 into a
+// 64 KiB buffer (readdir elsewhere) and entries are looked up relative to the
+// directory's fd, never by full path. The type comes from d_type, so an
+// entry is only stat'ed when the file system doesn't report it, when a
+// symbolic link must be followed or when its size is asked for.
+//
+// Subdirectories go on a shared work queue drained by 'threads' workers (the
+// calling thread is one of them), so entries are reported in no particular
+// order and the callback runs concurrently on several threads.
+
+#define DIRSCAN_PATH_MAX 4096
+
+// flags
+#define DIRSCAN_STAT (1 << 0)	 // fill in sizes of regular files
+#define DIRSCAN_FOLLOW (1 << 1)	 // follow symbolic links (no cycle check)
+#define DIRSCAN_DIRS (1 << 2)	 // also report directories
+
+// entry types
+#define DIRSCAN_FILE 1
+#define DIRSCAN_DIR 2
+#define DIRSCAN_LINK 3	// only without DIRSCAN_FOLLOW
+#define DIRSCAN_OTHER 4
+
+typedef struct DirscanEntry {
+	// relative to the root, '/' separated; NUL terminated
+	const char *path;
+	u32 path_len;
+	u32 type;
+	u64 size;  // regular files with DIRSCAN_STAT, 0 otherwise
+	// the containing directory and the name within it, for openat
+	int dir_fd;
+	const char *name;
+} DirscanEntry;
+
+// Called for each entry; the strings are only valid during the call. A
+// nonzero return stops the scan and is returned by dirscan (calls already
+// running on other threads still finish).
+typedef int (*DirscanFn)(const DirscanEntry *entry, void *ctx);
+
+// Walk the tree under 'root' with 'threads' threads (0 uses every online
+// CPU). Returns 0, the callback's nonzero return, or -1 if a directory can't
+// be read or a path is longer than DIRSCAN_PATH_MAX.
+int dirscan(const char *root, u32 flags, u32 threads, DirscanFn fn,
+			void *ctx);
+
+#endif	// _BASE_DIRSCAN__
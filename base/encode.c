@@ -0,0 +1,350 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <base/cpu.h>
+#include <base/encode.h>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif	// __x86_64__
+
+#define ENCODE_INVALID 0xFF
+
+static const char encode_hex_digits[16] = "0123456789abcdef";
+static const char encode_b64_digits[2][64] = {
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/",
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_"};
+
+// character -> value, ENCODE_INVALID outside the alphabet
+static byte encode_hex_values[256];
+static byte encode_b64_values[2][256];
+
+static void __attribute__((constructor)) encode_init() {
+	for (int c = 0; c < 256; c++) {
+		encode_hex_values[c] = ENCODE_INVALID;
+		encode_b64_values[0][c] = encode_b64_values[1][c] = ENCODE_INVALID;
+	}
+	for (int i = 0; i < 16; i++) {
+		encode_hex_values[(byte)encode_hex_digits[i]] = i;
+		if (i >= 10) encode_hex_values[(byte)encode_hex_digits[i] - 32] = i;
+	}
+	for (int i = 0; i < 64; i++) {
+		encode_b64_values[0][(byte)encode_b64_digits[0][i]] = i;
+		encode_b64_values[1][(byte)encode_b64_digits[1][i]] = i;
+	}
+}
+
+static void hex_encode_generic(char *out, const byte *in, u64 len) {
+	for (u64 i = 0; i < len; i++) {
+		out[2 * i] = encode_hex_digits[in[i] >> 4];
+		out[2 * i + 1] = encode_hex_digits[in[i] & 0xF];
+	}
+}
+
+static bool hex_decode_generic(byte *out, const byte *in, u64 bytes) {
+	byte bad = 0;
+	for (u64 i = 0; i < bytes; i++) {
+		byte hi = encode_hex_values[in[2 * i]];
+		byte lo = encode_hex_values[in[2 * i + 1]];
+		bad |= hi | lo;
+		out[i] = hi << 4 | lo;
+	}
+	return !(bad & 0x80);
+}
+
+// Four characters to three bytes; false if one is outside the alphabet.
+static bool base64_decode_quad(byte *out, const byte *in, const byte *values) {
+	byte a = values[in[0]], b = values[in[1]];
+	byte c = values[in[2]], d = values[in[3]];
+	if ((a | b | c | d) & 0x80) return false;
+	u32 v = (u32)a << 18 | (u32)b << 12 | (u32)c << 6 | d;
+	out[0] = v >> 16;
+	out[1] = v >> 8;
+	out[2] = v;
+	return true;
+}
+
+#ifdef __x86_64__
+
+// 32 bytes -> 64 digits: split into nibbles, interleave high and low, and
+// map each nibble to its digit with vpshufb. The input's 64 bit quarters are
+// reordered first because unpack works within 128 bit lanes.
+static __attribute__((target("avx2"))) u64 hex_encode_avx2(char *out,
+															const byte *in,
+															u64 len) {
+	const __m256i digits = _mm256_setr_epi8(
+		'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd',
+		'e', 'f', '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b',
+		'c', 'd', 'e', 'f');
+	const __m256i low = _mm256_set1_epi8(0x0F);
+	u64 i = 0;
+	for (; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(in + i));
+		v = _mm256_permute4x64_epi64(v, 0xD8);
+		__m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low);
+		__m256i lo = _mm256_and_si256(v, low);
+		__m256i a = _mm256_unpacklo_epi8(hi, lo);
+		__m256i b = _mm256_unpackhi_epi8(hi, lo);
+		_mm256_storeu_si256((__m256i *)(out + 2 * i),
+							_mm256_shuffle_epi8(digits, a));
+		_mm256_storeu_si256((__m256i *)(out + 2 * i + 32),
+							_mm256_shuffle_epi8(digits, b));
+	}
+	return i;
+}
+
+// Digit values of 32 characters, and in *valid a mask of the characters that
+// are hex digits.
+static inline __attribute__((target("avx2"))) __m256i
+hex_values_avx2(__m256i c, __m256i *valid) {
+	__m256i d = _mm256_sub_epi8(c, _mm256_set1_epi8('0'));
+	__m256i l = _mm256_sub_epi8(_mm256_or_si256(c, _mm256_set1_epi8(0x20)),
+								_mm256_set1_epi8('a'));
+	__m256i is_d =
+		_mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(9)), d);
+	__m256i is_l =
+		_mm256_cmpeq_epi8(_mm256_min_epu8(l, _mm256_set1_epi8(5)), l);
+	*valid = _mm256_or_si256(is_d, is_l);
+	return _mm256_blendv_epi8(_mm256_add_epi8(l, _mm256_set1_epi8(10)), d,
+							  is_d);
+}
+
+// 64 digits -> 32 bytes: pairs of nibbles are merged into 16 bit words with
+// vpmaddubsw (hi * 16 + lo) and narrowed with vpackuswb, which interleaves
+// the lanes of its two inputs, so the result is put back in order.
+static __attribute__((target("avx2"))) u64 hex_decode_avx2(byte *out,
+															const byte *in,
+															u64 bytes) {
+	const __m256i merge = _mm256_set1_epi16(0x0110);
+	u64 i = 0;
+	for (; i + 32 <= bytes; i += 32) {
+		__m256i valid_a, valid_b;
+		__m256i a = hex_values_avx2(
+			_mm256_loadu_si256((const __m256i *)(in + 2 * i)), &valid_a);
+		__m256i b = hex_values_avx2(
+			_mm256_loadu_si256((const __m256i *)(in + 2 * i + 32)), &valid_b);
+		if (_mm256_movemask_epi8(_mm256_and_si256(valid_a, valid_b)) != -1)
+			return ~0ULL;
+		__m256i v = _mm256_packus_epi16(_mm256_maddubs_epi16(a, merge),
+										_mm256_maddubs_epi16(b, merge));
+		_mm256_storeu_si256((__m256i *)(out + i),
+							_mm256_permute4x64_epi64(v, 0xD8));
+	}
+	return i;
+}
+
+// 24 bytes -> 32 characters (Mula and Lemire 2018). Each lane gets 12 input
+// bytes, spread so that every 32 bit word holds one 3 byte group; the four
+// 6 bit fields are moved into place with multiplies and turned into
+// characters by adding a per range offset looked up with vpshufb.
+static __attribute__((target("avx2"))) u64
+base64_encode_avx2(char *out, const byte *in, u64 len, u32 flags) {
+	const __m256i spread = _mm256_setr_epi8(
+		1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10, 1, 0, 2, 1, 4, 3,
+		5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+	// added to a value to get its character, per range: A-Z, a-z, 0-9, 62, 63
+	char c62 = (flags & BASE64_URL ? '-' : '+') - 62;
+	char c63 = (flags & BASE64_URL ? '_' : '/') - 63;
+	const __m256i offsets = _mm256_setr_epi8(
+		65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, c62, c63, 0, 0, 65,
+		71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, c62, c63, 0, 0);
+	u64 i = 0, o = 0;
+	// each step reads 28 bytes (16 at i and 16 at i + 12)
+	for (; i + 28 <= len; i += 24, o += 32) {
+		__m256i v = _mm256_inserti128_si256(
+			_mm256_castsi128_si256(
+				_mm_loadu_si128((const __m128i *)(in + i))),
+			_mm_loadu_si128((const __m128i *)(in + i + 12)), 1);
+		v = _mm256_shuffle_epi8(v, spread);
+		__m256i t0 = _mm256_mulhi_epu16(
+			_mm256_and_si256(v, _mm256_set1_epi32(0x0FC0FC00)),
+			_mm256_set1_epi32(0x04000040));
+		__m256i t1 = _mm256_mullo_epi16(
+			_mm256_and_si256(v, _mm256_set1_epi32(0x003F03F0)),
+			_mm256_set1_epi32(0x01000010));
+		v = _mm256_or_si256(t0, t1);
+		// 0..25 -> 0, 26..51 -> 1, 52..61 -> 2..11, 62 -> 12, 63 -> 13
+		__m256i index = _mm256_subs_epu8(v, _mm256_set1_epi8(51));
+		index = _mm256_sub_epi8(
+			index, _mm256_cmpgt_epi8(v, _mm256_set1_epi8(25)));
+		v = _mm256_add_epi8(v, _mm256_shuffle_epi8(offsets, index));
+		_mm256_storeu_si256((__m256i *)(out + o), v);
+	}
+	return i;
+}
+
+static inline __attribute__((target("avx2"))) __m256i
+base64_in_range(__m256i c, char lo, char hi) {
+	return _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8(lo - 1)),
+							_mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), c));
+}
+
+// 32 characters -> 24 bytes. Values come from range compares (bytes above
+// 127 are negative and match none), then vpmaddubsw and vpmaddwd pack four 6
+// bit values into each 32 bit word and a shuffle drops the spare bytes. The
+// store writes 32 bytes, so the caller leaves at least 8 bytes of room.
+static __attribute__((target("avx2"))) u64
+base64_decode_avx2(byte *out, const byte *in, u64 len, u32 flags) {
+	const char c62 = flags & BASE64_URL ? '-' : '+';
+	const char c63 = flags & BASE64_URL ? '_' : '/';
+	const __m256i pack = _mm256_setr_epi8(
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1, 2, 1, 0, 6, 5,
+		4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	const __m256i squeeze = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+	u64 i = 0, o = 0;
+	// 48 characters left decode to 36 bytes, room for the wide store
+	for (; i + 48 <= len; i += 32, o += 24) {
+		__m256i c = _mm256_loadu_si256((const __m256i *)(in + i));
+		__m256i upper = base64_in_range(c, 'A', 'Z');
+		__m256i lower = base64_in_range(c, 'a', 'z');
+		__m256i digit = base64_in_range(c, '0', '9');
+		__m256i is62 = _mm256_cmpeq_epi8(c, _mm256_set1_epi8(c62));
+		__m256i is63 = _mm256_cmpeq_epi8(c, _mm256_set1_epi8(c63));
+		__m256i valid = _mm256_or_si256(
+			_mm256_or_si256(upper, lower),
+			_mm256_or_si256(digit, _mm256_or_si256(is62, is63)));
+		if (_mm256_movemask_epi8(valid) != -1) return ~0ULL;
+		__m256i offset = _mm256_or_si256(
+			_mm256_or_si256(
+				_mm256_and_si256(upper, _mm256_set1_epi8(-'A')),
+				_mm256_and_si256(lower, _mm256_set1_epi8(26 - 'a'))),
+			_mm256_or_si256(
+				_mm256_and_si256(digit, _mm256_set1_epi8(52 - '0')),
+				_mm256_or_si256(
+					_mm256_and_si256(is62, _mm256_set1_epi8(62 - c62)),
+					_mm256_and_si256(is63, _mm256_set1_epi8(63 - c63)))));
+		__m256i v = _mm256_add_epi8(c, offset);
+		v = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+		v = _mm256_madd_epi16(v, _mm256_set1_epi32(0x00011000));
+		v = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v, pack),
+										squeeze);
+		_mm256_storeu_si256((__m256i *)(out + o), v);
+	}
+	return i;
+}
+
+#endif	// __x86_64__
+
+u64 hex_encode(char *out, const void *data, u64 len) {
+	const byte *in = data;
+	u64 i = 0;
+#ifdef __x86_64__
+	if (cpu_has(CPU_AVX2)) i = hex_encode_avx2(out, in, len);
+#endif	// __x86_64__
+	hex_encode_generic(out + 2 * i, in + i, len - i);
+	return 2 * len;
+}
+
+i64 hex_decode(void *out, const char *in, u64 len) {
+	const byte *p = (const byte *)in;
+	u64 bytes = len / 2, i = 0;
+	if (len & 1) return -1;
+#ifdef __x86_64__
+	if (cpu_has(CPU_AVX2)) i = hex_decode_avx2(out, p, bytes);
+	if (i == ~0ULL) return -1;
+#endif	// __x86_64__
+	if (!hex_decode_generic((byte *)out + i, p + 2 * i, bytes - i)) return -1;
+	return bytes;
+}
+
+int hex_parse_u64(const char *in, u64 len, u64 *value) {
+	if (len >= 2 && in[0] == '0' && (in[1] == 'x' || in[1] == 'X')) {
+		in += 2;
+		len -= 2;
+	}
+	if (len == 0 || len > 16) return -1;
+	// left pad to 16 digits and decode big endian
+	char digits[16];
+	byte bytes[8];
+	for (u64 i = 0; i < 16 - len; i++) digits[i] = '0';
+	for (u64 i = 0; i < len; i++) digits[16 - len + i] = in[i];
+	if (!hex_decode_generic(bytes, (const byte *)digits, 8)) return -1;
+	*value = 0;
+	for (int i = 0; i < 8; i++) *value = *value << 8 | bytes[i];
+	return 0;
+}
+
+u64 base64_encoded_len(u64 len, u32 flags) {
+	if (flags & BASE64_NOPAD) return len / 3 * 4 + (len % 3 ? len % 3 + 1 : 0);
+	return (len + 2) / 3 * 4;
+}
+
+u64 base64_encode(char *out, const void *data, u64 len, u32 flags) {
+	const byte *in = data;
+	const char *digits = encode_b64_digits[flags & BASE64_URL ? 1 : 0];
+	u64 i = 0;
+#ifdef __x86_64__
+	if (cpu_has(CPU_AVX2)) i = base64_encode_avx2(out, in, len, flags);
+#endif	// __x86_64__
+	char *o = out + i / 3 * 4;
+	for (; i + 3 <= len; i += 3, o += 4) {
+		u32 v = (u32)in[i] << 16 | (u32)in[i + 1] << 8 | in[i + 2];
+		o[0] = digits[v >> 18];
+		o[1] = digits[(v >> 12) & 63];
+		o[2] = digits[(v >> 6) & 63];
+		o[3] = digits[v & 63];
+	}
+	if (i < len) {
+		u32 v = (u32)in[i] << 16 | (i + 1 < len ? (u32)in[i + 1] << 8 : 0);
+		*o++ = digits[v >> 18];
+		*o++ = digits[(v >> 12) & 63];
+		if (i + 1 < len)
+			*o++ = digits[(v >> 6) & 63];
+		else if (!(flags & BASE64_NOPAD))
+			*o++ = '=';
+		if (!(flags & BASE64_NOPAD)) *o++ = '=';
+	}
+	return o - out;
+}
+
+u64 base64_decoded_len(u64 len) {
+	return len / 4 * 3 + (len % 4 ? len % 4 - 1 : 0);
+}
+
+i64 base64_decode(void *out, const char *in, u64 len, u32 flags) {
+	const byte *p = (const byte *)in;
+	const byte *values = encode_b64_values[flags & BASE64_URL ? 1 : 0];
+	byte *o = out;
+	// the final group, 2 to 4 characters without padding
+	u64 tail = len % 4;
+	if (flags & BASE64_NOPAD) {
+		if (tail == 1) return -1;
+		if (!tail && len) tail = 4;
+	} else {
+		if (tail) return -1;
+		if (len) tail = p[len - 1] != '=' ? 4 : p[len - 2] != '=' ? 3 : 2;
+	}
+	// whole groups before the final one
+	u64 body = len % 4 ? len - len % 4 : len ? len - 4 : 0, i = 0;
+
+#ifdef __x86_64__
+	if (cpu_has(CPU_AVX2)) i = base64_decode_avx2(o, p, body, flags);
+	if (i == ~0ULL) return -1;
+#endif	// __x86_64__
+	for (; i < body; i += 4)
+		if (!base64_decode_quad(o + i / 4 * 3, p + i, values)) return -1;
+	o += body / 4 * 3;
+	if (!tail) return 0;
+
+	// decode the final group padded with 'A' (0) and check that the
+	// characters and bits past its end are unused
+	byte last[4] = {'A', 'A', 'A', 'A'}, bytes[3];
+	for (u64 k = 0; k < tail; k++) last[k] = p[body + k];
+	if (!base64_decode_quad(bytes, last, values)) return -1;
+	u64 n = tail - 1;
+	if (n < 3 && bytes[n]) return -1;
+	if (n == 1 && bytes[2]) return -1;
+	for (u64 k = 0; k < n; k++) o[k] = bytes[k];
+	return o + n - (byte *)out;
+}
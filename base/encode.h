@@ -0,0 +1,48 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _BASE_ENCODE__
+#define _BASE_ENCODE__
+
+#include <base/types.h>
+
+// Hex and base64 (RFC 4648) encoding. Bulk input is handled 32 bytes or
+// characters at a time with AVX2 when available, the rest with tables.
+// Decoders validate everything they read and never write past the decoded
+// length. Output is not NUL terminated.
+
+// base64 flags
+#define BASE64_URL (1 << 0)	   // '-' and '_' instead of '+' and '/'
+#define BASE64_NOPAD (1 << 1)  // no trailing '='
+
+// Two lowercase digits per byte, high nibble first. Writes and returns
+// 2 * len characters.
+u64 hex_encode(char *out, const void *data, u64 len);
+// Decode 'len' digits of either case into len / 2 bytes. Returns the byte
+// count, or -1 if 'len' is odd or a character isn't a hex digit.
+i64 hex_decode(void *out, const char *in, u64 len);
+// Parse 1 to 16 digits, optionally prefixed by "0x", as a number.
+int hex_parse_u64(const char *in, u64 len, u64 *value);
+
+u64 base64_encoded_len(u64 len, u32 flags);
+// Writes and returns base64_encoded_len(len, flags) characters.
+u64 base64_encode(char *out, const void *data, u64 len, u32 flags);
+// Upper bound on the decoded size of 'len' characters.
+u64 base64_decoded_len(u64 len);
+// Returns the byte count, or -1 if the input isn't canonical base64 in the
+// alphabet selected by 'flags': padded to a multiple of 4 characters (or
+// unpadded with BASE64_NOPAD), with the unused bits of the last group zero.
+i64 base64_decode(void *out, const char *in, u64 len, u32 flags);
+
+#endif	// _BASE_ENCODE__
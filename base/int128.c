@@ -0,0 +1,263 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <base/int128.h>
+#include <base/util.h>
+
+#define INT128_POW19 10000000000000000000ULL
+
+// "00" "01" ... "99"
+static char int128_pairs[200];
+static U128Divisor int128_pow19;
+
+static void __attribute__((constructor)) int128_init() {
+	for (int i = 0; i < 100; i++) {
+		int128_pairs[2 * i] = '0' + i / 10;
+		int128_pairs[2 * i + 1] = '0' + i % 10;
+	}
+	u128_divisor_init(&int128_pow19, INT128_POW19);
+}
+
+// (hi * 2^64 + lo) / d for hi < d
+static inline u64 int128_divq(u64 hi, u64 lo, u64 d, u64 *rem) {
+#ifdef __x86_64__
+	u64 q, r;
+	__asm__("divq %4" : "=a"(q), "=d"(r) : "a"(lo), "d"(hi), "rm"(d));
+	*rem = r;
+	return q;
+#else
+	u128 n = (u128)hi << 64 | lo;
+	*rem = (u64)(n % d);
+	return (u64)(n / d);
+#endif	// __x86_64__
+}
+
+// (hi * 2^64 + lo) / d for hi < d and d normalized, with inv from
+// u128_divisor_init (Moller and Granlund, algorithm 4)
+static inline u64 int128_div_2by1(u64 hi, u64 lo, u64 d, u64 inv, u64 *rem) {
+	u128 q = (u128)inv * hi + ((u128)hi << 64 | lo);
+	u64 q1 = (u64)(q >> 64) + 1, q0 = (u64)q;
+	u64 r = lo - q1 * d;
+	if (r > q0) {
+		q1--;
+		r += d;
+	}
+	if (r >= d) {
+		q1++;
+		r -= d;
+	}
+	*rem = r;
+	return q1;
+}
+
+// (u2 * 2^128 + u1 * 2^64 + u0) / (v1 * 2^64 + v0) for (u2, u1) < (v1, v0)
+// and v1 normalized
+static u64 int128_div_3by2(u64 u2, u64 u1, u64 u0, u64 v1, u64 v0,
+						   u128 *rem) {
+	u64 q, r;
+	u128 rhat;
+	if (u2 == v1) {
+		q = ~0ULL;
+		rhat = (u128)u1 + v1;
+	} else {
+		q = int128_divq(u2, u1, v1, &r);
+		rhat = r;
+	}
+	// two corrections at most make q exact
+	while (!(rhat >> 64) && (u128)q * v0 > (rhat << 64 | u0)) {
+		q--;
+		rhat += v1;
+	}
+	u128 t = (u128)q * v0;
+	u64 lo = u0 - (u64)t;
+	u128 sub = (u128)q * v1 + (t >> 64) + (u0 < (u64)t);
+	u128 mid = ((u128)u2 << 64 | u1) - sub;
+	*rem = mid << 64 | lo;
+	return q;
+}
+
+void u128_divisor_init(U128Divisor *div, u64 d) {
+	div->d = d;
+	div->shift = __builtin_clzll(d);
+	div->norm = d << div->shift;
+	div->inv = (u64)(U128_MAX / div->norm);
+}
+
+u128 u128_div_const(u128 n, const U128Divisor *div, u64 *rem) {
+	u32 s = div->shift;
+	u64 n2 = s ? (u64)(n >> (128 - s)) : 0;
+	n <<= s;
+	u64 r;
+	u64 q1 = int128_div_2by1(n2, n >> 64, div->norm, div->inv, &r);
+	u64 q0 = int128_div_2by1(r, (u64)n, div->norm, div->inv, &r);
+	if (rem) *rem = r >> s;
+	return (u128)q1 << 64 | q0;
+}
+
+u128 u128_div_u64(u128 n, u64 d, u64 *rem) {
+	u64 hi = n >> 64, r;
+	u64 q1 = hi / d;
+	u64 q0 = int128_divq(hi % d, (u64)n, d, &r);
+	if (rem) *rem = r;
+	return (u128)q1 << 64 | q0;
+}
+
+u128 u128_mul_wide(u128 a, u128 b, u128 *hi) {
+	u64 a0 = a, a1 = a >> 64, b0 = b, b1 = b >> 64;
+	u128 p00 = (u128)a0 * b0, p01 = (u128)a0 * b1;
+	u128 p10 = (u128)a1 * b0, p11 = (u128)a1 * b1;
+	u128 mid = (p00 >> 64) + (u64)p01 + (u64)p10;
+	*hi = p11 + (p01 >> 64) + (p10 >> 64) + (mid >> 64);
+	return mid << 64 | (u64)p00;
+}
+
+u128 u128_div_wide(u128 hi, u128 lo, u128 d, u128 *rem) {
+	if (!(d >> 64)) {
+		u64 r;
+		u64 q1 = int128_divq(hi, lo >> 64, d, &r);
+		u64 q0 = int128_divq(r, lo, d, &r);
+		if (rem) *rem = r;
+		return (u128)q1 << 64 | q0;
+	}
+	u32 s = __builtin_clzll(d >> 64);
+	u128 v = d << s, r;
+	if (s) hi = hi << s | lo >> (128 - s);
+	lo <<= s;
+	u64 q1 = int128_div_3by2(hi >> 64, hi, lo >> 64, v >> 64, v, &r);
+	u64 q0 = int128_div_3by2(r >> 64, r, lo, v >> 64, v, &r);
+	if (rem) *rem = r >> s;
+	return (u128)q1 << 64 | q0;
+}
+
+bool u128_add_overflow(u128 a, u128 b, u128 *r) {
+	return __builtin_add_overflow(a, b, r);
+}
+
+bool u128_sub_overflow(u128 a, u128 b, u128 *r) {
+	return __builtin_sub_overflow(a, b, r);
+}
+
+bool u128_mul_overflow(u128 a, u128 b, u128 *r) {
+	return __builtin_mul_overflow(a, b, r);
+}
+
+bool i128_add_overflow(i128 a, i128 b, i128 *r) {
+	return __builtin_add_overflow(a, b, r);
+}
+
+bool i128_sub_overflow(i128 a, i128 b, i128 *r) {
+	return __builtin_sub_overflow(a, b, r);
+}
+
+bool i128_mul_overflow(i128 a, i128 b, i128 *r) {
+	return __builtin_mul_overflow(a, b, r);
+}
+
+u128 u128_add_sat(u128 a, u128 b) {
+	u128 r;
+	return __builtin_add_overflow(a, b, &r) ? U128_MAX : r;
+}
+
+u128 u128_sub_sat(u128 a, u128 b) {
+	return a > b ? a - b : 0;
+}
+
+u128 u128_mul_sat(u128 a, u128 b) {
+	u128 r;
+	return __builtin_mul_overflow(a, b, &r) ? U128_MAX : r;
+}
+
+i128 i128_add_sat(i128 a, i128 b) {
+	i128 r;
+	if (__builtin_add_overflow(a, b, &r)) return a < 0 ? I128_MIN : I128_MAX;
+	return r;
+}
+
+i128 i128_sub_sat(i128 a, i128 b) {
+	i128 r;
+	if (__builtin_sub_overflow(a, b, &r)) return a < 0 ? I128_MIN : I128_MAX;
+	return r;
+}
+
+i128 i128_mul_sat(i128 a, i128 b) {
+	i128 r;
+	if (__builtin_mul_overflow(a, b, &r))
+		return (a < 0) != (b < 0) ? I128_MIN : I128_MAX;
+	return r;
+}
+
+// Write the digits of 'v' to the characters before 'end', two at a time,
+// padded with zeros to 'width'. Returns the first character written.
+static char *int128_u64_digits(char *end, u64 v, u32 width) {
+	char *p = end;
+	while (v >= 100) {
+		u64 pair = v % 100;
+		v /= 100;
+		p -= 2;
+		p[0] = int128_pairs[2 * pair];
+		p[1] = int128_pairs[2 * pair + 1];
+	}
+	if (v >= 10) {
+		p -= 2;
+		p[0] = int128_pairs[2 * v];
+		p[1] = int128_pairs[2 * v + 1];
+	} else
+		*--p = '0' + v;
+	while (p > end - width) *--p = '0';
+	return p;
+}
+
+u64 u128_to_str(u128 v, char buf[U128_STR_LEN]) {
+	char tmp[U128_STR_LEN];
+	char *end = tmp + sizeof(tmp), *p = end;
+	// at most two divisions by 10^19 leave a value that fits in 64 bits
+	while (v >> 64) {
+		u64 low;
+		v = u128_div_const(v, &int128_pow19, &low);
+		p = int128_u64_digits(p, low, 19);
+	}
+	p = int128_u64_digits(p, v, 0);
+	u64 len = end - p;
+	copy_bytes(buf, p, len);
+	buf[len] = 0;
+	return len;
+}
+
+u64 i128_to_str(i128 v, char buf[I128_STR_LEN]) {
+	if (v >= 0) return u128_to_str(v, buf);
+	buf[0] = '-';
+	return 1 + u128_to_str(-(u128)v, buf + 1);
+}
+
+int u128_parse(const char *s, u64 len, u128 *v) {
+	if (!len) return -1;
+	u128 r = 0;
+	for (u64 i = 0; i < len; i++) {
+		u32 digit = (byte)s[i] - '0';
+		if (digit > 9) return -1;
+		if (__builtin_mul_overflow(r, 10, &r)) return -1;
+		if (__builtin_add_overflow(r, digit, &r)) return -1;
+	}
+	*v = r;
+	return 0;
+}
+
+int i128_parse(const char *s, u64 len, i128 *v) {
+	bool negative = len && s[0] == '-';
+	u128 r;
+	if (u128_parse(s + negative, len - negative, &r)) return -1;
+	if (r > (u128)I128_MAX + negative) return -1;
+	*v = negative ? (i128)-r : (i128)r;
+	return 0;
+}
@@ -0,0 +1,76 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _BASE_INT128__
+#define _BASE_INT128__
+
+#include <base/types.h>
+
+// Arithmetic and text conversion for u128 and i128. The compiler divides
+// 128 bit values with a call to __udivti3; here a division by a 64 bit value
+// is two hardware 128/64 divides, and a division by a value known ahead of
+// time (U128Divisor) is a multiply by a precomputed reciprocal and a few
+// adds per 64 bit word (Moller and Granlund, "Improved division by invariant
+// integers", 2011).
+
+#define U128_MAX (~(u128)0)
+#define I128_MAX ((i128)(U128_MAX >> 1))
+#define I128_MIN (-I128_MAX - 1)
+// buffer sizes for any value, with the terminating NUL
+#define U128_STR_LEN 40
+#define I128_STR_LEN 41
+
+typedef struct U128Divisor {
+	u64 d;
+	u64 norm;  // d shifted left until its top bit is set
+	u64 inv;   // floor((2^128 - 1) / norm) - 2^64
+	u32 shift;
+} U128Divisor;
+
+// 'd' must not be 0.
+void u128_divisor_init(U128Divisor *div, u64 d);
+u128 u128_div_const(u128 n, const U128Divisor *div, u64 *rem);
+u128 u128_div_u64(u128 n, u64 d, u64 *rem);
+
+// The 256 bit product of 'a' and 'b': returns the low half and stores the
+// high half in *hi.
+u128 u128_mul_wide(u128 a, u128 b, u128 *hi);
+// (hi * 2^128 + lo) / d for hi < d, so that the quotient fits.
+u128 u128_div_wide(u128 hi, u128 lo, u128 d, u128 *rem);
+
+// Checked arithmetic: store the wrapped result and return true on overflow.
+bool u128_add_overflow(u128 a, u128 b, u128 *r);
+bool u128_sub_overflow(u128 a, u128 b, u128 *r);
+bool u128_mul_overflow(u128 a, u128 b, u128 *r);
+bool i128_add_overflow(i128 a, i128 b, i128 *r);
+bool i128_sub_overflow(i128 a, i128 b, i128 *r);
+bool i128_mul_overflow(i128 a, i128 b, i128 *r);
+
+// Saturating arithmetic: results are clamped to the range of the type.
+u128 u128_add_sat(u128 a, u128 b);
+u128 u128_sub_sat(u128 a, u128 b);
+u128 u128_mul_sat(u128 a, u128 b);
+i128 i128_add_sat(i128 a, i128 b);
+i128 i128_sub_sat(i128 a, i128 b);
+i128 i128_mul_sat(i128 a, i128 b);
+
+// Decimal text, NUL terminated. Returns the length without the NUL.
+u64 u128_to_str(u128 v, char buf[U128_STR_LEN]);
+u64 i128_to_str(i128 v, char buf[I128_STR_LEN]);
+// Parse exactly 'len' characters of decimal digits (after a '-' for i128).
+// Returns -1 if the text is empty, has another character or overflows.
+int u128_parse(const char *s, u64 len, u128 *v);
+int i128_parse(const char *s, u64 len, i128 *v);
+
+#endif	// _BASE_INT128__
@@ -12,6 +12,20 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <base/bitset.h>
+#include <base/blake3.h>
 #include <base/colors.h>
+#include <base/cpu.h>
+#include <base/crc32c.h>
+#include <base/decimal.h>
+#include <base/dirscan.h>
+#include <base/encode.h>
+#include <base/int128.h>
+#include <base/lz.h>
+#include <base/random.h>
+#include <base/ring.h>
+#include <base/sha256.h>
+#include <base/sort.h>
 #include <base/sys.h>
+#include <base/utf8.h>
 #include <base/util.h>
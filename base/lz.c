@@ -0,0 +1,722 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <base/crc32c.h>
+#include <base/lz.h>
+#include <base/sys.h>
+#include <base/util.h>
+
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5
+#define LZ_MFLIMIT 12
+#define LZ_MAX_DISTANCE 65535
+#define LZ_HASH_LOG 12
+#define LZ_HC_HASH_LOG 15
+#define LZ_SKIP_TRIGGER 6
+
+#define LZ_FRAME_FLAG_LINKED 0x1
+#define LZ_FRAME_FLAG_CHECKSUM 0x2
+#define LZ_FRAME_STORED 0x80000000U
+
+#define LZ_STAGE_HEADER 0
+#define LZ_STAGE_BLOCK_HEADER 1
+#define LZ_STAGE_BLOCK_DATA 2
+#define LZ_STAGE_CHECKSUM 3
+#define LZ_STAGE_DONE 4
+
+// unaligned access without memcpy
+typedef u64 __attribute__((may_alias, aligned(1))) lz_u64u;
+typedef u32 __attribute__((may_alias, aligned(1))) lz_u32u;
+typedef u16 __attribute__((may_alias, aligned(1))) lz_u16u;
+
+static inline u64 lz_read64(const byte *p) {
+	return *(const lz_u64u *)p;
+}
+
+static inline u32 lz_read32(const byte *p) {
+	return *(const lz_u32u *)p;
+}
+
+static inline u16 lz_read16(const byte *p) {
+	return *(const lz_u16u *)p;
+}
+
+static inline void lz_write32(byte *p, u32 v) {
+	*(lz_u32u *)p = v;
+}
+
+static inline void lz_copy8(byte *dst, const byte *src) {
+	*(lz_u64u *)dst = lz_read64(src);
+}
+
+static inline void lz_copy16(byte *dst, const byte *src) {
+	__builtin_memcpy(dst, src, 16);
+}
+
+// copy in 8 byte steps until 'end', writing up to 7 bytes past it; 'src' may
+// overlap 'dst' if it is at least 8 bytes behind
+static inline void lz_wildcopy8(byte *dst, const byte *src, byte *end) {
+	do {
+		lz_copy8(dst, src);
+		dst += 8;
+		src += 8;
+	} while (dst < end);
+}
+
+// copy in 32 byte steps until 'end', writing up to 31 bytes past it; 'src'
+// may overlap 'dst' if it is at least 16 bytes behind
+static inline void lz_wildcopy32(byte *dst, const byte *src, byte *end) {
+	do {
+		lz_copy16(dst, src);
+		lz_copy16(dst + 16, src + 16);
+		dst += 32;
+		src += 32;
+	} while (dst < end);
+}
+
+static inline u32 lz_hash(u32 v, int log) {
+	return (v * 2654435761U) >> (32 - log);
+}
+
+static inline u64 lz_count(const byte *ip, const byte *match,
+						   const byte *limit) {
+	const byte *start = ip;
+	while (ip + 8 <= limit) {
+		u64 diff = lz_read64(ip) ^ lz_read64(match);
+		if (diff) return ip - start + (__builtin_ctzll(diff) >> 3);
+		ip += 8;
+		match += 8;
+	}
+	while (ip < limit && *ip == *match) {
+		ip++;
+		match++;
+	}
+	return ip - start;
+}
+
+static inline byte *lz_write_length(byte *op, u64 len) {
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = len;
+	return op;
+}
+
+// number of extension bytes lz_write_length writes for a token field
+static inline u64 lz_length_bytes(u64 len) {
+	return len >= 15 ? (len - 15) / 255 + 1 : 0;
+}
+
+static inline byte *lz_copy_literals(byte *op, byte *oend, const byte *anchor,
+									 u64 lit) {
+	if (oend - op >= lit + 8)
+		lz_wildcopy8(op, anchor, op + lit);
+	else
+		copy_bytes(op, anchor, lit);
+	return op + lit;
+}
+
+// Emit a sequence, returns NULL if it doesn't fit in the output.
+static inline byte *lz_emit(byte *op, byte *oend, const byte *anchor, u64 lit,
+							u64 offset, u64 mlen) {
+	if ((u64)(oend - op) < 1 + lz_length_bytes(lit) + lit + 2 +
+								lz_length_bytes(mlen - LZ_MIN_MATCH))
+		return NULL;
+	byte *token = op++;
+	if (lit >= 15) {
+		*token = 15 << 4;
+		op = lz_write_length(op, lit - 15);
+	} else
+		*token = lit << 4;
+	op = lz_copy_literals(op, oend, anchor, lit);
+	*op++ = offset;
+	*op++ = offset >> 8;
+	mlen -= LZ_MIN_MATCH;
+	if (mlen >= 15) {
+		*token |= 15;
+		op = lz_write_length(op, mlen - 15);
+	} else
+		*token |= mlen;
+	return op;
+}
+
+static inline byte *lz_emit_last(byte *op, byte *oend, const byte *anchor,
+								 u64 lit) {
+	if ((u64)(oend - op) < 1 + lz_length_bytes(lit) + lit) return NULL;
+	if (lit >= 15) {
+		*op++ = 15 << 4;
+		op = lz_write_length(op, lit - 15);
+	} else
+		*op++ = lit << 4;
+	copy_bytes(op, anchor, lit);
+	return op + lit;
+}
+
+// Compress base[prefix, end). Matches may reference the LZ_WINDOW_SIZE bytes
+// before 'prefix', which is how dictionaries and linked frame blocks work.
+static i64 lz_compress_fast(const byte *base, u64 prefix, u64 end, byte *dst,
+							u64 capacity) {
+	u32 table[1 << LZ_HASH_LOG];
+	const byte *ip = base + prefix, *anchor = ip, *iend = base + end;
+	const byte *mflimit = iend - LZ_MFLIMIT;
+	const byte *matchlimit = iend - LZ_LAST_LITERALS;
+	byte *op = dst, *oend = dst + capacity;
+
+	if (end - prefix < LZ_MFLIMIT + 1) goto last_literals;
+
+	set_bytes((byte *)table, 0, sizeof(table));
+	u64 p = prefix > LZ_MAX_DISTANCE ? prefix - LZ_MAX_DISTANCE : 0;
+	for (; p < prefix; p++)
+		table[lz_hash(lz_read32(base + p), LZ_HASH_LOG)] = p;
+
+	for (;;) {
+		const byte *match;
+		u32 attempts = 1 << LZ_SKIP_TRIGGER;
+		// the step grows with consecutive misses so incompressible data is
+		// skipped over quickly
+		for (;;) {
+			u32 h = lz_hash(lz_read32(ip), LZ_HASH_LOG);
+			match = base + table[h];
+			table[h] = ip - base;
+			if (match < ip && ip - match <= LZ_MAX_DISTANCE &&
+				lz_read32(match) == lz_read32(ip))
+				break;
+			ip += attempts++ >> LZ_SKIP_TRIGGER;
+			if (ip > mflimit) goto last_literals;
+		}
+
+		while (ip > anchor && match > base && ip[-1] == match[-1]) {
+			ip--;
+			match--;
+		}
+
+		u64 mlen = LZ_MIN_MATCH + lz_count(ip + LZ_MIN_MATCH,
+										   match + LZ_MIN_MATCH, matchlimit);
+		op = lz_emit(op, oend, anchor, ip - anchor, ip - match, mlen);
+		if (op == NULL) return -1;
+		ip += mlen;
+		anchor = ip;
+		if (ip > mflimit) break;
+		table[lz_hash(lz_read32(ip - 2), LZ_HASH_LOG)] = ip - 2 - base;
+	}
+
+last_literals:
+	op = lz_emit_last(op, oend, anchor, iend - anchor);
+	if (op == NULL) return -1;
+	return op - dst;
+}
+
+typedef struct LzHc {
+	u32 *head;
+	u16 *chain;
+	u64 next;
+	u32 attempts;
+	u64 nice;
+} LzHc;
+
+#define LZ_HC_PAGES                                             \
+	bytes_to_pages((1 << LZ_HC_HASH_LOG) * sizeof(u32) + \
+				   LZ_WINDOW_SIZE * sizeof(u16))
+
+// Positions are stored + 1 in 'head' so that 0 marks an empty bucket. 'chain'
+// holds the distance to the previous position with the same hash.
+static void lz_hc_insert(LzHc *hc, const byte *base, u64 upto) {
+	for (; hc->next < upto; hc->next++) {
+		u32 h = lz_hash(lz_read32(base + hc->next), LZ_HC_HASH_LOG);
+		u64 delta = hc->head[h] ? hc->next - (hc->head[h] - 1) : 0;
+		hc->chain[hc->next & (LZ_WINDOW_SIZE - 1)] =
+			delta > LZ_MAX_DISTANCE ? 0 : delta;
+		hc->head[h] = hc->next + 1;
+	}
+}
+
+static u64 lz_hc_find(LzHc *hc, const byte *base, const byte *ip,
+					  const byte *matchlimit, const byte **match) {
+	u64 pos = ip - base, best = 0;
+	lz_hc_insert(hc, base, pos + 1);
+	u32 v = lz_read32(ip);
+	u32 delta = hc->chain[pos & (LZ_WINDOW_SIZE - 1)];
+	u64 dist = delta;
+	for (u32 i = 0; i < hc->attempts && delta && dist <= LZ_MAX_DISTANCE;
+		 i++) {
+		const byte *cand = ip - dist;
+		if (lz_read32(cand) == v && cand[best] == ip[best]) {
+			u64 len = LZ_MIN_MATCH + lz_count(ip + LZ_MIN_MATCH,
+											  cand + LZ_MIN_MATCH, matchlimit);
+			if (len > best) {
+				best = len;
+				*match = cand;
+				// long enough that looking further isn't worth it
+				if (best >= hc->nice) break;
+			}
+		}
+		delta = hc->chain[(pos - dist) & (LZ_WINDOW_SIZE - 1)];
+		dist += delta;
+	}
+	return best;
+}
+
+static i64 lz_compress_hc_generic(const byte *base, u64 prefix, u64 end,
+								  byte *dst, u64 capacity, int level) {
+	const byte *ip = base + prefix, *anchor = ip, *iend = base + end;
+	const byte *mflimit = iend - LZ_MFLIMIT;
+	const byte *matchlimit = iend - LZ_LAST_LITERALS;
+	byte *op = dst, *oend = dst + capacity;
+	LzHc hc;
+
+	if (level < 1) level = 1;
+	if (level > LZ_HC_MAX_LEVEL) level = LZ_HC_MAX_LEVEL;
+	if (end - prefix < LZ_MFLIMIT + 1) goto last_literals;
+
+	byte *scratch = map(LZ_HC_PAGES);
+	if (scratch == NULL) return -1;
+	hc.head = (u32 *)scratch;
+	hc.chain = (u16 *)(hc.head + (1 << LZ_HC_HASH_LOG));
+	hc.next = prefix > LZ_MAX_DISTANCE ? prefix - LZ_MAX_DISTANCE : 0;
+	hc.attempts = 1 << (level - 1);
+	hc.nice = 16 << (level / 3);
+
+	while (ip <= mflimit) {
+		const byte *match, *match2;
+		u64 mlen = lz_hc_find(&hc, base, ip, matchlimit, &match);
+		if (mlen == 0) {
+			ip++;
+			continue;
+		}
+		// one step of lazy matching: prefer a clearly longer match at ip + 1
+		if (mlen < hc.nice && ip + 1 <= mflimit) {
+			u64 mlen2 = lz_hc_find(&hc, base, ip + 1, matchlimit, &match2);
+			if (mlen2 > mlen + 1) {
+				ip++;
+				mlen = mlen2;
+				match = match2;
+			}
+		}
+		while (ip > anchor && match > base && ip[-1] == match[-1]) {
+			ip--;
+			match--;
+			mlen++;
+		}
+
+		op = lz_emit(op, oend, anchor, ip - anchor, ip - match, mlen);
+		if (op == NULL) {
+			unmap(scratch, LZ_HC_PAGES);
+			return -1;
+		}
+		ip += mlen;
+		anchor = ip;
+	}
+	unmap(scratch, LZ_HC_PAGES);
+
+last_literals:
+	op = lz_emit_last(op, oend, anchor, iend - anchor);
+	if (op == NULL) return -1;
+	return op - dst;
+}
+
+// Room the wild copies in the decoder need past the end of a copy.
+#define LZ_WILD_MARGIN 32
+
+// For a match less than 8 bytes back, the first 8 bytes are copied in two
+// steps of 4, after which the source is moved back by a multiple of the
+// offset so that it is at least 8 bytes behind and 8 byte wild copies repeat
+// the pattern correctly.
+static const byte lz_inc32[8] = {0, 1, 2, 1, 0, 4, 4, 4};
+static const i32 lz_dec64[8] = {0, 0, 0, -1, -4, 1, 2, 3};
+
+// Decompress into dst, allowing matches to reach 'prefix' bytes back before
+// dst (contiguous history) and then into the end of 'dict'.
+static i64 lz_decompress_generic(const byte *src, u64 len, byte *dst,
+								 u64 capacity, u64 prefix, const byte *dict,
+								 u64 dict_len) {
+	const byte *ip = src, *iend = src + len;
+	byte *op = dst, *oend = dst + capacity;
+	const byte *low = dst - prefix;
+
+	if (len == 0) return -1;
+
+	for (;;) {
+		u32 token = *ip++;
+		u64 lit = token >> 4, mlen, offset;
+		const byte *match;
+
+		// Short literal run and plenty of room on both sides: copy a fixed
+		// 16 bytes of literals and, for a short match at least 8 bytes back,
+		// a fixed 24 bytes of match. This is the common case.
+		if (lit != 15 && iend - ip >= 18 && oend - op >= 40) {
+			lz_copy16(op, ip);
+			op += lit;
+			ip += lit;
+			offset = lz_read16(ip);
+			ip += 2;
+			mlen = token & 15;
+			match = op - offset;
+			if (mlen != 15 && offset >= 8 && offset <= (u64)(op - low)) {
+				lz_copy8(op, match);
+				lz_copy8(op + 8, match + 8);
+				lz_copy8(op + 16, match + 16);
+				op += mlen + LZ_MIN_MATCH;
+				continue;
+			}
+			goto copy_match;
+		}
+
+		if (lit == 15) {
+			u32 s;
+			do {
+				if (ip >= iend) return -1;
+				s = *ip++;
+				lit += s;
+			} while (s == 255);
+		}
+		if (lit > (u64)(iend - ip) || lit > (u64)(oend - op)) return -1;
+		if ((u64)(oend - op) >= lit + LZ_WILD_MARGIN &&
+			(u64)(iend - ip) >= lit + LZ_WILD_MARGIN)
+			lz_wildcopy32(op, ip, op + lit);
+		else
+			copy_bytes(op, ip, lit);
+		op += lit;
+		ip += lit;
+		if (ip == iend) break;	// the last sequence has no match
+
+		if (iend - ip < 2) return -1;
+		offset = lz_read16(ip);
+		ip += 2;
+		mlen = token & 15;
+		match = op - offset;
+
+	copy_match:
+		if (mlen == 15) {
+			u32 s;
+			do {
+				if (ip >= iend) return -1;
+				s = *ip++;
+				mlen += s;
+			} while (s == 255);
+		}
+		mlen += LZ_MIN_MATCH;
+		if (offset == 0 || mlen > (u64)(oend - op)) return -1;
+
+		if (offset > (u64)(op - low)) {
+			// the match starts in the external dictionary
+			u64 back = offset - (op - low);
+			if (dict == NULL || back > dict_len) return -1;
+			const byte *dmatch = dict + dict_len - back;
+			u64 n = back < mlen ? back : mlen;
+			copy_bytes(op, dmatch, n);
+			op += n;
+			mlen -= n;
+			for (match = low; mlen; mlen--) *op++ = *match++;
+		} else if ((u64)(oend - op) >= mlen + LZ_WILD_MARGIN) {
+			// the fast zone: wild copies with no checks per byte
+			byte *end = op + mlen;
+			if (offset >= 16) {
+				lz_wildcopy32(op, match, end);
+			} else {
+				if (offset < 8) {
+					op[0] = match[0];
+					op[1] = match[1];
+					op[2] = match[2];
+					op[3] = match[3];
+					match += lz_inc32[offset];
+					lz_write32(op + 4, lz_read32(match));
+					match -= lz_dec64[offset];
+					op += 8;
+				}
+				if (op < end) lz_wildcopy8(op, match, end);
+			}
+			op = end;
+		} else {
+			// near the end of the output
+			while (mlen--) *op++ = *match++;
+		}
+
+		if (ip >= iend) return -1;
+	}
+	return op - dst;
+}
+
+u64 lz_compress_bound(u64 len) {
+	return len + len / 255 + 16;
+}
+
+i64 lz_compress(const byte *src, u64 len, byte *dst, u64 capacity) {
+	if (len > LZ_MAX_INPUT_SIZE) return -1;
+	return lz_compress_fast(src, 0, len, dst, capacity);
+}
+
+i64 lz_compress_hc(const byte *src, u64 len, byte *dst, u64 capacity,
+				   int level) {
+	if (len > LZ_MAX_INPUT_SIZE) return -1;
+	return lz_compress_hc_generic(src, 0, len, dst, capacity, level);
+}
+
+i64 lz_compress_dict(const byte *dict, u64 dict_len, const byte *src, u64 len,
+					 byte *dst, u64 capacity, int level) {
+	if (len > LZ_MAX_INPUT_SIZE) return -1;
+	if (dict_len > LZ_WINDOW_SIZE) {
+		dict += dict_len - LZ_WINDOW_SIZE;
+		dict_len = LZ_WINDOW_SIZE;
+	}
+	// the matchers need the dictionary directly in front of the input
+	u64 pages = bytes_to_pages(dict_len + len);
+	byte *buf = map(pages ? pages : 1);
+	if (buf == NULL) return -1;
+	copy_bytes(buf, dict, dict_len);
+	copy_bytes(buf + dict_len, src, len);
+	i64 ret = level ? lz_compress_hc_generic(buf, dict_len, dict_len + len,
+											 dst, capacity, level)
+					: lz_compress_fast(buf, dict_len, dict_len + len, dst,
+									   capacity);
+	unmap(buf, pages ? pages : 1);
+	return ret;
+}
+
+i64 lz_decompress(const byte *src, u64 len, byte *dst, u64 capacity) {
+	return lz_decompress_generic(src, len, dst, capacity, 0, NULL, 0);
+}
+
+i64 lz_decompress_dict(const byte *dict, u64 dict_len, const byte *src,
+					   u64 len, byte *dst, u64 capacity) {
+	return lz_decompress_generic(src, len, dst, capacity, 0, dict, dict_len);
+}
+
+int lz_frame_init(LzFrame *frame, u64 block_size, int level) {
+	u64 size = 1ULL << LZ_FRAME_MIN_BLOCK_LOG;
+	if (block_size == 0) block_size = LZ_FRAME_DEFAULT_BLOCK_SIZE;
+	while (size < block_size && size < (1ULL << LZ_FRAME_MAX_BLOCK_LOG))
+		size <<= 1;
+	frame->block_size = size;
+	frame->pages = bytes_to_pages(LZ_WINDOW_SIZE + size);
+	frame->buf = map(frame->pages);
+	if (frame->buf == NULL) return -1;
+	frame->history = 0;
+	frame->pending = 0;
+	frame->level = level;
+	frame->header_written = false;
+	frame->checksum = 0;
+	return 0;
+}
+
+void lz_frame_cleanup(LzFrame *frame) {
+	if (frame->buf) unmap(frame->buf, frame->pages);
+	frame->buf = NULL;
+}
+
+u64 lz_frame_bound(const LzFrame *frame, u64 len) {
+	u64 total = frame->pending + len;
+	return LZ_FRAME_HEADER_SIZE + total + 4 * (total / frame->block_size + 3);
+}
+
+static i64 lz_frame_header(LzFrame *frame, byte *dst, u64 capacity) {
+	if (frame->header_written) return 0;
+	if (capacity < LZ_FRAME_HEADER_SIZE) return -1;
+	lz_write32(dst, LZ_FRAME_MAGIC);
+	dst[4] = LZ_FRAME_FLAG_LINKED | LZ_FRAME_FLAG_CHECKSUM;
+	dst[5] = __builtin_ctzll(frame->block_size);
+	dst[6] = dst[7] = 0;
+	frame->header_written = true;
+	return LZ_FRAME_HEADER_SIZE;
+}
+
+// Compress the pending input as one block. If it doesn't shrink it is stored.
+static i64 lz_frame_flush(LzFrame *frame, byte *dst, u64 capacity) {
+	u64 pending = frame->pending;
+	byte *block = frame->buf + frame->history;
+	if (capacity < 4 + pending) return -1;
+	frame->checksum = crc32c(frame->checksum, block, pending);
+
+	i64 len = frame->level ? lz_compress_hc_generic(
+								 frame->buf, frame->history,
+								 frame->history + pending, dst + 4,
+								 pending - 1, frame->level)
+						   : lz_compress_fast(frame->buf, frame->history,
+											  frame->history + pending,
+											  dst + 4, pending - 1);
+	if (len < 0) {
+		lz_write32(dst, pending | LZ_FRAME_STORED);
+		copy_bytes(dst + 4, block, pending);
+		len = pending;
+	} else
+		lz_write32(dst, len);
+
+	// keep the last window of input as history for the next block
+	u64 total = frame->history + pending;
+	u64 keep = total < LZ_WINDOW_SIZE ? total : LZ_WINDOW_SIZE;
+	if (keep < total) copy_bytes(frame->buf, frame->buf + total - keep, keep);
+	frame->history = keep;
+	frame->pending = 0;
+	return 4 + len;
+}
+
+i64 lz_frame_update(LzFrame *frame, const byte *src, u64 len, byte *dst,
+					u64 capacity) {
+	i64 out = lz_frame_header(frame, dst, capacity);
+	if (out < 0) return -1;
+	while (len) {
+		u64 n = frame->block_size - frame->pending;
+		if (n > len) n = len;
+		copy_bytes(frame->buf + frame->history + frame->pending, src, n);
+		frame->pending += n;
+		src += n;
+		len -= n;
+		if (frame->pending == frame->block_size) {
+			i64 r = lz_frame_flush(frame, dst + out, capacity - out);
+			if (r < 0) return -1;
+			out += r;
+		}
+	}
+	return out;
+}
+
+i64 lz_frame_end(LzFrame *frame, byte *dst, u64 capacity) {
+	i64 out = lz_frame_header(frame, dst, capacity);
+	if (out < 0) return -1;
+	if (frame->pending) {
+		i64 r = lz_frame_flush(frame, dst + out, capacity - out);
+		if (r < 0) return -1;
+		out += r;
+	}
+	if (capacity - out < 8) return -1;
+	lz_write32(dst + out, 0);
+	lz_write32(dst + out + 4, frame->checksum);
+	return out + 8;
+}
+
+int lz_frame_reader_init(LzFrameReader *reader) {
+	set_bytes((byte *)reader, 0, sizeof(LzFrameReader));
+	reader->stage = LZ_STAGE_HEADER;
+	return 0;
+}
+
+void lz_frame_reader_cleanup(LzFrameReader *reader) {
+	if (reader->buf) unmap(reader->buf, reader->pages);
+	reader->buf = NULL;
+}
+
+bool lz_frame_done(const LzFrameReader *reader) {
+	return reader->stage == LZ_STAGE_DONE && reader->out_len == 0;
+}
+
+// accumulate up to 'need' bytes of a header, returns true once complete
+static bool lz_frame_take(LzFrameReader *reader, u64 need, const byte *src,
+						  u64 *in, u64 avail) {
+	while (reader->header_len < need && *in < avail)
+		reader->header[reader->header_len++] = src[(*in)++];
+	return reader->header_len == need;
+}
+
+// The reader buffer holds [history | current block output | block input].
+static int lz_frame_decode_block(LzFrameReader *reader, const byte *block) {
+	byte *out = reader->buf;
+	if (reader->history > LZ_WINDOW_SIZE) {
+		copy_bytes(out, out + reader->history - LZ_WINDOW_SIZE,
+				   LZ_WINDOW_SIZE);
+		reader->history = LZ_WINDOW_SIZE;
+	}
+	i64 len;
+	if (reader->block_stored) {
+		copy_bytes(out + reader->history, block, reader->block_len);
+		len = reader->block_len;
+	} else {
+		len = lz_decompress_generic(block, reader->block_len,
+									out + reader->history, reader->block_size,
+									reader->history, NULL, 0);
+		if (len < 0) return -1;
+	}
+	reader->checksum = crc32c(reader->checksum, out + reader->history, len);
+	reader->out_pos = reader->history;
+	reader->out_len = len;
+	reader->history += len;
+	return 0;
+}
+
+i64 lz_frame_decompress(LzFrameReader *reader, const byte *src, u64 *src_len,
+						byte *dst, u64 capacity) {
+	u64 in = 0, avail = *src_len, out = 0;
+
+	for (;;) {
+		if (reader->out_len) {
+			u64 n = reader->out_len;
+			if (n > capacity - out) n = capacity - out;
+			copy_bytes(dst + out, reader->buf + reader->out_pos, n);
+			reader->out_pos += n;
+			reader->out_len -= n;
+			out += n;
+			if (reader->out_len) break;
+		}
+
+		if (reader->stage == LZ_STAGE_DONE) break;
+		if (reader->stage == LZ_STAGE_HEADER) {
+			if (!lz_frame_take(reader, LZ_FRAME_HEADER_SIZE, src, &in, avail))
+				break;
+			byte log = reader->header[5];
+			if (lz_read32(reader->header) != LZ_FRAME_MAGIC ||
+				(reader->header[4] &
+				 ~(LZ_FRAME_FLAG_LINKED | LZ_FRAME_FLAG_CHECKSUM)) ||
+				log < LZ_FRAME_MIN_BLOCK_LOG || log > LZ_FRAME_MAX_BLOCK_LOG)
+				return -1;
+			reader->flags = reader->header[4];
+			reader->block_size = 1ULL << log;
+			reader->pages =
+				bytes_to_pages(LZ_WINDOW_SIZE + 2 * reader->block_size);
+			reader->buf = map(reader->pages);
+			if (reader->buf == NULL) return -1;
+			reader->header_len = 0;
+			reader->stage = LZ_STAGE_BLOCK_HEADER;
+		} else if (reader->stage == LZ_STAGE_BLOCK_HEADER) {
+			if (!lz_frame_take(reader, 4, src, &in, avail)) break;
+			u32 v = lz_read32(reader->header);
+			reader->header_len = 0;
+			if (v == 0) {
+				reader->stage = reader->flags & LZ_FRAME_FLAG_CHECKSUM
+									? LZ_STAGE_CHECKSUM
+									: LZ_STAGE_DONE;
+				continue;
+			}
+			reader->block_stored = (v & LZ_FRAME_STORED) != 0;
+			reader->block_len = v & ~LZ_FRAME_STORED;
+			if (reader->block_len > reader->block_size) return -1;
+			reader->in_len = 0;
+			reader->stage = LZ_STAGE_BLOCK_DATA;
+		} else if (reader->stage == LZ_STAGE_CHECKSUM) {
+			if (!lz_frame_take(reader, 4, src, &in, avail)) break;
+			if (lz_read32(reader->header) != reader->checksum) return -1;
+			reader->stage = LZ_STAGE_DONE;
+		} else {
+			byte *block_in =
+				reader->buf + LZ_WINDOW_SIZE + reader->block_size;
+			const byte *block;
+			if (reader->in_len == 0 && avail - in >= reader->block_len) {
+				// whole block available, decode straight from the input
+				block = src + in;
+				in += reader->block_len;
+			} else {
+				u64 n = reader->block_len - reader->in_len;
+				if (n > avail - in) n = avail - in;
+				copy_bytes(block_in + reader->in_len, src + in, n);
+				reader->in_len += n;
+				in += n;
+				if (reader->in_len < reader->block_len) break;
+				block = block_in;
+			}
+			if (lz_frame_decode_block(reader, block)) return -1;
+			reader->stage = LZ_STAGE_BLOCK_HEADER;
+		}
+	}
+
+	*src_len = in;
+	return out;
+}
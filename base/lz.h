@@ -0,0 +1,113 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _BASE_LZ__
+#define _BASE_LZ__
+
+#include <base/types.h>
+
+// Blocks use the LZ4 block format: a sequence is a token (literal length in
+// the high nibble, match length - 4 in the low nibble), optional length
+// extension bytes, the literals and a 16 bit little endian match offset. The
+// last 5 bytes of a block are always literals, so a decoder can copy in wide
+// chunks without overrunning the output.
+//
+// All functions return the number of bytes written or -1 on error (invalid
+// input, or 'capacity' too small).
+
+#define LZ_MAX_INPUT_SIZE 0x7E000000ULL
+#define LZ_WINDOW_SIZE 65536
+#define LZ_HC_DEFAULT_LEVEL 9
+#define LZ_HC_MAX_LEVEL 12
+
+u64 lz_compress_bound(u64 len);
+i64 lz_compress(const byte *src, u64 len, byte *dst, u64 capacity);
+// Slower, better ratio: 'level' (1 - 12) sets how far each match search looks
+// (2^(level - 1) candidates).
+i64 lz_compress_hc(const byte *src, u64 len, byte *dst, u64 capacity,
+				   int level);
+// Compress with a dictionary of data likely to occur in 'src'. Only the last
+// LZ_WINDOW_SIZE bytes of 'dict' are used. 'level' 0 selects the fast mode.
+i64 lz_compress_dict(const byte *dict, u64 dict_len, const byte *src, u64 len,
+					 byte *dst, u64 capacity, int level);
+i64 lz_decompress(const byte *src, u64 len, byte *dst, u64 capacity);
+i64 lz_decompress_dict(const byte *dict, u64 dict_len, const byte *src,
+					   u64 len, byte *dst, u64 capacity);
+
+// Framed streaming format:
+//   u32 magic, u8 flags, u8 log2(block size), u16 reserved
+//   blocks: u32 size (bit 31 set if stored uncompressed), data
+//   u32 0 end mark
+//   u32 crc32c of the decompressed content (if flags has bit 1 set)
+// Each block may reference the previous LZ_WINDOW_SIZE bytes of output, so a
+// stream compresses about as well as one large block while using bounded
+// memory.
+
+#define LZ_FRAME_MAGIC 0x315A4C46  // "FLZ1"
+#define LZ_FRAME_HEADER_SIZE 8
+#define LZ_FRAME_DEFAULT_BLOCK_SIZE (256 * 1024)
+#define LZ_FRAME_MIN_BLOCK_LOG 16
+#define LZ_FRAME_MAX_BLOCK_LOG 22
+
+typedef struct LzFrame {
+	byte *buf;
+	u64 pages;
+	u64 block_size;
+	u64 history;
+	u64 pending;
+	int level;
+	bool header_written;
+	u32 checksum;
+} LzFrame;
+
+typedef struct LzFrameReader {
+	byte *buf;
+	u64 pages;
+	u64 block_size;
+	int stage;
+	byte flags;
+	byte header[LZ_FRAME_HEADER_SIZE];
+	u64 header_len;
+	u64 block_len;
+	bool block_stored;
+	u64 in_len;
+	u64 history;
+	u64 out_pos;
+	u64 out_len;
+	u32 checksum;
+} LzFrameReader;
+
+// 'block_size' is rounded up to a power of two between 64KB and 4MB, 0
+// selects LZ_FRAME_DEFAULT_BLOCK_SIZE. Returns 0 on success.
+int lz_frame_init(LzFrame *frame, u64 block_size, int level);
+void lz_frame_cleanup(LzFrame *frame);
+// Worst case number of bytes an update of 'len' bytes (plus lz_frame_end) can
+// write.
+u64 lz_frame_bound(const LzFrame *frame, u64 len);
+i64 lz_frame_update(LzFrame *frame, const byte *src, u64 len, byte *dst,
+					u64 capacity);
+i64 lz_frame_end(LzFrame *frame, byte *dst, u64 capacity);
+
+int lz_frame_reader_init(LzFrameReader *reader);
+void lz_frame_reader_cleanup(LzFrameReader *reader);
+// Consume up to '*src_len' bytes of a frame and write up to 'capacity'
+// decompressed bytes. On return '*src_len' holds the bytes consumed. Returns
+// the number of bytes written or -1 if the frame is corrupt. A content
+// checksum mismatch is only detected at the end of the frame. Call again with
+// more output space if the return value equals 'capacity'.
+i64 lz_frame_decompress(LzFrameReader *reader, const byte *src, u64 *src_len,
+						byte *dst, u64 capacity);
+bool lz_frame_done(const LzFrameReader *reader);
+
+#endif	// _BASE_LZ__
@@ -0,0 +1,208 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <base/cpu.h>
+#include <base/random.h>
+#include <base/sys.h>
+#include <base/util.h>
+
+// Fills shorter than this use the scalar generator: seeding the lanes costs
+// about as much as generating 32 words.
+#define RANDOM_FILL_LANES_MIN 512
+
+typedef u64 RandomV4 __attribute__((vector_size(32)));
+typedef u64 RandomV4u __attribute__((vector_size(32), aligned(1), may_alias));
+
+static __thread Rng random_tls;
+static __thread bool random_tls_seeded = false;
+
+static u64 random_splitmix(u64 *state) {
+	u64 z = (*state += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+static inline u64 random_rotl(u64 x, int k) {
+	return (x << k) | (x >> (64 - k));
+}
+
+void rng_seed(Rng *rng, u64 seed) {
+	for (int i = 0; i < 4; i++) rng->s[i] = random_splitmix(&seed);
+}
+
+int rng_seed_entropy(Rng *rng) {
+	if (getentropy(rng->s, sizeof(rng->s)) == 0 &&
+		(rng->s[0] | rng->s[1] | rng->s[2] | rng->s[3]))
+		return 0;
+	rng_seed(rng, (u64)getnanos() ^ (u64)rng);
+	return -1;
+}
+
+u64 rng_next(Rng *rng) {
+	u64 *s = rng->s;
+	u64 result = random_rotl(s[0] + s[3], 23) + s[0];
+	u64 t = s[1] << 17;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = random_rotl(s[3], 45);
+	return result;
+}
+
+void rng_jump(Rng *rng) {
+	static const u64 jump[] = {0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+							   0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL};
+	u64 s[4] = {0, 0, 0, 0};
+	for (int i = 0; i < 4; i++) {
+		for (int b = 0; b < 64; b++) {
+			if (jump[i] & (1ULL << b))
+				for (int k = 0; k < 4; k++) s[k] ^= rng->s[k];
+			rng_next(rng);
+		}
+	}
+	for (int k = 0; k < 4; k++) rng->s[k] = s[k];
+}
+
+u64 rng_bounded(Rng *rng, u64 bound) {
+	u128 m = (u128)rng_next(rng) * bound;
+	u64 low = m;
+	// only products whose low half falls below 2^64 mod bound are biased
+	if (low < bound) {
+		u64 threshold = -bound % bound;
+		while (low < threshold) {
+			m = (u128)rng_next(rng) * bound;
+			low = m;
+		}
+	}
+	return m >> 64;
+}
+
+f64 rng_f64(Rng *rng) {
+	return (rng_next(rng) >> 11) * 0x1.0p-53;
+}
+
+f32 rng_f32(Rng *rng) {
+	return (rng_next(rng) >> 40) * 0x1.0p-24f;
+}
+
+void rng_shuffle(Rng *rng, void *base, u64 count, u64 size) {
+	byte *b = base;
+	for (u64 i = count; i > 1; i--) {
+		u64 j = rng_bounded(rng, i);
+		if (j == i - 1) continue;
+		byte *x = b + (i - 1) * size, *y = b + j * size;
+		for (u64 k = 0; k < size; k++) {
+			byte t = x[k];
+			x[k] = y[k];
+			y[k] = t;
+		}
+	}
+}
+
+// Four xoshiro256++ generators side by side; 'state' is [word][lane]. Written
+// with vector extensions so the same code compiles to SSE2 (two lanes per
+// instruction) or AVX2 (all four).
+static inline __attribute__((always_inline)) void
+random_fill_lanes(u64 state[4][4], byte *out, u64 blocks) {
+	RandomV4 s0 = *(RandomV4u *)state[0], s1 = *(RandomV4u *)state[1],
+			 s2 = *(RandomV4u *)state[2], s3 = *(RandomV4u *)state[3];
+	for (u64 i = 0; i < blocks; i++) {
+		RandomV4 sum = s0 + s3;
+		RandomV4 result = ((sum << 23) | (sum >> 41)) + s0;
+		RandomV4 t = s1 << 17;
+		s2 ^= s0;
+		s3 ^= s1;
+		s1 ^= s2;
+		s0 ^= s3;
+		s2 ^= t;
+		s3 = (s3 << 45) | (s3 >> 19);
+		*(RandomV4u *)(out + i * sizeof(RandomV4)) = result;
+	}
+	*(RandomV4u *)state[0] = s0;
+	*(RandomV4u *)state[1] = s1;
+	*(RandomV4u *)state[2] = s2;
+	*(RandomV4u *)state[3] = s3;
+}
+
+static void random_fill_generic(u64 state[4][4], byte *out, u64 blocks) {
+	random_fill_lanes(state, out, blocks);
+}
+
+#ifdef __x86_64__
+static __attribute__((target("avx2"))) void
+random_fill_avx2(u64 state[4][4], byte *out, u64 blocks) {
+	random_fill_lanes(state, out, blocks);
+}
+#endif	// __x86_64__
+
+void rng_fill(Rng *rng, void *buf, u64 len) {
+	byte *p = buf;
+	if (len >= RANDOM_FILL_LANES_MIN) {
+		u64 state[4][4];
+		for (int lane = 0; lane < 4; lane++) {
+			u64 seed = rng_next(rng);
+			for (int w = 0; w < 4; w++)
+				state[w][lane] = random_splitmix(&seed);
+		}
+		u64 blocks = len / sizeof(RandomV4);
+#ifdef __x86_64__
+		if (cpu_has(CPU_AVX2))
+			random_fill_avx2(state, p, blocks);
+		else
+#endif	// __x86_64__
+			random_fill_generic(state, p, blocks);
+		p += blocks * sizeof(RandomV4);
+		len -= blocks * sizeof(RandomV4);
+	}
+	while (len) {
+		u64 v = rng_next(rng);
+		u64 n = len < sizeof(v) ? len : sizeof(v);
+		copy_bytes(p, (byte *)&v, n);
+		p += n;
+		len -= n;
+	}
+}
+
+Rng *random_thread_rng() {
+	if (!random_tls_seeded) random_reseed();
+	return &random_tls;
+}
+
+void random_reseed() {
+	rng_seed_entropy(&random_tls);
+	random_tls_seeded = true;
+}
+
+u64 random_u64() {
+	return rng_next(random_thread_rng());
+}
+
+u64 random_bounded(u64 bound) {
+	return rng_bounded(random_thread_rng(), bound);
+}
+
+f64 random_f64() {
+	return rng_f64(random_thread_rng());
+}
+
+void random_shuffle(void *base, u64 count, u64 size) {
+	rng_shuffle(random_thread_rng(), base, count, size);
+}
+
+void fill_random(void *buf, u64 len) {
+	rng_fill(random_thread_rng(), buf, len);
+}
@@ -0,0 +1,62 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _BASE_RANDOM__
+#define _BASE_RANDOM__
+
+#include <base/types.h>
+
+// xoshiro256++ generator. Fast and statistically strong, but not
+// cryptographically secure: use getentropy for keys and tokens.
+typedef struct Rng {
+	u64 s[4];
+} Rng;
+
+// Deterministic seeding (the seed is expanded with splitmix64), for
+// reproducible streams in tests and simulations.
+void rng_seed(Rng *rng, u64 seed);
+// Seed from the OS with getentropy. Returns 0 on success; on failure the
+// generator is still seeded, from the clock and the address of 'rng'.
+int rng_seed_entropy(Rng *rng);
+// Advance 'rng' by 2^128 steps. Calling this repeatedly on a copy produces
+// non-overlapping streams, for instance one per worker.
+void rng_jump(Rng *rng);
+
+u64 rng_next(Rng *rng);
+// Uniform in [0, bound) without modulo bias (Lemire's multiply and reject);
+// rarely needs more than one draw. Returns 0 if 'bound' is 0.
+u64 rng_bounded(Rng *rng, u64 bound);
+// Uniform in [0, 1).
+f64 rng_f64(Rng *rng);
+f32 rng_f32(Rng *rng);
+// Fisher-Yates shuffle of 'count' elements of 'size' bytes.
+void rng_shuffle(Rng *rng, void *base, u64 count, u64 size);
+// Fill 'buf' with 'len' random bytes. Large fills run four generators in
+// SIMD lanes (seeded from 'rng'), so the bytes differ from consecutive
+// rng_next calls but are still reproducible from the seed.
+void rng_fill(Rng *rng, void *buf, u64 len);
+
+// The same operations on a per-thread generator that is seeded from
+// getentropy on first use in each thread. A forked child inherits its
+// parent's state, so call random_reseed() after fork if the streams must
+// differ.
+Rng *random_thread_rng();
+void random_reseed();
+u64 random_u64();
+u64 random_bounded(u64 bound);
+f64 random_f64();
+void random_shuffle(void *base, u64 count, u64 size);
+void fill_random(void *buf, u64 len);
+
+#endif	// _BASE_RANDOM__
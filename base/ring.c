@@ -0,0 +1,87 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <base/ring.h>
+#include <base/sys.h>
+#include <base/util.h>
+
+int ring_init(Ring *r, u64 capacity) {
+	u64 size = PAGE_SIZE;
+	while (size < capacity) size <<= 1;
+	if (!(r->buf = map_ring(size / PAGE_SIZE))) return -1;
+	r->capacity = size;
+	r->head = r->tail = 0;
+	return 0;
+}
+
+void ring_cleanup(Ring *r) {
+	if (r->buf) unmap_ring(r->buf, r->capacity / PAGE_SIZE);
+	r->buf = NULL;
+}
+
+byte *ring_write_ptr(Ring *r, u64 *avail) {
+	u64 head = r->head;
+	*avail = r->capacity - (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE));
+	return r->buf + (head & (r->capacity - 1));
+}
+
+void ring_commit(Ring *r, u64 n) {
+	__atomic_store_n(&r->head, r->head + n, __ATOMIC_RELEASE);
+}
+
+const byte *ring_read_ptr(Ring *r, u64 *avail) {
+	u64 tail = r->tail;
+	*avail = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - tail;
+	return r->buf + (tail & (r->capacity - 1));
+}
+
+void ring_consume(Ring *r, u64 n) {
+	__atomic_store_n(&r->tail, r->tail + n, __ATOMIC_RELEASE);
+}
+
+u64 ring_write(Ring *r, const void *data, u64 len) {
+	u64 avail;
+	byte *p = ring_write_ptr(r, &avail);
+	if (len > avail) len = avail;
+	copy_bytes(p, data, len);
+	ring_commit(r, len);
+	return len;
+}
+
+u64 ring_read(Ring *r, void *data, u64 len) {
+	u64 avail;
+	const byte *p = ring_read_ptr(r, &avail);
+	if (len > avail) len = avail;
+	copy_bytes(data, p, len);
+	ring_consume(r, len);
+	return len;
+}
+
+i64 ring_fill(Ring *r, int fd) {
+	u64 avail;
+	byte *p = ring_write_ptr(r, &avail);
+	if (!avail) return 0;
+	i64 n = read(fd, p, avail);
+	if (n > 0) ring_commit(r, n);
+	return n;
+}
+
+i64 ring_drain(Ring *r, int fd) {
+	u64 avail;
+	const byte *p = ring_read_ptr(r, &avail);
+	if (!avail) return 0;
+	i64 n = write(fd, p, avail);
+	if (n > 0) ring_consume(r, n);
+	return n;
+}
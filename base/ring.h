@@ -0,0 +1,58 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _BASE_RING__
+#define _BASE_RING__
+
+#include <base/types.h>
+
+// Byte ring buffer for one producer and one consumer thread. The buffer is
+// mapped twice back to back (map_ring), so the readable and the writable
+// region are each always contiguous however they wrap: records can be parsed
+// in place and read(2)/write(2) need a single call.
+//
+// 'head' and 'tail' count the bytes ever written and read. Each is stored
+// only by its own side (a release store, no atomic read-modify-write) and
+// has a cache line to itself.
+typedef struct Ring {
+	byte *buf;
+	u64 capacity;  // a power of two, at least a page
+	u64 head __attribute__((aligned(64)));
+	u64 tail __attribute__((aligned(64)));
+} Ring;
+
+// 'capacity' is rounded up to a power of two of at least a page. Returns -1
+// if the memory can't be mapped.
+int ring_init(Ring *r, u64 capacity);
+void ring_cleanup(Ring *r);
+
+// Producer: the free region and its length; commit publishes 'n' bytes
+// written there.
+byte *ring_write_ptr(Ring *r, u64 *avail);
+void ring_commit(Ring *r, u64 n);
+// Consumer: the readable region and its length; consume releases 'n' bytes.
+const byte *ring_read_ptr(Ring *r, u64 *avail);
+void ring_consume(Ring *r, u64 n);
+
+// Copy in or out up to 'len' bytes; return the number copied.
+u64 ring_write(Ring *r, const void *data, u64 len);
+u64 ring_read(Ring *r, void *data, u64 len);
+
+// read(2) from 'fd' into the free region (producer), or write(2) the
+// readable region to 'fd' (consumer). Return the bytes moved, 0 at end of
+// file or when there is no room (no data), and -1 on errors.
+i64 ring_fill(Ring *r, int fd);
+i64 ring_drain(Ring *r, int fd);
+
+#endif	// _BASE_RING__
@@ -0,0 +1,183 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <base/cpu.h>
+#include <base/sha256.h>
+#include <base/util.h>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif	// __x86_64__
+
+static const u32 sha256_iv[8] = {0x6A09E667, 0xBB67AE85, 0x3C6EF372,
+								 0xA54FF53A, 0x510E527F, 0x9B05688C,
+								 0x1F83D9AB, 0x5BE0CD19};
+
+static const u32 sha256_k[64] = {
+	0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1,
+	0x923F82A4, 0xAB1C5ED5, 0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3,
+	0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174, 0xE49B69C1, 0xEFBE4786,
+	0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+	0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147,
+	0x06CA6351, 0x14292967, 0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13,
+	0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85, 0xA2BFE8A1, 0xA81A664B,
+	0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+	0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A,
+	0x5B9CCA4F, 0x682E6FF3, 0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208,
+	0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2};
+
+static inline u32 sha256_rotr(u32 x, int n) {
+	return x >> n | x << (32 - n);
+}
+
+static void sha256_blocks_generic(u32 state[8], const byte *p, u64 blocks) {
+	for (; blocks; blocks--, p += SHA256_BLOCK_LEN) {
+		u32 w[64];
+		for (int i = 0; i < 16; i++)
+			w[i] = (u32)p[4 * i] << 24 | (u32)p[4 * i + 1] << 16 |
+				   (u32)p[4 * i + 2] << 8 | p[4 * i + 3];
+		for (int i = 16; i < 64; i++) {
+			u32 s0 = sha256_rotr(w[i - 15], 7) ^ sha256_rotr(w[i - 15], 18) ^
+					 w[i - 15] >> 3;
+			u32 s1 = sha256_rotr(w[i - 2], 17) ^ sha256_rotr(w[i - 2], 19) ^
+					 w[i - 2] >> 10;
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+		u32 a = state[0], b = state[1], c = state[2], d = state[3];
+		u32 e = state[4], f = state[5], g = state[6], h = state[7];
+		for (int i = 0; i < 64; i++) {
+			u32 s1 =
+				sha256_rotr(e, 6) ^ sha256_rotr(e, 11) ^ sha256_rotr(e, 25);
+			u32 t1 = h + s1 + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+			u32 s0 =
+				sha256_rotr(a, 2) ^ sha256_rotr(a, 13) ^ sha256_rotr(a, 22);
+			u32 t2 = s0 + ((a & b) ^ (a & c) ^ (b & c));
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+		state[5] += f;
+		state[6] += g;
+		state[7] += h;
+	}
+}
+
+#ifdef __x86_64__
+
+// sha256rnds2 does two rounds on the state split as ABEF and CDGH, so the
+// state is rearranged on the way in and out. Each step below is four rounds;
+// sha256msg1/msg2 extend the message schedule four words at a time.
+static __attribute__((target("sha,sse4.1"))) void
+sha256_blocks_shani(u32 state[8], const byte *p, u64 blocks) {
+	const __m128i bswap =
+		_mm_set_epi64x(0x0C0D0E0F08090A0BULL, 0x0405060700010203ULL);
+	__m128i dcba = _mm_loadu_si128((const __m128i *)state);
+	__m128i hgfe = _mm_loadu_si128((const __m128i *)(state + 4));
+	__m128i cdab = _mm_shuffle_epi32(dcba, 0xB1);
+	__m128i efgh = _mm_shuffle_epi32(hgfe, 0x1B);
+	__m128i abef = _mm_alignr_epi8(cdab, efgh, 8);
+	__m128i cdgh = _mm_blend_epi16(efgh, cdab, 0xF0);
+
+	for (; blocks; blocks--, p += SHA256_BLOCK_LEN) {
+		__m128i abef_start = abef, cdgh_start = cdgh, m[4];
+		for (int i = 0; i < 4; i++)
+			m[i] = _mm_shuffle_epi8(
+				_mm_loadu_si128((const __m128i *)(p + 16 * i)), bswap);
+		for (int i = 0; i < 16; i++) {
+			__m128i wk = _mm_add_epi32(
+				m[i & 3], _mm_loadu_si128((const __m128i *)(sha256_k + 4 * i)));
+			cdgh = _mm_sha256rnds2_epu32(cdgh, abef, wk);
+			abef = _mm_sha256rnds2_epu32(abef, cdgh,
+										 _mm_shuffle_epi32(wk, 0x0E));
+			if (i < 12) {
+				// w[i + 4] from w[i], w[i + 1], w[i + 2] and w[i + 3]
+				__m128i t = _mm_sha256msg1_epu32(m[i & 3], m[(i + 1) & 3]);
+				t = _mm_add_epi32(
+					t, _mm_alignr_epi8(m[(i + 3) & 3], m[(i + 2) & 3], 4));
+				m[i & 3] = _mm_sha256msg2_epu32(t, m[(i + 3) & 3]);
+			}
+		}
+		abef = _mm_add_epi32(abef, abef_start);
+		cdgh = _mm_add_epi32(cdgh, cdgh_start);
+	}
+
+	__m128i feba = _mm_shuffle_epi32(abef, 0x1B);
+	__m128i dchg = _mm_shuffle_epi32(cdgh, 0xB1);
+	_mm_storeu_si128((__m128i *)state, _mm_blend_epi16(feba, dchg, 0xF0));
+	_mm_storeu_si128((__m128i *)(state + 4), _mm_alignr_epi8(dchg, feba, 8));
+}
+
+#endif	// __x86_64__
+
+static void sha256_blocks(u32 state[8], const byte *p, u64 blocks) {
+#ifdef __x86_64__
+	if (cpu_has(CPU_SHA | CPU_SSE42)) {
+		sha256_blocks_shani(state, p, blocks);
+		return;
+	}
+#endif	// __x86_64__
+	sha256_blocks_generic(state, p, blocks);
+}
+
+void sha256_init(Sha256 *s) {
+	copy_bytes((byte *)s->state, (const byte *)sha256_iv, sizeof(sha256_iv));
+	s->len = 0;
+}
+
+void sha256_update(Sha256 *s, const void *data, u64 len) {
+	const byte *p = data;
+	u64 used = s->len % SHA256_BLOCK_LEN;
+	s->len += len;
+	if (used) {
+		u64 take = SHA256_BLOCK_LEN - used;
+		if (take > len) take = len;
+		copy_bytes(s->block + used, p, take);
+		p += take;
+		len -= take;
+		if (used + take < SHA256_BLOCK_LEN) return;
+		sha256_blocks(s->state, s->block, 1);
+	}
+	sha256_blocks(s->state, p, len / SHA256_BLOCK_LEN);
+	p += len - len % SHA256_BLOCK_LEN;
+	copy_bytes(s->block, p, len % SHA256_BLOCK_LEN);
+}
+
+void sha256_final(Sha256 *s, byte digest[SHA256_DIGEST_LEN]) {
+	u64 used = s->len % SHA256_BLOCK_LEN, bits = s->len * 8;
+	// 0x80, zeros, then the length in bits in the last 8 bytes
+	byte pad[2 * SHA256_BLOCK_LEN] = {0x80};
+	u64 pad_len = (used < 56 ? 56 : 120) - used;
+	for (int i = 0; i < 8; i++) pad[pad_len + i] = bits >> (56 - 8 * i);
+	sha256_update(s, pad, pad_len + 8);
+	for (int i = 0; i < 8; i++)
+		for (int j = 0; j < 4; j++)
+			digest[4 * i + j] = s->state[i] >> (24 - 8 * j);
+}
+
+void sha256(const void *data, u64 len, byte digest[SHA256_DIGEST_LEN]) {
+	Sha256 s;
+	sha256_init(&s);
+	sha256_update(&s, data, len);
+	sha256_final(&s, digest);
+}
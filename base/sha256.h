@@ -0,0 +1,44 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _BASE_SHA256__
+#define _BASE_SHA256__
+
+#include <base/types.h>
+
+// SHA-256 (FIPS 180-4). Blocks are compressed with the SHA extensions
+// (SHA-NI) when the CPU has them and with portable code otherwise.
+//
+//   Sha256 s;
+//   sha256_init(&s);
+//   sha256_update(&s, a, a_len);
+//   sha256_update(&s, b, b_len);
+//   sha256_final(&s, digest);  // same as sha256(ab, ab_len, digest)
+
+#define SHA256_BLOCK_LEN 64
+#define SHA256_DIGEST_LEN 32
+
+typedef struct Sha256 {
+	u32 state[8];
+	u64 len;
+	byte block[SHA256_BLOCK_LEN];
+} Sha256;
+
+void sha256_init(Sha256 *s);
+void sha256_update(Sha256 *s, const void *data, u64 len);
+// Write the digest; 's' must be initialized again before reuse.
+void sha256_final(Sha256 *s, byte digest[SHA256_DIGEST_LEN]);
+void sha256(const void *data, u64 len, byte digest[SHA256_DIGEST_LEN]);
+
+#endif	// _BASE_SHA256__
@@ -0,0 +1,725 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <base/cpu.h>
+#include <base/sort.h>
+#include <base/sys.h>
+#include <base/util.h>
+#include <pthread.h>
+
+#define SORT_INSERTION_THRESHOLD 24
+#define SORT_NINTHER_THRESHOLD 128
+#define SORT_PARTIAL_INSERTION_LIMIT 8
+#define SORT_BLOCK 64
+#define SORT_STACK 64
+// Below this radix sort loses to pdqsort: clearing and summing the
+// histograms costs about as much as sorting a thousand keys.
+#define SORT_RADIX_MIN 1024
+// Smallest chunk handed to a thread by parallel_sort_u64.
+#define SORT_PARALLEL_MIN (1 << 16)
+#define SORT_MAX_THREADS 256
+
+#define SORT_INLINE static inline __attribute__((always_inline))
+
+typedef u64 __attribute__((may_alias, aligned(1))) SortWord;
+
+typedef struct SortRange {
+	byte *begin;
+	byte *end;
+	int bad_allowed;
+	bool leftmost;
+} SortRange;
+
+// The pdqsort routines are written once over elements of 'size' bytes and
+// instantiated for u64 keys (a NULL 'cmp') and for caller supplied
+// comparisons; everything inlines into the two entry points so that 'size'
+// and 'cmp' are constants.
+
+SORT_INLINE bool sort_less(const byte *a, const byte *b, SortCompare cmp) {
+	if (!cmp) return *(const SortWord *)a < *(const SortWord *)b;
+	return cmp(a, b) < 0;
+}
+
+// Comparisons with the pivot at 'pivot'; in u64 mode its key is loaded once
+// so that it stays in a register while elements are swapped around it.
+SORT_INLINE bool sort_less_key(const byte *a, const byte *pivot,
+							   u64 pivot_key, SortCompare cmp) {
+	if (!cmp) return *(const SortWord *)a < pivot_key;
+	return cmp(a, pivot) < 0;
+}
+
+SORT_INLINE bool sort_key_less(const byte *pivot, u64 pivot_key,
+							   const byte *b, SortCompare cmp) {
+	if (!cmp) return pivot_key < *(const SortWord *)b;
+	return cmp(pivot, b) < 0;
+}
+
+SORT_INLINE u64 sort_key(const byte *a, SortCompare cmp) {
+	return cmp ? 0 : *(const SortWord *)a;
+}
+
+SORT_INLINE void sort_swap(byte *a, byte *b, u64 size) {
+	u64 i = 0;
+	for (; i + 8 <= size; i += 8) {
+		u64 t = *(SortWord *)(a + i);
+		*(SortWord *)(a + i) = *(SortWord *)(b + i);
+		*(SortWord *)(b + i) = t;
+	}
+	for (; i < size; i++) {
+		byte t = a[i];
+		a[i] = b[i];
+		b[i] = t;
+	}
+}
+
+// Insertion sort of [begin, end). Unless 'guarded' the element before
+// 'begin' must not be greater than any element in the range.
+SORT_INLINE void sort_insertion(byte *begin, byte *end, u64 size,
+								SortCompare cmp, bool guarded) {
+	if (!cmp) {
+		u64 *b = (u64 *)begin, *e = (u64 *)end;
+		for (u64 *cur = b + 1; cur < e; cur++) {
+			u64 v = *cur, *p = cur;
+			for (; (!guarded || p > b) && v < p[-1]; p--) *p = p[-1];
+			*p = v;
+		}
+		return;
+	}
+	for (byte *cur = begin + size; cur < end; cur += size)
+		for (byte *p = cur;
+			 (!guarded || p > begin) && sort_less(p, p - size, cmp); p -= size)
+			sort_swap(p, p - size, size);
+}
+
+// Insertion sort that gives up after a few moves, for ranges that look
+// sorted already. Returns true if the range is now sorted.
+SORT_INLINE bool sort_partial_insertion(byte *begin, byte *end, u64 size,
+										SortCompare cmp) {
+	u64 moved = 0;
+	if (begin == end) return true;
+	for (byte *cur = begin + size; cur < end; cur += size) {
+		byte *p = cur;
+		for (; p > begin && sort_less(p, p - size, cmp); p -= size)
+			sort_swap(p, p - size, size);
+		moved += (cur - p) / size;
+		if (moved > SORT_PARTIAL_INSERTION_LIMIT) return false;
+	}
+	return true;
+}
+
+SORT_INLINE void sort2(byte *a, byte *b, u64 size, SortCompare cmp) {
+	if (sort_less(b, a, cmp)) sort_swap(a, b, size);
+}
+
+SORT_INLINE void sort3(byte *a, byte *b, byte *c, u64 size, SortCompare cmp) {
+	sort2(a, b, size, cmp);
+	sort2(b, c, size, cmp);
+	sort2(a, b, size, cmp);
+}
+
+// Partition [begin, end) around the pivot at 'begin' into elements less than
+// the pivot followed by the others. Returns the final pivot position and
+// sets 'partitioned' if no elements had to be swapped.
+SORT_INLINE byte *sort_partition_right(byte *begin, byte *end, u64 size,
+									   SortCompare cmp, bool *partitioned) {
+	u64 key = sort_key(begin, cmp);
+	byte *first = begin, *last = end;
+	do first += size;
+	while (sort_less_key(first, begin, key, cmp));
+	if (first - size == begin) {
+		while (first < last) {
+			last -= size;
+			if (sort_less_key(last, begin, key, cmp)) break;
+		}
+	} else {
+		do last -= size;
+		while (!sort_less_key(last, begin, key, cmp));
+	}
+	*partitioned = first >= last;
+	while (first < last) {
+		sort_swap(first, last, size);
+		do first += size;
+		while (sort_less_key(first, begin, key, cmp));
+		do last -= size;
+		while (!sort_less_key(last, begin, key, cmp));
+	}
+	byte *pivot = first - size;
+	sort_swap(begin, pivot, size);
+	return pivot;
+}
+
+// The same result without branching on comparisons: the positions of
+// misplaced elements in a block from each end are recorded as offsets, then
+// swapped in bulk (BlockQuicksort).
+SORT_INLINE byte *sort_partition_right_branchless(byte *begin, byte *end,
+												  u64 size, SortCompare cmp,
+												  bool *partitioned) {
+	u64 key = sort_key(begin, cmp);
+	byte *first = begin, *last = end;
+	do first += size;
+	while (sort_less_key(first, begin, key, cmp));
+	if (first - size == begin) {
+		while (first < last) {
+			last -= size;
+			if (sort_less_key(last, begin, key, cmp)) break;
+		}
+	} else {
+		do last -= size;
+		while (!sort_less_key(last, begin, key, cmp));
+	}
+	*partitioned = first >= last;
+	if (!*partitioned) {
+		sort_swap(first, last, size);
+		first += size;
+
+		byte offsets_l[SORT_BLOCK], offsets_r[SORT_BLOCK];
+		byte *base_l = first, *base_r = last;
+		u64 num_l = 0, num_r = 0, start_l = 0, start_r = 0;
+		while (first < last) {
+			u64 unknown = (last - first) / size;
+			u64 split_l = num_l ? 0 : num_r ? unknown : unknown / 2;
+			u64 split_r = num_r ? 0 : unknown - split_l;
+			if (split_l > SORT_BLOCK) split_l = SORT_BLOCK;
+			if (split_r > SORT_BLOCK) split_r = SORT_BLOCK;
+			for (u64 i = 0; i < split_l; i++) {
+				offsets_l[num_l] = i;
+				num_l += !sort_less_key(first, begin, key, cmp);
+				first += size;
+			}
+			for (u64 i = 0; i < split_r; i++) {
+				last -= size;
+				offsets_r[num_r] = i + 1;
+				num_r += sort_less_key(last, begin, key, cmp);
+			}
+			u64 num = num_l < num_r ? num_l : num_r;
+			for (u64 i = 0; i < num; i++)
+				sort_swap(base_l + offsets_l[start_l + i] * size,
+						  base_r - offsets_r[start_r + i] * size, size);
+			num_l -= num;
+			num_r -= num;
+			start_l += num;
+			start_r += num;
+			if (num_l == 0) {
+				start_l = 0;
+				base_l = first;
+			}
+			if (num_r == 0) {
+				start_r = 0;
+				base_r = last;
+			}
+		}
+		// one side may still hold misplaced elements: move them to the
+		// boundary
+		if (num_l) {
+			while (num_l--) {
+				last -= size;
+				sort_swap(base_l + offsets_l[start_l + num_l] * size, last,
+						  size);
+			}
+			first = last;
+		}
+		if (num_r) {
+			while (num_r--) {
+				sort_swap(base_r - offsets_r[start_r + num_r] * size, first,
+						  size);
+				first += size;
+			}
+		}
+	}
+	byte *pivot = first - size;
+	sort_swap(begin, pivot, size);
+	return pivot;
+}
+
+// Partition into elements equal to the pivot at 'begin' followed by greater
+// ones, used when the pivot equals the element before the range (so nothing
+// in the range is smaller). Returns the last element equal to the pivot.
+SORT_INLINE byte *sort_partition_left(byte *begin, byte *end, u64 size,
+									  SortCompare cmp) {
+	u64 key = sort_key(begin, cmp);
+	byte *first = begin, *last = end;
+	do last -= size;
+	while (sort_key_less(begin, key, last, cmp));
+	if (last + size == end) {
+		while (first < last) {
+			first += size;
+			if (sort_key_less(begin, key, first, cmp)) break;
+		}
+	} else {
+		do first += size;
+		while (!sort_key_less(begin, key, first, cmp));
+	}
+	while (first < last) {
+		sort_swap(first, last, size);
+		do last -= size;
+		while (sort_key_less(begin, key, last, cmp));
+		do first += size;
+		while (!sort_key_less(begin, key, first, cmp));
+	}
+	sort_swap(begin, last, size);
+	return last;
+}
+
+SORT_INLINE void sort_sift_down(byte *base, u64 root, u64 n, u64 size,
+								SortCompare cmp) {
+	for (;;) {
+		u64 child = 2 * root + 1;
+		if (child >= n) return;
+		if (child + 1 < n &&
+			sort_less(base + child * size, base + (child + 1) * size, cmp))
+			child++;
+		if (!sort_less(base + root * size, base + child * size, cmp)) return;
+		sort_swap(base + root * size, base + child * size, size);
+		root = child;
+	}
+}
+
+SORT_INLINE void sort_heap(byte *base, u64 n, u64 size, SortCompare cmp) {
+	for (u64 i = n / 2; i-- > 0;) sort_sift_down(base, i, n, size, cmp);
+	for (u64 i = n; i-- > 1;) {
+		sort_swap(base, base + i * size, size);
+		sort_sift_down(base, 0, i, size, cmp);
+	}
+}
+
+// Sort one range, pushing the larger side of each partition on 'stack' and
+// continuing with the smaller so the stack stays within log2(n) entries.
+SORT_INLINE void sort_pdq_range(SortRange r, SortRange *stack, u64 *depth,
+								u64 size, SortCompare cmp, bool branchless) {
+	byte *begin = r.begin, *end = r.end;
+	for (;;) {
+		u64 n = (end - begin) / size;
+		if (n < SORT_INSERTION_THRESHOLD) {
+			sort_insertion(begin, end, size, cmp, r.leftmost);
+			return;
+		}
+
+		// median of three, or pseudomedian of nine, moved to 'begin'
+		u64 half = n / 2;
+		if (n > SORT_NINTHER_THRESHOLD) {
+			sort3(begin, begin + half * size, end - size, size, cmp);
+			sort3(begin + size, begin + (half - 1) * size, end - 2 * size,
+				  size, cmp);
+			sort3(begin + 2 * size, begin + (half + 1) * size, end - 3 * size,
+				  size, cmp);
+			sort3(begin + (half - 1) * size, begin + half * size,
+				  begin + (half + 1) * size, size, cmp);
+			sort_swap(begin, begin + half * size, size);
+		} else
+			sort3(begin + half * size, begin, end - size, size, cmp);
+
+		// a pivot equal to the preceding element is the smallest value in
+		// the range: set all the copies aside at once
+		if (!r.leftmost && !sort_less(begin - size, begin, cmp)) {
+			begin = sort_partition_left(begin, end, size, cmp) + size;
+			continue;
+		}
+
+		bool partitioned;
+		byte *pivot =
+			branchless ? sort_partition_right_branchless(begin, end, size, cmp,
+														 &partitioned)
+					   : sort_partition_right(begin, end, size, cmp,
+											  &partitioned);
+		u64 l_size = (pivot - begin) / size;
+		u64 r_size = (end - pivot) / size - 1;
+
+		if (l_size < n / 8 || r_size < n / 8) {
+			// a bad split: after log2(n) of them fall back to heapsort,
+			// otherwise shuffle a few elements to break up the pattern
+			if (--r.bad_allowed == 0) {
+				sort_heap(begin, n, size, cmp);
+				return;
+			}
+			if (l_size >= SORT_INSERTION_THRESHOLD) {
+				u64 q = l_size / 4;
+				sort_swap(begin, begin + q * size, size);
+				sort_swap(pivot - size, pivot - q * size, size);
+				if (l_size > SORT_NINTHER_THRESHOLD) {
+					sort_swap(begin + size, begin + (q + 1) * size, size);
+					sort_swap(begin + 2 * size, begin + (q + 2) * size, size);
+					sort_swap(pivot - 2 * size, pivot - (q + 1) * size, size);
+					sort_swap(pivot - 3 * size, pivot - (q + 2) * size, size);
+				}
+			}
+			if (r_size >= SORT_INSERTION_THRESHOLD) {
+				u64 q = r_size / 4;
+				sort_swap(pivot + size, pivot + (1 + q) * size, size);
+				sort_swap(end - size, end - q * size, size);
+				if (r_size > SORT_NINTHER_THRESHOLD) {
+					sort_swap(pivot + 2 * size, pivot + (2 + q) * size, size);
+					sort_swap(pivot + 3 * size, pivot + (3 + q) * size, size);
+					sort_swap(end - 2 * size, end - (1 + q) * size, size);
+					sort_swap(end - 3 * size, end - (2 + q) * size, size);
+				}
+			}
+		} else if (partitioned &&
+				   sort_partial_insertion(begin, pivot, size, cmp) &&
+				   sort_partial_insertion(pivot + size, end, size, cmp))
+			return;
+
+		SortRange left = {begin, pivot, r.bad_allowed, r.leftmost};
+		SortRange right = {pivot + size, end, r.bad_allowed, false};
+		if (l_size > r_size) {
+			stack[(*depth)++] = left;
+			r = right;
+		} else {
+			stack[(*depth)++] = right;
+			r = left;
+		}
+		begin = r.begin;
+		end = r.end;
+	}
+}
+
+SORT_INLINE void sort_pdq(byte *base, u64 count, u64 size, SortCompare cmp,
+						  bool branchless) {
+	SortRange stack[SORT_STACK];
+	u64 depth = 0;
+	if (count < 2) return;
+	stack[depth++] = (SortRange){base, base + count * size,
+								 64 - __builtin_clzll(count), true};
+	while (depth) {
+		SortRange r = stack[--depth];
+		sort_pdq_range(r, stack, &depth, size, cmp, branchless);
+	}
+}
+
+void sort(void *base, u64 count, u64 size, SortCompare cmp) {
+	if (size) sort_pdq(base, count, size, cmp, false);
+}
+
+void sort_u64(u64 *keys, u64 count) {
+	sort_pdq((byte *)keys, count, sizeof(u64), NULL, true);
+}
+
+// LSD radix sort of 'keys' using 'scratch' (of the same length).
+static void sort_radix_keys(u64 *keys, u64 *scratch, u64 n) {
+	u64 counts[8][256];
+	if (n == 0) return;
+	set_bytes((byte *)counts, 0, sizeof(counts));
+	for (u64 i = 0; i < n; i++) {
+		u64 k = keys[i];
+		for (int d = 0; d < 8; d++) counts[d][(k >> (8 * d)) & 0xFF]++;
+	}
+	u64 *src = keys, *dst = scratch;
+	for (int d = 0; d < 8; d++) {
+		u64 *c = counts[d], sum = 0;
+		if (c[(src[0] >> (8 * d)) & 0xFF] == n) continue;
+		for (int b = 0; b < 256; b++) {
+			u64 t = c[b];
+			c[b] = sum;
+			sum += t;
+		}
+		for (u64 i = 0; i < n; i++) {
+			u64 k = src[i];
+			dst[c[(k >> (8 * d)) & 0xFF]++] = k;
+		}
+		u64 *t = src;
+		src = dst;
+		dst = t;
+	}
+	if (src != keys) copy_bytes((byte *)keys, (byte *)src, n * sizeof(u64));
+}
+
+SORT_INLINE void sort_copy_record(byte *dst, const byte *src, u64 size) {
+	u64 i = 0;
+	for (; i + 8 <= size; i += 8)
+		*(SortWord *)(dst + i) = *(const SortWord *)(src + i);
+	for (; i < size; i++) dst[i] = src[i];
+}
+
+static void sort_radix_records(byte *base, byte *scratch, u64 n, u64 size) {
+	u64 counts[8][256];
+	if (n == 0) return;
+	set_bytes((byte *)counts, 0, sizeof(counts));
+	for (u64 i = 0; i < n; i++) {
+		u64 k = *(SortWord *)(base + i * size);
+		for (int d = 0; d < 8; d++) counts[d][(k >> (8 * d)) & 0xFF]++;
+	}
+	byte *src = base, *dst = scratch;
+	for (int d = 0; d < 8; d++) {
+		u64 *c = counts[d], sum = 0;
+		if (c[(*(SortWord *)src >> (8 * d)) & 0xFF] == n) continue;
+		for (int b = 0; b < 256; b++) {
+			u64 t = c[b];
+			c[b] = sum;
+			sum += t;
+		}
+		for (u64 i = 0; i < n; i++) {
+			const byte *rec = src + i * size;
+			u64 k = *(const SortWord *)rec;
+			sort_copy_record(dst + c[(k >> (8 * d)) & 0xFF]++ * size, rec,
+							 size);
+		}
+		byte *t = src;
+		src = dst;
+		dst = t;
+	}
+	if (src != base) copy_bytes(base, src, n * size);
+}
+
+SORT_INLINE bool sort_record_less(const byte *a, const byte *b) {
+	return *(const SortWord *)a < *(const SortWord *)b;
+}
+
+// Swap the 'n' records at 'a' with the 'n' at 'b'.
+static void sort_swap_records(byte *a, byte *b, u64 n, u64 size) {
+	for (u64 i = 0; i < n; i++) sort_swap(a + i * size, b + i * size, size);
+}
+
+// Rotate records [a, b) left so that the record at 'm' comes first, by
+// swapping blocks (Gries and Mills).
+static void sort_rotate_records(byte *base, u64 a, u64 m, u64 b, u64 size) {
+	u64 i = m - a, j = b - m;
+	while (i != j) {
+		if (i > j) {
+			sort_swap_records(base + (m - i) * size, base + m * size, j, size);
+			i -= j;
+		} else {
+			sort_swap_records(base + (m - i) * size,
+							  base + (m + j - i) * size, i, size);
+			j -= i;
+		}
+	}
+	sort_swap_records(base + (m - i) * size, base + m * size, i, size);
+}
+
+// Stable in-place merge of the sorted runs [a, m) and [m, b) (SymMerge, Kim
+// and Kutzner 2004): O(n log n) swaps for n records, recursion depth
+// O(log n).
+static void sort_sym_merge(byte *base, u64 a, u64 m, u64 b, u64 size) {
+	if (m - a == 1) {
+		// insert the record at 'a' after every record <= it in [m, b)
+		u64 i = m, j = b;
+		while (i < j) {
+			u64 h = i + (j - i) / 2;
+			if (sort_record_less(base + h * size, base + a * size))
+				i = h + 1;
+			else
+				j = h;
+		}
+		for (u64 k = a; k + 1 < i; k++)
+			sort_swap(base + k * size, base + (k + 1) * size, size);
+		return;
+	}
+	if (b - m == 1) {
+		// insert the record at 'm' before every record > it in [a, m)
+		u64 i = a, j = m;
+		while (i < j) {
+			u64 h = i + (j - i) / 2;
+			if (!sort_record_less(base + m * size, base + h * size))
+				i = h + 1;
+			else
+				j = h;
+		}
+		for (u64 k = m; k > i; k--)
+			sort_swap(base + k * size, base + (k - 1) * size, size);
+		return;
+	}
+	u64 mid = a + (b - a) / 2, n = mid + m, start, r;
+	if (m > mid) {
+		start = n - b;
+		r = mid;
+	} else {
+		start = a;
+		r = m;
+	}
+	while (start < r) {
+		u64 c = start + (r - start) / 2;
+		if (!sort_record_less(base + (n - 1 - c) * size, base + c * size))
+			start = c + 1;
+		else
+			r = c;
+	}
+	u64 end = n - start;
+	if (start < m && m < end) sort_rotate_records(base, start, m, end, size);
+	if (a < start && start < mid) sort_sym_merge(base, a, start, mid, size);
+	if (mid < end && end < b) sort_sym_merge(base, mid, end, b, size);
+}
+
+// Stable insertion sort of records [a, b).
+static void sort_insertion_records(byte *base, u64 a, u64 b, u64 size) {
+	for (u64 i = a + 1; i < b; i++) {
+		byte *p = base + i * size;
+		while (p > base + a * size && sort_record_less(p, p - size)) {
+			sort_swap(p, p - size, size);
+			p -= size;
+		}
+	}
+}
+
+// Stable sort of records by key without a scratch buffer: insertion sort of
+// blocks of SORT_INSERTION_THRESHOLD, then rounds of pairwise merges.
+static void sort_stable_records(byte *base, u64 count, u64 size) {
+	u64 block = SORT_INSERTION_THRESHOLD;
+	for (u64 a = 0; a < count; a += block)
+		sort_insertion_records(base, a, a + block < count ? a + block : count,
+							   size);
+	for (; block < count; block *= 2)
+		for (u64 a = 0; a + block < count; a += 2 * block) {
+			u64 b = a + 2 * block < count ? a + 2 * block : count;
+			sort_sym_merge(base, a, a + block, b, size);
+		}
+}
+
+void radix_sort_u64(u64 *keys, u64 count) {
+	if (count < SORT_RADIX_MIN) {
+		sort_u64(keys, count);
+		return;
+	}
+	u64 pages = bytes_to_pages(count * sizeof(u64));
+	u64 *scratch = map(pages);
+	if (!scratch) {
+		sort_u64(keys, count);
+		return;
+	}
+	sort_radix_keys(keys, scratch, count);
+	unmap(scratch, pages);
+}
+
+void radix_sort_records(void *base, u64 count, u64 size) {
+	if (size < sizeof(u64)) return;
+	u64 pages = count < SORT_RADIX_MIN ? 0 : bytes_to_pages(count * size);
+	byte *scratch = pages ? map(pages) : NULL;
+	if (!scratch) {
+		sort_stable_records(base, count, size);
+		return;
+	}
+	sort_radix_records(base, scratch, count, size);
+	unmap(scratch, pages);
+}
+
+// A thread's share of parallel_sort_u64: with 'width' 0 radix sort
+// src[lo, hi) using dst[lo, hi) as scratch, otherwise produce dst[lo, hi) of
+// the round that merges adjacent sorted runs of 'width' keys from 'src'.
+typedef struct SortTask {
+	u64 *src;
+	u64 *dst;
+	u64 count;
+	u64 width;
+	u64 lo;
+	u64 hi;
+} SortTask;
+
+// Number of elements taken from 'a' among the first 'k' of the merge of 'a'
+// and 'b' (merge path).
+static u64 sort_co_rank(const u64 *a, u64 la, const u64 *b, u64 lb, u64 k) {
+	u64 lo = k > lb ? k - lb : 0, hi = k < la ? k : la;
+	while (lo < hi) {
+		u64 i = lo + (hi - lo) / 2;
+		if (a[i] <= b[k - i - 1])
+			lo = i + 1;
+		else
+			hi = i;
+	}
+	return lo;
+}
+
+static void sort_merge(const u64 *a, u64 la, const u64 *b, u64 lb, u64 *out) {
+	u64 i = 0, j = 0, k = 0;
+	while (i < la && j < lb) {
+		u64 x = a[i], y = b[j];
+		bool take_a = x <= y;
+		out[k++] = take_a ? x : y;
+		i += take_a;
+		j += !take_a;
+	}
+	while (i < la) out[k++] = a[i++];
+	while (j < lb) out[k++] = b[j++];
+}
+
+static void sort_merge_range(SortTask *t) {
+	u64 pos = t->lo, w = t->width, n = t->count;
+	while (pos < t->hi) {
+		u64 p = pos / (2 * w) * (2 * w);
+		u64 mid = p + w < n ? p + w : n;
+		u64 e = mid + w < n ? mid + w : n;
+		u64 stop = t->hi < e ? t->hi : e;
+		const u64 *a = t->src + p, *b = t->src + mid;
+		u64 la = mid - p, lb = e - mid, k0 = pos - p, k1 = stop - p;
+		u64 i0 = sort_co_rank(a, la, b, lb, k0);
+		u64 i1 = sort_co_rank(a, la, b, lb, k1);
+		sort_merge(a + i0, i1 - i0, b + (k0 - i0), (k1 - i1) - (k0 - i0),
+				   t->dst + pos);
+		pos = stop;
+	}
+}
+
+static void *sort_worker(void *arg) {
+	SortTask *t = arg;
+	if (t->width == 0)
+		sort_radix_keys(t->src + t->lo, t->dst + t->lo, t->hi - t->lo);
+	else
+		sort_merge_range(t);
+	return NULL;
+}
+
+// Run tasks[0..threads) concurrently; a task whose thread can't be created
+// runs on the calling thread.
+static void sort_run(SortTask *tasks, u32 threads) {
+	pthread_t ids[SORT_MAX_THREADS];
+	bool started[SORT_MAX_THREADS];
+	for (u32 t = 1; t < threads; t++)
+		started[t] = !pthread_create(&ids[t], NULL, sort_worker, &tasks[t]);
+	sort_worker(&tasks[0]);
+	for (u32 t = 1; t < threads; t++) {
+		if (started[t])
+			pthread_join(ids[t], NULL);
+		else
+			sort_worker(&tasks[t]);
+	}
+}
+
+void parallel_sort_u64(u64 *keys, u64 count, u32 threads) {
+	if (threads == 0) threads = cpu_count();
+	if (threads > SORT_MAX_THREADS) threads = SORT_MAX_THREADS;
+	if (threads > count / SORT_PARALLEL_MIN)
+		threads = count / SORT_PARALLEL_MIN;
+	if (threads <= 1) {
+		radix_sort_u64(keys, count);
+		return;
+	}
+	u64 pages = bytes_to_pages(count * sizeof(u64));
+	u64 *scratch = map(pages);
+	if (!scratch) {
+		sort_u64(keys, count);
+		return;
+	}
+
+	SortTask tasks[SORT_MAX_THREADS];
+	u64 chunk = (count + threads - 1) / threads;
+	for (u32 t = 0; t < threads; t++) {
+		u64 lo = t * chunk, hi = lo + chunk;
+		if (lo > count) lo = count;
+		if (hi > count) hi = count;
+		tasks[t] = (SortTask){keys, scratch, count, 0, lo, hi};
+	}
+	sort_run(tasks, threads);
+
+	u64 *src = keys, *dst = scratch;
+	for (u64 w = chunk; w < count; w *= 2) {
+		for (u32 t = 0; t < threads; t++) {
+			u64 lo = (u128)count * t / threads;
+			u64 hi = (u128)count * (t + 1) / threads;
+			tasks[t] = (SortTask){src, dst, count, w, lo, hi};
+		}
+		sort_run(tasks, threads);
+		u64 *t = src;
+		src = dst;
+		dst = t;
+	}
+	if (src != keys) copy_bytes((byte *)keys, (byte *)src, count * sizeof(u64));
+	unmap(scratch, pages);
+}
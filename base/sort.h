@@ -0,0 +1,46 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _BASE_SORT__
+#define _BASE_SORT__
+
+#include <base/types.h>
+
+// Returns < 0, 0 or > 0 as 'a' sorts before, equal to or after 'b'.
+typedef int (*SortCompare)(const void *a, const void *b);
+
+// In-place, unstable pattern-defeating quicksort (Peters 2021): median of
+// three (ninther for large ranges) pivots, insertion sort below 24 elements,
+// detection of already partitioned and equal ranges, and a heapsort fallback
+// that bounds the worst case to O(n log n). 'count' elements of 'size' bytes.
+void sort(void *base, u64 count, u64 size, SortCompare cmp);
+// The same specialized for u64 keys, with branchless block partitioning
+// (Edelkamp and Weiss's BlockQuicksort) to avoid mispredicted comparisons.
+void sort_u64(u64 *keys, u64 count);
+
+// Stable least significant digit radix sort, one pass per byte of the key;
+// passes in which every key has the same byte are skipped. Needs a scratch
+// buffer as large as the input, which is mapped and released internally. If
+// the mapping fails (or the input is small) keys are sorted with sort_u64 and
+// records with a stable in-place merge sort instead.
+void radix_sort_u64(u64 *keys, u64 count);
+// Records of 'size' >= 8 bytes that start with a little endian u64 key.
+void radix_sort_records(void *base, u64 count, u64 size);
+
+// For very large inputs: 'threads' chunks are radix sorted concurrently, then
+// merged pairwise, with each merge round split evenly across the threads by
+// merge path partitioning. 'threads' of 0 uses every online CPU.
+void parallel_sort_u64(u64 *keys, u64 count, u32 threads);
+
+#endif	// _BASE_SORT__
@@ -16,10 +16,13 @@
 #define _XOPEN_SOURCE 700
 #define _POSIX_C_SOURCE 200112L
 #endif	// __linux__
+#include <base/encode.h>
 #include <base/sys.h>
 #include <base/util.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <time.h>
 
@@ -32,6 +35,10 @@
 #define MAP_ANONYMOUS 0x20
 #endif
 
+#ifndef MREMAP_MAYMOVE
+#define MREMAP_MAYMOVE 1
+#endif
+
 #define MAX_BACKTRACE_ENTRIES 128
 
 // system calls / std library functions
@@ -41,24 +48,137 @@ void free(void *addr);
 void *popen(const char *command, const char *rw);
 char *fgets(char *str, int n, void *stream);
 int pclose(void *fp);
+int ftruncate(int fd, off_t length);
+#ifdef __linux__
+void *mremap(void *old_address, size_t old_size, size_t new_size, int flags,
+			 ...);
+int memfd_create(const char *name, unsigned int flags);
+#else
+int getpid(void);
+#endif	// __linux__
 
 void *map(u64 pages) {
 	if (pages == 0) return NULL;
 	void *ret = mmap(NULL, pages * PAGE_SIZE, PROT_READ | PROT_WRITE,
 					 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ret == MAP_FAILED) return NULL;
 #ifdef TEST
-	if (ret) _alloc_sum += pages;
+	// sorts and other parallel code map from several threads
+	__atomic_fetch_add(&_alloc_sum, pages, __ATOMIC_RELAXED);
 #endif	// TEST
 	return ret;
 }
 
 void unmap(void *addr, u64 pages) {
 #ifdef TEST
-	_alloc_sum -= pages;
+	__atomic_fetch_sub(&_alloc_sum, pages, __ATOMIC_RELAXED);
 #endif	// TEST
 	if (pages) munmap(addr, pages * PAGE_SIZE);
 }
 
+u64 bytes_to_pages(u64 bytes) {
+	return (bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+}
+
+void *remap(void *addr, u64 old_pages, u64 new_pages) {
+	if (!addr || !old_pages) return map(new_pages);
+	if (!new_pages) {
+		unmap(addr, old_pages);
+		return NULL;
+	}
+#ifdef __linux__
+	// the kernel moves the page table entries, not the data
+	void *ret = mremap(addr, old_pages * PAGE_SIZE, new_pages * PAGE_SIZE,
+					   MREMAP_MAYMOVE);
+	if (ret == MAP_FAILED) return NULL;
+#ifdef TEST
+	__atomic_fetch_add(&_alloc_sum, new_pages - old_pages, __ATOMIC_RELAXED);
+#endif	// TEST
+#else
+	void *ret = map(new_pages);
+	if (!ret) return NULL;
+	copy_bytes(ret, addr,
+			   (old_pages < new_pages ? old_pages : new_pages) * PAGE_SIZE);
+	unmap(addr, old_pages);
+#endif	// __linux__
+	return ret;
+}
+
+void *map_ring(u64 pages) {
+	if (pages == 0) return NULL;
+	u64 size = pages * PAGE_SIZE;
+#ifdef __linux__
+	int fd = memfd_create("ring", 1);  // MFD_CLOEXEC
+#else
+	static u64 counter = 0;
+	char name[64];
+	snprintf(name, sizeof(name), "/ring.%d.%llu", getpid(),
+			 __atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED));
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd >= 0) shm_unlink(name);
+#endif	// __linux__
+	if (fd < 0) return NULL;
+	byte *ret = MAP_FAILED;
+	if (ftruncate(fd, size) < 0) goto out;
+	// reserve both halves first so nothing else lands in the second one
+	ret = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ret == MAP_FAILED) goto out;
+	if (mmap(ret, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd,
+			 0) == MAP_FAILED ||
+		mmap(ret + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+			 fd, 0) == MAP_FAILED) {
+		munmap(ret, 2 * size);
+		ret = MAP_FAILED;
+	}
+out:
+	close(fd);
+	if (ret == MAP_FAILED) return NULL;
+#ifdef TEST
+	__atomic_fetch_add(&_alloc_sum, pages, __ATOMIC_RELAXED);
+#endif	// TEST
+	return ret;
+}
+
+void unmap_ring(void *addr, u64 pages) {
+#ifdef TEST
+	__atomic_fetch_sub(&_alloc_sum, pages, __ATOMIC_RELAXED);
+#endif	// TEST
+	if (pages) munmap(addr, 2 * pages * PAGE_SIZE);
+}
+
+// Map a whole file read-only. Returns NULL on error or if the file is empty.
+void *map_file(const char *path, u64 *size) {
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return NULL;
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+	*size = st.st_size;
+	void *ret = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (ret == MAP_FAILED) return NULL;
+	return ret;
+}
+
+void unmap_file(void *addr, u64 size) {
+	if (size) munmap(addr, size);
+}
+
+void spin_lock(bool *lock) {
+	while (__atomic_test_and_set(lock, __ATOMIC_ACQUIRE))
+		while (__atomic_load_n(lock, __ATOMIC_RELAXED)) sched_yield();
+}
+
+bool spin_try_lock(bool *lock) {
+	return !__atomic_test_and_set(lock, __ATOMIC_ACQUIRE);
+}
+
+void spin_unlock(bool *lock) {
+	__atomic_clear(lock, __ATOMIC_RELEASE);
+}
+
 int os_sleep(u64 millis) {
 	struct timespec ts;
 	ts.tv_sec = millis / 1000;				 // seconds
@@ -136,7 +256,8 @@ char *backtrace_full() {
 				}
 				itt++;
 			}
-			u64 address = cstring_strtoull(addr, 16);
+			u64 address = 0;
+			hex_parse_u64((char *)addr, cstring_len((char *)addr), &address);
 			address -= 8;
 
 			char command[256];
@@ -245,7 +366,8 @@ char *__last_trace_impl__() {
 				}
 				itt++;
 			}
-			u64 address = cstring_strtoull(addr, 16);
+			u64 address = 0;
+			hex_parse_u64((char *)addr, cstring_len((char *)addr), &address);
 			address -= 8;
 
 			char command[256];
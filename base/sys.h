@@ -26,11 +26,30 @@ int getpagesize();
 
 void *map(u64 pages);
 void unmap(void *addr, u64 pages);
+// The number of pages that hold 'bytes'.
+u64 bytes_to_pages(u64 bytes);
+// Resize a mapping from map(), keeping its contents; the address may change.
+// On Linux this is mremap, so no bytes are copied. Returns NULL on failure,
+// in which case the old mapping is untouched.
+void *remap(void *addr, u64 old_pages, u64 new_pages);
+// 'pages' of memory mapped twice back to back: byte i and byte i + pages *
+// PAGE_SIZE are the same, so a region that wraps around the end is still
+// contiguous. unmap_ring takes the same 'pages'.
+void *map_ring(u64 pages);
+void unmap_ring(void *addr, u64 pages);
+void *map_file(const char *path, u64 *size);
+void unmap_file(void *addr, u64 size);
 int os_sleep(u64 millis);
 int set_timer(void (*alarm)(int), u64 millis);
 int unset_timer();
 
 int sched_yield(void);
+// A test-and-set lock on a bool (false is unlocked) for short critical
+// sections; waiters spin on a plain load and yield the CPU in between.
+void spin_lock(bool *lock);
+// Take the lock if it is free; returns whether it was taken.
+bool spin_try_lock(bool *lock);
+void spin_unlock(bool *lock);
 int getentropy(void *buffer, size_t length);
 
 char *backtrace_full();
@@ -38,6 +57,8 @@ char *last_trace();
 
 ssize_t write(int fd, const void *buf, size_t count);
 ssize_t read(int fd, void *buf, size_t count);
+int open(const char *path, int flags, ...);
+int close(int fd);
 
 int snprintf(char *buf, unsigned long capacity, const char *fmt, ...);
 void __attribute__((noreturn)) _exit(int code);
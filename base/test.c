@@ -13,6 +13,10 @@
 // limitations under the License.
 
 #include <base/test.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 Suite(base);
 
@@ -21,3 +25,2538 @@ Test(sys) {
 
 Test(sys2) {
 }
+
+Bench(copy_bytes) {
+	byte *src = map(16), *dst = map(16);
+	u64 len = 16 * PAGE_SIZE;
+	set_bytes(src, 'a', len);
+	bench_set_bytes(len);
+	bench_loop {
+		copy_bytes(dst, src, len);
+		do_not_optimize(dst);
+	}
+	unmap(src, 16);
+	unmap(dst, 16);
+}
+
+static u64 test_rand_state = 0x9E3779B97F4A7C15ULL;
+
+static u64 test_rand() {
+	test_rand_state ^= test_rand_state << 13;
+	test_rand_state ^= test_rand_state >> 7;
+	test_rand_state ^= test_rand_state << 17;
+	return test_rand_state;
+}
+
+// map(0) fails, so empty buffers still get a page
+static u64 test_pages(u64 bytes) {
+	return bytes ? bytes_to_pages(bytes) : 1;
+}
+
+// Text-like test corpus: words drawn from a small skewed vocabulary with
+// punctuation, compresses roughly like English prose.
+static void lz_test_corpus(byte *buf, u64 len) {
+	static const char *words[] = {
+		"the",	   "of",	 "and",		 "to",		"in",	  "a",
+		"is",	   "that",	 "for",		 "it",		"as",	  "was",
+		"with",	   "be",	 "by",		 "on",		"not",	  "he",
+		"family",  "body",	 "many",	 "parts",	"spirit", "one",
+		"compile", "binary", "resource", "memory",	"stream", "block"};
+	u64 i = 0;
+	while (i < len) {
+		u64 r = test_rand();
+		const char *w = words[(r % 30) * (r % 30) / 30];
+		while (*w && i < len) buf[i++] = *w++;
+		if (i < len) buf[i++] = (r >> 32) % 11 == 0 ? '.' : ' ';
+		if (i < len && (r >> 40) % 17 == 0) buf[i++] = '\n';
+	}
+}
+
+static void lz_test_fill(byte *buf, u64 len, int kind) {
+	if (kind == 0)
+		for (u64 i = 0; i < len; i++) buf[i] = test_rand();
+	else if (kind == 1)
+		set_bytes(buf, 'z', len);
+	else if (kind == 2)
+		lz_test_corpus(buf, len);
+	else
+		for (u64 i = 0; i < len; i++)
+			buf[i] = (i / 7) % 5 == 0 ? test_rand() % 4 : i % 13;
+}
+
+Test(lz_roundtrip) {
+	u64 sizes[] = {0, 1, 5, 12, 13, 14, 15, 16, 17, 64, 255, 256, 1000, 4096,
+				   65535, 65536, 65537, 200000};
+	u64 max = 200000;
+	byte *src = map(test_pages(max));
+	byte *cmp = map(test_pages(lz_compress_bound(max)));
+	byte *out = map(test_pages(max));
+
+	for (int kind = 0; kind < 4; kind++) {
+		for (int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+			u64 len = sizes[s];
+			lz_test_fill(src, len, kind);
+			for (int level = 0; level <= LZ_HC_MAX_LEVEL; level += 4) {
+				i64 clen = level ? lz_compress_hc(src, len, cmp,
+												  lz_compress_bound(len), level)
+								 : lz_compress(src, len, cmp,
+											   lz_compress_bound(len));
+				assert(clen > 0);
+				assert(clen <= lz_compress_bound(len));
+				assert_eq(lz_decompress(cmp, clen, out, len), (i64)len);
+				for (u64 i = 0; i < len; i++) assert_eq(out[i], src[i]);
+				if (len) assert_eq(lz_decompress(cmp, clen, out, len - 1), -1);
+				if (kind == 1 && len > 1000) assert(clen < len / 50);
+			}
+		}
+	}
+
+	// output that doesn't fit fails cleanly
+	lz_test_fill(src, 1000, 0);
+	assert_eq(lz_compress(src, 1000, cmp, 500), -1);
+	assert_eq(lz_compress_hc(src, 1000, cmp, 500, 4), -1);
+
+	unmap(src, test_pages(max));
+	unmap(cmp, test_pages(lz_compress_bound(max)));
+	unmap(out, test_pages(max));
+}
+
+Test(lz_fuzz) {
+	u64 max = 1 << 16;
+	byte *src = map(test_pages(max));
+	byte *cmp = map(test_pages(lz_compress_bound(max)));
+	byte *out = map(test_pages(max));
+
+	for (int iter = 0; iter < 300; iter++) {
+		u64 len = test_rand() % max;
+		lz_test_fill(src, len, iter % 4);
+		i64 clen = iter % 2 ? lz_compress(src, len, cmp, lz_compress_bound(len))
+							: lz_compress_hc(src, len, cmp,
+											 lz_compress_bound(len), 3);
+		assert(clen > 0);
+		assert_eq(lz_decompress(cmp, clen, out, len), (i64)len);
+		for (u64 i = 0; i < len; i++) assert_eq(out[i], src[i]);
+
+		// corrupted or truncated input must never write past the output
+		for (int j = 0; j < 4; j++) cmp[test_rand() % clen] ^= test_rand();
+		i64 r = lz_decompress(cmp, test_rand() % (clen + 1), out, len);
+		assert(r <= (i64)len);
+	}
+
+	unmap(src, test_pages(max));
+	unmap(cmp, test_pages(lz_compress_bound(max)));
+	unmap(out, test_pages(max));
+}
+
+Test(lz_dict) {
+	u64 len = 4096, dict_len = 100000;
+	byte *dict = map(test_pages(dict_len));
+	byte src[4096], out[4096], cmp[4096 + 64];
+	lz_test_corpus(dict, dict_len);
+	// the input repeats pieces of the dictionary's last window
+	for (u64 i = 0; i < len; i += 64)
+		copy_bytes(src + i, dict + dict_len - 1 - (test_rand() % 60000) - 64,
+				   64);
+
+	i64 plain = lz_compress(src, len, cmp, sizeof(cmp));
+	for (int level = 0; level <= LZ_HC_MAX_LEVEL; level += 6) {
+		i64 clen = lz_compress_dict(dict, dict_len, src, len, cmp, sizeof(cmp),
+									level);
+		assert(clen > 0);
+		// the fast matcher only remembers the last position per hash bucket
+		assert(clen < (level ? plain / 2 : plain));
+		assert_eq(lz_decompress_dict(dict, dict_len, cmp, clen, out, len),
+				  (i64)len);
+		for (u64 i = 0; i < len; i++) assert_eq(out[i], src[i]);
+		// without the dictionary the matches can't be resolved
+		assert_eq(lz_decompress(cmp, clen, out, len), -1);
+	}
+	unmap(dict, test_pages(dict_len));
+}
+
+Test(lz_frame) {
+	u64 len = 1500000;
+	byte *src = map(test_pages(len));
+	byte *out = map(test_pages(len));
+	lz_test_corpus(src, len / 2);
+	lz_test_fill(src + len / 2, len / 2, 0);
+
+	for (int level = 0; level <= 4; level += 4) {
+		LzFrame frame;
+		assert(!lz_frame_init(&frame, 100000, level));
+		assert_eq(frame.block_size, 131072);
+		u64 cap = lz_frame_bound(&frame, len);
+		byte *cmp = map(test_pages(cap));
+		u64 clen = 0, pos = 0;
+		while (pos < len) {
+			u64 n = test_rand() % 50000;
+			if (n > len - pos) n = len - pos;
+			i64 r = lz_frame_update(&frame, src + pos, n, cmp + clen,
+									cap - clen);
+			assert(r >= 0);
+			clen += r;
+			pos += n;
+		}
+		i64 r = lz_frame_end(&frame, cmp + clen, cap - clen);
+		assert(r >= 8);
+		clen += r;
+		assert(clen < len - len / 8);
+		lz_frame_cleanup(&frame);
+
+		// feed the frame back in small, uneven pieces
+		LzFrameReader reader;
+		lz_frame_reader_init(&reader);
+		u64 in = 0, produced = 0;
+		while (!lz_frame_done(&reader)) {
+			u64 n = test_rand() % 70000, cap_out = test_rand() % 90000 + 1;
+			if (n > clen - in) n = clen - in;
+			if (cap_out > len - produced) cap_out = len - produced;
+			i64 w = lz_frame_decompress(&reader, cmp + in, &n, out + produced,
+										cap_out);
+			assert(w >= 0);
+			in += n;
+			produced += w;
+			assert(produced <= len);
+		}
+		assert_eq(in, clen);
+		assert_eq(produced, len);
+		for (u64 i = 0; i < len; i++) assert_eq(out[i], src[i]);
+		lz_frame_reader_cleanup(&reader);
+
+		// flip a bit inside a stored (incompressible) block, which only the
+		// content checksum can catch
+		const byte *needle = src + len * 3 / 4;
+		u64 at = 0;
+		for (int k = 0; k < 8; k++)
+			if (cmp[at + k] != needle[k]) {
+				at++;
+				k = -1;
+			}
+		cmp[at] ^= 1;
+		lz_frame_reader_init(&reader);
+		u64 n = clen;
+		assert_eq(lz_frame_decompress(&reader, cmp, &n, out, len), -1);
+		lz_frame_reader_cleanup(&reader);
+		cmp[at] ^= 1;
+
+		// a corrupt magic is rejected
+		cmp[0] ^= 1;
+		lz_frame_reader_init(&reader);
+		n = clen;
+		assert_eq(lz_frame_decompress(&reader, cmp, &n, out, len), -1);
+		lz_frame_reader_cleanup(&reader);
+		unmap(cmp, test_pages(cap));
+	}
+
+	unmap(src, test_pages(len));
+	unmap(out, test_pages(len));
+}
+
+#define LZ_BENCH_SIZE (4 * 1024 * 1024)
+
+typedef struct LzBenchCorpus {
+	const char *root;
+	byte *buf;
+	u64 len;
+} LzBenchCorpus;
+
+static bool lz_bench_has_suffix(const char *name, u64 len, const char *suffix) {
+	u64 n = cstring_len(suffix);
+	return len > n && !cstring_compare(name + len - n, suffix);
+}
+
+static int lz_bench_add_file(const DirscanEntry *e, void *ctx) {
+	LzBenchCorpus *c = ctx;
+	char path[DIRSCAN_PATH_MAX + 16];
+	u64 len = cstring_len(e->name), size;
+	if (e->type != DIRSCAN_FILE || e->name[0] == '.') return 0;
+	if (!lz_bench_has_suffix(e->name, len, ".c") &&
+		!lz_bench_has_suffix(e->name, len, ".h") &&
+		!lz_bench_has_suffix(e->name, len, ".md"))
+		return 0;
+	snprintf(path, sizeof(path), "%s/%s", c->root, e->path);
+	byte *data = map_file(path, &size);
+	if (data == NULL) return 0;	 // empty
+	u64 n = size < LZ_BENCH_SIZE - c->len ? size : LZ_BENCH_SIZE - c->len;
+	copy_bytes(c->buf + c->len, data, n);
+	c->len += n;
+	unmap_file(data, size);
+	return 0;
+}
+
+// The benches compress the C sources, headers and docs of this repository
+// (benches run in base/): real code and prose, with the uneven redundancy of
+// typical input, where the generated corpus of the tests repeats a small
+// vocabulary. Fills 'buf' (LZ_BENCH_SIZE bytes) and returns the length.
+static u64 lz_bench_corpus(byte *buf) {
+	static const char *roots[] = {"../base", "../core", "../main", "../docs"};
+	LzBenchCorpus c = {.buf = buf};
+	for (u64 i = 0; i < sizeof(roots) / sizeof(roots[0]); i++) {
+		c.root = roots[i];
+		assert(!dirscan(c.root, 0, 1, lz_bench_add_file, &c));
+	}
+	assert(c.len > 0);
+	return c.len;
+}
+
+Bench(lz_compress) {
+	byte *src = map(test_pages(LZ_BENCH_SIZE));
+	byte *cmp = map(test_pages(lz_compress_bound(LZ_BENCH_SIZE)));
+	u64 len = lz_bench_corpus(src);
+	bench_set_bytes(len);
+	bench_loop {
+		i64 r = lz_compress(src, len, cmp, lz_compress_bound(len));
+		do_not_optimize(r);
+	}
+	unmap(src, test_pages(LZ_BENCH_SIZE));
+	unmap(cmp, test_pages(lz_compress_bound(LZ_BENCH_SIZE)));
+}
+
+Bench(lz_compress_hc) {
+	byte *src = map(test_pages(LZ_BENCH_SIZE));
+	byte *cmp = map(test_pages(lz_compress_bound(LZ_BENCH_SIZE)));
+	u64 len = lz_bench_corpus(src);
+	bench_set_bytes(len);
+	bench_loop {
+		i64 r = lz_compress_hc(src, len, cmp, lz_compress_bound(len),
+							   LZ_HC_DEFAULT_LEVEL);
+		do_not_optimize(r);
+	}
+	unmap(src, test_pages(LZ_BENCH_SIZE));
+	unmap(cmp, test_pages(lz_compress_bound(LZ_BENCH_SIZE)));
+}
+
+// Decompress the corpus compressed at 'level' (0 for lz_compress).
+static void lz_bench_decompress(u64 bench_iterations, int level) {
+	byte *src = map(test_pages(LZ_BENCH_SIZE));
+	byte *cmp = map(test_pages(lz_compress_bound(LZ_BENCH_SIZE)));
+	byte *out = map(test_pages(LZ_BENCH_SIZE));
+	u64 len = lz_bench_corpus(src);
+	i64 clen = level ? lz_compress_hc(src, len, cmp, lz_compress_bound(len),
+									  level)
+					 : lz_compress(src, len, cmp, lz_compress_bound(len));
+	assert(clen > 0);
+	bench_set_bytes(len);
+	bench_loop {
+		i64 r = lz_decompress(cmp, clen, out, len);
+		do_not_optimize(r);
+	}
+	for (u64 i = 0; i < len; i++) assert_eq(out[i], src[i]);
+	unmap(src, test_pages(LZ_BENCH_SIZE));
+	unmap(cmp, test_pages(lz_compress_bound(LZ_BENCH_SIZE)));
+	unmap(out, test_pages(LZ_BENCH_SIZE));
+}
+
+Bench(lz_decompress) {
+	lz_bench_decompress(bench_iterations, 0);
+}
+
+Bench(lz_decompress_hc) {
+	lz_bench_decompress(bench_iterations, LZ_HC_DEFAULT_LEVEL);
+}
+
+#define CRC32C_PATHS 4
+
+// Restrict the CPU features so crc32c takes the i-th code path. Returns false
+// if this machine can't run it.
+static bool crc32c_select_path(int path) {
+	u32 features[CRC32C_PATHS] = {
+		0, CPU_SSE42, CPU_SSE42 | CPU_PCLMUL,
+		CPU_SSE42 | CPU_PCLMUL | CPU_AVX512 | CPU_VPCLMUL};
+	cpu_override(~0U);
+	if (!cpu_has(features[path])) return false;
+	cpu_override(features[path]);
+	return true;
+}
+
+Test(crc32c) {
+	byte buf[32];
+	for (int path = 0; path < CRC32C_PATHS; path++) {
+		if (!crc32c_select_path(path)) continue;
+		// known answers from RFC 3720 (iSCSI) and the usual check value
+		assert_eq(crc32c(0, "123456789", 9), 0xE3069283);
+		assert_eq(crc32c(0, "", 0), 0);
+		set_bytes(buf, 0, 32);
+		assert_eq(crc32c(0, buf, 32), 0x8A9136AA);
+		set_bytes(buf, 0xFF, 32);
+		assert_eq(crc32c(0, buf, 32), 0x62A8AB43);
+		for (int i = 0; i < 32; i++) buf[i] = i;
+		assert_eq(crc32c(0, buf, 32), 0x46DD794E);
+		for (int i = 0; i < 32; i++) buf[i] = 31 - i;
+		assert_eq(crc32c(0, buf, 32), 0x113FDB5C);
+	}
+	cpu_override(~0U);
+}
+
+Test(crc32c_paths) {
+	u64 max = 3 * 8192 * 2 + 1000;
+	byte *data = map(test_pages(max + 16));
+	for (u64 i = 0; i < max + 16; i++) data[i] = test_rand();
+
+	// every path agrees with the portable one across lengths and alignments
+	// that exercise each kernel's head, bulk and tail handling
+	for (int iter = 0; iter < 300; iter++) {
+		u64 len = iter < 100 ? iter : test_rand() % max;
+		const byte *p = data + test_rand() % 16;
+		u32 seed = iter % 3 ? test_rand() : 0;
+		crc32c_select_path(0);
+		u32 expected = crc32c(seed, p, len);
+		for (int path = 1; path < CRC32C_PATHS; path++)
+			if (crc32c_select_path(path))
+				assert_eq(crc32c(seed, p, len), expected);
+	}
+	cpu_override(~0U);
+
+	// running checksums and combining independent chunks
+	for (int iter = 0; iter < 100; iter++) {
+		u64 len = test_rand() % max, split = len ? test_rand() % len : 0;
+		u32 whole = crc32c(0, data, len);
+		assert_eq(crc32c(crc32c(0, data, split), data + split, len - split),
+				  whole);
+		u32 a = crc32c(0, data, split);
+		u32 b = crc32c(0, data + split, len - split);
+		assert_eq(crc32c_combine(a, b, len - split), whole);
+	}
+	assert_eq(crc32c_combine(0x1234, 0, 0), 0x1234);
+
+	unmap(data, test_pages(max + 16));
+}
+
+#define CRC32C_BENCH_SIZE (1024 * 1024)
+
+static void crc32c_bench(u64 bench_iterations, u64 size, int path) {
+	byte *data = map(test_pages(size));
+	for (u64 i = 0; i < size; i++) data[i] = i * 31;
+	if (!crc32c_select_path(path)) {
+		unmap(data, test_pages(size));
+		return;
+	}
+	bench_set_bytes(size);
+	bench_loop {
+		u32 crc = crc32c(0, data, size);
+		do_not_optimize(crc);
+	}
+	cpu_override(~0U);
+	unmap(data, test_pages(size));
+}
+
+Bench(crc32c_portable) {
+	crc32c_bench(bench_iterations, CRC32C_BENCH_SIZE, 0);
+}
+
+Bench(crc32c_sse42) {
+	crc32c_bench(bench_iterations, CRC32C_BENCH_SIZE, 1);
+}
+
+Bench(crc32c_pclmul) {
+	crc32c_bench(bench_iterations, CRC32C_BENCH_SIZE, 2);
+}
+
+Bench(crc32c_vpclmul) {
+	crc32c_bench(bench_iterations, CRC32C_BENCH_SIZE, 3);
+}
+
+Bench(crc32c_small) {
+	crc32c_bench(bench_iterations, 64, 2);
+}
+
+Test(rng_known_answer) {
+	// reference xoshiro256++ outputs for the state {1, 2, 3, 4}
+	Rng rng = {{1, 2, 3, 4}};
+	assert_eq(rng_next(&rng), 41943041ULL);
+	assert_eq(rng_next(&rng), 58720359ULL);
+	assert_eq(rng_next(&rng), 3588806011781223ULL);
+
+	Rng a, b;
+	rng_seed(&a, 42);
+	rng_seed(&b, 42);
+	for (int i = 0; i < 100; i++) assert_eq(rng_next(&a), rng_next(&b));
+	rng_seed(&b, 43);
+	assert(rng_next(&a) != rng_next(&b));
+
+	// a jumped copy starts an unrelated stream
+	b = a;
+	rng_jump(&b);
+	for (int i = 0; i < 100; i++) assert(rng_next(&a) != rng_next(&b));
+
+	assert(!rng_seed_entropy(&a));
+	assert(random_u64() != random_u64());
+}
+
+Test(rng_bounded) {
+	Rng rng;
+	rng_seed(&rng, 7);
+	u64 counts[10] = {0};
+	for (int i = 0; i < 100000; i++) counts[rng_bounded(&rng, 10)]++;
+	// chi-square with 9 degrees of freedom, p = 0.001 at 27.9
+	f64 chi = 0;
+	for (int i = 0; i < 10; i++)
+		chi += (counts[i] - 10000.0) * (counts[i] - 10000.0) / 10000.0;
+	assert(chi < 27.9);
+
+	assert_eq(rng_bounded(&rng, 0), 0);
+	assert_eq(rng_bounded(&rng, 1), 0);
+	u64 big = (1ULL << 63) + 12345, high = 0;
+	for (int i = 0; i < 1000; i++) {
+		u64 v = rng_bounded(&rng, big);
+		assert(v < big);
+		if (v >= big / 2) high++;
+	}
+	assert(high > 400 && high < 600);
+
+	f64 sum = 0;
+	for (int i = 0; i < 100000; i++) {
+		f64 d = rng_f64(&rng);
+		f32 f = rng_f32(&rng);
+		assert(d >= 0.0 && d < 1.0);
+		assert(f >= 0.0f && f < 1.0f);
+		sum += d;
+	}
+	assert(sum / 100000 > 0.49 && sum / 100000 < 0.51);
+}
+
+Test(rng_shuffle) {
+	Rng rng;
+	rng_seed(&rng, 99);
+	u32 v[100];
+	for (u32 i = 0; i < 100; i++) v[i] = i;
+	rng_shuffle(&rng, v, 100, sizeof(u32));
+	u64 seen[2] = {0, 0}, moved = 0;
+	for (u32 i = 0; i < 100; i++) {
+		seen[v[i] / 64] |= 1ULL << (v[i] % 64);
+		if (v[i] != i) moved++;
+	}
+	assert_eq(seen[0], ~0ULL);
+	assert_eq(seen[1], (1ULL << 36) - 1);
+	assert(moved > 90);
+
+	// all 24 orders of 4 elements are about equally likely
+	u64 counts[256] = {0};
+	for (int i = 0; i < 24000; i++) {
+		byte e[4] = {0, 1, 2, 3};
+		rng_shuffle(&rng, e, 4, 1);
+		counts[e[0] * 64 + e[1] * 16 + e[2] * 4 + e[3]]++;
+	}
+	u64 orders = 0;
+	for (int i = 0; i < 256; i++) {
+		if (!counts[i]) continue;
+		orders++;
+		assert(counts[i] > 800 && counts[i] < 1200);
+	}
+	assert_eq(orders, 24);
+	rng_shuffle(&rng, v, 0, sizeof(u32));
+}
+
+Test(rng_fill) {
+	u64 len = 1 << 20;
+	byte *buf = map(test_pages(len + 64));
+	byte *copy = map(test_pages(len + 64));
+	Rng rng, saved;
+	rng_seed(&rng, 5);
+	saved = rng;
+
+	rng_fill(&rng, buf, len);
+	u64 ones = 0, counts[256] = {0};
+	for (u64 i = 0; i < len; i++) {
+		ones += __builtin_popcount(buf[i]);
+		counts[buf[i]]++;
+	}
+	assert(ones > len * 4 - len / 100 && ones < len * 4 + len / 100);
+	// chi-square over byte values, 255 degrees of freedom
+	f64 chi = 0, expected = len / 256.0;
+	for (int i = 0; i < 256; i++)
+		chi += (counts[i] - expected) * (counts[i] - expected) / expected;
+	assert(chi < 330);
+
+	// the SIMD and portable lane paths produce the same bytes
+	cpu_override(0);
+	rng = saved;
+	rng_fill(&rng, copy, len);
+	cpu_override(~0U);
+	for (u64 i = 0; i < len; i++) assert_eq(copy[i], buf[i]);
+
+	// odd lengths stop exactly at the end
+	for (u64 n = 0; n < 1100; n += 37) {
+		set_bytes(buf, 0xAA, n + 64);
+		rng_fill(&rng, buf, n);
+		for (u64 i = n; i < n + 64; i++) assert_eq(buf[i], 0xAA);
+	}
+	fill_random(buf, 64);
+
+	unmap(buf, test_pages(len + 64));
+	unmap(copy, test_pages(len + 64));
+}
+
+Bench(rng_next) {
+	Rng rng;
+	rng_seed(&rng, 1);
+	bench_set_bytes(sizeof(u64));
+	bench_loop {
+		u64 v = rng_next(&rng);
+		do_not_optimize(v);
+	}
+}
+
+Bench(rng_bounded) {
+	Rng rng;
+	rng_seed(&rng, 1);
+	bench_loop {
+		u64 v = rng_bounded(&rng, 1000);
+		do_not_optimize(v);
+	}
+}
+
+Bench(rng_fill) {
+	u64 len = 1 << 20;
+	byte *buf = map(test_pages(len));
+	Rng rng;
+	rng_seed(&rng, 1);
+	bench_set_bytes(len);
+	bench_loop {
+		rng_fill(&rng, buf, len);
+		clobber_memory();
+	}
+	unmap(buf, test_pages(len));
+}
+
+// Reference decoder, straight from the table of well-formed byte sequences
+// in RFC 3629 section 4. Returns the sequence length, or 0 if invalid.
+static u32 utf8_test_decode(const byte *s, u64 avail, u32 *cp) {
+	static const struct {
+		byte lead_lo, lead_hi, len, second_lo, second_hi;
+	} forms[] = {{0x00, 0x7F, 1, 0, 0},		{0xC2, 0xDF, 2, 0x80, 0xBF},
+				 {0xE0, 0xE0, 3, 0xA0, 0xBF}, {0xE1, 0xEC, 3, 0x80, 0xBF},
+				 {0xED, 0xED, 3, 0x80, 0x9F}, {0xEE, 0xEF, 3, 0x80, 0xBF},
+				 {0xF0, 0xF0, 4, 0x90, 0xBF}, {0xF1, 0xF3, 4, 0x80, 0xBF},
+				 {0xF4, 0xF4, 4, 0x80, 0x8F}};
+	static const u32 lead_bits[] = {0, 0x7F, 0x1F, 0x0F, 0x07};
+	for (u32 f = 0; f < sizeof(forms) / sizeof(forms[0]); f++) {
+		if (s[0] < forms[f].lead_lo || s[0] > forms[f].lead_hi) continue;
+		u32 n = forms[f].len;
+		if (avail < n) return 0;
+		if (n > 1 && (s[1] < forms[f].second_lo || s[1] > forms[f].second_hi))
+			return 0;
+		u32 v = s[0] & lead_bits[n];
+		for (u32 k = 1; k < n; k++) {
+			if (k > 1 && (s[k] < 0x80 || s[k] > 0xBF)) return 0;
+			v = (v << 6) | (s[k] & 0x3F);
+		}
+		*cp = v;
+		return n;
+	}
+	return 0;
+}
+
+static i64 utf8_test_validate(const byte *s, u64 len) {
+	u32 cp;
+	for (u64 i = 0; i < len;) {
+		u32 n = utf8_test_decode(s + i, len - i, &cp);
+		if (!n) return i;
+		i += n;
+	}
+	return -1;
+}
+
+static u64 utf8_test_encode(u32 c, byte *out) {
+	if (c < 0x80) {
+		out[0] = c;
+		return 1;
+	} else if (c < 0x800) {
+		out[0] = 0xC0 | (c >> 6);
+		out[1] = 0x80 | (c & 0x3F);
+		return 2;
+	} else if (c < 0x10000) {
+		out[0] = 0xE0 | (c >> 12);
+		out[1] = 0x80 | ((c >> 6) & 0x3F);
+		out[2] = 0x80 | (c & 0x3F);
+		return 3;
+	}
+	out[0] = 0xF0 | (c >> 18);
+	out[1] = 0x80 | ((c >> 12) & 0x3F);
+	out[2] = 0x80 | ((c >> 6) & 0x3F);
+	out[3] = 0x80 | (c & 0x3F);
+	return 4;
+}
+
+// Valid UTF-8 with long ASCII runs and code points from every length class,
+// including the boundary values. Returns the number of code points.
+static u64 utf8_test_text(byte *buf, u64 len, u32 ascii_percent) {
+	static const u32 edges[] = {0x7F,	0x80,	0x7FF,	0x800,	 0xD7FF,
+								0xE000, 0xFFFD, 0xFFFF, 0x10000, 0x10FFFF};
+	u64 i = 0, count = 0;
+	byte tmp[4];
+	while (i < len) {
+		u64 r = test_rand();
+		u32 c;
+		if (r % 100 < ascii_percent)
+			c = 0x20 + (r >> 8) % 0x5F;
+		else if ((r >> 8) % 8 == 0)
+			c = edges[(r >> 16) % 10];
+		else if ((r >> 8) % 8 < 3)
+			c = 0x80 + (r >> 16) % 0x780;
+		else if ((r >> 8) % 8 < 6)
+			c = 0x800 + (r >> 16) % 0xF800;
+		else
+			c = 0x10000 + (r >> 16) % 0x100000;
+		if (c >= 0xD800 && c <= 0xDFFF) c -= 0x1000;
+		u64 n = utf8_test_encode(c, tmp);
+		if (i + n > len) break;
+		for (u64 k = 0; k < n; k++) buf[i++] = tmp[k];
+		count++;
+	}
+	while (i < len) {
+		buf[i++] = 'x';
+		count++;
+	}
+	return count;
+}
+
+static void utf8_test_check(const byte *s, u64 len) {
+	i64 expected = utf8_test_validate(s, len);
+	cpu_override(0);
+	i64 scalar = utf8_validate(s, len);
+	cpu_override(~0U);
+	assert_eq(scalar, expected);
+	assert_eq(utf8_validate(s, len), expected);
+}
+
+Test(utf8_validate) {
+	const char *valid[] = {"", "a", "\xC2\x80", "\xDF\xBF", "\xE0\xA0\x80",
+						   "\xED\x9F\xBF", "\xEE\x80\x80", "\xEF\xBF\xBF",
+						   "\xF0\x90\x80\x80", "\xF4\x8F\xBF\xBF"};
+	const char *invalid[] = {
+		"\x80",			"\xBF",			"\xC0\x80",			"\xC1\xBF",
+		"\xC2",			"\xC2\x41",		"\xE0\x80\x80",		"\xE0\x9F\xBF",
+		"\xED\xA0\x80", "\xED\xBF\xBF", "\xE1\x80",			"\xF0\x80\x80\x80",
+		"\xF0\x8F\xBF\xBF", "\xF4\x90\x80\x80", "\xF5\x80\x80\x80", "\xFF",
+		"\xF1\x80\x80"};
+	for (u64 i = 0; i < sizeof(valid) / sizeof(valid[0]); i++) {
+		u64 len = cstring_len(valid[i]);
+		assert(utf8_valid((const byte *)valid[i], len));
+		utf8_test_check((const byte *)valid[i], len);
+	}
+
+	// each invalid sequence at every offset around a 32 byte block boundary
+	byte buf[128];
+	for (u64 i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+		u64 len = cstring_len(invalid[i]);
+		for (u64 at = 0; at < 70; at++) {
+			set_bytes(buf, 'a', sizeof(buf));
+			copy_bytes(buf + at, (const byte *)invalid[i], len);
+			assert_eq(utf8_test_validate(buf, sizeof(buf)), at);
+			utf8_test_check(buf, sizeof(buf));
+			utf8_test_check(buf, at + len);
+		}
+	}
+}
+
+Test(utf8_fuzz) {
+	u64 max = 4096;
+	byte *buf = map(test_pages(max));
+	for (int iter = 0; iter < 3000; iter++) {
+		u64 len = test_rand() % (iter < 2500 ? 300 : max);
+		utf8_test_text(buf, len, test_rand() % 101);
+		utf8_test_check(buf, len);
+		// a few random mutations: replaced bytes, stray continuation and
+		// lead bytes, truncation
+		u64 mutations = len ? 1 + test_rand() % 4 : 0;
+		for (u64 m = 0; m < mutations && len; m++) {
+			u64 r = test_rand(), at = (r >> 8) % len;
+			switch (r % 4) {
+				case 0:
+					buf[at] = r >> 32;
+					break;
+				case 1:
+					buf[at] = 0x80 | ((r >> 32) & 0x3F);
+					break;
+				case 2:
+					buf[at] = 0xC0 | ((r >> 32) & 0x3F);
+					break;
+				default:
+					len = at;
+			}
+		}
+		utf8_test_check(buf, len);
+	}
+	unmap(buf, test_pages(max));
+}
+
+// UTF-8 -> UTF-16/32 -> UTF-8 on the current path, checked against the
+// reference decoder.
+static void utf8_test_roundtrip(const byte *s, u64 len, u64 count, u16 *u16s,
+								u32 *u32s, byte *back) {
+	assert_eq(utf8_count(s, len), count);
+	assert_eq(utf8_to_utf32(s, len, u32s, len), count);
+	u64 i = 0;
+	for (u64 k = 0; k < count; k++) {
+		u32 cp;
+		i += utf8_test_decode(s + i, len - i, &cp);
+		assert_eq(u32s[k], cp);
+	}
+	assert_eq(utf32_to_utf8(u32s, count, back, len), len);
+	for (u64 k = 0; k < len; k++) assert_eq(back[k], s[k]);
+
+	u64 units = utf8_utf16_length(s, len);
+	assert_eq(utf8_to_utf16(s, len, u16s, len), units);
+	set_bytes(back, 0, len);
+	assert_eq(utf16_to_utf8(u16s, units, back, len), len);
+	for (u64 k = 0; k < len; k++) assert_eq(back[k], s[k]);
+
+	// one unit short of the exact size fails
+	if (count) {
+		assert_eq(utf8_to_utf32(s, len, u32s, count - 1), -1);
+		assert_eq(utf8_to_utf16(s, len, u16s, units - 1), -1);
+		assert_eq(utf32_to_utf8(u32s, count, back, len - 1), -1);
+	}
+}
+
+Test(utf8_transcode) {
+	u64 max = 4096;
+	byte *s = map(test_pages(max)), *back = map(test_pages(max));
+	u16 *u16s = map(test_pages(max * sizeof(u16)));
+	u32 *u32s = map(test_pages(max * sizeof(u32)));
+	for (int iter = 0; iter < 1000; iter++) {
+		u64 len = test_rand() % (iter < 800 ? 200 : max);
+		u64 count = utf8_test_text(s, len, test_rand() % 101);
+		utf8_test_roundtrip(s, len, count, u16s, u32s, back);
+		cpu_override(0);
+		utf8_test_roundtrip(s, len, count, u16s, u32s, back);
+		cpu_override(~0U);
+
+		// invalid input is rejected by both decoders
+		if (!len) continue;
+		s[test_rand() % len] = 0x80 | (test_rand() & 0x7F);
+		bool valid = utf8_test_validate(s, len) < 0;
+		assert_eq(utf8_to_utf16(s, len, u16s, len) >= 0, valid);
+		assert_eq(utf8_to_utf32(s, len, u32s, len) >= 0, valid);
+	}
+
+	// unpaired surrogates and out of range code points
+	u16 high[] = {'a', 0xD800}, low[] = {0xDC00, 'a'}, rev[] = {0xDC00, 0xD800};
+	u16 pair[] = {0xD83D, 0xDE00};
+	assert_eq(utf16_to_utf8(high, 2, back, 16), -1);
+	assert_eq(utf16_to_utf8(low, 2, back, 16), -1);
+	assert_eq(utf16_to_utf8(rev, 2, back, 16), -1);
+	assert_eq(utf16_to_utf8(pair, 2, back, 16), 4);
+	assert_eq(back[0], 0xF0);
+	assert_eq(back[3], 0x80);
+	u32 bad[] = {0xD800, 0x110000};
+	assert_eq(utf32_to_utf8(bad, 1, back, 16), -1);
+	assert_eq(utf32_to_utf8(bad + 1, 1, back, 16), -1);
+
+	unmap(s, test_pages(max));
+	unmap(back, test_pages(max));
+	unmap(u16s, test_pages(max * sizeof(u16)));
+	unmap(u32s, test_pages(max * sizeof(u32)));
+}
+
+#define UTF8_BENCH_SIZE (1 << 20)
+
+static void utf8_bench(u64 bench_iterations, u32 ascii_percent, bool convert) {
+	byte *s = map(test_pages(UTF8_BENCH_SIZE));
+	u16 *out = map(test_pages(UTF8_BENCH_SIZE * sizeof(u16)));
+	utf8_test_text(s, UTF8_BENCH_SIZE, ascii_percent);
+	bench_set_bytes(UTF8_BENCH_SIZE);
+	bench_loop {
+		i64 r = convert ? utf8_to_utf16(s, UTF8_BENCH_SIZE, out,
+										UTF8_BENCH_SIZE)
+						: utf8_validate(s, UTF8_BENCH_SIZE);
+		do_not_optimize(r);
+	}
+	unmap(s, test_pages(UTF8_BENCH_SIZE));
+	unmap(out, test_pages(UTF8_BENCH_SIZE * sizeof(u16)));
+}
+
+Bench(utf8_validate_ascii) {
+	utf8_bench(bench_iterations, 100, false);
+}
+
+Bench(utf8_validate_mixed) {
+	utf8_bench(bench_iterations, 50, false);
+}
+
+Bench(utf8_to_utf16_ascii) {
+	utf8_bench(bench_iterations, 100, true);
+}
+
+Bench(utf8_to_utf16_mixed) {
+	utf8_bench(bench_iterations, 50, true);
+}
+
+#define SORT_PATTERNS 7
+
+// Inputs that exercise the pdqsort special cases: random, sorted, reverse,
+// few distinct values, all equal, organ pipe and sawtooth.
+static void sort_test_fill(u64 *keys, u64 n, int pattern) {
+	for (u64 i = 0; i < n; i++) {
+		switch (pattern) {
+			case 0:
+				keys[i] = test_rand();
+				break;
+			case 1:
+				keys[i] = i;
+				break;
+			case 2:
+				keys[i] = n - i;
+				break;
+			case 3:
+				keys[i] = test_rand() % 16;
+				break;
+			case 4:
+				keys[i] = 7;
+				break;
+			case 5:
+				keys[i] = i < n / 2 ? i : n - i;
+				break;
+			default:
+				keys[i] = i % 100;
+		}
+	}
+}
+
+static bool sort_test_sorted(const u64 *keys, u64 n) {
+	for (u64 i = 1; i < n; i++)
+		if (keys[i - 1] > keys[i]) return false;
+	return true;
+}
+
+Test(sort_u64) {
+	u64 max = 100000;
+	u64 *a = map(test_pages(max * sizeof(u64)));
+	u64 *b = map(test_pages(max * sizeof(u64)));
+	u64 sizes[] = {0, 1, 2, 3, 23, 24, 25, 100, 129, 1000, 1023, 1024, 5000,
+				   max};
+	for (u64 s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		u64 n = sizes[s];
+		for (int pattern = 0; pattern < SORT_PATTERNS; pattern++) {
+			sort_test_fill(a, n, pattern);
+			u64 sum = 0, xor = 0;
+			for (u64 i = 0; i < n; i++) {
+				b[i] = a[i];
+				sum += a[i];
+				xor ^= a[i] * 0x9E3779B97F4A7C15ULL;
+			}
+			sort_u64(a, n);
+			radix_sort_u64(b, n);
+			assert(sort_test_sorted(a, n));
+			for (u64 i = 0; i < n; i++) {
+				assert_eq(a[i], b[i]);
+				sum -= a[i];
+				xor ^= a[i] * 0x9E3779B97F4A7C15ULL;
+			}
+			assert_eq(sum, 0);
+			assert_eq(xor, 0);
+		}
+	}
+	unmap(a, test_pages(max * sizeof(u64)));
+	unmap(b, test_pages(max * sizeof(u64)));
+}
+
+typedef struct SortTestRecord {
+	u64 key;
+	u32 id;
+	u32 check;
+	byte pad[5];
+} SortTestRecord;
+
+static int sort_test_compare(const void *a, const void *b) {
+	const SortTestRecord *x = a, *y = b;
+	return (x->key > y->key) - (x->key < y->key);
+}
+
+static int sort_test_compare_3(const void *a, const void *b) {
+	const byte *x = a, *y = b;
+	for (int i = 0; i < 3; i++)
+		if (x[i] != y[i]) return x[i] < y[i] ? -1 : 1;
+	return 0;
+}
+
+Test(sort_records) {
+	// the last sizes are below SORT_RADIX_MIN, where radix_sort_records
+	// falls back to a merge sort
+	u64 counts[] = {20000, 1000, 100, 25, 2, 1};
+	u64 bytes = counts[0] * sizeof(SortTestRecord);
+	SortTestRecord *r = map(test_pages(bytes));
+	u32 *seen = map(test_pages(counts[0] * sizeof(u32)));
+	for (u64 c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+		u64 n = counts[c];
+		for (int round = 0; round < 4; round++) {
+			for (u32 i = 0; i < n; i++) {
+				r[i].key = round & 1 ? test_rand() : test_rand() % 50;
+				r[i].id = i;
+				r[i].check = i * 2654435761U;
+				seen[i] = 0;
+			}
+			if (round < 2)
+				sort(r, n, sizeof(SortTestRecord), sort_test_compare);
+			else
+				radix_sort_records(r, n, sizeof(SortTestRecord));
+			for (u32 i = 0; i < n; i++) {
+				// records move whole
+				assert_eq(r[i].check, r[i].id * 2654435761U);
+				seen[r[i].id]++;
+				if (i == 0) continue;
+				assert(r[i - 1].key <= r[i].key);
+				// the radix sort is stable
+				if (round >= 2 && r[i - 1].key == r[i].key)
+					assert(r[i - 1].id < r[i].id);
+			}
+			for (u32 i = 0; i < n; i++) assert_eq(seen[i], 1);
+		}
+	}
+
+	// odd sized elements
+	byte bytes3[3000];
+	for (int i = 0; i < 3000; i++) bytes3[i] = test_rand();
+	sort(bytes3, 1000, 3, sort_test_compare_3);
+	for (int i = 1; i < 1000; i++)
+		assert(sort_test_compare_3(bytes3 + (i - 1) * 3, bytes3 + i * 3) <= 0);
+
+	unmap(r, test_pages(bytes));
+	unmap(seen, test_pages(counts[0] * sizeof(u32)));
+}
+
+Test(parallel_sort) {
+	u64 n = 300001;
+	u64 *a = map(test_pages(n * sizeof(u64)));
+	u64 *b = map(test_pages(n * sizeof(u64)));
+	u32 threads[] = {0, 2, 3, 4};
+	for (int pattern = 0; pattern < SORT_PATTERNS; pattern++) {
+		for (u64 t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+			sort_test_fill(a, n, pattern);
+			for (u64 i = 0; i < n; i++) b[i] = a[i];
+			parallel_sort_u64(a, n, threads[t]);
+			sort_u64(b, n);
+			for (u64 i = 0; i < n; i++) assert_eq(a[i], b[i]);
+		}
+	}
+	unmap(a, test_pages(n * sizeof(u64)));
+	unmap(b, test_pages(n * sizeof(u64)));
+}
+
+#define SORT_BENCH_PDQ 0
+#define SORT_BENCH_RADIX 1
+#define SORT_BENCH_PARALLEL 2
+
+// Each iteration restores the unsorted input first, which adds a copy (about
+// 2% of the sort) to the time.
+static void sort_bench(u64 bench_iterations, u64 n, int pattern,
+					   int algorithm) {
+	u64 pages = test_pages(n * sizeof(u64));
+	u64 *input = map(pages), *keys = map(pages);
+	sort_test_fill(input, n, pattern);
+	bench_set_bytes(n * sizeof(u64));
+	bench_loop {
+		copy_bytes((byte *)keys, (byte *)input, n * sizeof(u64));
+		if (algorithm == SORT_BENCH_PDQ)
+			sort_u64(keys, n);
+		else if (algorithm == SORT_BENCH_RADIX)
+			radix_sort_u64(keys, n);
+		else
+			parallel_sort_u64(keys, n, 0);
+		clobber_memory();
+	}
+	unmap(input, pages);
+	unmap(keys, pages);
+}
+
+Bench(sort_u64_random_1k) {
+	sort_bench(bench_iterations, 1000, 0, SORT_BENCH_PDQ);
+}
+
+Bench(sort_u64_random_1m) {
+	sort_bench(bench_iterations, 1000000, 0, SORT_BENCH_PDQ);
+}
+
+Bench(sort_u64_sorted_1m) {
+	sort_bench(bench_iterations, 1000000, 1, SORT_BENCH_PDQ);
+}
+
+Bench(sort_u64_reverse_1m) {
+	sort_bench(bench_iterations, 1000000, 2, SORT_BENCH_PDQ);
+}
+
+Bench(sort_u64_dups_1m) {
+	sort_bench(bench_iterations, 1000000, 3, SORT_BENCH_PDQ);
+}
+
+Bench(radix_sort_u64_random_1k) {
+	sort_bench(bench_iterations, 1000, 0, SORT_BENCH_RADIX);
+}
+
+Bench(radix_sort_u64_random_1m) {
+	sort_bench(bench_iterations, 1000000, 0, SORT_BENCH_RADIX);
+}
+
+Bench(radix_sort_u64_sorted_1m) {
+	sort_bench(bench_iterations, 1000000, 1, SORT_BENCH_RADIX);
+}
+
+Bench(radix_sort_u64_dups_1m) {
+	sort_bench(bench_iterations, 1000000, 3, SORT_BENCH_RADIX);
+}
+
+Bench(parallel_sort_u64_random_4m) {
+	sort_bench(bench_iterations, 4000000, 0, SORT_BENCH_PARALLEL);
+}
+
+// Random bitset with roughly 'per_mille' of the bits set.
+static void bitset_test_fill(Bitset *b, u64 per_mille) {
+	bitset_fill(b, false);
+	for (u64 i = 0; i < b->bits; i++)
+		if (test_rand() % 1000 < per_mille) bitset_set(b, i);
+}
+
+Test(bitset) {
+	Bitset b, c;
+	assert(!bitset_init(&b, 0));
+	assert_eq(bitset_count(&b), 0);
+	assert_eq(bitset_next_set(&b, 0), 0);
+	for (u64 i = 0; i < 100000; i++) {
+		assert(!bitset_resize(&b, i + 1));
+		if (i % 3 == 0) bitset_set(&b, i);
+	}
+	assert_eq(b.bits, 100000);
+	assert_eq(bitset_count(&b), 33334);
+	assert(bitset_test(&b, 99999));
+	assert(!bitset_test(&b, 99998));
+	assert(!bitset_test(&b, 100000));
+	bitset_set(&b, 100000);
+	assert_eq(bitset_count(&b), 33334);
+
+	// shrinking clears the dropped bits, growing exposes clear bits
+	assert(!bitset_resize(&b, 70));
+	assert_eq(bitset_count(&b), 24);
+	assert(!bitset_resize(&b, 200));
+	assert_eq(bitset_count(&b), 24);
+	assert_eq(bitset_next_set(&b, 70), 200);
+	assert_eq(bitset_next_clear(&b, 69), 70);
+	bitset_fill(&b, true);
+	assert_eq(bitset_count(&b), 200);
+	assert_eq(bitset_next_clear(&b, 0), 200);
+	bitset_clear(&b, 130);
+	assert_eq(bitset_next_clear(&b, 5), 130);
+	assert_eq(bitset_next_set(&b, 130), 131);
+	bitset_cleanup(&b);
+
+	// scans and counts against a bit by bit reference, on every path
+	u32 paths[] = {0, CPU_POPCNT, ~0U};
+	for (u64 len = 1; len < 3000; len += 97) {
+		assert(!bitset_init(&b, len));
+		assert(!bitset_init(&c, len + test_rand() % 300));
+		bitset_test_fill(&b, test_rand() % 1001);
+		bitset_test_fill(&c, 500);
+		for (int p = 0; p < 3; p++) {
+			cpu_override(paths[p]);
+			u64 count = 0, next_set = len, next_clear = len;
+			for (u64 i = len; i-- > 0;) {
+				bool bit = bitset_test(&b, i);
+				count += bit;
+				if (bit)
+					next_set = i;
+				else
+					next_clear = i;
+				assert_eq(bitset_next_set(&b, i), next_set);
+				assert_eq(bitset_next_clear(&b, i), next_clear);
+			}
+			assert_eq(bitset_count(&b), count);
+		}
+		cpu_override(~0U);
+
+		for (int op = 0; op < 4; op++) {
+			for (int p = 0; p < 2; p++) {
+				Bitset d;
+				assert(!bitset_init(&d, len));
+				for (u64 i = 0; i < len; i++)
+					if (bitset_test(&b, i)) bitset_set(&d, i);
+				cpu_override(p ? ~0U : 0);
+				if (op == 0) bitset_and(&d, &c);
+				if (op == 1) bitset_or(&d, &c);
+				if (op == 2) bitset_xor(&d, &c);
+				if (op == 3) bitset_andnot(&d, &c);
+				cpu_override(~0U);
+				for (u64 i = 0; i < len; i++) {
+					bool x = bitset_test(&b, i), y = bitset_test(&c, i);
+					bool expected = op == 0	  ? x && y
+									: op == 1 ? x || y
+									: op == 2 ? x != y
+											  : x && !y;
+					assert_eq(bitset_test(&d, i), expected);
+				}
+				bitset_cleanup(&d);
+			}
+		}
+		bitset_cleanup(&b);
+		bitset_cleanup(&c);
+	}
+}
+
+Test(bitset_rank) {
+	u64 per_mille[] = {0, 1, 30, 500, 990, 1000};
+	u32 paths[] = {0, ~0U};
+	for (u64 d = 0; d < sizeof(per_mille) / sizeof(per_mille[0]); d++) {
+		Bitset b;
+		BitsetRank r;
+		u64 len = 200000 + test_rand() % 1000;
+		assert(!bitset_init(&b, len));
+		bitset_test_fill(&b, per_mille[d]);
+		assert(!bitset_rank_init(&r, &b));
+		assert_eq(r.ones, bitset_count(&b));
+		for (int p = 0; p < 2; p++) {
+			cpu_override(paths[p]);
+			u64 rank = 0;
+			for (u64 i = 0; i < len; i++) {
+				if (i % 7 == 0 || i % 512 < 3)
+					assert_eq(bitset_rank(&r, i), rank);
+				if (bitset_test(&b, i)) {
+					assert_eq(bitset_select(&r, rank), i);
+					rank++;
+				}
+			}
+			assert_eq(bitset_rank(&r, len), rank);
+			assert_eq(bitset_select(&r, rank), len);
+		}
+		cpu_override(~0U);
+		bitset_rank_cleanup(&r);
+		bitset_cleanup(&b);
+	}
+}
+
+#define BITSET_BENCH_BITS (1ULL << 30)
+#define BITSET_BENCH_RANK_BITS (1ULL << 32)
+
+Bench(bitset_and) {
+	Bitset a, b;
+	assert(!bitset_init(&a, BITSET_BENCH_BITS));
+	assert(!bitset_init(&b, BITSET_BENCH_BITS));
+	fill_random(a.words, BITSET_BENCH_BITS / 8);
+	fill_random(b.words, BITSET_BENCH_BITS / 8);
+	bench_set_bytes(BITSET_BENCH_BITS / 8);
+	bench_loop {
+		bitset_and(&a, &b);
+		clobber_memory();
+	}
+	bitset_cleanup(&a);
+	bitset_cleanup(&b);
+}
+
+Bench(bitset_count) {
+	Bitset a;
+	assert(!bitset_init(&a, BITSET_BENCH_BITS));
+	fill_random(a.words, BITSET_BENCH_BITS / 8);
+	bench_set_bytes(BITSET_BENCH_BITS / 8);
+	bench_loop {
+		u64 count = bitset_count(&a);
+		do_not_optimize(count);
+	}
+	bitset_cleanup(&a);
+}
+
+// Random queries over 2^32 bits (512 MiB), so most miss the cache.
+static void bitset_rank_bench(u64 bench_iterations, bool select) {
+	Bitset a;
+	BitsetRank r;
+	assert(!bitset_init(&a, BITSET_BENCH_RANK_BITS));
+	fill_random(a.words, BITSET_BENCH_RANK_BITS / 8);
+	assert(!bitset_rank_init(&r, &a));
+	Rng rng;
+	rng_seed(&rng, 1);
+	bench_loop {
+		u64 v = select ? bitset_select(&r, rng_bounded(&rng, r.ones))
+					   : bitset_rank(&r, rng_bounded(&rng, r.bits));
+		do_not_optimize(v);
+	}
+	bitset_rank_cleanup(&r);
+	bitset_cleanup(&a);
+}
+
+Bench(bitset_rank) {
+	bitset_rank_bench(bench_iterations, false);
+}
+
+Bench(bitset_select) {
+	bitset_rank_bench(bench_iterations, true);
+}
+
+Test(remap) {
+	u64 *p = map(1);
+	for (u64 i = 0; i < PAGE_SIZE / 8; i++) p[i] = i;
+	p = remap(p, 1, 1000);
+	assert(p);
+	for (u64 i = 0; i < PAGE_SIZE / 8; i++) assert_eq(p[i], i);
+	p[1000 * PAGE_SIZE / 8 - 1] = 7;
+	p = remap(p, 1000, 2);
+	assert(p);
+	assert_eq(p[PAGE_SIZE / 8 - 1], PAGE_SIZE / 8 - 1);
+	assert(!remap(p, 2, 0));
+	p = remap(NULL, 0, 3);
+	assert(p);
+	unmap(p, 3);
+}
+
+int pipe(int fds[2]);
+
+Test(ring) {
+	Ring r;
+	u64 avail;
+	assert(!ring_init(&r, PAGE_SIZE + 1));
+	assert_eq(r.capacity, 2 * PAGE_SIZE);
+	u64 cap = r.capacity;
+
+	// the second mapping is the same memory
+	r.buf[5] = 'x';
+	assert_eq(r.buf[cap + 5], 'x');
+	r.buf[cap + 6] = 'y';
+	assert_eq(r.buf[6], 'y');
+
+	byte *data = map(test_pages(2 * cap)), *out = data + cap;
+	for (u64 i = 0; i < cap; i++) data[i] = i * 7;
+	assert_eq(ring_write(&r, data, cap - 100), cap - 100);
+	assert_eq(ring_read(&r, out, cap - 200), cap - 200);
+	// the next write wraps around the end but is one region for both sides
+	ring_write_ptr(&r, &avail);
+	assert_eq(avail, cap - 100);
+	assert_eq(ring_write(&r, data, cap), cap - 100);
+	assert_eq(ring_write(&r, data, 1), 0);
+	const byte *p = ring_read_ptr(&r, &avail);
+	assert_eq(avail, cap);
+	for (u64 i = 0; i < 100; i++) assert_eq(p[i], (byte)((cap - 200 + i) * 7));
+	for (u64 i = 0; i < cap - 100; i++) assert_eq(p[100 + i], (byte)(i * 7));
+	ring_consume(&r, cap - 1);
+	assert_eq(ring_read(&r, out, 10), 1);
+	assert_eq(ring_read(&r, out, 10), 0);
+
+	// straight from one pipe through the ring to another
+	int in[2], drain[2];
+	assert(!pipe(in));
+	assert(!pipe(drain));
+	assert_eq(write(in[1], data, 3000), 3000);
+	assert_eq(ring_fill(&r, in[0]), 3000);
+	assert_eq(ring_drain(&r, drain[1]), 3000);
+	assert_eq(ring_drain(&r, drain[1]), 0);
+	assert_eq(read(drain[0], out, cap), 3000);
+	for (u64 i = 0; i < 3000; i++) assert_eq(out[i], data[i]);
+	close(in[1]);
+	assert_eq(ring_fill(&r, in[0]), 0);
+	close(in[0]);
+	close(drain[0]);
+	close(drain[1]);
+
+	unmap(data, test_pages(2 * cap));
+	ring_cleanup(&r);
+}
+
+#define RING_TEST_RECORDS 200000
+
+// Records are a u32 length and that many bytes of (seq + i); the consumer
+// parses them in place, never copying one that wraps.
+static u32 ring_test_len(u64 seq) {
+	return (seq * 2654435761U) % 300;
+}
+
+static void *ring_test_producer(void *arg) {
+	Ring *r = arg;
+	for (u64 seq = 0; seq < RING_TEST_RECORDS; seq++) {
+		u32 len = ring_test_len(seq);
+		u64 avail;
+		byte *p = ring_write_ptr(r, &avail);
+		for (; avail < 4 + len; p = ring_write_ptr(r, &avail)) sched_yield();
+		copy_bytes(p, (const byte *)&len, 4);
+		for (u32 i = 0; i < len; i++) p[4 + i] = seq + i;
+		ring_commit(r, 4 + len);
+	}
+	return NULL;
+}
+
+Test(ring_threads) {
+	Ring r;
+	pthread_t producer;
+	assert(!ring_init(&r, 4096));
+	pthread_create(&producer, NULL, ring_test_producer, &r);
+	u64 seq = 0, errors = 0;
+	while (seq < RING_TEST_RECORDS) {
+		u64 avail, used = 0;
+		const byte *p = ring_read_ptr(&r, &avail);
+		u32 len;
+		while (avail - used >= 4) {
+			copy_bytes((byte *)&len, p + used, 4);
+			if (avail - used < 4 + len) break;
+			if (len != ring_test_len(seq)) errors++;
+			for (u32 i = 0; i < len; i++)
+				if (p[used + 4 + i] != (byte)(seq + i)) errors++;
+			used += 4 + len;
+			seq++;
+		}
+		if (used)
+			ring_consume(&r, used);
+		else
+			sched_yield();
+	}
+	pthread_join(producer, NULL);
+	assert_eq(errors, 0);
+	assert_eq(ring_read(&r, &seq, 1), 0);
+	ring_cleanup(&r);
+}
+
+#define RING_BENCH_CAPACITY (64 * 1024)
+#define RING_BENCH_BYTES (16 * 1024 * 1024)
+
+// Conventional ring for comparison: copies split at the end of the buffer,
+// and a record that wraps is copied out before it is parsed.
+typedef struct RingWrap {
+	byte *buf;
+	u64 head, tail;
+} RingWrap;
+
+static void ring_wrap_write(RingWrap *r, const byte *data, u64 len) {
+	u64 at = r->head % RING_BENCH_CAPACITY;
+	u64 first = RING_BENCH_CAPACITY - at < len ? RING_BENCH_CAPACITY - at : len;
+	copy_bytes(r->buf + at, data, first);
+	copy_bytes(r->buf, data + first, len - first);
+	r->head += len;
+}
+
+static const byte *ring_wrap_peek(RingWrap *r, u64 off, u64 len,
+								  byte *scratch) {
+	u64 at = (r->tail + off) % RING_BENCH_CAPACITY;
+	if (at + len <= RING_BENCH_CAPACITY) return r->buf + at;
+	u64 first = RING_BENCH_CAPACITY - at;
+	copy_bytes(scratch, r->buf + at, first);
+	copy_bytes(scratch + first, r->buf, len - first);
+	return scratch;
+}
+
+// Stream RING_BENCH_BYTES of records (a u32 length and a payload) through
+// the ring; the consumer checksums each payload. Producer and consumer
+// alternate on one thread so only the buffer handling differs.
+static void ring_bench(u64 bench_iterations, bool wrap) {
+	byte *records = map(test_pages(RING_BENCH_CAPACITY));
+	byte *scratch = map(test_pages(RING_BENCH_CAPACITY));
+	u32 sum = 0;
+	// 64 records of 4 + 0..1000 bytes
+	u64 offsets[65] = {0};
+	for (u32 i = 0; i < 64; i++) {
+		u32 len = (i * 2654435761U) % 1000;
+		copy_bytes(records + offsets[i], (const byte *)&len, 4);
+		set_bytes(records + offsets[i] + 4, i, len);
+		offsets[i + 1] = offsets[i] + 4 + len;
+	}
+	Ring r;
+	RingWrap w = {map(test_pages(RING_BENCH_CAPACITY)), 0, 0};
+	ring_init(&r, RING_BENCH_CAPACITY);
+
+	bench_set_bytes(RING_BENCH_BYTES);
+	bench_loop {
+		u64 written = 0, next = 0;
+		while (written < RING_BENCH_BYTES) {
+			// produce until the next record doesn't fit
+			for (;;) {
+				u64 len = offsets[next + 1] - offsets[next];
+				if (wrap) {
+					if (RING_BENCH_CAPACITY - (w.head - w.tail) < len) break;
+					ring_wrap_write(&w, records + offsets[next], len);
+				} else {
+					u64 avail;
+					byte *p = ring_write_ptr(&r, &avail);
+					if (avail < len) break;
+					copy_bytes(p, records + offsets[next], len);
+					ring_commit(&r, len);
+				}
+				written += len;
+				next = (next + 1) % 64;
+			}
+			// consume everything
+			if (wrap) {
+				u64 off = 0, avail = w.head - w.tail;
+				while (off < avail) {
+					u32 len;
+					const byte *p = ring_wrap_peek(&w, off, 4, scratch);
+					copy_bytes((byte *)&len, p, 4);
+					p = ring_wrap_peek(&w, off + 4, len, scratch);
+					sum = crc32c(sum, p, len);
+					off += 4 + len;
+				}
+				w.tail += off;
+			} else {
+				u64 avail, off = 0;
+				const byte *p = ring_read_ptr(&r, &avail);
+				while (off < avail) {
+					u32 len;
+					copy_bytes((byte *)&len, p + off, 4);
+					sum = crc32c(sum, p + off + 4, len);
+					off += 4 + len;
+				}
+				ring_consume(&r, off);
+			}
+		}
+	}
+	do_not_optimize(sum);
+	ring_cleanup(&r);
+	unmap(w.buf, test_pages(RING_BENCH_CAPACITY));
+	unmap(records, test_pages(RING_BENCH_CAPACITY));
+	unmap(scratch, test_pages(RING_BENCH_CAPACITY));
+}
+
+Bench(ring_records) {
+	ring_bench(bench_iterations, false);
+}
+
+Bench(ring_records_wrap) {
+	ring_bench(bench_iterations, true);
+}
+
+int unlink(const char *path);
+int rmdir(const char *path);
+int symlink(const char *target, const char *path);
+int atexit(void (*fn)(void));
+
+typedef struct DirscanTest {
+	u64 files;
+	u64 dirs;
+	u64 links;
+	u64 bytes;
+	u64 found;	// bit per expected path
+	u64 bad;
+} DirscanTest;
+
+static const char *dirscan_test_paths[] = {"f0",	 "f1",		 "f2",
+										   "d1/f",	 "d1/d2/g",	 "l",
+										   "d1",	 "d1/d2",	 "d1/d2/d3"};
+
+static int dirscan_test_fn(const DirscanEntry *e, void *ctx) {
+	DirscanTest *t = ctx;
+	u64 *counter = e->type == DIRSCAN_FILE ? &t->files
+				   : e->type == DIRSCAN_DIR	 ? &t->dirs
+				   : e->type == DIRSCAN_LINK ? &t->links
+											 : &t->bad;
+	__atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&t->bytes, e->size, __ATOMIC_RELAXED);
+
+	u32 name_len = cstring_len(e->name);
+	struct stat st;
+	if (cstring_len(e->path) != e->path_len || name_len > e->path_len ||
+		cstring_compare(e->path + e->path_len - name_len, e->name) ||
+		fstatat(e->dir_fd, e->name, &st, AT_SYMLINK_NOFOLLOW))
+		__atomic_fetch_add(&t->bad, 1, __ATOMIC_RELAXED);
+	for (u64 i = 0; i < sizeof(dirscan_test_paths) / sizeof(char *); i++)
+		if (!cstring_compare(e->path, dirscan_test_paths[i]))
+			__atomic_fetch_or(&t->found, 1ULL << i, __ATOMIC_RELAXED);
+	return 0;
+}
+
+static int dirscan_test_stop(const DirscanEntry *e, void *ctx) {
+	__atomic_fetch_add((u64 *)ctx, 1, __ATOMIC_RELAXED);
+	return 7;
+}
+
+static void dirscan_test_file(const char *root, const char *name, u64 size) {
+	char path[256], data[128] = {0};
+	snprintf(path, sizeof(path), "%s/%s", root, name);
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	assert(fd >= 0);
+	assert_eq(write(fd, data, size), (ssize_t)size);
+	close(fd);
+}
+
+Test(dirscan) {
+	char path[256];
+	mkdir(test_file, 0755);
+	snprintf(path, sizeof(path), "%s/d1", test_file);
+	mkdir(path, 0755);
+	snprintf(path, sizeof(path), "%s/d1/d2", test_file);
+	mkdir(path, 0755);
+	snprintf(path, sizeof(path), "%s/d1/d2/d3", test_file);
+	mkdir(path, 0755);
+	dirscan_test_file(test_file, "f0", 10);
+	dirscan_test_file(test_file, "f1", 20);
+	dirscan_test_file(test_file, "f2", 30);
+	dirscan_test_file(test_file, "d1/f", 100);
+	dirscan_test_file(test_file, "d1/d2/g", 5);
+	snprintf(path, sizeof(path), "%s/l", test_file);
+	assert(!symlink("d1/f", path));
+
+	for (u32 threads = 1; threads <= 4; threads += 3) {
+		DirscanTest t = {0};
+		assert(!dirscan(test_file, 0, threads, dirscan_test_fn, &t));
+		assert_eq(t.files, 5);
+		assert_eq(t.dirs, 0);
+		assert_eq(t.links, 1);
+		assert_eq(t.bytes, 0);
+		assert_eq(t.found, 0x3F);
+		assert_eq(t.bad, 0);
+
+		t = (DirscanTest){0};
+		assert(!dirscan(test_file, DIRSCAN_STAT | DIRSCAN_DIRS, threads,
+						dirscan_test_fn, &t));
+		assert_eq(t.files, 5);
+		assert_eq(t.dirs, 3);
+		assert_eq(t.links, 1);
+		assert_eq(t.bytes, 165);
+		assert_eq(t.found, 0x1FF);
+		assert_eq(t.bad, 0);
+
+		// the link is reported as the file it points to
+		t = (DirscanTest){0};
+		assert(!dirscan(test_file, DIRSCAN_STAT | DIRSCAN_FOLLOW, threads,
+						dirscan_test_fn, &t));
+		assert_eq(t.files, 6);
+		assert_eq(t.links, 0);
+		assert_eq(t.bytes, 265);
+		assert_eq(t.bad, 0);
+
+		u64 calls = 0;
+		assert_eq(dirscan(test_file, 0, threads, dirscan_test_stop, &calls), 7);
+		// at most one call per worker can be running when the first stops
+		assert(calls >= 1 && calls <= threads);
+	}
+	snprintf(path, sizeof(path), "%s/missing", test_file);
+	assert_eq(dirscan(path, 0, 1, dirscan_test_fn, NULL), -1);
+
+	for (int i = 5; i >= 0; i--) {
+		snprintf(path, sizeof(path), "%s/%s", test_file, dirscan_test_paths[i]);
+		assert(!unlink(path));
+	}
+	for (int i = 8; i >= 6; i--) {
+		snprintf(path, sizeof(path), "%s/%s", test_file, dirscan_test_paths[i]);
+		assert(!rmdir(path));
+	}
+	assert(!rmdir(test_file));
+}
+
+// 200,000 empty files in 1,000 directories of 200, two levels deep. The tree
+// is built on first use and removed when the process exits.
+#define DIRSCAN_BENCH_ROOT "./.dirscan_bench.fam"
+#define DIRSCAN_BENCH_TOP 10
+#define DIRSCAN_BENCH_SUB 100
+#define DIRSCAN_BENCH_FILES 200
+
+static void dirscan_bench_tree(bool remove) {
+	char path[128];
+	if (!remove) mkdir(DIRSCAN_BENCH_ROOT, 0755);
+	for (int a = 0; a < DIRSCAN_BENCH_TOP; a++) {
+		snprintf(path, sizeof(path), "%s/%i", DIRSCAN_BENCH_ROOT, a);
+		if (!remove) mkdir(path, 0755);
+		for (int b = 0; b < DIRSCAN_BENCH_SUB; b++) {
+			snprintf(path, sizeof(path), "%s/%i/%i", DIRSCAN_BENCH_ROOT, a, b);
+			if (!remove) mkdir(path, 0755);
+			for (int f = 0; f < DIRSCAN_BENCH_FILES; f++) {
+				snprintf(path, sizeof(path), "%s/%i/%i/file%i",
+						 DIRSCAN_BENCH_ROOT, a, b, f);
+				if (remove)
+					unlink(path);
+				else
+					close(open(path, O_WRONLY | O_CREAT, 0644));
+			}
+			snprintf(path, sizeof(path), "%s/%i/%i", DIRSCAN_BENCH_ROOT, a, b);
+			if (remove) rmdir(path);
+		}
+		snprintf(path, sizeof(path), "%s/%i", DIRSCAN_BENCH_ROOT, a);
+		if (remove) rmdir(path);
+	}
+	if (remove) rmdir(DIRSCAN_BENCH_ROOT);
+}
+
+static void dirscan_bench_remove() {
+	dirscan_bench_tree(true);
+}
+
+static void dirscan_bench_setup() {
+	static bool built = false;
+	if (built) return;
+	dirscan_bench_tree(false);
+	atexit(dirscan_bench_remove);
+	built = true;
+}
+
+static int dirscan_bench_fn(const DirscanEntry *e, void *ctx) {
+	__atomic_fetch_add((u64 *)ctx, e->size + 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+static void dirscan_bench(u64 bench_iterations, u32 flags, u32 threads) {
+	dirscan_bench_setup();
+	u64 count = 0;
+	bench_loop {
+		assert(!dirscan(DIRSCAN_BENCH_ROOT, flags, threads, dirscan_bench_fn,
+						&count));
+	}
+	assert_eq(count, bench_iterations * DIRSCAN_BENCH_TOP *
+						 DIRSCAN_BENCH_SUB * DIRSCAN_BENCH_FILES);
+}
+
+// What xxdir used to do: readdir and a stat of every entry by full path.
+static u64 dirscan_bench_readdir(const char *dir_path) {
+	u64 count = 0;
+	DIR *dir = opendir(dir_path);
+	assert(dir);
+	struct dirent *entry;
+	while ((entry = readdir(dir))) {
+		if (!cstring_compare(entry->d_name, ".") ||
+			!cstring_compare(entry->d_name, ".."))
+			continue;
+		char path[256];
+		snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name);
+		struct stat st;
+		assert(!stat(path, &st));
+		count += S_ISDIR(st.st_mode) ? dirscan_bench_readdir(path)
+									 : (u64)st.st_size + 1;
+	}
+	closedir(dir);
+	return count;
+}
+
+Bench(dirscan) {
+	dirscan_bench(bench_iterations, 0, 1);
+}
+
+Bench(dirscan_stat) {
+	dirscan_bench(bench_iterations, DIRSCAN_STAT, 1);
+}
+
+Bench(dirscan_stat_threads) {
+	dirscan_bench(bench_iterations, DIRSCAN_STAT, 0);
+}
+
+Bench(dirscan_readdir_stat) {
+	dirscan_bench_setup();
+	bench_loop {
+		assert_eq(dirscan_bench_readdir(DIRSCAN_BENCH_ROOT),
+				  DIRSCAN_BENCH_TOP * DIRSCAN_BENCH_SUB * DIRSCAN_BENCH_FILES);
+	}
+}
+
+// Bit at a time reference codecs for the encode tests.
+static const char *encode_test_alphabet(u32 flags) {
+	static char alphabet[2][65];
+	char *a = alphabet[flags & BASE64_URL ? 1 : 0];
+	for (int i = 0; i < 26; i++) a[i] = 'A' + i;
+	for (int i = 0; i < 26; i++) a[26 + i] = 'a' + i;
+	for (int i = 0; i < 10; i++) a[52 + i] = '0' + i;
+	a[62] = flags & BASE64_URL ? '-' : '+';
+	a[63] = flags & BASE64_URL ? '_' : '/';
+	return a;
+}
+
+static int encode_test_value(const char *alphabet, u32 n, char c) {
+	for (u32 i = 0; i < n; i++)
+		if (alphabet[i] == c) return i;
+	if (n == 16 && c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+static u64 ref_base64_encode(char *out, const byte *in, u64 len, u32 flags) {
+	const char *alphabet = encode_test_alphabet(flags);
+	u64 acc = 0, bits = 0, n = 0;
+	for (u64 i = 0; i < len; i++) {
+		acc = acc << 8 | in[i];
+		for (bits += 8; bits >= 6; bits -= 6)
+			out[n++] = alphabet[(acc >> (bits - 6)) & 63];
+	}
+	if (bits) out[n++] = alphabet[(acc << (6 - bits)) & 63];
+	if (!(flags & BASE64_NOPAD))
+		while (n % 4) out[n++] = '=';
+	return n;
+}
+
+static i64 ref_base64_decode(byte *out, const char *in, u64 len, u32 flags) {
+	const char *alphabet = encode_test_alphabet(flags);
+	if (!(flags & BASE64_NOPAD)) {
+		if (len % 4) return -1;
+		u64 pads = 0;
+		while (pads < 2 && pads < len && in[len - 1 - pads] == '=') pads++;
+		len -= pads;
+		if (pads && len % 4 != 4 - pads) return -1;
+	}
+	if (len % 4 == 1) return -1;
+	u64 acc = 0, bits = 0, n = 0;
+	for (u64 i = 0; i < len; i++) {
+		int v = encode_test_value(alphabet, 64, in[i]);
+		if (v < 0) return -1;
+		acc = acc << 6 | v;
+		bits += 6;
+		if (bits >= 8) {
+			bits -= 8;
+			out[n++] = acc >> bits;
+		}
+	}
+	if (acc & ((1ULL << bits) - 1)) return -1;
+	return n;
+}
+
+static i64 ref_hex_decode(byte *out, const char *in, u64 len) {
+	if (len % 2) return -1;
+	for (u64 i = 0; i < len; i += 2) {
+		int hi = encode_test_value("0123456789abcdef", 16, in[i]);
+		int lo = encode_test_value("0123456789abcdef", 16, in[i + 1]);
+		if (hi < 0 || lo < 0) return -1;
+		out[i / 2] = hi << 4 | lo;
+	}
+	return len / 2;
+}
+
+static void encode_test_check(const void *a, const void *b, u64 n) {
+	for (u64 i = 0; i < n; i++)
+		assert_eq(((const byte *)a)[i], ((const byte *)b)[i]);
+}
+
+Test(encode) {
+	char out[64];
+	byte bytes[8];
+	assert_eq(hex_encode(out, "\x01\xAB\xff", 3), 6);
+	assert(!cstring_compare_n(out, "01abff", 6));
+	assert_eq(hex_decode(bytes, "01ABff", 6), 3);
+	assert(bytes[0] == 1 && bytes[1] == 0xAB && bytes[2] == 0xFF);
+	assert_eq(hex_decode(bytes, "01a", 3), -1);
+	assert_eq(hex_decode(bytes, "0g", 2), -1);
+
+	u64 v;
+	assert(!hex_parse_u64("0x7f3a", 6, &v));
+	assert_eq(v, 0x7f3a);
+	assert(!hex_parse_u64("FFFFFFFFFFFFFFFF", 16, &v));
+	assert_eq(v, ~0ULL);
+	assert(hex_parse_u64("0x", 2, &v));
+	assert(hex_parse_u64("12345678123456781", 17, &v));
+	assert(hex_parse_u64("12z", 3, &v));
+
+	// RFC 4648 test vectors
+	const char *vectors[] = {"",	 "",		 "f",		 "Zg==",
+							 "fo",	 "Zm8=",	 "foo",		 "Zm9v",
+							 "foob", "Zm9vYg==", "fooba",	 "Zm9vYmE=",
+							 "foobar", "Zm9vYmFy"};
+	for (int i = 0; i < 14; i += 2) {
+		u64 len = cstring_len(vectors[i]);
+		u64 n = base64_encode(out, vectors[i], len, 0);
+		assert_eq(n, base64_encoded_len(len, 0));
+		assert_eq(n, cstring_len(vectors[i + 1]));
+		assert(!cstring_compare_n(out, vectors[i + 1], n));
+		assert_eq(base64_decode(bytes, vectors[i + 1], n, 0), (i64)len);
+		assert(!cstring_compare_n((char *)bytes, vectors[i], len));
+	}
+	assert_eq(base64_encode(out, "\xfb\xff", 2, BASE64_URL | BASE64_NOPAD),
+			  3);
+	assert(!cstring_compare_n(out, "-_8", 3));
+	assert_eq(base64_decode(bytes, "-_8", 3, BASE64_URL | BASE64_NOPAD), 2);
+	assert_eq(base64_decode(bytes, "-_8=", 4, BASE64_URL), 2);
+	assert_eq(base64_decode(bytes, "+/8=", 4, BASE64_URL), -1);
+	assert_eq(base64_decode(bytes, "Zh==", 4, 0), -1);	// unused bits set
+	assert_eq(base64_decode(bytes, "Zg=", 3, 0), -1);
+	assert_eq(base64_decode(bytes, "Zg==", 4, BASE64_NOPAD), -1);
+	assert_eq(base64_decode(bytes, "Z===", 4, 0), -1);
+	assert_eq(base64_decode(bytes, "Zg==Zg==", 8, 0), -1);
+}
+
+// Random data and random corruptions of its encodings, checked against the
+// reference codecs on the generic and the AVX2 paths.
+Test(encode_fuzz) {
+	u64 max = 1024;
+	byte *data = map(test_pages(max));
+	byte *dec = map(test_pages(max));
+	byte *ref = map(test_pages(max));
+	char *enc = map(test_pages(max * 2 + 4));
+	char *ref_enc = map(test_pages(max * 2 + 4));
+	Rng rng;
+	rng_seed(&rng, 46);
+	for (int path = 0; path < 2; path++) {
+		cpu_override(path ? ~0U : 0);
+		for (int iter = 0; iter < 2000; iter++) {
+			u64 len = rng_bounded(&rng, iter < 1000 ? 100 : max);
+			u32 flags = rng_bounded(&rng, 4);
+			rng_fill(&rng, data, len);
+
+			u64 n = hex_encode(enc, data, len);
+			for (u64 i = 0; i < len; i++) {
+				char digits[3];
+				snprintf(digits, 3, "%02x", data[i]);
+				assert(!cstring_compare_n(enc + 2 * i, digits, 2));
+			}
+			if (n && rng_bounded(&rng, 2))
+				enc[rng_bounded(&rng, n)] = rng_next(&rng);
+			i64 got = hex_decode(dec, enc, n);
+			i64 want = ref_hex_decode(ref, enc, n);
+			assert_eq(got, want);
+			if (want > 0) encode_test_check(dec, ref, want);
+
+			n = base64_encode(enc, data, len, flags);
+			assert_eq(n, ref_base64_encode(ref_enc, data, len, flags));
+			assert_eq(n, base64_encoded_len(len, flags));
+			encode_test_check(enc, ref_enc, n);
+			assert_eq(base64_decode(dec, enc, n, flags), (i64)len);
+			encode_test_check(dec, data, len);
+			assert(base64_decoded_len(n) >= len);
+
+			// flip one character, sometimes to a valid one or to '='
+			if (n) {
+				u64 pos = rng_bounded(&rng, n);
+				u64 pick = rng_bounded(&rng, 3);
+				const char *alphabet = encode_test_alphabet(flags);
+				enc[pos] = pick == 0   ? '='
+						   : pick == 1 ? alphabet[rng_bounded(&rng, 64)]
+									   : (char)rng_next(&rng);
+			}
+			if (rng_bounded(&rng, 8) == 0 && n) n--;
+			got = base64_decode(dec, enc, n, flags);
+			want = ref_base64_decode(ref, enc, n, flags);
+			assert_eq(got, want);
+			if (want > 0) encode_test_check(dec, ref, want);
+		}
+	}
+	cpu_override(~0U);
+	unmap(data, test_pages(max));
+	unmap(dec, test_pages(max));
+	unmap(ref, test_pages(max));
+	unmap(enc, test_pages(max * 2 + 4));
+	unmap(ref_enc, test_pages(max * 2 + 4));
+}
+
+#define ENCODE_BENCH_BYTES (1 << 20)
+
+// 1 MiB through each codec; 'simd' false measures the table code.
+static void encode_bench(u64 bench_iterations, bool base64, bool decode,
+						 bool simd) {
+	byte *data = map(test_pages(ENCODE_BENCH_BYTES));
+	char *text = map(test_pages(2 * ENCODE_BENCH_BYTES));
+	fill_random(data, ENCODE_BENCH_BYTES);
+	u64 len = base64 ? base64_encode(text, data, ENCODE_BENCH_BYTES, 0)
+					 : hex_encode(text, data, ENCODE_BENCH_BYTES);
+	cpu_override(simd ? ~0U : 0);
+	bench_set_bytes(ENCODE_BENCH_BYTES);
+	bench_loop {
+		i64 n = base64 ? decode ? base64_decode(data, text, len, 0)
+								: (i64)base64_encode(text, data,
+													 ENCODE_BENCH_BYTES, 0)
+				: decode ? hex_decode(data, text, len)
+						 : (i64)hex_encode(text, data, ENCODE_BENCH_BYTES);
+		do_not_optimize(n);
+	}
+	cpu_override(~0U);
+	unmap(data, test_pages(ENCODE_BENCH_BYTES));
+	unmap(text, test_pages(2 * ENCODE_BENCH_BYTES));
+}
+
+Bench(hex_encode) {
+	encode_bench(bench_iterations, false, false, true);
+}
+
+Bench(hex_encode_generic) {
+	encode_bench(bench_iterations, false, false, false);
+}
+
+Bench(hex_decode) {
+	encode_bench(bench_iterations, false, true, true);
+}
+
+Bench(hex_decode_generic) {
+	encode_bench(bench_iterations, false, true, false);
+}
+
+Bench(base64_encode) {
+	encode_bench(bench_iterations, true, false, true);
+}
+
+Bench(base64_encode_generic) {
+	encode_bench(bench_iterations, true, false, false);
+}
+
+Bench(base64_decode) {
+	encode_bench(bench_iterations, true, true, true);
+}
+
+Bench(base64_decode_generic) {
+	encode_bench(bench_iterations, true, true, false);
+}
+
+static void hash_test_check(const byte *out, const char *hex) {
+	byte want[256];
+	u64 len = cstring_len(hex);
+	assert_eq(hex_decode(want, hex, len), (i64)len / 2);
+	encode_test_check(out, want, len / 2);
+}
+
+// bytes i % 251, the input of the BLAKE3 test vectors
+static byte *hash_test_input(u64 len) {
+	byte *p = map(test_pages(len));
+	for (u64 i = 0; i < len; i++) p[i] = i % 251;
+	return p;
+}
+
+Test(sha256) {
+	const char *a448 =
+		"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+	const char *a896 =
+		"abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijkl"
+		"mnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu";
+	u64 big_len = 3 * (1 << 20) + 777;
+	byte *big = hash_test_input(big_len);
+	byte *million = map(test_pages(1000000));
+	set_bytes(million, 'a', 1000000);
+	byte digest[SHA256_DIGEST_LEN];
+
+	for (int path = 0; path < 2; path++) {
+		cpu_override(path ? ~0U : 0);
+		sha256("", 0, digest);
+		hash_test_check(digest, "e3b0c44298fc1c149afbf4c8996fb924"
+								"27ae41e4649b934ca495991b7852b855");
+		sha256("abc", 3, digest);
+		hash_test_check(digest, "ba7816bf8f01cfea414140de5dae2223"
+								"b00361a396177a9cb410ff61f20015ad");
+		sha256(a448, cstring_len(a448), digest);
+		hash_test_check(digest, "248d6a61d20638b8e5c026930c3e6039"
+								"a33ce45964ff2167f6ecedd419db06c1");
+		sha256(a896, cstring_len(a896), digest);
+		hash_test_check(digest, "cf5b16a778af8380036ce59e7b049237"
+								"0b249b11e8f07a51afac45037afee9d1");
+		sha256(big, big_len, digest);
+		hash_test_check(digest, "cacfac8c5d35ba1f96f753076202089d"
+								"ed992cf6cda1b387db29c3f961bae806");
+
+		// the same million bytes in uneven pieces
+		Sha256 s;
+		sha256_init(&s);
+		for (u64 off = 0, step = 1; off < 1000000; off += step, step += 7)
+			sha256_update(&s, million + off,
+						  off + step > 1000000 ? 1000000 - off : step);
+		sha256_final(&s, digest);
+		hash_test_check(digest, "cdc76e5c9914fb9281a1c7e284d73e67"
+								"f1809a48a497200e046d39ccc7112cd0");
+	}
+	cpu_override(~0U);
+	unmap(big, test_pages(big_len));
+	unmap(million, test_pages(1000000));
+}
+
+Test(blake3) {
+	// from the reference implementation's test vectors
+	static const struct {
+		u64 len;
+		const char *hash;
+	} vectors[] = {
+		{0, "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262"},
+		{1, "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213"},
+		{1023,
+		 "10108970eeda3eb932baac1428c7a2163b0e924c9a9e25b35bba72b28f70bd11"},
+		{1024,
+		 "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7"},
+		{1025,
+		 "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444"},
+		{2048,
+		 "e776b6028c7cd22a4d0ba182a8bf62205d2ef576467e838ed6f2529b85fba24a"},
+		{2049,
+		 "5f4d72f40d7a5f82b15ca2b2e44b1de3c2ef86c426c95c1af0b6879522563030"},
+		{3072,
+		 "b98cb0ff3623be03326b373de6b9095218513e64f1ee2edd2525c7ad1e5cffd2"},
+		{3073,
+		 "7124b49501012f81cc7f11ca069ec9226cecb8a2c850cfe644e327d22d3e1cd3"},
+		{4096,
+		 "015094013f57a5277b59d8475c0501042c0b642e531b0a1c8f58d2163229e969"},
+		{4097,
+		 "9b4052b38f1c5fc8b1f9ff7ac7b27cd242487b3d890d15c96a1c25b8aa0fb995"},
+		{5120,
+		 "9cadc15fed8b5d854562b26a9536d9707cadeda9b143978f319ab34230535833"},
+		{5121,
+		 "628bd2cb2004694adaab7bbd778a25df25c47b9d4155a55f8fbd79f2fe154cff"},
+		{6144,
+		 "3e2e5b74e048f3add6d21faab3f83aa44d3b2278afb83b80b3c35164ebeca205"},
+		{6145,
+		 "f1323a8631446cc50536a9f705ee5cb619424d46887f3c376c695b70e0f0507f"},
+		{7168,
+		 "61da957ec2499a95d6b8023e2b0e604ec7f6b50e80a9678b89d2628e99ada77a"},
+		{7169,
+		 "a003fc7a51754a9b3c7fae0367ab3d782dccf28855a03d435f8cfe74605e7817"},
+		{8192,
+		 "aae792484c8efe4f19e2ca7d371d8c467ffb10748d8a5a1ae579948f718a2a63"},
+		{8193,
+		 "bab6c09cb8ce8cf459261398d2e7aef35700bf488116ceb94a36d0f5f1b7bc3b"},
+		{16384,
+		 "f875d6646de28985646f34ee13be9a576fd515f76b5b0a26bb324735041ddde4"},
+		{31744,
+		 "62b6960e1a44bcc1eb1a611a8d6235b6b4b78f32e7abc4fb4c6cdcce94895c47"},
+		{102400,
+		 "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085"},
+		{(1 << 22) + 1,
+		 "0460893a0170917e0d568bb27c0287984d4f7e9d59eafb95e6fb3c01ec611eab"}};
+	u64 max = (1 << 22) + 1;
+	byte *input = hash_test_input(max);
+	byte key[BLAKE3_KEY_LEN], out[131];
+	for (int i = 0; i < BLAKE3_KEY_LEN; i++) key[i] = i;
+
+	for (int path = 0; path < 2; path++) {
+		cpu_override(path ? ~0U : 0);
+		for (u64 v = 0; v < sizeof(vectors) / sizeof(vectors[0]); v++) {
+			u64 len = vectors[v].len;
+			blake3(input, len, out, BLAKE3_OUT_LEN);
+			hash_test_check(out, vectors[v].hash);
+
+			// streamed in uneven pieces
+			Blake3 h;
+			blake3_init(&h);
+			for (u64 off = 0, step = 1; off < len; off += step, step += 131)
+				blake3_update(&h, input + off,
+							  off + step > len ? len - off : step);
+			blake3_final(&h, out, BLAKE3_OUT_LEN);
+			hash_test_check(out, vectors[v].hash);
+
+			for (u32 threads = 2; threads <= 5; threads += 3) {
+				set_bytes(out, 0, BLAKE3_OUT_LEN);
+				blake3_parallel(input, len, out, BLAKE3_OUT_LEN, threads);
+				hash_test_check(out, vectors[v].hash);
+			}
+		}
+
+		Blake3 h;
+		blake3_init_keyed(&h, key);
+		blake3_final(&h, out, BLAKE3_OUT_LEN);
+		hash_test_check(out, "73492b19995d71cdb1e9d74decc09809"
+							 "eb732f1b00bc95c27cb15f9dd4d6478f");
+		blake3_init_keyed(&h, key);
+		blake3_update(&h, input, 102400);
+		blake3_final(&h, out, BLAKE3_OUT_LEN);
+		hash_test_check(out, "ab2ecf0478e816065ba6039d8ec583cb"
+							 "ce8a2335efe903e2d7313c04ba5330d2");
+
+		// extended output; final leaves the state usable
+		blake3_init(&h);
+		blake3_update(&h, input, 1000);
+		blake3_final(&h, out, 16);
+		blake3_update(&h, input + 1000, 25);
+		blake3_final(&h, out, 131);
+		hash_test_check(
+			out,
+			"d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444"
+			"f4c4a22b4b399155358a994e52bf255de60035742ec71bd08ac275a1b51cc6bf"
+			"e332b0ef84b409108cda080e6269ed4b3e2c3f7d722aa4cdc98d16deb554e562"
+			"7be8f955c98e1d5f9565a9194cad0c4285f93700062d9595adb992ae68ff1280"
+			"0ab67a");
+	}
+	cpu_override(~0U);
+	unmap(input, test_pages(max));
+}
+
+static void hash_bench(u64 bench_iterations, bool blake, u64 len, bool simd,
+					   u32 threads) {
+	byte *data = map(test_pages(len));
+	byte out[32];
+	fill_random(data, len);
+	cpu_override(simd ? ~0U : 0);
+	bench_set_bytes(len);
+	bench_loop {
+		if (!blake)
+			sha256(data, len, out);
+		else if (threads == 1)
+			blake3(data, len, out, BLAKE3_OUT_LEN);
+		else
+			blake3_parallel(data, len, out, BLAKE3_OUT_LEN, threads);
+		do_not_optimize(out);
+	}
+	cpu_override(~0U);
+	unmap(data, test_pages(len));
+}
+
+Bench(sha256_64) {
+	hash_bench(bench_iterations, false, 64, true, 1);
+}
+
+Bench(sha256_1k) {
+	hash_bench(bench_iterations, false, 1 << 10, true, 1);
+}
+
+Bench(sha256_64k) {
+	hash_bench(bench_iterations, false, 1 << 16, true, 1);
+}
+
+Bench(sha256_1m) {
+	hash_bench(bench_iterations, false, 1 << 20, true, 1);
+}
+
+Bench(sha256_1m_generic) {
+	hash_bench(bench_iterations, false, 1 << 20, false, 1);
+}
+
+Bench(blake3_64) {
+	hash_bench(bench_iterations, true, 64, true, 1);
+}
+
+Bench(blake3_1k) {
+	hash_bench(bench_iterations, true, 1 << 10, true, 1);
+}
+
+Bench(blake3_64k) {
+	hash_bench(bench_iterations, true, 1 << 16, true, 1);
+}
+
+Bench(blake3_1m) {
+	hash_bench(bench_iterations, true, 1 << 20, true, 1);
+}
+
+Bench(blake3_1m_generic) {
+	hash_bench(bench_iterations, true, 1 << 20, false, 1);
+}
+
+Bench(blake3_16m) {
+	hash_bench(bench_iterations, true, 1 << 24, true, 1);
+}
+
+Bench(blake3_16m_parallel) {
+	hash_bench(bench_iterations, true, 1 << 24, true, 0);
+}
+
+// Random value of a random bit length, so small and large magnitudes are
+// equally likely.
+static u128 int128_test_rand(Rng *rng) {
+	u128 v = (u128)rng_next(rng) << 64 | rng_next(rng);
+	u32 bits = rng_bounded(rng, 129);
+	return bits ? v >> (128 - bits) : 0;
+}
+
+static void int128_test_div(u128 n, u64 d) {
+	U128Divisor div;
+	u64 rem;
+	u128_divisor_init(&div, d);
+	assert_eq(u128_div_u64(n, d, &rem), n / d);
+	assert_eq((u128)rem, n % d);
+	assert_eq(u128_div_const(n, &div, &rem), n / d);
+	assert_eq((u128)rem, n % d);
+}
+
+Test(int128_div) {
+	u128 values[] = {0,
+					 1,
+					 9,
+					 10,
+					 1ULL << 63,
+					 ~0ULL,
+					 (u128)1 << 64,
+					 ((u128)1 << 64) + 1,
+					 10000000000000000000ULL,
+					 (u128)10000000000000000000ULL * 10000000000000000000ULL,
+					 (u128)I128_MAX,
+					 (u128)1 << 127,
+					 U128_MAX - 1,
+					 U128_MAX};
+	u64 divisors[] = {1,
+					  2,
+					  3,
+					  7,
+					  10,
+					  1000000000,
+					  10000000000000000000ULL,
+					  1ULL << 63,
+					  (1ULL << 63) + 1,
+					  ~0ULL - 1,
+					  ~0ULL};
+	u64 nv = sizeof(values) / sizeof(values[0]);
+	u64 nd = sizeof(divisors) / sizeof(divisors[0]);
+	for (u64 i = 0; i < nv; i++)
+		for (u64 j = 0; j < nd; j++) int128_test_div(values[i], divisors[j]);
+
+	Rng rng;
+	rng_seed(&rng, 49);
+	for (int i = 0; i < 20000; i++) {
+		u64 d = int128_test_rand(&rng);
+		int128_test_div(int128_test_rand(&rng), d ? d : 1);
+	}
+
+	// q * d + r for r < d, through both the 64 bit and the two word paths
+	u128 wide[] = {1, 10, ~0ULL, (u128)1 << 64, ((u128)1 << 64) + 1,
+				   (u128)1 << 127, U128_MAX};
+	for (int i = 0; i < 20000 + 49; i++) {
+		u128 q, d, r;
+		if (i < 49) {
+			q = wide[i % 7];
+			d = wide[i / 7];
+			r = d - 1;
+		} else {
+			q = int128_test_rand(&rng);
+			d = int128_test_rand(&rng);
+			if (!d) d = 1;
+			r = int128_test_rand(&rng) % d;
+		}
+		u128 hi, lo = u128_mul_wide(q, d, &hi), rem;
+		hi += __builtin_add_overflow(lo, r, &lo);
+		if (!(q >> 64) && !(d >> 64)) {
+			assert_eq(hi, (u128)0);
+			assert_eq(lo, q * d + r);
+		}
+		assert_eq(u128_div_wide(hi, lo, d, &rem), q);
+		assert_eq(rem, r);
+	}
+}
+
+static u64 int128_test_ref_str(u128 v, char *buf) {
+	char tmp[U128_STR_LEN];
+	u64 len = 0;
+	do {
+		tmp[len++] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	for (u64 i = 0; i < len; i++) buf[i] = tmp[len - 1 - i];
+	buf[len] = 0;
+	return len;
+}
+
+Test(int128_str) {
+	char buf[I128_STR_LEN], ref[I128_STR_LEN];
+	u128 u;
+	i128 v;
+	Rng rng;
+	rng_seed(&rng, 490);
+	for (int i = 0; i < 20000; i++) {
+		u128 x = i < 1000 ? (u128)i : int128_test_rand(&rng);
+		if (i == 1000) x = U128_MAX;
+		u64 len = u128_to_str(x, buf);
+		assert_eq(len, int128_test_ref_str(x, ref));
+		assert(!cstring_compare(buf, ref));
+		assert(!u128_parse(buf, len, &u));
+		assert_eq(u, x);
+
+		i128 y = rng_bounded(&rng, 2) ? -(i128)(x >> 1) : (i128)(x >> 1);
+		len = i128_to_str(y, buf);
+		assert(!i128_parse(buf, len, &v));
+		assert_eq(v, y);
+	}
+
+	assert_eq(u128_to_str(U128_MAX, buf), 39);
+	assert(!cstring_compare(buf, "340282366920938463463374607431768211455"));
+	assert_eq(i128_to_str(I128_MIN, buf), 40);
+	assert(!cstring_compare(buf, "-170141183460469231731687303715884105728"));
+	assert_eq(i128_to_str(0, buf), 1);
+	assert(!cstring_compare(buf, "0"));
+
+	assert(!i128_parse(buf, 1, &v));
+	assert_eq(v, (i128)0);
+	assert(!i128_parse("-170141183460469231731687303715884105728", 40, &v));
+	assert_eq(v, I128_MIN);
+	assert_eq(i128_parse("170141183460469231731687303715884105728", 39, &v),
+			  -1);
+	assert_eq(u128_parse("340282366920938463463374607431768211456", 39, &u),
+			  -1);
+	assert_eq(u128_parse("", 0, &u), -1);
+	assert_eq(u128_parse("12a", 3, &u), -1);
+	assert_eq(u128_parse("-1", 2, &u), -1);
+	assert_eq(i128_parse("-", 1, &v), -1);
+	assert_eq(i128_parse("+1", 2, &v), -1);
+}
+
+Test(int128_sat) {
+	u128 u;
+	i128 v;
+	assert(!u128_add_overflow(1, 2, &u));
+	assert_eq(u, (u128)3);
+	assert(u128_add_overflow(U128_MAX, 1, &u));
+	assert_eq(u, (u128)0);
+	assert(u128_sub_overflow(0, 1, &u));
+	assert_eq(u, U128_MAX);
+	assert(u128_mul_overflow((u128)1 << 64, (u128)1 << 64, &u));
+	assert(!u128_mul_overflow((u128)1 << 64, ~0ULL, &u));
+	assert(i128_add_overflow(I128_MAX, 1, &v));
+	assert_eq(v, I128_MIN);
+	assert(i128_sub_overflow(I128_MIN, 1, &v));
+	assert(i128_mul_overflow(I128_MIN, -1, &v));
+	assert(!i128_mul_overflow(I128_MIN, 1, &v));
+	assert_eq(v, I128_MIN);
+
+	assert_eq(u128_add_sat(U128_MAX - 1, 5), U128_MAX);
+	assert_eq(u128_add_sat(3, 4), (u128)7);
+	assert_eq(u128_sub_sat(3, 4), (u128)0);
+	assert_eq(u128_sub_sat(4, 3), (u128)1);
+	assert_eq(u128_mul_sat(U128_MAX, 2), U128_MAX);
+	assert_eq(u128_mul_sat(6, 7), (u128)42);
+	assert_eq(i128_add_sat(I128_MAX, 1), I128_MAX);
+	assert_eq(i128_add_sat(I128_MIN, -1), I128_MIN);
+	assert_eq(i128_add_sat(-5, 3), (i128)-2);
+	assert_eq(i128_sub_sat(I128_MIN, 1), I128_MIN);
+	assert_eq(i128_sub_sat(0, I128_MIN), I128_MAX);
+	assert_eq(i128_sub_sat(-1, I128_MIN), I128_MAX);
+	assert_eq(i128_sub_sat(5, 7), (i128)-2);
+	assert_eq(i128_mul_sat(I128_MIN, -1), I128_MAX);
+	assert_eq(i128_mul_sat(I128_MAX, -2), I128_MIN);
+	assert_eq(i128_mul_sat(I128_MIN, I128_MIN), I128_MAX);
+	assert_eq(i128_mul_sat(-6, 7), (i128)-42);
+}
+
+static void decimal_test_check(Decimal d, u32 digits, const char *expected) {
+	char buf[DECIMAL_STR_LEN];
+	u64 len = decimal_to_str(d, digits, buf);
+	assert_eq(len, cstring_len(expected));
+	assert(!cstring_compare(buf, expected));
+}
+
+static Decimal decimal_test_parse(const char *s) {
+	Decimal d = {0};
+	assert(!decimal_parse(s, cstring_len(s), &d));
+	return d;
+}
+
+Test(decimal) {
+	Decimal a, b, r;
+	char buf[DECIMAL_STR_LEN];
+
+	a = decimal_test_parse("19.99");
+	assert(!decimal_mul(a, decimal_from_i64(3), &r));
+	decimal_test_check(r, 2, "59.97");
+	decimal_test_check(r, 0, "60");
+	decimal_test_check(r, 4, "59.9700");
+	assert(!decimal_sub(r, decimal_test_parse("60"), &r));
+	decimal_test_check(r, 2, "-0.03");
+	decimal_test_check(r, 1, "0.0");
+	assert_eq(decimal_trunc(decimal_test_parse("-7.9")), (i128)-7);
+	assert_eq(decimal_trunc(decimal_test_parse("7.9")), (i128)7);
+
+	assert(!decimal_div(decimal_from_i64(1), decimal_from_i64(3), &r));
+	decimal_test_check(r, 18, "0.333333333333333333");
+	assert(!decimal_div(decimal_from_i64(-2), decimal_from_i64(3), &r));
+	decimal_test_check(r, 18, "-0.666666666666666667");
+	assert(!decimal_mul(decimal_test_parse("0.000000000000000001"),
+						decimal_test_parse("0.5"), &r));
+	decimal_test_check(r, 18, "0.000000000000000001");
+	assert(!decimal_mul(decimal_test_parse("-1.5"), decimal_test_parse("1.5"),
+						&r));
+	decimal_test_check(r, 18, "-2.250000000000000000");
+
+	assert(!decimal_round(decimal_test_parse("2.5"), 0, &r));
+	decimal_test_check(r, 18, "3.000000000000000000");
+	assert(!decimal_round(decimal_test_parse("-2.45"), 1, &r));
+	decimal_test_check(r, 2, "-2.50");
+	assert(!decimal_round(decimal_test_parse("2.449"), 1, &r));
+	decimal_test_check(r, 2, "2.40");
+	assert_eq(decimal_cmp(decimal_test_parse("1.1"), decimal_test_parse("1.2")),
+			  -1);
+	assert_eq(decimal_cmp(decimal_test_parse("-0"), decimal_from_i64(0)), 0);
+
+	// nanoseconds to seconds, as the test runner prints them
+	assert(!decimal_from_scaled(1234567890, 9, &r));
+	decimal_test_check(r, 6, "1.234568");
+	assert(!decimal_from_scaled(999999, 9, &r));
+	decimal_test_check(r, 6, "0.001000");
+	assert_eq(decimal_from_scaled(1, 19, &r), -1);
+
+	// the limits and overflow
+	const char *max = "170141183460469231731.687303715884105727";
+	const char *min = "-170141183460469231731.687303715884105728";
+	decimal_test_check(decimal_test_parse(max), 18, max);
+	decimal_test_check(decimal_test_parse(min), 18, min);
+	decimal_test_check(decimal_test_parse(min), 0, "-170141183460469231732");
+	assert_eq(decimal_parse("170141183460469231731.687303715884105728", 40, &a),
+			  -1);
+	assert_eq(decimal_parse("1.0000000000000000001", 21, &a), -1);
+	assert_eq(decimal_parse("1.", 2, &a), -1);
+	assert_eq(decimal_parse(".5", 2, &a), -1);
+	assert_eq(decimal_parse("1,5", 3, &a), -1);
+	a = decimal_test_parse(max);
+	assert_eq(decimal_add(a, decimal_test_parse("0.000000000000000001"), &r),
+			  -1);
+	assert_eq(decimal_mul(a, decimal_from_i64(2), &r), -1);
+	assert_eq(decimal_div(a, decimal_test_parse("0.5"), &r), -1);
+	assert_eq(decimal_div(a, decimal_from_i64(0), &r), -1);
+	assert_eq(decimal_round(a, 0, &r), -1);
+	assert(!decimal_div(a, a, &r));
+	decimal_test_check(r, 1, "1.0");
+
+	// against 128 bit arithmetic where the intermediates fit
+	Rng rng;
+	rng_seed(&rng, 4900);
+	for (int i = 0; i < 20000; i++) {
+		a.raw = (i64)(rng_next(&rng) >> (1 + rng_bounded(&rng, 63)));
+		b.raw = (i64)(rng_next(&rng) >> (1 + rng_bounded(&rng, 63)));
+		if (rng_bounded(&rng, 2)) a.raw = -a.raw;
+		u128 ma = a.raw < 0 ? -a.raw : a.raw, mb = b.raw;
+		bool negative = a.raw < 0;
+
+		u128 want = (ma * mb + 500000000000000000ULL) / 1000000000000000000ULL;
+		assert(!decimal_mul(a, b, &r));
+		assert_eq(r.raw, negative ? -(i128)want : (i128)want);
+
+		if (!mb || ma >> 64) continue;
+		u128 n = ma * 1000000000000000000ULL;
+		want = n / mb + (n % mb >= mb - n % mb);
+		assert(!decimal_div(a, b, &r));
+		assert_eq(r.raw, negative ? -(i128)want : (i128)want);
+
+		u64 len = decimal_to_str(a, 18, buf);
+		assert(!decimal_parse(buf, len, &r));
+		assert_eq(r.raw, a.raw);
+	}
+}
+
+static void int128_div_bench(u64 bench_iterations, int mode) {
+	u128 n[256];
+	u64 d, rem, sum = 0;
+	fill_random(n, sizeof(n));
+	fill_random(&d, sizeof(d));
+	d |= 1ULL << 40;
+	U128Divisor div;
+	u128_divisor_init(&div, d);
+	bench_loop {
+		for (int i = 0; i < 256; i++) {
+			if (mode == 0)
+				sum += u128_div_u64(n[i], d, &rem) + rem;
+			else if (mode == 1)
+				sum += u128_div_const(n[i], &div, &rem) + rem;
+			else
+				sum += n[i] / d + n[i] % d;
+		}
+		do_not_optimize(sum);
+	}
+}
+
+Bench(int128_div_u64) {
+	int128_div_bench(bench_iterations, 0);
+}
+
+Bench(int128_div_const) {
+	int128_div_bench(bench_iterations, 1);
+}
+
+Bench(int128_div_builtin) {
+	int128_div_bench(bench_iterations, 2);
+}
+
+static void int128_str_bench(u64 bench_iterations, bool naive) {
+	u128 v[256];
+	char buf[U128_STR_LEN];
+	fill_random(v, sizeof(v));
+	bench_loop {
+		for (int i = 0; i < 256; i++) {
+			if (naive)
+				int128_test_ref_str(v[i], buf);
+			else
+				u128_to_str(v[i], buf);
+			do_not_optimize(buf);
+		}
+	}
+}
+
+Bench(int128_to_str) {
+	int128_str_bench(bench_iterations, false);
+}
+
+Bench(int128_to_str_naive) {
+	int128_str_bench(bench_iterations, true);
+}
+
+// Nanosecond timings printed as seconds, as the test runner does.
+static void decimal_str_bench(u64 bench_iterations, bool use_double) {
+	i64 ns[256];
+	char buf[DECIMAL_STR_LEN];
+	fill_random(ns, sizeof(ns));
+	for (int i = 0; i < 256; i++) ns[i] = (u64)ns[i] >> 24;
+	bench_loop {
+		for (int i = 0; i < 256; i++) {
+			if (use_double)
+				snprintf(buf, sizeof(buf), "%f", (double)ns[i] / 1e9);
+			else {
+				Decimal d;
+				decimal_from_scaled(ns[i], 9, &d);
+				decimal_to_str(d, 6, buf);
+			}
+			do_not_optimize(buf);
+		}
+	}
+}
+
+Bench(decimal_to_str) {
+	decimal_str_bench(bench_iterations, false);
+}
+
+Bench(decimal_to_str_double) {
+	decimal_str_bench(bench_iterations, true);
+}
@@ -15,6 +15,7 @@
 #include <base/lib.h>
 
 #define MAX_TESTS 1024
+#define MAX_BENCHES 1024
 #define MAX_TEST_NAME 128
 
 int printf(const char *fmt, ...);
@@ -25,6 +26,16 @@ typedef void (*test_fn_ptr)(const char *);
 extern test_fn_ptr test_arr[MAX_TESTS + 1];
 extern char test_names[MAX_TESTS][MAX_TEST_NAME + 1];
 int execute_tests(char *suite_name);
+
+extern int bench_count;
+extern int bench_mode;
+typedef void (*bench_fn_ptr)(u64);
+extern bench_fn_ptr bench_arr[MAX_BENCHES + 1];
+extern char bench_names[MAX_BENCHES][MAX_TEST_NAME + 1];
+int execute_benches(char *suite_name);
+void bench_timer_start();
+void bench_timer_stop();
+void bench_set_bytes(u64 bytes);
 #define BREAK    \
 	"----------" \
 	"----------" \
@@ -37,13 +48,14 @@ int execute_tests(char *suite_name);
 
 void fail_assert();
 
-#define Suite(name)                         \
-	int main() {                            \
-		int success = execute_tests(#name); \
-		if (success) {                      \
-			return -1;                      \
-		}                                   \
-		return 0;                           \
+#define Suite(name)                                       \
+	int main() {                                          \
+		int success = bench_mode ? execute_benches(#name) \
+								 : execute_tests(#name);  \
+		if (success) {                                    \
+			return -1;                                    \
+		}                                                 \
+		return 0;                                         \
 	}
 
 #define Test(name)                                                  \
@@ -65,6 +77,38 @@ void fail_assert();
 	}                                                               \
 	void __test_##name(const char *test_file)
 
+// A benchmark body receives 'bench_iterations' (calibrated by the harness) and
+// should run the measured operation that many times, normally via
+// 'bench_loop' so that setup and teardown outside the loop are not timed. If
+// the body never uses 'bench_loop' the whole call is timed.
+#define Bench(name)                                                  \
+	void __bench_##name(u64 bench_iterations);                       \
+	static void __attribute__((constructor)) __bench_init_##name() { \
+		if (bench_count >= MAX_BENCHES) {                            \
+			printf("Too many benchmarks!\n");                        \
+			_exit(-1);                                               \
+		}                                                            \
+		int name_len = cstring_len(#name);                           \
+		if (name_len > MAX_TEST_NAME) {                              \
+			printf("bench name too long!\n");                        \
+			_exit(-1);                                               \
+		}                                                            \
+		bench_arr[bench_count] = &__bench_##name;                    \
+		copy_bytes(bench_names[bench_count], #name, name_len);       \
+		bench_names[bench_count][name_len] = 0;                      \
+		bench_count++;                                               \
+	}                                                                \
+	void __bench_##name(u64 bench_iterations)
+
+#define bench_loop                                                \
+	for (u64 __bench_i = (bench_timer_start(), 0);                \
+		 __bench_i < bench_iterations || (bench_timer_stop(), 0); \
+		 __bench_i++)
+
+// Force the compiler to materialize 'v' and treat all memory as read/written.
+#define do_not_optimize(v) __asm__ volatile("" : : "r,m"(v) : "memory")
+#define clobber_memory() __asm__ volatile("" : : : "memory")
+
 #define assert(v) \
 	if (!(v)) fail_assert();
 
@@ -13,16 +13,53 @@
 // limitations under the License.
 
 #include <base/test.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <setjmp.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#define TEST_DEFAULT_TIMEOUT 300
+#define TEST_DEFAULT_SLOWEST 5
+
+#define BENCH_TARGET_SAMPLE_NS 5000000
+#define BENCH_WARMUP_SAMPLES 3
+#define BENCH_SAMPLES 30
+#define BENCH_MAX_ITERATIONS (1ULL << 40)
+#define BENCH_DEFAULT_THRESHOLD 10.0
 
 jmp_buf test_jmp;
 int test_count = 0;
 int fail_count = 0;
 char test_names[MAX_TESTS][MAX_TEST_NAME + 1];
-int test_itt;
 char target_test[MAX_TEST_NAME + 1];
 extern char **environ;
 test_fn_ptr test_arr[MAX_TESTS + 1];
+int test_jobs = 0;  // 0 runs one job per CPU
+int test_timeout = TEST_DEFAULT_TIMEOUT;
+int test_slowest = TEST_DEFAULT_SLOWEST;
+
+int bench_count = 0;
+int bench_mode = 0;
+bench_fn_ptr bench_arr[MAX_BENCHES + 1];
+char bench_names[MAX_BENCHES][MAX_TEST_NAME + 1];
+char *bench_output = NULL;
+char *bench_baseline = NULL;
+double bench_threshold = BENCH_DEFAULT_THRESHOLD;
+
+__int128_t bench_start_ns;
+__int128_t bench_elapsed_ns;
+bool bench_timer_used;
+u64 bench_bytes;
+
+int close(int fd);
+double strtod(const char *nptr, char **endptr);
+int atoi(const char *nptr);
+pid_t fork(void);
+int pipe(int fds[2]);
+int dup2(int oldfd, int newfd);
+int fflush(void *stream);
+void __attribute__((noreturn)) exit(int code);
 
 static void __attribute__((constructor)) get_target_test() {
 	target_test[0] = 0;
@@ -34,52 +71,227 @@ static void __attribute__((constructor)) get_target_test() {
 				int len = env_var_len + 12;
 				if (len > MAX_TEST_NAME) len = MAX_TEST_NAME;
 				copy_bytes(target_test, env_var + 12, len);
-				break;
 			}
+		} else if (!cstring_compare_n("TEST_JOBS=", env_var, 10)) {
+			int jobs = atoi(env_var + 10);
+			if (jobs > 0) test_jobs = jobs;
+		} else if (!cstring_compare_n("TEST_TIMEOUT=", env_var, 13)) {
+			int timeout = atoi(env_var + 13);
+			if (timeout > 0) test_timeout = timeout;
+		} else if (!cstring_compare_n("TEST_SLOWEST=", env_var, 13)) {
+			test_slowest = atoi(env_var + 13);
+		} else if (!cstring_compare("TEST_BENCH=1", env_var)) {
+			bench_mode = 1;
+		} else if (!cstring_compare_n("BENCH_OUTPUT=", env_var, 13)) {
+			if (env_var[13]) bench_output = env_var + 13;
+		} else if (!cstring_compare_n("BENCH_BASELINE=", env_var, 15)) {
+			if (env_var[15]) bench_baseline = env_var + 15;
+		} else if (!cstring_compare_n("BENCH_THRESHOLD=", env_var, 16)) {
+			if (env_var[16]) bench_threshold = strtod(env_var + 16, NULL);
 		}
 	}
 }
 
-int execute_tests(char *suite_name) {
-	__int128_t start, end;
-	char success[test_count];
-	start = getnanos();
-	int test_exe_count = 0;
+// Each test runs in its own forked process so a crash, hang or corrupted
+// global can't take down the rest of the suite. The child reports a
+// TestResult over one pipe and its stdout/stderr over another; the parent
+// keeps up to 'test_jobs' children running and prints each test's output
+// only once the test completes so parallel output is never interleaved.
+typedef struct TestResult {
+	int passed;
+	u64 alloc_sum_pre;
+	u64 alloc_sum_post;
+} TestResult;
 
-	for (int i = 0; i < test_count; i++) {
-		test_itt = i;
-		if (setjmp(test_jmp) == 0) {
-			if (target_test[0] == 0 ||
-				!cstring_compare(target_test, test_names[i])) {
-				test_exe_count++;
-				int test_name_len = cstring_len(test_names[i]);
-				char test_dir[test_name_len + 100];
-				copy_bytes(test_dir, "./.", 3);
-				copy_bytes(test_dir + 3, test_names[i], test_name_len);
-				copy_bytes(test_dir + 3 + test_name_len, ".fam", 4);
-				test_dir[4 + 3 + test_name_len] = 0;
-				u64 alloc_sum_pre = _alloc_sum;
-				test_arr[i](test_dir);
-				if (alloc_sum_pre != _alloc_sum)
-					printf("Alloc sum is not equal. Memory leak?\n");
-				assert_eq(alloc_sum_pre, _alloc_sum);
-			}
-		} else {
-			printf("%sFAIL:%s test '%s%s%s' failed!\n", BRIGHT_RED, RESET,
-				   GREEN, test_names[i], RESET);
+typedef struct TestJob {
+	pid_t pid;
+	int test;
+	int result_fd;
+	int output_fd;
+	__int128_t start;
+	TestResult result;
+	u64 result_len;
+	char *output;
+	u64 output_len;
+	u64 output_pages;
+} TestJob;
 
-			fail_count++;
+static void run_test_child(int i, int result_fd, int output_fd) {
+	TestResult result = {0};
+	dup2(output_fd, 1);
+	dup2(output_fd, 2);
+	close(output_fd);
+
+	int test_name_len = cstring_len(test_names[i]);
+	char test_dir[test_name_len + 100];
+	copy_bytes(test_dir, "./.", 3);
+	copy_bytes(test_dir + 3, test_names[i], test_name_len);
+	copy_bytes(test_dir + 3 + test_name_len, ".fam", 4);
+	test_dir[4 + 3 + test_name_len] = 0;
+
+	if (setjmp(test_jmp) == 0) {
+		result.alloc_sum_pre = _alloc_sum;
+		test_arr[i](test_dir);
+		result.alloc_sum_post = _alloc_sum;
+		result.passed = 1;
+	}
+
+	fflush(NULL);
+	write(result_fd, &result, sizeof(result));
+	// exit rather than _exit so that atexit handlers run, including the one
+	// writing gcov coverage data
+	exit(0);
+}
+
+static int start_test_job(TestJob *job, int i) {
+	int result_pipe[2], output_pipe[2];
+	if (pipe(result_pipe) < 0) return -1;
+	if (pipe(output_pipe) < 0) {
+		close(result_pipe[0]);
+		close(result_pipe[1]);
+		return -1;
+	}
+
+	// don't let buffered parent output be duplicated in the child
+	fflush(NULL);
+	pid_t pid = fork();
+	if (pid < 0) {
+		close(result_pipe[0]);
+		close(result_pipe[1]);
+		close(output_pipe[0]);
+		close(output_pipe[1]);
+		return -1;
+	}
+	if (pid == 0) {
+		close(result_pipe[0]);
+		close(output_pipe[0]);
+		run_test_child(i, result_pipe[1], output_pipe[1]);
+	}
+
+	close(result_pipe[1]);
+	close(output_pipe[1]);
+	job->pid = pid;
+	job->test = i;
+	job->result_fd = result_pipe[0];
+	job->output_fd = output_pipe[0];
+	job->start = getnanos();
+	job->result_len = 0;
+	job->output = NULL;
+	job->output_len = 0;
+	job->output_pages = 0;
+	return 0;
+}
+
+static void read_test_output(TestJob *job) {
+	if (job->output_len == job->output_pages * PAGE_SIZE) {
+		u64 npages = job->output_pages ? job->output_pages * 2 : 1;
+		char *nbuf = map(npages);
+		if (job->output) {
+			copy_bytes(nbuf, job->output, job->output_len);
+			unmap(job->output, job->output_pages);
 		}
+		job->output = nbuf;
+		job->output_pages = npages;
 	}
+	ssize_t len =
+		read(job->output_fd, job->output + job->output_len,
+			 job->output_pages * PAGE_SIZE - job->output_len);
+	if (len > 0)
+		job->output_len += len;
+	else {
+		close(job->output_fd);
+		job->output_fd = -1;
+	}
+}
 
-	double time_ns = getnanos() - start;
-	if (fail_count) printf("%s\n", BREAK);
+static void read_test_result(TestJob *job) {
+	ssize_t len = 0;
+	if (job->result_len < sizeof(TestResult))
+		len = read(job->result_fd, (byte *)&job->result + job->result_len,
+				   sizeof(TestResult) - job->result_len);
+	if (len > 0)
+		job->result_len += len;
+	else {
+		close(job->result_fd);
+		job->result_fd = -1;
+	}
+}
+
+// Reap a finished (or timed out) job, print its output and return whether it
+// passed.
+static bool finish_test_job(TestJob *job, bool timed_out, i64 *durations) {
+	int status = 0;
+	if (timed_out) kill(job->pid, SIGKILL);
+	waitpid(job->pid, &status, 0);
+	if (job->result_fd >= 0) close(job->result_fd);
+	if (job->output_fd >= 0) close(job->output_fd);
+	durations[job->test] = getnanos() - job->start;
+
+	if (job->output_len) write(1, job->output, job->output_len);
+	if (job->output) unmap(job->output, job->output_pages);
+
+	char *name = test_names[job->test];
+	bool passed = false;
+	if (timed_out)
+		printf("%sFAIL:%s test '%s%s%s' timed out after %is\n", BRIGHT_RED,
+			   RESET, GREEN, name, RESET, test_timeout);
+	else if (WIFSIGNALED(status))
+		printf("%sFAIL:%s test '%s%s%s' crashed (signal %i)\n", BRIGHT_RED,
+			   RESET, GREEN, name, RESET, WTERMSIG(status));
+	else if (job->result_len != sizeof(TestResult) || !job->result.passed)
+		printf("%sFAIL:%s test '%s%s%s' failed!\n", BRIGHT_RED, RESET, GREEN,
+			   name, RESET);
+	else if (job->result.alloc_sum_pre != job->result.alloc_sum_post) {
+		printf("Alloc sum is not equal. Memory leak? (%llu != %llu)\n",
+			   job->result.alloc_sum_pre, job->result.alloc_sum_post);
+		printf("%sFAIL:%s test '%s%s%s' failed!\n", BRIGHT_RED, RESET, GREEN,
+			   name, RESET);
+	} else
+		passed = true;
+
+	return passed;
+}
+
+// 'ns' nanoseconds as seconds with six decimals.
+static char *test_seconds(i128 ns, char buf[DECIMAL_STR_LEN]) {
+	Decimal d;
+	decimal_from_scaled(ns, 9, &d);
+	decimal_to_str(d, 6, buf);
+	return buf;
+}
+
+static void print_slowest_tests(i64 *durations) {
+	char buf[DECIMAL_STR_LEN];
+	int order[test_count];
+	int n = 0;
+	for (int i = 0; i < test_count; i++)
+		if (durations[i] >= 0) order[n++] = i;
+	for (int i = 1; i < n; i++) {
+		int x = order[i], j = i - 1;
+		while (j >= 0 && durations[order[j]] < durations[x]) {
+			order[j + 1] = order[j];
+			j--;
+		}
+		order[j + 1] = x;
+	}
+	if (n > test_slowest) n = test_slowest;
+	if (n < 2) return;
+	printf("[%s====%s] Slowest tests:\n", BLUE, RESET);
+	for (int i = 0; i < n; i++)
+		printf("       %s%-40s%s %s%ss%s\n", GREEN, test_names[order[i]], RESET,
+			   CYAN, test_seconds(durations[order[i]], buf), RESET);
+}
+
+static int print_test_summary(char *suite_name, int test_exe_count,
+							  i128 start) {
+	char buf[DECIMAL_STR_LEN];
+	i128 time_ns = getnanos() - start;
 	printf(
 		"[%s====%s] Tested: %s%i%s | Passing: %s%i%s Failing: %s%i%s "
-		"(Execution time: %s%f%ss)\n",
+		"(Execution time: %s%s%ss, jobs: %s%i%s)\n",
 		BLUE, RESET, YELLOW, test_exe_count, RESET, GREEN,
 		test_exe_count - fail_count, RESET, CYAN, fail_count, RESET, CYAN,
-		time_ns / 1e9, RESET);
+		test_seconds(time_ns, buf), RESET, CYAN, test_jobs, RESET);
 
 	printf(
 		"[%s=========="
@@ -99,9 +311,324 @@ int execute_tests(char *suite_name) {
 	return fail_count != 0;
 }
 
+int execute_tests(char *suite_name) {
+	__int128_t start = getnanos();
+	int test_exe_count = 0;
+	if (test_jobs <= 0) test_jobs = cpu_count();
+	// nothing to run (the main suite), and no zero length arrays below
+	if (test_count == 0) return print_test_summary(suite_name, 0, start);
+	i64 durations[test_count];
+	TestJob jobs[test_jobs];
+	struct pollfd fds[test_jobs * 2];
+	int running = 0, next = 0;
+
+	for (int i = 0; i < test_count; i++) durations[i] = -1;
+
+	while (next < test_count || running > 0) {
+		while (running < test_jobs && next < test_count) {
+			int i = next++;
+			if (target_test[0] != 0 &&
+				cstring_compare(target_test, test_names[i]))
+				continue;
+			test_exe_count++;
+			if (start_test_job(&jobs[running], i)) {
+				printf("%sFAIL:%s could not start test '%s%s%s'\n",
+					   BRIGHT_RED, RESET, GREEN, test_names[i], RESET);
+				fail_count++;
+				continue;
+			}
+			running++;
+		}
+		if (running == 0) break;
+
+		int nfds = 0;
+		__int128_t now = getnanos();
+		__int128_t wait_ns = (__int128_t)test_timeout * 1000000000;
+		for (int j = 0; j < running; j++) {
+			__int128_t left =
+				jobs[j].start + (__int128_t)test_timeout * 1000000000 - now;
+			if (left < wait_ns) wait_ns = left;
+			if (jobs[j].result_fd >= 0) {
+				fds[nfds].fd = jobs[j].result_fd;
+				fds[nfds++].events = POLLIN;
+			}
+			if (jobs[j].output_fd >= 0) {
+				fds[nfds].fd = jobs[j].output_fd;
+				fds[nfds++].events = POLLIN;
+			}
+		}
+		if (wait_ns < 0) wait_ns = 0;
+		poll(fds, nfds, (int)(wait_ns / 1000000) + 1);
+
+		now = getnanos();
+		for (int j = 0; j < running; j++) {
+			TestJob *job = &jobs[j];
+			for (int k = 0; k < nfds; k++) {
+				if (!fds[k].revents) continue;
+				if (fds[k].fd == job->result_fd)
+					read_test_result(job);
+				else if (fds[k].fd == job->output_fd)
+					read_test_output(job);
+			}
+			bool done = job->result_fd < 0 && job->output_fd < 0;
+			bool timed_out =
+				!done &&
+				now - job->start > (__int128_t)test_timeout * 1000000000;
+			if (!done && !timed_out) continue;
+
+			if (!finish_test_job(job, timed_out, durations)) fail_count++;
+			jobs[j--] = jobs[--running];
+		}
+	}
+
+	if (fail_count) printf("%s\n", BREAK);
+	print_slowest_tests(durations);
+	return print_test_summary(suite_name, test_exe_count, start);
+}
+
 void fail_assert() {
 	char *lt = last_trace();
 	printf("Assertion failure: %s", lt);
 	if (lt) unmap(lt, 1);
 	longjmp(test_jmp, 1);
 }
+
+void bench_timer_start() {
+	bench_timer_used = true;
+	bench_start_ns = getnanos();
+}
+
+void bench_timer_stop() {
+	bench_elapsed_ns += getnanos() - bench_start_ns;
+}
+
+void bench_set_bytes(u64 bytes) {
+	bench_bytes = bytes;
+}
+
+// Run 'iterations' iterations of bench 'i' and return the elapsed time. Only
+// time inside bench_loop is counted if the bench uses it.
+static double bench_run(int i, u64 iterations) {
+	bench_timer_used = false;
+	bench_elapsed_ns = 0;
+	__int128_t start = getnanos();
+	bench_arr[i](iterations);
+	__int128_t end = getnanos();
+	if (!bench_timer_used) bench_elapsed_ns = end - start;
+	return bench_elapsed_ns;
+}
+
+static u64 bench_calibrate(int i) {
+	u64 iterations = 1;
+	while (iterations < BENCH_MAX_ITERATIONS) {
+		double ns = bench_run(i, iterations);
+		if (ns >= BENCH_TARGET_SAMPLE_NS) break;
+		// grow towards the target but never more than 10x per round so that a
+		// noisy short measurement can't overshoot wildly.
+		double scale = ns > 0 ? (BENCH_TARGET_SAMPLE_NS * 1.2) / ns : 10.0;
+		if (scale > 10.0) scale = 10.0;
+		if (scale < 2.0) scale = 2.0;
+		iterations = (u64)(iterations * scale);
+	}
+	return iterations;
+}
+
+static void bench_sort(double *v, int n) {
+	for (int i = 1; i < n; i++) {
+		double x = v[i];
+		int j = i - 1;
+		while (j >= 0 && v[j] > x) {
+			v[j + 1] = v[j];
+			j--;
+		}
+		v[j + 1] = x;
+	}
+}
+
+// nearest rank percentile of sorted values
+static double bench_percentile(double *v, int n, int pct) {
+	int rank = (pct * n + 99) / 100;
+	if (rank < 1) rank = 1;
+	if (rank > n) rank = n;
+	return v[rank - 1];
+}
+
+// Load the median for 'suite'/'name' from a file in the BENCH_OUTPUT format.
+// Returns a negative value if the bench is not in the baseline.
+static double bench_baseline_median(const char *suite, const char *name) {
+	int fd = open(bench_baseline, O_RDONLY);
+	if (fd < 0) return -1.0;
+	u64 pages = 16;
+	char *buf = map(pages);
+	u64 len = 0;
+	ssize_t rlen;
+	while ((rlen = read(fd, buf + len, pages * PAGE_SIZE - len - 1)) > 0) {
+		len += rlen;
+		if (len == pages * PAGE_SIZE - 1) {
+			char *nbuf = map(pages * 2);
+			copy_bytes(nbuf, buf, len);
+			unmap(buf, pages);
+			buf = nbuf;
+			pages *= 2;
+		}
+	}
+	close(fd);
+	buf[len] = 0;
+
+	double ret = -1.0;
+	u64 suite_len = cstring_len(suite), name_len = cstring_len(name);
+	char *line = buf;
+	while (*line) {
+		// suite,name,iterations,samples,outliers,min,median,...
+		if (!cstring_compare_n(line, suite, suite_len) &&
+			line[suite_len] == ',' &&
+			!cstring_compare_n(line + suite_len + 1, name, name_len) &&
+			line[suite_len + 1 + name_len] == ',') {
+			char *field = line;
+			for (int commas = 0; *field && commas < 6; field++)
+				if (*field == ',') commas++;
+			ret = strtod(field, NULL);
+			break;
+		}
+		while (*line && *line != '\n') line++;
+		if (*line) line++;
+	}
+	unmap(buf, pages);
+	return ret;
+}
+
+static void bench_write_output(const char *suite, const char *name,
+							   u64 iterations, int samples, int outliers,
+							   double min, double median, double p99,
+							   double mean, double bytes_per_sec) {
+	int fd = open(bench_output, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (fd < 0) {
+		printf("WARN: could not open bench output file '%s'\n", bench_output);
+		return;
+	}
+	char line[MAX_TEST_NAME * 2 + 256];
+	int len = snprintf(line, sizeof(line), "%s,%s,%llu,%i,%i,%f,%f,%f,%f,%f\n",
+					   suite, name, iterations, samples, outliers, min, median,
+					   p99, mean, bytes_per_sec);
+	write(fd, line, len);
+	close(fd);
+}
+
+static void bench_print_time(const char *label, double ns) {
+	if (ns < 1e3)
+		printf("%s=%s%.2fns%s ", label, CYAN, ns, RESET);
+	else if (ns < 1e6)
+		printf("%s=%s%.2fus%s ", label, CYAN, ns / 1e3, RESET);
+	else if (ns < 1e9)
+		printf("%s=%s%.2fms%s ", label, CYAN, ns / 1e6, RESET);
+	else
+		printf("%s=%s%.2fs%s ", label, CYAN, ns / 1e9, RESET);
+}
+
+int execute_benches(char *suite_name) {
+	__int128_t start = getnanos();
+	int bench_exe_count = 0;
+	int regressions = 0;
+	double samples[BENCH_SAMPLES];
+
+	for (int i = 0; i < bench_count; i++) {
+		if (target_test[0] != 0 && cstring_compare(target_test, bench_names[i]))
+			continue;
+		bench_exe_count++;
+		if (setjmp(test_jmp) != 0) {
+			printf("%sFAIL:%s bench '%s%s%s' failed!\n", BRIGHT_RED, RESET,
+				   GREEN, bench_names[i], RESET);
+			fail_count++;
+			continue;
+		}
+
+		u64 alloc_sum_pre = _alloc_sum;
+		bench_bytes = 0;
+		u64 iterations = bench_calibrate(i);
+		for (int j = 0; j < BENCH_WARMUP_SAMPLES; j++) bench_run(i, iterations);
+		for (int j = 0; j < BENCH_SAMPLES; j++)
+			samples[j] = bench_run(i, iterations) / iterations;
+		if (alloc_sum_pre != _alloc_sum)
+			printf("Alloc sum is not equal. Memory leak?\n");
+		assert_eq(alloc_sum_pre, _alloc_sum);
+
+		// Tukey fences: drop samples outside [q1 - 1.5 * iqr, q3 + 1.5 * iqr]
+		bench_sort(samples, BENCH_SAMPLES);
+		double q1 = bench_percentile(samples, BENCH_SAMPLES, 25);
+		double q3 = bench_percentile(samples, BENCH_SAMPLES, 75);
+		double lo = q1 - 1.5 * (q3 - q1), hi = q3 + 1.5 * (q3 - q1);
+		int first = 0, last = BENCH_SAMPLES;
+		while (first < last && samples[first] < lo) first++;
+		while (last > first && samples[last - 1] > hi) last--;
+		double *kept = samples + first;
+		int n = last - first;
+		int outliers = BENCH_SAMPLES - n;
+
+		double mean = 0.0;
+		for (int j = 0; j < n; j++) mean += kept[j];
+		mean /= n;
+		double min = kept[0];
+		double median =
+			n % 2 ? kept[n / 2] : (kept[n / 2 - 1] + kept[n / 2]) / 2.0;
+		double p99 = bench_percentile(kept, n, 99);
+		double bytes_per_sec = bench_bytes ? bench_bytes * 1e9 / median : 0.0;
+
+		printf("[%sBENCH%s] %s%-32s%s ", BLUE, RESET, GREEN, bench_names[i],
+			   RESET);
+		bench_print_time("min", min);
+		bench_print_time("median", median);
+		bench_print_time("p99", p99);
+		if (bytes_per_sec)
+			printf("(%s%.2f MB/s%s) ", YELLOW, bytes_per_sec / 1e6, RESET);
+		printf("%s[iters=%llu outliers=%i]%s\n", DIMMED, iterations, outliers,
+			   RESET);
+
+		if (bench_output)
+			bench_write_output(suite_name, bench_names[i], iterations, n,
+							   outliers, min, median, p99, mean,
+							   bytes_per_sec);
+
+		if (bench_baseline) {
+			double base = bench_baseline_median(suite_name, bench_names[i]);
+			if (base > 0.0) {
+				double delta = (median - base) * 100.0 / base;
+				bool regressed = delta > bench_threshold;
+				printf("        baseline median=%.2fns change=%s%+.2f%%%s\n",
+					   base, regressed ? BRIGHT_RED : GREEN, delta, RESET);
+				if (regressed) {
+					printf(
+						"%sFAIL:%s bench '%s%s%s' regressed by more than "
+						"%.2f%%\n",
+						BRIGHT_RED, RESET, GREEN, bench_names[i], RESET,
+						bench_threshold);
+					regressions++;
+				}
+			}
+		}
+	}
+
+	char buf[DECIMAL_STR_LEN];
+	i128 time_ns = getnanos() - start;
+	printf(
+		"[%s====%s] Benchmarked: %s%i%s | Failed: %s%i%s Regressed: %s%i%s "
+		"(Execution time: %s%s%ss)\n",
+		BLUE, RESET, YELLOW, bench_exe_count, RESET, CYAN, fail_count, RESET,
+		CYAN, regressions, RESET, CYAN, test_seconds(time_ns, buf), RESET);
+
+	printf(
+		"[%s=========="
+		"=========="
+		"=========="
+		"=========="
+		"=========="
+		"=========="
+		"=========="
+		"==========%s]\n",
+		BLUE, RESET);
+
+	if (fail_count != 0 || regressions != 0)
+		printf("%sFAIL:%s Bench suite %s%s%s failed!", BRIGHT_RED, RESET,
+			   GREEN, suite_name, RESET);
+
+	return fail_count != 0 || regressions != 0;
+}
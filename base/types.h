@@ -22,6 +22,8 @@ typedef __uint128_t u128;
 typedef __int128_t i128;
 typedef int i32;
 typedef unsigned int u32;
+typedef short i16;
+typedef unsigned short u16;
 typedef unsigned char byte;
 typedef double f64;
 typedef float f32;
@@ -0,0 +1,536 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <base/cpu.h>
+#include <base/utf8.h>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif	// __x86_64__
+
+#define UTF8_ASCII_MASK 0x8080808080808080ULL
+#define UTF16_ASCII_MASK 0xFF80FF80FF80FF80ULL
+
+typedef u64 __attribute__((may_alias, aligned(1))) utf8_u64u;
+
+static inline bool utf8_is_ascii8(const byte *s) {
+	return (*(const utf8_u64u *)s & UTF8_ASCII_MASK) == 0;
+}
+
+// Decode the sequence at 's' ('avail' >= 1 bytes). Returns its length and
+// stores the code point, or returns 0 if it is invalid or truncated.
+static inline u32 utf8_decode(const byte *s, u64 avail, u32 *cp) {
+	byte c = s[0];
+	u32 n, min, v;
+	if (c < 0x80) {
+		*cp = c;
+		return 1;
+	} else if (c >= 0xC2 && c <= 0xDF) {
+		n = 2;
+		v = c & 0x1F;
+		min = 0x80;
+	} else if ((c & 0xF0) == 0xE0) {
+		n = 3;
+		v = c & 0x0F;
+		min = 0x800;
+	} else if (c >= 0xF0 && c <= 0xF4) {
+		n = 4;
+		v = c & 0x07;
+		min = 0x10000;
+	} else
+		return 0;
+	if (avail < n) return 0;
+	for (u32 k = 1; k < n; k++) {
+		if ((s[k] & 0xC0) != 0x80) return 0;
+		v = (v << 6) | (s[k] & 0x3F);
+	}
+	if (v < min || v > 0x10FFFF || (v >= 0xD800 && v <= 0xDFFF)) return 0;
+	*cp = v;
+	return n;
+}
+
+// Append the encoding of 'c' (a valid scalar value) at out[*o].
+static inline bool utf8_encode(u32 c, byte *out, u64 capacity, u64 *o) {
+	u64 p = *o;
+	if (c < 0x80) {
+		if (p >= capacity) return false;
+		out[p++] = c;
+	} else if (c < 0x800) {
+		if (capacity - p < 2) return false;
+		out[p++] = 0xC0 | (c >> 6);
+		out[p++] = 0x80 | (c & 0x3F);
+	} else if (c < 0x10000) {
+		if (capacity - p < 3) return false;
+		out[p++] = 0xE0 | (c >> 12);
+		out[p++] = 0x80 | ((c >> 6) & 0x3F);
+		out[p++] = 0x80 | (c & 0x3F);
+	} else {
+		if (capacity - p < 4) return false;
+		out[p++] = 0xF0 | (c >> 18);
+		out[p++] = 0x80 | ((c >> 12) & 0x3F);
+		out[p++] = 0x80 | ((c >> 6) & 0x3F);
+		out[p++] = 0x80 | (c & 0x3F);
+	}
+	*o = p;
+	return true;
+}
+
+// One code point of each conversion. These return false on invalid input or
+// when the output is full.
+
+static inline bool utf8_step16(const byte *s, u64 len, u64 *i, u16 *out,
+							   u64 capacity, u64 *o) {
+	u32 c, n = utf8_decode(s + *i, len - *i, &c);
+	if (n == 0) return false;
+	if (c < 0x10000) {
+		if (*o >= capacity) return false;
+		out[(*o)++] = c;
+	} else {
+		if (capacity - *o < 2) return false;
+		c -= 0x10000;
+		out[(*o)++] = 0xD800 | (c >> 10);
+		out[(*o)++] = 0xDC00 | (c & 0x3FF);
+	}
+	*i += n;
+	return true;
+}
+
+static inline bool utf8_step32(const byte *s, u64 len, u64 *i, u32 *out,
+							   u64 capacity, u64 *o) {
+	u32 c, n = utf8_decode(s + *i, len - *i, &c);
+	if (n == 0 || *o >= capacity) return false;
+	out[(*o)++] = c;
+	*i += n;
+	return true;
+}
+
+static inline bool utf16_step8(const u16 *s, u64 len, u64 *i, byte *out,
+							   u64 capacity, u64 *o) {
+	u32 c = s[*i], n = 1;
+	if (c >= 0xD800 && c <= 0xDFFF) {
+		if (c > 0xDBFF || len - *i < 2 || s[*i + 1] < 0xDC00 ||
+			s[*i + 1] > 0xDFFF)
+			return false;
+		c = 0x10000 + ((c - 0xD800) << 10) + (s[*i + 1] - 0xDC00);
+		n = 2;
+	}
+	if (!utf8_encode(c, out, capacity, o)) return false;
+	*i += n;
+	return true;
+}
+
+static inline bool utf32_step8(const u32 *s, u64 *i, byte *out, u64 capacity,
+							   u64 *o) {
+	u32 c = s[*i];
+	if (c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF)) return false;
+	if (!utf8_encode(c, out, capacity, o)) return false;
+	(*i)++;
+	return true;
+}
+
+static i64 utf8_validate_scalar(const byte *s, u64 i, u64 len) {
+	u32 c;
+	while (i < len) {
+		if (len - i >= 8 && utf8_is_ascii8(s + i)) {
+			i += 8;
+			continue;
+		}
+		u32 n = utf8_decode(s + i, len - i, &c);
+		if (n == 0) return i;
+		i += n;
+	}
+	return -1;
+}
+
+// A position at or shortly before 'i' where a character starts, given that
+// everything before i - 3 is valid.
+static u64 utf8_resync(const byte *s, u64 i) {
+	u64 j = i >= 4 ? i - 4 : 0;
+	for (int k = 0; k < 3 && j < i && (s[j] & 0xC0) == 0x80; k++) j++;
+	return j;
+}
+
+static u64 utf8_count_scalar(const byte *s, u64 len, u64 *four_byte) {
+	u64 conts = 0, fours = 0, i = 0;
+	for (; i + 8 <= len; i += 8) {
+		u64 w = *(const utf8_u64u *)(s + i);
+		// continuation bytes are 10xxxxxx, four byte leads 11110xxx
+		conts += __builtin_popcountll((w >> 7) & ~(w >> 6) &
+									  0x0101010101010101ULL);
+		fours += __builtin_popcountll((w >> 7) & (w >> 6) & (w >> 5) &
+									  (w >> 4) & 0x0101010101010101ULL);
+	}
+	for (; i < len; i++) {
+		conts += (s[i] & 0xC0) == 0x80;
+		fours += s[i] >= 0xF0;
+	}
+	*four_byte = fours;
+	return len - conts;
+}
+
+static i64 utf8_to_utf16_scalar(const byte *s, u64 len, u16 *out,
+								u64 capacity) {
+	u64 i = 0, o = 0;
+	while (i < len) {
+		if (len - i >= 8 && capacity - o >= 8 && utf8_is_ascii8(s + i)) {
+			for (int k = 0; k < 8; k++) out[o + k] = s[i + k];
+			i += 8;
+			o += 8;
+		} else if (!utf8_step16(s, len, &i, out, capacity, &o))
+			return -1;
+	}
+	return o;
+}
+
+static i64 utf8_to_utf32_scalar(const byte *s, u64 len, u32 *out,
+								u64 capacity) {
+	u64 i = 0, o = 0;
+	while (i < len) {
+		if (len - i >= 8 && capacity - o >= 8 && utf8_is_ascii8(s + i)) {
+			for (int k = 0; k < 8; k++) out[o + k] = s[i + k];
+			i += 8;
+			o += 8;
+		} else if (!utf8_step32(s, len, &i, out, capacity, &o))
+			return -1;
+	}
+	return o;
+}
+
+static i64 utf16_to_utf8_scalar(const u16 *s, u64 len, byte *out,
+								u64 capacity) {
+	u64 i = 0, o = 0;
+	while (i < len) {
+		if (len - i >= 4 && capacity - o >= 4 &&
+			(*(const utf8_u64u *)(s + i) & UTF16_ASCII_MASK) == 0) {
+			for (int k = 0; k < 4; k++) out[o + k] = s[i + k];
+			i += 4;
+			o += 4;
+		} else if (!utf16_step8(s, len, &i, out, capacity, &o))
+			return -1;
+	}
+	return o;
+}
+
+static i64 utf32_to_utf8_scalar(const u32 *s, u64 len, byte *out,
+								u64 capacity) {
+	u64 i = 0, o = 0;
+	while (i < len) {
+		if (s[i] < 0x80 && o < capacity)
+			out[o++] = s[i++];
+		else if (!utf32_step8(s, &i, out, capacity, &o))
+			return -1;
+	}
+	return o;
+}
+
+#ifdef __x86_64__
+
+// Error classes for the two byte patterns at (previous byte, current byte),
+// looked up from three nibbles and combined with AND ("Validating UTF-8 In
+// Less Than One Instruction Per Byte", Keiser and Lemire 2021).
+#define UTF8_TOO_SHORT (1 << 0)		  // lead followed by a lead or ASCII
+#define UTF8_TOO_LONG (1 << 1)		  // ASCII followed by a continuation
+#define UTF8_OVERLONG_3 (1 << 2)	  // E0 80..9F
+#define UTF8_TOO_LARGE (1 << 3)		  // F4 90..BF, F5..FF
+#define UTF8_SURROGATE (1 << 4)		  // ED A0..BF
+#define UTF8_OVERLONG_2 (1 << 5)	  // C0, C1
+#define UTF8_TOO_LARGE_1000 (1 << 6)  // F5..FF 80..8F
+#define UTF8_OVERLONG_4 (1 << 6)	  // F0 80..8F
+#define UTF8_TWO_CONTS (1 << 7)		  // continuation after continuation
+#define UTF8_CARRY (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+#define UTF8_TABLE(...) _mm256_setr_epi8(__VA_ARGS__, __VA_ARGS__)
+
+// 'input' shifted right by 'n' bytes with the end of 'prev' shifted in
+#define UTF8_PREV(input, prev, n)                                      \
+	_mm256_alignr_epi8(input, _mm256_permute2x128_si256(prev, input, 0x21), \
+					   16 - (n))
+
+static inline __attribute__((target("avx2"))) __m256i
+utf8_nibble_lookup(__m256i table, __m256i nibbles) {
+	return _mm256_shuffle_epi8(table, nibbles);
+}
+
+static inline __attribute__((target("avx2"))) __m256i
+utf8_check_block(__m256i input, __m256i prev) {
+	const __m256i low = _mm256_set1_epi8(0x0F);
+	const __m256i byte_1_high_table = UTF8_TABLE(
+		UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+		UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+		UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+		UTF8_TOO_SHORT | UTF8_OVERLONG_2, UTF8_TOO_SHORT,
+		UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+		UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 |
+			UTF8_OVERLONG_4);
+	const __m256i byte_1_low_table = UTF8_TABLE(
+		UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+		UTF8_CARRY | UTF8_OVERLONG_2, UTF8_CARRY, UTF8_CARRY,
+		UTF8_CARRY | UTF8_TOO_LARGE,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000);
+	const __m256i byte_2_high_table = UTF8_TABLE(
+		UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+		UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+		UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 |
+			UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+		UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 |
+			UTF8_TOO_LARGE,
+		UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE |
+			UTF8_TOO_LARGE,
+		UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE |
+			UTF8_TOO_LARGE,
+		UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT);
+
+	__m256i prev1 = UTF8_PREV(input, prev, 1);
+	__m256i byte_1_high = utf8_nibble_lookup(
+		byte_1_high_table, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), low));
+	__m256i byte_1_low =
+		utf8_nibble_lookup(byte_1_low_table, _mm256_and_si256(prev1, low));
+	__m256i byte_2_high = utf8_nibble_lookup(
+		byte_2_high_table, _mm256_and_si256(_mm256_srli_epi16(input, 4), low));
+	__m256i special = _mm256_and_si256(
+		_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+
+	// the second and third continuation bytes of 3 and 4 byte sequences
+	// must (and may only) appear where TWO_CONTS was flagged
+	__m256i prev2 = UTF8_PREV(input, prev, 2);
+	__m256i prev3 = UTF8_PREV(input, prev, 3);
+	__m256i third = _mm256_subs_epu8(prev2, _mm256_set1_epi8(0xE0 - 0x80));
+	__m256i fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8(0xF0 - 0x80));
+	__m256i must23 = _mm256_and_si256(_mm256_or_si256(third, fourth),
+									  _mm256_set1_epi8((char)0x80));
+	return _mm256_xor_si256(must23, special);
+}
+
+static __attribute__((target("avx2"))) i64 utf8_validate_avx2(const byte *s,
+															  u64 len) {
+	// a block ending in a lead byte needs the next block to complete it
+	const __m256i max_value = _mm256_setr_epi8(
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0xF0 - 1, 0xE0 - 1,
+		0xC0 - 1);
+	__m256i prev = _mm256_setzero_si256();
+	__m256i incomplete = _mm256_setzero_si256();
+	u64 i = 0;
+	for (; i + 32 <= len; i += 32) {
+		__m256i input = _mm256_loadu_si256((const __m256i *)(s + i));
+		__m256i error;
+		if (_mm256_movemask_epi8(input) == 0)
+			error = incomplete;
+		else {
+			error = utf8_check_block(input, prev);
+			incomplete = _mm256_subs_epu8(input, max_value);
+		}
+		prev = input;
+		if (!_mm256_testz_si256(error, error))
+			return utf8_validate_scalar(s, utf8_resync(s, i), len);
+	}
+	return utf8_validate_scalar(s, utf8_resync(s, i), len);
+}
+
+static __attribute__((target("avx2,popcnt"))) u64
+utf8_count_avx2(const byte *s, u64 len, u64 *four_byte) {
+	u64 count = 0, fours = 0, i = 0;
+	for (; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+		u32 leads = _mm256_movemask_epi8(
+			_mm256_cmpgt_epi8(v, _mm256_set1_epi8((char)0xBF)));
+		u32 four = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+			_mm256_max_epu8(v, _mm256_set1_epi8((char)0xF0)), v));
+		count += __builtin_popcount(leads);
+		fours += __builtin_popcount(four);
+	}
+	u64 tail_fours;
+	count += utf8_count_scalar(s + i, len - i, &tail_fours);
+	*four_byte = fours + tail_fours;
+	return count;
+}
+
+static __attribute__((target("avx2"))) i64
+utf8_to_utf16_avx2(const byte *s, u64 len, u16 *out, u64 capacity) {
+	u64 i = 0, o = 0;
+	while (i < len) {
+		if (len - i >= 32 && capacity - o >= 32) {
+			__m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+			if (_mm256_movemask_epi8(v) == 0) {
+				_mm256_storeu_si256(
+					(__m256i *)(out + o),
+					_mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)));
+				_mm256_storeu_si256(
+					(__m256i *)(out + o + 16),
+					_mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1)));
+				i += 32;
+				o += 32;
+				continue;
+			}
+		}
+		// not ASCII: convert the block one code point at a time
+		u64 end = len - i > 32 ? i + 32 : len;
+		while (i < end)
+			if (!utf8_step16(s, len, &i, out, capacity, &o)) return -1;
+	}
+	return o;
+}
+
+static __attribute__((target("avx2"))) i64
+utf8_to_utf32_avx2(const byte *s, u64 len, u32 *out, u64 capacity) {
+	u64 i = 0, o = 0;
+	while (i < len) {
+		if (len - i >= 32 && capacity - o >= 32) {
+			__m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+			if (_mm256_movemask_epi8(v) == 0) {
+				__m128i lo = _mm256_castsi256_si128(v);
+				__m128i hi = _mm256_extracti128_si256(v, 1);
+				_mm256_storeu_si256((__m256i *)(out + o),
+									_mm256_cvtepu8_epi32(lo));
+				_mm256_storeu_si256(
+					(__m256i *)(out + o + 8),
+					_mm256_cvtepu8_epi32(_mm_srli_si128(lo, 8)));
+				_mm256_storeu_si256((__m256i *)(out + o + 16),
+									_mm256_cvtepu8_epi32(hi));
+				_mm256_storeu_si256(
+					(__m256i *)(out + o + 24),
+					_mm256_cvtepu8_epi32(_mm_srli_si128(hi, 8)));
+				i += 32;
+				o += 32;
+				continue;
+			}
+		}
+		u64 end = len - i > 32 ? i + 32 : len;
+		while (i < end)
+			if (!utf8_step32(s, len, &i, out, capacity, &o)) return -1;
+	}
+	return o;
+}
+
+static __attribute__((target("avx2"))) i64
+utf16_to_utf8_avx2(const u16 *s, u64 len, byte *out, u64 capacity) {
+	u64 i = 0, o = 0;
+	while (i < len) {
+		if (len - i >= 16 && capacity - o >= 16) {
+			__m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+			if (_mm256_testz_si256(v, _mm256_set1_epi16((short)0xFF80))) {
+				// packus interleaves the 128 bit lanes, the permute undoes it
+				__m256i packed = _mm256_permute4x64_epi64(
+					_mm256_packus_epi16(v, v), 0xD8);
+				_mm_storeu_si128((__m128i *)(out + o),
+								 _mm256_castsi256_si128(packed));
+				i += 16;
+				o += 16;
+				continue;
+			}
+		}
+		u64 end = len - i > 16 ? i + 16 : len;
+		while (i < end)
+			if (!utf16_step8(s, len, &i, out, capacity, &o)) return -1;
+	}
+	return o;
+}
+
+static __attribute__((target("avx2"))) i64
+utf32_to_utf8_avx2(const u32 *s, u64 len, byte *out, u64 capacity) {
+	u64 i = 0, o = 0;
+	while (i < len) {
+		if (len - i >= 16 && capacity - o >= 16) {
+			__m256i a = _mm256_loadu_si256((const __m256i *)(s + i));
+			__m256i b = _mm256_loadu_si256((const __m256i *)(s + i + 8));
+			if (_mm256_testz_si256(_mm256_or_si256(a, b),
+								   _mm256_set1_epi32(0xFFFFFF80))) {
+				__m256i words = _mm256_permute4x64_epi64(
+					_mm256_packus_epi32(a, b), 0xD8);
+				__m256i bytes = _mm256_permute4x64_epi64(
+					_mm256_packus_epi16(words, words), 0xD8);
+				_mm_storeu_si128((__m128i *)(out + o),
+								 _mm256_castsi256_si128(bytes));
+				i += 16;
+				o += 16;
+				continue;
+			}
+		}
+		u64 end = len - i > 16 ? i + 16 : len;
+		while (i < end)
+			if (!utf32_step8(s, &i, out, capacity, &o)) return -1;
+	}
+	return o;
+}
+
+#endif	// __x86_64__
+
+i64 utf8_validate(const byte *s, u64 len) {
+#ifdef __x86_64__
+	if (cpu_has(CPU_AVX2)) return utf8_validate_avx2(s, len);
+#endif	// __x86_64__
+	return utf8_validate_scalar(s, 0, len);
+}
+
+bool utf8_valid(const byte *s, u64 len) {
+	return utf8_validate(s, len) < 0;
+}
+
+static u64 utf8_count_dispatch(const byte *s, u64 len, u64 *four_byte) {
+#ifdef __x86_64__
+	if (cpu_has(CPU_AVX2 | CPU_POPCNT))
+		return utf8_count_avx2(s, len, four_byte);
+#endif	// __x86_64__
+	return utf8_count_scalar(s, len, four_byte);
+}
+
+u64 utf8_count(const byte *s, u64 len) {
+	u64 four_byte;
+	return utf8_count_dispatch(s, len, &four_byte);
+}
+
+u64 utf8_utf16_length(const byte *s, u64 len) {
+	// code points above U+FFFF (four byte sequences) need surrogate pairs
+	u64 four_byte;
+	u64 count = utf8_count_dispatch(s, len, &four_byte);
+	return count + four_byte;
+}
+
+i64 utf8_to_utf16(const byte *s, u64 len, u16 *out, u64 capacity) {
+#ifdef __x86_64__
+	if (cpu_has(CPU_AVX2)) return utf8_to_utf16_avx2(s, len, out, capacity);
+#endif	// __x86_64__
+	return utf8_to_utf16_scalar(s, len, out, capacity);
+}
+
+i64 utf8_to_utf32(const byte *s, u64 len, u32 *out, u64 capacity) {
+#ifdef __x86_64__
+	if (cpu_has(CPU_AVX2)) return utf8_to_utf32_avx2(s, len, out, capacity);
+#endif	// __x86_64__
+	return utf8_to_utf32_scalar(s, len, out, capacity);
+}
+
+i64 utf16_to_utf8(const u16 *s, u64 len, byte *out, u64 capacity) {
+#ifdef __x86_64__
+	if (cpu_has(CPU_AVX2)) return utf16_to_utf8_avx2(s, len, out, capacity);
+#endif	// __x86_64__
+	return utf16_to_utf8_scalar(s, len, out, capacity);
+}
+
+i64 utf32_to_utf8(const u32 *s, u64 len, byte *out, u64 capacity) {
+#ifdef __x86_64__
+	if (cpu_has(CPU_AVX2)) return utf32_to_utf8_avx2(s, len, out, capacity);
+#endif	// __x86_64__
+	return utf32_to_utf8_scalar(s, len, out, capacity);
+}
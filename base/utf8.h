@@ -0,0 +1,44 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _BASE_UTF8__
+#define _BASE_UTF8__
+
+#include <base/types.h>
+
+// Strict UTF-8 (RFC 3629): overlong forms, surrogates (U+D800 - U+DFFF) and
+// code points above U+10FFFF are rejected. With AVX2 validation runs 32
+// bytes at a time using nibble lookup tables, and transcoding converts runs
+// of ASCII 32 bytes at a time; otherwise scalar code is used.
+
+// Returns -1 if 's' is valid UTF-8, otherwise the offset of the first byte of
+// the first invalid (or truncated) sequence.
+i64 utf8_validate(const byte *s, u64 len);
+bool utf8_valid(const byte *s, u64 len);
+
+// Number of code points in valid UTF-8 (the UTF-32 length).
+u64 utf8_count(const byte *s, u64 len);
+// Number of UTF-16 code units needed for valid UTF-8.
+u64 utf8_utf16_length(const byte *s, u64 len);
+
+// Transcoders return the number of units written, or -1 if the input is
+// invalid or 'capacity' is too small. Worst cases: UTF-8 -> UTF-16/32 needs
+// 'len' units, UTF-16 -> UTF-8 3 * 'len' bytes and UTF-32 -> UTF-8
+// 4 * 'len' bytes. Unpaired surrogates in UTF-16 are invalid.
+i64 utf8_to_utf16(const byte *s, u64 len, u16 *out, u64 capacity);
+i64 utf8_to_utf32(const byte *s, u64 len, u32 *out, u64 capacity);
+i64 utf16_to_utf8(const u16 *s, u64 len, byte *out, u64 capacity);
+i64 utf32_to_utf8(const u32 *s, u64 len, byte *out, u64 capacity);
+
+#endif	// _BASE_UTF8__
@@ -0,0 +1,305 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <base/sys.h>
+#include <core/coro.h>
+
+#define CORO_SUSPENDED 0
+#define CORO_RUNNING 1
+#define CORO_WAITING 2
+#define CORO_DONE 3
+
+#ifndef PROT_NONE
+#define PROT_NONE 0
+#endif
+
+int mprotect(void *addr, size_t len, int prot);
+
+struct pollfd {
+	int fd;
+	short events;
+	short revents;
+};
+int poll(struct pollfd *fds, unsigned long nfds, int timeout);
+
+// coro_switch(save, sp) pushes the callee saved registers on the current
+// stack, stores the stack pointer in *save, then loads 'sp' and pops the
+// registers saved there. A new stack is laid out as if it had been switched
+// away from: the Coro sits in a callee saved register slot and the return
+// address is coro_start, which passes it to coro_main.
+void coro_switch(void **save, void *sp);
+void coro_start();
+
+#ifdef __APPLE__
+#define CORO_SYMBOL(name) "_" #name
+#else
+#define CORO_SYMBOL(name) #name
+#endif	// __APPLE__
+
+#if defined(__x86_64__)
+// frame: r15 r14 r13 r12 rbx rbp return (plus a word of padding)
+#define CORO_FRAME_WORDS 8
+#define CORO_FRAME_ARG 3
+#define CORO_FRAME_RETURN 6
+
+__asm__(".text\n"
+		".p2align 4\n"
+		".globl " CORO_SYMBOL(coro_switch) "\n" CORO_SYMBOL(coro_switch) ":\n"
+		"	pushq %rbp\n"
+		"	pushq %rbx\n"
+		"	pushq %r12\n"
+		"	pushq %r13\n"
+		"	pushq %r14\n"
+		"	pushq %r15\n"
+		"	movq %rsp, (%rdi)\n"
+		"	movq %rsi, %rsp\n"
+		"	popq %r15\n"
+		"	popq %r14\n"
+		"	popq %r13\n"
+		"	popq %r12\n"
+		"	popq %rbx\n"
+		"	popq %rbp\n"
+		"	ret\n"
+		".p2align 4\n"
+		".globl " CORO_SYMBOL(coro_start) "\n" CORO_SYMBOL(coro_start) ":\n"
+		"	movq %r12, %rdi\n"
+		"	andq $-16, %rsp\n"
+		"	call " CORO_SYMBOL(coro_main) "\n"
+		"	ud2\n");
+
+#elif defined(__aarch64__)
+// frame: x19-x28, x29 (fp), x30 (lr), d8-d15
+#define CORO_FRAME_WORDS 20
+#define CORO_FRAME_ARG 0
+#define CORO_FRAME_RETURN 11
+
+__asm__(".text\n"
+		".p2align 4\n"
+		".globl " CORO_SYMBOL(coro_switch) "\n" CORO_SYMBOL(coro_switch) ":\n"
+		"	sub sp, sp, #160\n"
+		"	stp x19, x20, [sp, #0]\n"
+		"	stp x21, x22, [sp, #16]\n"
+		"	stp x23, x24, [sp, #32]\n"
+		"	stp x25, x26, [sp, #48]\n"
+		"	stp x27, x28, [sp, #64]\n"
+		"	stp x29, x30, [sp, #80]\n"
+		"	stp d8, d9, [sp, #96]\n"
+		"	stp d10, d11, [sp, #112]\n"
+		"	stp d12, d13, [sp, #128]\n"
+		"	stp d14, d15, [sp, #144]\n"
+		"	mov x2, sp\n"
+		"	str x2, [x0]\n"
+		"	mov sp, x1\n"
+		"	ldp x19, x20, [sp, #0]\n"
+		"	ldp x21, x22, [sp, #16]\n"
+		"	ldp x23, x24, [sp, #32]\n"
+		"	ldp x25, x26, [sp, #48]\n"
+		"	ldp x27, x28, [sp, #64]\n"
+		"	ldp x29, x30, [sp, #80]\n"
+		"	ldp d8, d9, [sp, #96]\n"
+		"	ldp d10, d11, [sp, #112]\n"
+		"	ldp d12, d13, [sp, #128]\n"
+		"	ldp d14, d15, [sp, #144]\n"
+		"	add sp, sp, #160\n"
+		"	ret\n"
+		".p2align 4\n"
+		".globl " CORO_SYMBOL(coro_start) "\n" CORO_SYMBOL(coro_start) ":\n"
+		"	mov x0, x19\n"
+		"	bl " CORO_SYMBOL(coro_main) "\n"
+		"	brk #0\n");
+
+#else
+#error "coroutines need a context switch for this architecture"
+#endif
+
+static __thread Coro *coro_current;
+
+// First frame of every coroutine (entered from coro_start).
+__attribute__((used, noreturn)) void coro_main(Coro *c) {
+	c->fn(c->arg);
+	c->state = CORO_DONE;
+	coro_switch(&c->sp, c->caller_sp);
+	__builtin_unreachable();
+}
+
+int coro_init(Coro *c, CoroFn fn, void *arg, u64 stack_size) {
+	if (stack_size == 0) stack_size = CORO_DEFAULT_STACK;
+	// one extra page below the stack, left inaccessible to catch overflows
+	u64 pages = bytes_to_pages(stack_size) + 1;
+	byte *stack = map(pages);
+	if (!stack) return -1;
+	if (mprotect(stack, PAGE_SIZE, PROT_NONE)) {
+		unmap(stack, pages);
+		return -1;
+	}
+
+	void **frame = (void **)(stack + pages * PAGE_SIZE) - CORO_FRAME_WORDS;
+	for (u32 i = 0; i < CORO_FRAME_WORDS; i++) frame[i] = NULL;
+	frame[CORO_FRAME_ARG] = c;
+	frame[CORO_FRAME_RETURN] = (void *)coro_start;
+
+	c->sp = frame;
+	c->caller_sp = NULL;
+	c->stack = stack;
+	c->stack_pages = pages;
+	c->fn = fn;
+	c->arg = arg;
+	c->state = CORO_SUSPENDED;
+	c->sched = NULL;
+	c->next = c->waiter = NULL;
+	c->wait_fd = -1;
+	c->wait_events = 0;
+	return 0;
+}
+
+void coro_cleanup(Coro *c) {
+	if (c->stack) unmap(c->stack, c->stack_pages);
+	c->stack = NULL;
+	c->stack_pages = 0;
+}
+
+int coro_resume(Coro *c) {
+	if (c->state == CORO_DONE) return -1;
+	Coro *prev = coro_current;
+	c->state = CORO_RUNNING;
+	coro_current = c;
+	coro_switch(&c->caller_sp, c->sp);
+	coro_current = prev;
+	if (c->state == CORO_DONE) return 1;
+	if (c->state == CORO_RUNNING) c->state = CORO_SUSPENDED;
+	return 0;
+}
+
+void coro_yield() {
+	Coro *c = coro_current;
+	coro_switch(&c->sp, c->caller_sp);
+}
+
+Coro *coro_self() {
+	return coro_current;
+}
+
+bool coro_done(const Coro *c) {
+	return c->state == CORO_DONE;
+}
+
+static void coro_push(CoroSched *s, Coro *c) {
+	c->next = NULL;
+	if (s->tail)
+		s->tail->next = c;
+	else
+		s->head = c;
+	s->tail = c;
+}
+
+void coro_sched_init(CoroSched *s) {
+	s->head = s->tail = s->polling = NULL;
+	s->polling_count = s->live = 0;
+}
+
+void coro_spawn(CoroSched *s, Coro *c) {
+	c->sched = s;
+	c->waiter = NULL;
+	s->live++;
+	coro_push(s, c);
+}
+
+// Poll every waiting descriptor and queue the coroutines that are ready.
+static int coro_sched_poll(CoroSched *s, struct pollfd *fds) {
+	u64 n = 0;
+	for (Coro *c = s->polling; c; c = c->next) {
+		fds[n].fd = c->wait_fd;
+		fds[n].events = c->wait_events;
+		fds[n++].revents = 0;
+	}
+	if (poll(fds, n, -1) < 0) return -1;
+
+	Coro **link = &s->polling;
+	for (u64 i = 0; *link; i++) {
+		Coro *c = *link;
+		if (!fds[i].revents) {
+			link = &c->next;
+			continue;
+		}
+		*link = c->next;
+		s->polling_count--;
+		c->wait_events = (u16)fds[i].revents;
+		coro_push(s, c);
+	}
+	return 0;
+}
+
+int coro_sched_run(CoroSched *s) {
+	struct pollfd *fds = NULL;
+	u64 fds_pages = 0;
+	int ret = 0;
+	while (s->live) {
+		if (!s->head) {
+			// everything left is waiting on a coroutine that can't run
+			if (!s->polling) {
+				ret = -1;
+				break;
+			}
+			u64 pages =
+				bytes_to_pages(s->polling_count * sizeof(struct pollfd));
+			if (pages > fds_pages) {
+				struct pollfd *grown = remap(fds, fds_pages, pages);
+				if (!grown) {
+					ret = -1;
+					break;
+				}
+				fds = grown;
+				fds_pages = pages;
+			}
+			if (coro_sched_poll(s, fds)) {
+				ret = -1;
+				break;
+			}
+			continue;
+		}
+
+		Coro *c = s->head;
+		s->head = c->next;
+		if (!s->head) s->tail = NULL;
+		coro_resume(c);
+		if (c->state == CORO_DONE) {
+			s->live--;
+			if (c->waiter) coro_push(s, c->waiter);
+		} else if (c->state != CORO_WAITING)
+			coro_push(s, c);
+	}
+	if (fds) unmap(fds, fds_pages);
+	return ret;
+}
+
+void coro_await(Coro *c) {
+	Coro *self = coro_current;
+	if (c->state == CORO_DONE) return;
+	c->waiter = self;
+	self->state = CORO_WAITING;
+	coro_yield();
+}
+
+u32 coro_wait_fd(int fd, u32 events) {
+	Coro *self = coro_current;
+	CoroSched *s = self->sched;
+	self->wait_fd = fd;
+	self->wait_events = events;
+	self->state = CORO_WAITING;
+	self->next = s->polling;
+	s->polling = self;
+	s->polling_count++;
+	coro_yield();
+	return self->wait_events;
+}
@@ -0,0 +1,98 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _CORE_CORO__
+#define _CORE_CORO__
+
+#include <base/types.h>
+
+// Stackful coroutines. Each coroutine runs on its own mapped stack with a
+// guard page below it, and switching between coroutines is a few lines of
+// assembly (x86-64 and aarch64) that saves only the callee saved registers
+// and the stack pointer, with no system calls (unlike swapcontext, which
+// saves and restores the signal mask).
+//
+// A coroutine can be driven by hand with coro_resume / coro_yield, or
+// handed to a CoroSched, a single threaded run queue that also parks
+// coroutines waiting for another coroutine (coro_await) or for a file
+// descriptor to become ready (coro_wait_fd, multiplexed with poll).
+//
+// Coroutines never migrate: resume a coroutine only on the thread that
+// created its scheduler (or that resumed it first).
+
+#define CORO_DEFAULT_STACK (64 * 1024)
+// Readiness events for coro_wait_fd (the poll bits).
+#define CORO_READABLE 0x1
+#define CORO_WRITABLE 0x4
+
+typedef struct Coro Coro;
+typedef struct CoroSched CoroSched;
+typedef void (*CoroFn)(void *arg);
+
+struct Coro {
+	void *sp;
+	void *caller_sp;
+	byte *stack;
+	u64 stack_pages;
+	CoroFn fn;
+	void *arg;
+	u32 state;
+	// scheduler bookkeeping
+	CoroSched *sched;
+	Coro *next;
+	Coro *waiter;
+	int wait_fd;
+	u32 wait_events;
+};
+
+struct CoroSched {
+	Coro *head;
+	Coro *tail;
+	Coro *polling;
+	u64 polling_count;
+	u64 live;
+};
+
+// Prepare 'c' to run fn(arg) on a stack of at least 'stack_size' bytes
+// (CORO_DEFAULT_STACK if 0). Returns -1 if the stack or its guard page can't
+// be set up. The stack refers to 'c', so it must not move until it is cleaned
+// up.
+int coro_init(Coro *c, CoroFn fn, void *arg, u64 stack_size);
+void coro_cleanup(Coro *c);
+
+// Run 'c' until it yields or returns. Returns 0 if it yielded, 1 if it has
+// finished and -1 if it had already finished.
+int coro_resume(Coro *c);
+// Suspend the running coroutine, returning to whoever resumed it.
+void coro_yield();
+// The running coroutine, or NULL outside of one.
+Coro *coro_self();
+bool coro_done(const Coro *c);
+
+void coro_sched_init(CoroSched *s);
+// Queue 'c' to run; it belongs to 's' until it finishes.
+void coro_spawn(CoroSched *s, Coro *c);
+// Run queued coroutines until all of them have finished, polling when every
+// live coroutine is waiting on a file descriptor. Returns -1 if poll fails
+// or if coroutines are left waiting on each other.
+int coro_sched_run(CoroSched *s);
+
+// From a coroutine of a scheduler: suspend until 'c' (of the same
+// scheduler) finishes. Only one coroutine may await a given coroutine.
+void coro_await(Coro *c);
+// From a coroutine of a scheduler: suspend until 'fd' is ready for one of
+// 'events'. Returns the events reported by poll (which may include errors).
+u32 coro_wait_fd(int fd, u32 events);
+
+#endif	// _CORE_CORO__
@@ -0,0 +1,254 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <base/sys.h>
+#include <base/util.h>
+#include <core/ebr.h>
+
+typedef struct EbrRetired {
+	void *ptr;
+	EbrFree fn;
+	void *ctx;
+} EbrRetired;
+
+// A page of nodes retired in the same epoch; a thread's batches are listed
+// newest first.
+struct EbrBatch {
+	EbrBatch *next;
+	u64 epoch;
+	u64 count;
+	EbrRetired items[];
+};
+
+// 'state' is (epoch << 1) | 1 while pinned and 0 otherwise. It has a cache
+// line to itself since other threads read it on every advance attempt.
+struct EbrThread {
+	u64 state;
+	void *hazards[EBR_HAZARDS];
+	Ebr *ebr __attribute__((aligned(64)));
+	EbrThread *next;
+	bool in_use;
+	u32 depth;
+	EbrBatch *batches;
+	EbrBatch *spare;
+	u64 pending;
+	u64 since_flush;
+} __attribute__((aligned(64)));
+
+#define EBR_BATCH_PAGES 1
+#define EBR_BATCH_ITEMS \
+	((EBR_BATCH_PAGES * PAGE_SIZE - sizeof(EbrBatch)) / sizeof(EbrRetired))
+
+int ebr_init(Ebr *e, u32 mode) {
+	if (mode != EBR_MODE_EPOCH && mode != EBR_MODE_HAZARD) return -1;
+	e->epoch = 0;
+	e->mode = mode;
+	e->threads = NULL;
+	e->orphans = NULL;
+	e->lock = false;
+	return 0;
+}
+
+static void ebr_free_batch(EbrBatch *b) {
+	for (u64 i = 0; i < b->count; i++)
+		b->items[i].fn(b->items[i].ptr, b->items[i].ctx);
+	unmap(b, EBR_BATCH_PAGES);
+}
+
+void ebr_cleanup(Ebr *e) {
+	for (EbrBatch *b = e->orphans, *next; b; b = next) {
+		next = b->next;
+		ebr_free_batch(b);
+	}
+	for (EbrThread *t = e->threads, *next; t; t = next) {
+		next = t->next;
+		unmap(t, bytes_to_pages(sizeof(EbrThread)));
+	}
+	e->orphans = NULL;
+	e->threads = NULL;
+}
+
+EbrThread *ebr_register(Ebr *e) {
+	EbrThread *t = __atomic_load_n(&e->threads, __ATOMIC_ACQUIRE);
+	for (; t; t = t->next) {
+		bool free = false;
+		if (__atomic_compare_exchange_n(&t->in_use, &free, true, false,
+										__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			return t;
+	}
+
+	// records are never unmapped before cleanup: other threads scan them
+	t = map(bytes_to_pages(sizeof(EbrThread)));
+	if (!t) return NULL;
+	t->ebr = e;
+	t->in_use = true;
+	spin_lock(&e->lock);
+	t->next = e->threads;
+	__atomic_store_n(&e->threads, t, __ATOMIC_RELEASE);
+	spin_unlock(&e->lock);
+	return t;
+}
+
+void ebr_unregister(EbrThread *t) {
+	Ebr *e = t->ebr;
+	ebr_flush(t);
+	if (t->batches) {
+		EbrBatch *last = t->batches;
+		while (last->next) last = last->next;
+		spin_lock(&e->lock);
+		last->next = e->orphans;
+		// read without the lock by ebr_flush
+		__atomic_store_n(&e->orphans, t->batches, __ATOMIC_RELAXED);
+		spin_unlock(&e->lock);
+	}
+	if (t->spare) unmap(t->spare, EBR_BATCH_PAGES);
+	t->batches = t->spare = NULL;
+	t->pending = t->since_flush = 0;
+	t->depth = 0;
+	for (u32 i = 0; i < EBR_HAZARDS; i++) ebr_clear(t, i);
+	__atomic_store_n(&t->state, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&t->in_use, false, __ATOMIC_RELEASE);
+}
+
+void ebr_pin(EbrThread *t) {
+	if (t->depth++ || t->ebr->mode != EBR_MODE_EPOCH) return;
+	u64 epoch = __atomic_load_n(&t->ebr->epoch, __ATOMIC_RELAXED);
+	__atomic_store_n(&t->state, (epoch << 1) | 1, __ATOMIC_RELAXED);
+	// the announcement must be visible before any read of the structure
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void ebr_unpin(EbrThread *t) {
+	if (--t->depth || t->ebr->mode != EBR_MODE_EPOCH) return;
+	__atomic_store_n(&t->state, 0, __ATOMIC_RELEASE);
+}
+
+void *ebr_protect(EbrThread *t, u32 slot, void *const *src) {
+	void *p = __atomic_load_n(src, __ATOMIC_ACQUIRE);
+	if (t->ebr->mode != EBR_MODE_HAZARD) return p;
+	for (;;) {
+		__atomic_store_n(&t->hazards[slot], p, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		void *again = __atomic_load_n(src, __ATOMIC_ACQUIRE);
+		if (again == p) return p;
+		p = again;
+	}
+}
+
+void ebr_clear(EbrThread *t, u32 slot) {
+	__atomic_store_n(&t->hazards[slot], NULL, __ATOMIC_RELEASE);
+}
+
+// Advance the epoch if every pinned thread has seen the current one.
+static u64 ebr_advance(Ebr *e) {
+	u64 epoch = __atomic_load_n(&e->epoch, __ATOMIC_ACQUIRE);
+	EbrThread *t = __atomic_load_n(&e->threads, __ATOMIC_ACQUIRE);
+	for (; t; t = t->next) {
+		u64 state = __atomic_load_n(&t->state, __ATOMIC_ACQUIRE);
+		if ((state & 1) && (state >> 1) != epoch) return epoch;
+	}
+	// losing the race means another thread advanced it
+	if (__atomic_compare_exchange_n(&e->epoch, &epoch, epoch + 1, false,
+									__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		epoch++;
+	return epoch;
+}
+
+static bool ebr_hazardous(Ebr *e, void *ptr) {
+	EbrThread *t = __atomic_load_n(&e->threads, __ATOMIC_ACQUIRE);
+	for (; t; t = t->next)
+		for (u32 i = 0; i < EBR_HAZARDS; i++)
+			if (__atomic_load_n(&t->hazards[i], __ATOMIC_ACQUIRE) == ptr)
+				return true;
+	return false;
+}
+
+// Free what is safe in a list of batches, unlinking batches that empty.
+// Returns the number of nodes freed.
+static u64 ebr_reclaim(Ebr *e, EbrBatch **list, u64 epoch, EbrBatch **spare) {
+	u64 freed = 0;
+	if (e->mode == EBR_MODE_HAZARD)
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	for (EbrBatch **link = list; *link;) {
+		EbrBatch *b = *link;
+		if (e->mode == EBR_MODE_EPOCH) {
+			if (b->epoch + 2 > epoch) {
+				link = &b->next;
+				continue;
+			}
+			freed += b->count;
+			for (u64 i = 0; i < b->count; i++)
+				b->items[i].fn(b->items[i].ptr, b->items[i].ctx);
+			b->count = 0;
+		} else {
+			u64 kept = 0;
+			for (u64 i = 0; i < b->count; i++) {
+				EbrRetired *r = &b->items[i];
+				if (ebr_hazardous(e, r->ptr))
+					b->items[kept++] = *r;
+				else
+					r->fn(r->ptr, r->ctx);
+			}
+			freed += b->count - kept;
+			b->count = kept;
+		}
+		if (b->count) {
+			link = &b->next;
+			continue;
+		}
+		__atomic_store_n(link, b->next, __ATOMIC_RELAXED);
+		if (spare && !*spare)
+			*spare = b;
+		else
+			unmap(b, EBR_BATCH_PAGES);
+	}
+	return freed;
+}
+
+void ebr_flush(EbrThread *t) {
+	Ebr *e = t->ebr;
+	u64 epoch = e->mode == EBR_MODE_EPOCH ? ebr_advance(e) : 0;
+	t->pending -= ebr_reclaim(e, &t->batches, epoch, &t->spare);
+	t->since_flush = 0;
+	if (__atomic_load_n(&e->orphans, __ATOMIC_RELAXED) &&
+		spin_try_lock(&e->lock)) {
+		ebr_reclaim(e, &e->orphans, epoch, NULL);
+		spin_unlock(&e->lock);
+	}
+}
+
+int ebr_retire(EbrThread *t, void *ptr, EbrFree fn, void *ctx) {
+	Ebr *e = t->ebr;
+	u64 epoch = __atomic_load_n(&e->epoch, __ATOMIC_ACQUIRE);
+	EbrBatch *b = t->batches;
+	if (!b || b->epoch != epoch || b->count == EBR_BATCH_ITEMS) {
+		if (t->spare) {
+			b = t->spare;
+			t->spare = NULL;
+		} else if (!(b = map(EBR_BATCH_PAGES)))
+			return -1;
+		b->epoch = epoch;
+		b->count = 0;
+		b->next = t->batches;
+		t->batches = b;
+	}
+	b->items[b->count++] = (EbrRetired){ptr, fn, ctx};
+	t->pending++;
+	if (++t->since_flush >= EBR_BATCH) ebr_flush(t);
+	return 0;
+}
+
+u64 ebr_pending(const EbrThread *t) {
+	return t->pending;
+}
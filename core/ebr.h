@@ -0,0 +1,87 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _CORE_EBR__
+#define _CORE_EBR__
+
+#include <base/types.h>
+
+// Safe memory reclamation for lock free data structures: a node unlinked by
+// one thread may still be read by others, so instead of freeing it the
+// thread retires it and the domain frees it once no reader can hold it.
+//
+// EBR_MODE_EPOCH: readers pin the domain around each operation (a store to
+// their own participant record and a fence). A global epoch advances once
+// every pinned thread has seen the current one; nodes retired in epoch e
+// are freed once the epoch reaches e + 2. Reads are as cheap as it gets,
+// but one thread that stays pinned holds back all reclamation.
+//
+// EBR_MODE_HAZARD: readers publish each pointer they are about to follow in
+// one of EBR_HAZARDS hazard slots (ebr_protect), and a retired node is freed
+// as soon as no slot holds it. Costs a fence per protected pointer, but the
+// garbage is bounded even if a reader stalls.
+//
+// Retired nodes are kept in per thread batches of a page and reclaimed
+// together once EBR_BATCH of them are pending, so freeing is amortized.
+
+#define EBR_MODE_EPOCH 0
+#define EBR_MODE_HAZARD 1
+#define EBR_HAZARDS 4
+#define EBR_BATCH 64
+
+typedef void (*EbrFree)(void *ptr, void *ctx);
+
+typedef struct EbrThread EbrThread;
+typedef struct EbrBatch EbrBatch;
+
+typedef struct Ebr {
+	u64 epoch;
+	u32 mode;
+	EbrThread *threads;
+	// batches left by threads that unregistered with nodes pending
+	EbrBatch *orphans;
+	bool lock;
+} Ebr;
+
+int ebr_init(Ebr *e, u32 mode);
+// Frees everything still retired. No thread may be registered.
+void ebr_cleanup(Ebr *e);
+
+// Participant record for the calling thread (records of threads that
+// unregistered are reused). Returns NULL if it can't be mapped.
+EbrThread *ebr_register(Ebr *e);
+// Pending nodes are handed to the domain, to be freed later.
+void ebr_unregister(EbrThread *t);
+
+// Critical section (epoch mode; no-ops in hazard mode). Pointers read from
+// the structure are valid until the matching unpin. Pins nest.
+void ebr_pin(EbrThread *t);
+void ebr_unpin(EbrThread *t);
+
+// Load *src and protect the pointer in hazard slot 'slot' (hazard mode),
+// retrying until the slot is published before *src changes. In epoch mode
+// this is a plain acquire load.
+void *ebr_protect(EbrThread *t, u32 slot, void *const *src);
+void ebr_clear(EbrThread *t, u32 slot);
+
+// Free 'ptr' with fn(ptr, ctx) once no reader can hold it. 'ptr' must
+// already be unreachable for new readers. Returns -1 if a batch can't be
+// mapped (the node is then not retired).
+int ebr_retire(EbrThread *t, void *ptr, EbrFree fn, void *ctx);
+// Try to advance the epoch and free what has become safe now.
+void ebr_flush(EbrThread *t);
+// Nodes retired by 't' that are not freed yet.
+u64 ebr_pending(const EbrThread *t);
+
+#endif	// _CORE_EBR__
@@ -0,0 +1,403 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <base/cpu.h>
+#include <base/sys.h>
+#include <base/util.h>
+#include <core/filter.h>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif	// __x86_64__
+
+#define BLOOM_BLOCK_WORDS 8
+#define BLOOM_BLOCK_BYTES 32
+
+#define CUCKOO_SLOTS 4
+#define CUCKOO_LOAD 0.9
+#define CUCKOO_MAX_KICKS 500
+#define CUCKOO_RNG_SEED 0x9E3779B97F4A7C15ULL
+
+typedef u64 FilterU64u __attribute__((aligned(1), may_alias));
+
+// Odd multipliers picking the bit in each word of a block (the ones of the
+// Parquet split block Bloom filter).
+static const u32 bloom_salt[BLOOM_BLOCK_WORDS]
+	__attribute__((aligned(32))) = {0x47b6137bU, 0x44974d91U, 0x8824ad5bU,
+									0xa2b7289dU, 0x705495c7U, 0x2df1424bU,
+									0x9efc4947U, 0x5c6bfb31U};
+
+static u64 filter_fmix(u64 h) {
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+u64 filter_hash(const void *data, u64 len) {
+	const byte *p = data;
+	u64 h = len * 0x9E3779B97F4A7C15ULL, w = 0;
+	for (; len >= 8; p += 8, len -= 8) {
+		h = (h ^ *(const FilterU64u *)p) * 0xD6E8FEB86659FD93ULL;
+		h ^= h >> 32;
+	}
+	for (u64 i = 0; i < len; i++) w |= (u64)p[i] << (8 * i);
+	return filter_fmix(h ^ w);
+}
+
+// e^x for x <= 0, by squaring a short Taylor series (there is no libm).
+static f64 filter_exp(f64 x) {
+	u32 squarings = 0;
+	while (x < -0.5) {
+		x /= 2;
+		squarings++;
+	}
+	f64 term = 1, sum = 1;
+	for (u32 i = 1; i < 16; i++) {
+		term *= x / i;
+		sum += term;
+	}
+	while (squarings--) sum *= sum;
+	return sum;
+}
+
+// Keys per block are Poisson distributed with mean 'lambda'; a block with j
+// keys has each bit of a word set with probability 1 - (31/32)^j.
+static f64 bloom_model(f64 lambda) {
+	if (lambda > 200) return 1;
+	f64 pmf = filter_exp(-lambda), clear = 1, fpr = 0;
+	u64 limit = (u64)(2 * lambda) + 100;
+	for (u64 j = 0; j <= limit; j++) {
+		if (j) {
+			pmf *= lambda / j;
+			clear *= 31.0 / 32.0;
+		}
+		f64 set = 1 - clear, hit = set * set;
+		hit *= hit;
+		fpr += pmf * hit * hit;
+	}
+	return fpr < 1 ? fpr : 1;
+}
+
+int bloom_init(Bloom *b, u64 keys, f64 fpr) {
+	if (!(fpr > 0 && fpr < 1)) return -1;
+	if (!keys) keys = 1;
+	// the rate falls as blocks are added: find the fewest that reach 'fpr'
+	u64 lo = 1, hi = keys + 1;
+	while (lo < hi) {
+		u64 mid = lo + (hi - lo) / 2;
+		if (bloom_model((f64)keys / mid) <= fpr)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	b->blocks = lo;
+	b->pages = bytes_to_pages(b->blocks * BLOOM_BLOCK_BYTES);
+	if (!(b->words = map(b->pages))) return -1;
+	return 0;
+}
+
+void bloom_cleanup(Bloom *b) {
+	if (b->pages) unmap(b->words, b->pages);
+	b->words = NULL;
+	b->pages = 0;
+}
+
+f64 bloom_fpr(const Bloom *b, u64 keys) {
+	return b->blocks ? bloom_model((f64)keys / b->blocks) : 1;
+}
+
+static u32 *bloom_block(const Bloom *b, u64 hash) {
+	return b->words + (u64)(((u128)hash * b->blocks) >> 64) * BLOOM_BLOCK_WORDS;
+}
+
+static void bloom_add_generic(u32 *block, u32 key) {
+	for (u32 i = 0; i < BLOOM_BLOCK_WORDS; i++)
+		block[i] |= 1U << ((key * bloom_salt[i]) >> 27);
+}
+
+static bool bloom_contains_generic(const u32 *block, u32 key) {
+	u32 missing = 0;
+	for (u32 i = 0; i < BLOOM_BLOCK_WORDS; i++)
+		missing |= ~block[i] & (1U << ((key * bloom_salt[i]) >> 27));
+	return !missing;
+}
+
+#ifdef __x86_64__
+static inline __attribute__((target("avx2"), always_inline)) __m256i
+bloom_mask_avx2(u32 key) {
+	__m256i salt = _mm256_load_si256((const __m256i *)bloom_salt);
+	__m256i bits = _mm256_srli_epi32(
+		_mm256_mullo_epi32(_mm256_set1_epi32(key), salt), 27);
+	return _mm256_sllv_epi32(_mm256_set1_epi32(1), bits);
+}
+
+static __attribute__((target("avx2"))) void bloom_add_avx2(u32 *block,
+														   u32 key) {
+	__m256i *p = (__m256i *)block;
+	__m256i v = _mm256_or_si256(_mm256_load_si256(p), bloom_mask_avx2(key));
+	_mm256_store_si256(p, v);
+}
+
+static __attribute__((target("avx2"))) bool bloom_contains_avx2(
+	const u32 *block, u32 key) {
+	__m256i v = _mm256_load_si256((const __m256i *)block);
+	return _mm256_testc_si256(v, bloom_mask_avx2(key));
+}
+#endif	// __x86_64__
+
+void bloom_add(Bloom *b, u64 hash) {
+#ifdef __x86_64__
+	if (cpu_has(CPU_AVX2))
+		bloom_add_avx2(bloom_block(b, hash), hash);
+	else
+#endif	// __x86_64__
+		bloom_add_generic(bloom_block(b, hash), hash);
+}
+
+bool bloom_contains(const Bloom *b, u64 hash) {
+#ifdef __x86_64__
+	if (cpu_has(CPU_AVX2))
+		return bloom_contains_avx2(bloom_block(b, hash), hash);
+#endif	// __x86_64__
+	return bloom_contains_generic(bloom_block(b, hash), hash);
+}
+
+u64 bloom_size(const Bloom *b) {
+	return FILTER_HEADER_BYTES + b->blocks * BLOOM_BLOCK_BYTES;
+}
+
+int bloom_serialize(const Bloom *b, void *buf, u64 capacity) {
+	if (capacity < bloom_size(b)) return -1;
+	u64 *header = buf;
+	set_bytes(buf, 0, FILTER_HEADER_BYTES);
+	header[0] = FILTER_BLOOM_MAGIC;
+	header[1] = b->blocks;
+	copy_bytes((byte *)buf + FILTER_HEADER_BYTES, (const byte *)b->words,
+			   b->blocks * BLOOM_BLOCK_BYTES);
+	return 0;
+}
+
+int bloom_view(Bloom *b, const void *buf, u64 len) {
+	const u64 *header = buf;
+	if ((u64)buf % BLOOM_BLOCK_BYTES || len < FILTER_HEADER_BYTES ||
+		header[0] != FILTER_BLOOM_MAGIC || !header[1] ||
+		header[1] > (len - FILTER_HEADER_BYTES) / BLOOM_BLOCK_BYTES)
+		return -1;
+	b->blocks = header[1];
+	b->words = (u32 *)((const byte *)buf + FILTER_HEADER_BYTES);
+	b->pages = 0;
+	return 0;
+}
+
+// Fingerprints are never 0, which marks an empty slot.
+static u32 cuckoo_fp(const Cuckoo *c, u64 hash) {
+	u32 fp = hash & (c->fp_bytes == 4 ? ~0U : (1U << (8 * c->fp_bytes)) - 1);
+	return fp ? fp : 1;
+}
+
+static u64 cuckoo_index(const Cuckoo *c, u64 hash) {
+	return ((u128)hash * c->buckets) >> 64;
+}
+
+// (h(fp) - i) mod buckets: applying it twice gives back i, so the table size
+// needn't be a power of two.
+static u64 cuckoo_alt(const Cuckoo *c, u64 i, u32 fp) {
+	u64 h = cuckoo_index(c, fp * 0x5851F42D4C957F2DULL);
+	return h >= i ? h - i : h + c->buckets - i;
+}
+
+static u32 cuckoo_get(const Cuckoo *c, u64 bucket, u32 slot) {
+	u64 i = bucket * CUCKOO_SLOTS + slot;
+	if (c->fp_bytes == 1) return c->table[i];
+	if (c->fp_bytes == 2) return ((const u16 *)c->table)[i];
+	return ((const u32 *)c->table)[i];
+}
+
+static void cuckoo_set(Cuckoo *c, u64 bucket, u32 slot, u32 fp) {
+	u64 i = bucket * CUCKOO_SLOTS + slot;
+	if (c->fp_bytes == 1)
+		c->table[i] = fp;
+	else if (c->fp_bytes == 2)
+		((u16 *)c->table)[i] = fp;
+	else
+		((u32 *)c->table)[i] = fp;
+}
+
+// SWAR compare of the whole bucket for the small fingerprint sizes.
+static bool cuckoo_bucket_has(const Cuckoo *c, u64 bucket, u32 fp) {
+	if (c->fp_bytes == 1) {
+		u32 w = ((const u32 *)c->table)[bucket] ^ (fp * 0x01010101U);
+		return (w - 0x01010101U) & ~w & 0x80808080U;
+	}
+	if (c->fp_bytes == 2) {
+		u64 w = ((const u64 *)c->table)[bucket] ^ (fp * 0x0001000100010001ULL);
+		return (w - 0x0001000100010001ULL) & ~w & 0x8000800080008000ULL;
+	}
+	const u32 *slots = (const u32 *)c->table + bucket * CUCKOO_SLOTS;
+	return (slots[0] == fp) | (slots[1] == fp) | (slots[2] == fp) |
+		   (slots[3] == fp);
+}
+
+static bool cuckoo_put(Cuckoo *c, u64 bucket, u32 fp) {
+	for (u32 slot = 0; slot < CUCKOO_SLOTS; slot++)
+		if (!cuckoo_get(c, bucket, slot)) {
+			cuckoo_set(c, bucket, slot, fp);
+			return true;
+		}
+	return false;
+}
+
+static bool cuckoo_take(Cuckoo *c, u64 bucket, u32 fp) {
+	for (u32 slot = 0; slot < CUCKOO_SLOTS; slot++)
+		if (cuckoo_get(c, bucket, slot) == fp) {
+			cuckoo_set(c, bucket, slot, 0);
+			return true;
+		}
+	return false;
+}
+
+int cuckoo_init(Cuckoo *c, u64 keys, f64 fpr) {
+	if (!(fpr > 0 && fpr < 1)) return -1;
+	// a lookup compares 2 * CUCKOO_SLOTS fingerprints of 8 * fp_bytes bits
+	if (fpr >= 8.0 / 256)
+		c->fp_bytes = 1;
+	else if (fpr >= 8.0 / 65536)
+		c->fp_bytes = 2;
+	else
+		c->fp_bytes = 4;
+	c->buckets = (u64)(keys / (CUCKOO_SLOTS * CUCKOO_LOAD)) + 1;
+	c->victim_fp = 0;
+	c->victim_bucket = 0;
+	c->count = 0;
+	rng_seed(&c->rng, CUCKOO_RNG_SEED);
+	c->pages = bytes_to_pages(cuckoo_size(c) - FILTER_HEADER_BYTES);
+	if (!(c->table = map(c->pages))) return -1;
+	return 0;
+}
+
+void cuckoo_cleanup(Cuckoo *c) {
+	if (c->pages) unmap(c->table, c->pages);
+	c->table = NULL;
+	c->pages = 0;
+}
+
+// Place 'fp' in bucket 'i' or its alternate, evicting random fingerprints to
+// their other bucket until one fits. The last one evicted waits aside as the
+// victim if that fails.
+static void cuckoo_insert(Cuckoo *c, u64 i, u32 fp) {
+	u64 alt = cuckoo_alt(c, i, fp);
+	if (cuckoo_put(c, i, fp) || cuckoo_put(c, alt, fp)) return;
+	if (rng_next(&c->rng) & 1) i = alt;
+	for (u32 kick = 0; kick < CUCKOO_MAX_KICKS; kick++) {
+		u32 slot = rng_bounded(&c->rng, CUCKOO_SLOTS);
+		u32 evicted = cuckoo_get(c, i, slot);
+		cuckoo_set(c, i, slot, fp);
+		fp = evicted;
+		i = cuckoo_alt(c, i, fp);
+		if (cuckoo_put(c, i, fp)) return;
+	}
+	c->victim_fp = fp;
+	c->victim_bucket = i;
+}
+
+int cuckoo_add(Cuckoo *c, u64 hash) {
+	if (c->victim_fp) return -1;
+	c->count++;
+	cuckoo_insert(c, cuckoo_index(c, hash), cuckoo_fp(c, hash));
+	return 0;
+}
+
+bool cuckoo_contains(const Cuckoo *c, u64 hash) {
+	u32 fp = cuckoo_fp(c, hash);
+	u64 i = cuckoo_index(c, hash);
+	u64 alt = cuckoo_alt(c, i, fp);
+	if (cuckoo_bucket_has(c, i, fp) || cuckoo_bucket_has(c, alt, fp))
+		return true;
+	return c->victim_fp == fp &&
+		   (c->victim_bucket == i || c->victim_bucket == alt);
+}
+
+int cuckoo_remove(Cuckoo *c, u64 hash) {
+	u32 fp = cuckoo_fp(c, hash);
+	u64 i = cuckoo_index(c, hash);
+	u64 alt = cuckoo_alt(c, i, fp);
+	if (cuckoo_take(c, i, fp) || cuckoo_take(c, alt, fp)) {
+		// there may be room for the victim now
+		u32 victim = c->victim_fp;
+		c->victim_fp = 0;
+		if (victim) cuckoo_insert(c, c->victim_bucket, victim);
+	} else if (c->victim_fp == fp &&
+			   (c->victim_bucket == i || c->victim_bucket == alt))
+		c->victim_fp = 0;
+	else
+		return -1;
+	c->count--;
+	return 0;
+}
+
+u64 cuckoo_count(const Cuckoo *c) {
+	return c->count;
+}
+
+u64 cuckoo_size(const Cuckoo *c) {
+	return FILTER_HEADER_BYTES + c->buckets * CUCKOO_SLOTS * c->fp_bytes;
+}
+
+typedef struct CuckooHeader {
+	u64 magic;
+	u64 buckets;
+	u32 fp_bytes;
+	u32 victim_fp;
+	u64 victim_bucket;
+	u64 count;
+} CuckooHeader;
+
+int cuckoo_serialize(const Cuckoo *c, void *buf, u64 capacity) {
+	if (capacity < cuckoo_size(c)) return -1;
+	CuckooHeader *header = buf;
+	set_bytes(buf, 0, FILTER_HEADER_BYTES);
+	header->magic = FILTER_CUCKOO_MAGIC;
+	header->buckets = c->buckets;
+	header->fp_bytes = c->fp_bytes;
+	header->victim_fp = c->victim_fp;
+	header->victim_bucket = c->victim_bucket;
+	header->count = c->count;
+	copy_bytes((byte *)buf + FILTER_HEADER_BYTES, c->table,
+			   cuckoo_size(c) - FILTER_HEADER_BYTES);
+	return 0;
+}
+
+int cuckoo_view(Cuckoo *c, const void *buf, u64 len) {
+	const CuckooHeader *header = buf;
+	if ((u64)buf % 8 || len < FILTER_HEADER_BYTES ||
+		header->magic != FILTER_CUCKOO_MAGIC || !header->buckets)
+		return -1;
+	if (header->fp_bytes != 1 && header->fp_bytes != 2 &&
+		header->fp_bytes != 4)
+		return -1;
+	c->buckets = header->buckets;
+	c->fp_bytes = header->fp_bytes;
+	if (c->buckets > (len - FILTER_HEADER_BYTES) / CUCKOO_SLOTS / c->fp_bytes)
+		return -1;
+	c->victim_fp = header->victim_fp;
+	c->victim_bucket = header->victim_bucket;
+	c->count = header->count;
+	rng_seed(&c->rng, CUCKOO_RNG_SEED);
+	c->table = (byte *)buf + FILTER_HEADER_BYTES;
+	c->pages = 0;
+	return 0;
+}
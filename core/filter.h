@@ -0,0 +1,91 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _CORE_FILTER__
+#define _CORE_FILTER__
+
+#include <base/random.h>
+#include <base/types.h>
+
+// Approximate membership filters: 'contains' may report a key that was never
+// added (at about the false positive rate the filter was sized for) but never
+// misses one that was. Keys are given as 64 bit hashes (filter_hash, or any
+// well mixed hash).
+//
+// Bloom: split block Bloom filter. A key sets 8 bits in one 32 byte block,
+// one bit in each 32 bit word, so a lookup touches a single cache line and
+// is a handful of SIMD instructions (AVX2 when available). Keys can't be
+// removed.
+//
+// Cuckoo: buckets of 4 fingerprints of 1, 2 or 4 bytes; a key lives in one
+// of two buckets, so a lookup reads two and keys can be removed. Inserts
+// fail once the table is about 95% full.
+//
+// Both serialize to a flat buffer (a header and the table) that a view can
+// use in place, for instance straight from map_file.
+
+#define FILTER_BLOOM_MAGIC 0x4D4F4F4C42ULL	  // "BLOOM"
+#define FILTER_CUCKOO_MAGIC 0x4F4F4B435543ULL  // "CUCKOO"
+#define FILTER_HEADER_BYTES 64
+
+typedef struct Bloom {
+	u32 *words;	 // 8 per block
+	u64 blocks;
+	u64 pages;	// 0 for a view
+} Bloom;
+
+typedef struct Cuckoo {
+	byte *table;
+	u64 buckets;
+	u32 fp_bytes;
+	// a fingerprint evicted when the table filled up (0 if none)
+	u32 victim_fp;
+	u64 victim_bucket;
+	u64 count;
+	Rng rng;  // picks evictions, with a fixed seed so builds are reproducible
+	u64 pages;	// 0 for a view
+} Cuckoo;
+
+u64 filter_hash(const void *data, u64 len);
+
+// Sized for 'keys' keys at a false positive rate of 'fpr' (0 < fpr < 1).
+int bloom_init(Bloom *b, u64 keys, f64 fpr);
+void bloom_cleanup(Bloom *b);
+void bloom_add(Bloom *b, u64 hash);
+bool bloom_contains(const Bloom *b, u64 hash);
+// Expected false positive rate after 'keys' adds.
+f64 bloom_fpr(const Bloom *b, u64 keys);
+// Serialized size, and serialization into 'buf' (-1 if 'capacity' is short).
+u64 bloom_size(const Bloom *b);
+int bloom_serialize(const Bloom *b, void *buf, u64 capacity);
+// Use a serialized filter in place: 'buf' must be 32 byte aligned and
+// outlive the view, and must be writable to add keys. Cleanup is a no-op.
+int bloom_view(Bloom *b, const void *buf, u64 len);
+
+int cuckoo_init(Cuckoo *c, u64 keys, f64 fpr);
+void cuckoo_cleanup(Cuckoo *c);
+// Returns -1 if the table is full (the key is not added).
+int cuckoo_add(Cuckoo *c, u64 hash);
+bool cuckoo_contains(const Cuckoo *c, u64 hash);
+// Remove a key that was added; removing one that wasn't may remove another
+// key with the same fingerprint. Returns -1 if no fingerprint matches.
+int cuckoo_remove(Cuckoo *c, u64 hash);
+u64 cuckoo_count(const Cuckoo *c);
+u64 cuckoo_size(const Cuckoo *c);
+int cuckoo_serialize(const Cuckoo *c, void *buf, u64 capacity);
+// Lookups on a serialized filter in place ('buf' must be 8 byte aligned and
+// outlive the view). The header isn't updated by later adds or removes.
+int cuckoo_view(Cuckoo *c, const void *buf, u64 len);
+
+#endif	// _CORE_FILTER__
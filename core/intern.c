@@ -0,0 +1,217 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <base/crc32c.h>
+#include <base/sys.h>
+#include <base/util.h>
+#include <core/intern.h>
+
+#define INTERN_SEGMENT_LOG 10
+#define INTERN_MIN_SLOTS 1024
+#define INTERN_CHUNK_PAGES 16
+
+// Slots hold (hash << 32) | (id + 1); zero is empty. Tables are never
+// unmapped while the Intern is alive: 'prev' chains the replaced ones.
+struct InternTable {
+	InternTable *prev;
+	u64 pages;
+	u64 mask;
+	u64 used;
+	u64 slots[];
+};
+
+// Arena chunks, each holding entries of { u64 len; char bytes[len + 1] }
+// aligned to 8 bytes. The directory points at the bytes.
+struct InternChunk {
+	InternChunk *next;
+	u64 pages;
+};
+
+static InternTable *intern_table_new(u64 slots) {
+	u64 pages = bytes_to_pages(sizeof(InternTable) + slots * sizeof(u64));
+	InternTable *t = map(pages);
+	if (!t) return NULL;
+	t->prev = NULL;
+	t->pages = pages;
+	t->mask = slots - 1;
+	t->used = 0;
+	set_bytes((byte *)t->slots, 0, slots * sizeof(u64));
+	return t;
+}
+
+// Directory position of 'id': segment k starts at ID (1024 << k) - 1024.
+static const char **intern_entry(const Intern *in, u32 id) {
+	u64 n = (u64)id + (1 << INTERN_SEGMENT_LOG);
+	u32 k = 63 - __builtin_clzll(n) - INTERN_SEGMENT_LOG;
+	const char **segment = __atomic_load_n(&in->segments[k], __ATOMIC_ACQUIRE);
+	return segment + (n - ((u64)1 << (k + INTERN_SEGMENT_LOG)));
+}
+
+static u64 intern_entry_len(const char *bytes) {
+	return ((const u64 *)bytes)[-1];
+}
+
+static bool intern_matches(const char *entry, const char *bytes, u64 len) {
+	if (intern_entry_len(entry) != len) return false;
+	for (u64 i = 0; i < len; i++)
+		if (entry[i] != bytes[i]) return false;
+	return true;
+}
+
+// Probe 't' for the string; returns its ID + 1, or 0 if it isn't there.
+static u64 intern_probe(const Intern *in, const InternTable *t,
+						const char *bytes, u64 len, u32 hash) {
+	for (u64 i = hash & t->mask;; i = (i + 1) & t->mask) {
+		u64 slot = __atomic_load_n(&t->slots[i], __ATOMIC_ACQUIRE);
+		if (!slot) return 0;
+		if ((u32)(slot >> 32) != hash) continue;
+		u32 id = (u32)slot - 1;
+		if (intern_matches(*intern_entry(in, id), bytes, len)) return slot;
+	}
+}
+
+static void intern_place(InternTable *t, u64 slot) {
+	u64 i = (slot >> 32) & t->mask;
+	while (t->slots[i]) i = (i + 1) & t->mask;
+	__atomic_store_n(&t->slots[i], slot, __ATOMIC_RELEASE);
+	t->used++;
+}
+
+// Double the table (called with the lock held). The new table is filled
+// before it is published; the old one stays readable.
+static int intern_grow(Intern *in) {
+	InternTable *old = in->table;
+	InternTable *t = intern_table_new((old->mask + 1) * 2);
+	if (!t) return -1;
+	for (u64 i = 0; i <= old->mask; i++)
+		if (old->slots[i]) intern_place(t, old->slots[i]);
+	t->prev = old;
+	__atomic_store_n(&in->table, t, __ATOMIC_RELEASE);
+	return 0;
+}
+
+// Copy the string into the arena (called with the lock held).
+static char *intern_store(Intern *in, const char *bytes, u64 len) {
+	u64 size = (sizeof(u64) + len + 1 + 7) & ~7ULL;
+	if (size > in->arena_left) {
+		u64 pages = bytes_to_pages(sizeof(InternChunk) + size);
+		if (pages < INTERN_CHUNK_PAGES) pages = INTERN_CHUNK_PAGES;
+		InternChunk *chunk = map(pages);
+		if (!chunk) return NULL;
+		chunk->pages = pages;
+		chunk->next = in->chunks;
+		in->chunks = chunk;
+		in->arena = (byte *)(chunk + 1);
+		in->arena_left = pages * PAGE_SIZE - sizeof(InternChunk);
+	}
+	*(u64 *)in->arena = len;
+	char *entry = (char *)in->arena + sizeof(u64);
+	copy_bytes((byte *)entry, (const byte *)bytes, len);
+	entry[len] = 0;
+	in->arena += size;
+	in->arena_left -= size;
+	return entry;
+}
+
+int intern_init(Intern *in) {
+	set_bytes((byte *)in, 0, sizeof(Intern));
+	in->table = intern_table_new(INTERN_MIN_SLOTS);
+	return in->table ? 0 : -1;
+}
+
+void intern_cleanup(Intern *in) {
+	for (InternTable *t = in->table, *prev; t; t = prev) {
+		prev = t->prev;
+		unmap(t, t->pages);
+	}
+	for (u32 k = 0; k < INTERN_SEGMENTS && in->segments[k]; k++)
+		unmap(in->segments[k],
+			  bytes_to_pages(sizeof(char *) << (k + INTERN_SEGMENT_LOG)));
+	for (InternChunk *c = in->chunks, *next; c; c = next) {
+		next = c->next;
+		unmap(c, c->pages);
+	}
+	set_bytes((byte *)in, 0, sizeof(Intern));
+}
+
+int intern_find(const Intern *in, const char *bytes, u64 len, u32 *id) {
+	u32 hash = crc32c(0, bytes, len);
+	const InternTable *t = __atomic_load_n(&in->table, __ATOMIC_ACQUIRE);
+	u64 slot = intern_probe(in, t, bytes, len, hash);
+	if (!slot) return -1;
+	*id = (u32)slot - 1;
+	return 0;
+}
+
+int intern(Intern *in, const char *bytes, u64 len, u32 *id) {
+	u32 hash = crc32c(0, bytes, len);
+	const InternTable *t = __atomic_load_n(&in->table, __ATOMIC_ACQUIRE);
+	u64 slot = intern_probe(in, t, bytes, len, hash);
+	if (slot) {
+		*id = (u32)slot - 1;
+		return 0;
+	}
+
+	// another thread may have added it (or grown the table) since the probe
+	spin_lock(&in->lock);
+	slot = intern_probe(in, in->table, bytes, len, hash);
+	if (slot) {
+		spin_unlock(&in->lock);
+		*id = (u32)slot - 1;
+		return 0;
+	}
+
+	u32 next = in->count;
+	u64 n = (u64)next + (1 << INTERN_SEGMENT_LOG);
+	u32 k = 63 - __builtin_clzll(n) - INTERN_SEGMENT_LOG;
+	int ret = -1;
+	if (next == 0xFFFFFFFE || k >= INTERN_SEGMENTS) goto done;
+	if ((in->table->used + 1) * 4 > (in->table->mask + 1) * 3 &&
+		intern_grow(in))
+		goto done;
+	if (!in->segments[k]) {
+		u64 pages = bytes_to_pages(sizeof(char *) << (k + INTERN_SEGMENT_LOG));
+		const char **segment = map(pages);
+		if (!segment) goto done;
+		__atomic_store_n(&in->segments[k], segment, __ATOMIC_RELEASE);
+	}
+	char *entry = intern_store(in, bytes, len);
+	if (!entry) goto done;
+
+	// the directory entry must be visible before the slot that leads to it
+	__atomic_store_n(intern_entry(in, next), entry, __ATOMIC_RELEASE);
+	intern_place(in->table, ((u64)hash << 32) | ((u64)next + 1));
+	__atomic_store_n(&in->count, next + 1, __ATOMIC_RELEASE);
+	*id = next;
+	ret = 0;
+done:
+	spin_unlock(&in->lock);
+	return ret;
+}
+
+int intern_cstr(Intern *in, const char *cstr, u32 *id) {
+	return intern(in, cstr, cstring_len(cstr), id);
+}
+
+const char *intern_get(const Intern *in, u32 id) {
+	return *intern_entry(in, id);
+}
+
+u64 intern_len(const Intern *in, u32 id) {
+	return intern_entry_len(*intern_entry(in, id));
+}
+
+u32 intern_count(const Intern *in) {
+	return __atomic_load_n(&in->count, __ATOMIC_ACQUIRE);
+}
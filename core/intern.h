@@ -0,0 +1,65 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _CORE_INTERN__
+#define _CORE_INTERN__
+
+#include <base/types.h>
+
+// String interning: each distinct byte string gets a small dense ID (0, 1,
+// 2, ... in insertion order) and one canonical NUL terminated copy, so
+// interned strings compare with a single integer (or pointer) compare.
+//
+// Lookups are lock free: the open addressing table of (CRC32C, ID) slots and
+// the ID directory are only ever published with release stores, and a table
+// replaced by growth stays mapped until cleanup so readers holding it remain
+// safe. Inserts take a spinlock. The bytes live in an append only arena, so
+// canonical pointers are stable for the life of the table.
+
+#define INTERN_SEGMENTS 32
+
+typedef struct InternTable InternTable;
+typedef struct InternChunk InternChunk;
+
+typedef struct Intern {
+	InternTable *table;
+	// ID directory: segment k holds 1024 << k entry pointers
+	const char **segments[INTERN_SEGMENTS];
+	InternChunk *chunks;
+	byte *arena;
+	u64 arena_left;
+	u32 count;
+	bool lock;
+} Intern;
+
+// Functions returning int return 0 on success and -1 on failure (the string
+// is absent, or memory can't be mapped).
+int intern_init(Intern *in);
+// Unmaps everything; canonical pointers are invalid afterwards.
+void intern_cleanup(Intern *in);
+
+// ID of 'bytes', adding the string if it is new. Safe to call from several
+// threads at once.
+int intern(Intern *in, const char *bytes, u64 len, u32 *id);
+int intern_cstr(Intern *in, const char *cstr, u32 *id);
+// ID of 'bytes' if it is already interned; never blocks.
+int intern_find(const Intern *in, const char *bytes, u64 len, u32 *id);
+
+// Canonical NUL terminated copy and length of an ID returned by intern.
+const char *intern_get(const Intern *in, u32 id);
+u64 intern_len(const Intern *in, u32 id);
+// Number of distinct strings.
+u32 intern_count(const Intern *in);
+
+#endif	// _CORE_INTERN__
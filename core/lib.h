@@ -11,3 +11,15 @@
 // WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 // See the License for the specific language governing permissions and
 // limitations under the License.
+
+#include <core/coro.h>
+#include <core/ebr.h>
+#include <core/filter.h>
+#include <core/intern.h>
+#include <core/metrics.h>
+#include <core/resource.h>
+#include <core/seglog.h>
+#include <core/serial.h>
+#include <core/skiplist.h>
+#include <core/str.h>
+#include <core/vec.h>
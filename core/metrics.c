@@ -0,0 +1,322 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <base/sys.h>
+#include <base/util.h>
+#include <core/metrics.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#define METRICS_COUNTER 1
+#define METRICS_GAUGE 2
+#define METRICS_HISTOGRAM 3
+// metric data starts this far into its entry, on a cache line boundary
+#define METRICS_ENTRY_HEADER 128
+#define METRICS_PATH_MAX 256
+#define METRICS_DUMP_BUFFER 4096
+
+int rename(const char *old_path, const char *new_path);
+
+struct MetricsEntry {
+	MetricsEntry *next;
+	u64 pages;
+	u32 kind;
+	char name[METRICS_NAME_MAX];
+};
+
+struct MetricsDumper {
+	pthread_t thread;
+	Metrics *m;
+	int fd;
+	bool stop;
+	u64 millis;
+	char path[METRICS_PATH_MAX];
+};
+
+_Static_assert(sizeof(MetricsEntry) <= METRICS_ENTRY_HEADER,
+			   "metrics entry header too large");
+
+static __thread u32 metrics_tls_shard;	// shard + 1, or 0 until assigned
+static u32 metrics_next_shard;
+
+static u32 metrics_shard() {
+	u32 shard = metrics_tls_shard;
+	if (__builtin_expect(!shard, 0)) {
+		shard = __atomic_fetch_add(&metrics_next_shard, 1, __ATOMIC_RELAXED);
+		shard = shard % METRICS_SHARDS + 1;
+		metrics_tls_shard = shard;
+	}
+	return shard - 1;
+}
+
+static void *metrics_entry_data(MetricsEntry *e) {
+	return (byte *)e + METRICS_ENTRY_HEADER;
+}
+
+int metrics_init(Metrics *m) {
+	m->entries = NULL;
+	m->dumper = NULL;
+	m->lock = false;
+	return 0;
+}
+
+void metrics_cleanup(Metrics *m) {
+	MetricsDumper *d = m->dumper;
+	if (d) {
+		__atomic_store_n(&d->stop, true, __ATOMIC_RELEASE);
+		pthread_join(d->thread, NULL);
+		unmap(d, bytes_to_pages(sizeof(MetricsDumper)));
+		m->dumper = NULL;
+	}
+	for (MetricsEntry *e = m->entries, *next; e; e = next) {
+		next = e->next;
+		unmap(e, e->pages);
+	}
+	m->entries = NULL;
+}
+
+static void *metrics_register(Metrics *m, const char *name, u32 kind,
+							  u64 size) {
+	u64 len = cstring_len(name);
+	if (len == 0 || len >= METRICS_NAME_MAX) return NULL;
+	spin_lock(&m->lock);
+	void *ret = NULL;
+	MetricsEntry *e = m->entries;
+	while (e && cstring_compare(e->name, name)) e = e->next;
+	if (e) {
+		if (e->kind == kind) ret = metrics_entry_data(e);
+	} else {
+		u64 pages = bytes_to_pages(METRICS_ENTRY_HEADER + size);
+		// mapped pages are zeroed, so the metric starts at 0
+		if ((e = map(pages))) {
+			e->pages = pages;
+			e->kind = kind;
+			copy_bytes((byte *)e->name, (const byte *)name, len + 1);
+			e->next = m->entries;
+			__atomic_store_n(&m->entries, e, __ATOMIC_RELEASE);
+			ret = metrics_entry_data(e);
+		}
+	}
+	spin_unlock(&m->lock);
+	return ret;
+}
+
+MetricsCounter *metrics_counter(Metrics *m, const char *name) {
+	return metrics_register(m, name, METRICS_COUNTER, sizeof(MetricsCounter));
+}
+
+MetricsGauge *metrics_gauge(Metrics *m, const char *name) {
+	return metrics_register(m, name, METRICS_GAUGE, sizeof(MetricsGauge));
+}
+
+MetricsHistogram *metrics_histogram(Metrics *m, const char *name) {
+	return metrics_register(m, name, METRICS_HISTOGRAM,
+							sizeof(MetricsHistogram));
+}
+
+void metrics_counter_add(MetricsCounter *c, u64 n) {
+	__atomic_fetch_add(&c->shards[metrics_shard()].value, n, __ATOMIC_RELAXED);
+}
+
+u64 metrics_counter_read(const MetricsCounter *c) {
+	u64 sum = 0;
+	for (u32 i = 0; i < METRICS_SHARDS; i++)
+		sum += __atomic_load_n(&c->shards[i].value, __ATOMIC_RELAXED);
+	return sum;
+}
+
+void metrics_gauge_add(MetricsGauge *g, i64 n) {
+	__atomic_fetch_add(&g->shards[metrics_shard()].value, (u64)n,
+					   __ATOMIC_RELAXED);
+}
+
+i64 metrics_gauge_read(const MetricsGauge *g) {
+	u64 sum = 0;
+	for (u32 i = 0; i < METRICS_SHARDS; i++)
+		sum += __atomic_load_n(&g->shards[i].value, __ATOMIC_RELAXED);
+	return (i64)sum;
+}
+
+u32 metrics_hist_bucket(u64 value) {
+	if (value < (1ULL << METRICS_HIST_BITS)) return (u32)value;
+	u32 msb = 63 - __builtin_clzll(value);
+	if (msb >= METRICS_HIST_MAX_LOG) return METRICS_HIST_BUCKETS - 1;
+	// the top METRICS_HIST_BITS bits select the bucket within the octave
+	u32 shift = msb - METRICS_HIST_BITS + 1;
+	return (shift << (METRICS_HIST_BITS - 1)) + (u32)(value >> shift);
+}
+
+u64 metrics_hist_bucket_max(u32 bucket) {
+	if (bucket < (1U << METRICS_HIST_BITS)) return bucket;
+	u32 shift = (bucket >> (METRICS_HIST_BITS - 1)) - 1;
+	u64 top = bucket - (shift << (METRICS_HIST_BITS - 1));
+	return ((top + 1) << shift) - 1;
+}
+
+void metrics_histogram_record(MetricsHistogram *h, u64 value) {
+	MetricsHistogramShard *s = &h->shards[metrics_shard()];
+	__atomic_fetch_add(&s->buckets[metrics_hist_bucket(value)], 1,
+					   __ATOMIC_RELAXED);
+	__atomic_fetch_add(&s->sum, value, __ATOMIC_RELAXED);
+}
+
+void metrics_snapshot(MetricsSnapshot *s, const MetricsHistogram *h) {
+	set_bytes((byte *)s, 0, sizeof(MetricsSnapshot));
+	for (u32 i = 0; i < METRICS_SHARDS; i++) {
+		const MetricsHistogramShard *shard = &h->shards[i];
+		s->sum += __atomic_load_n(&shard->sum, __ATOMIC_RELAXED);
+		for (u32 b = 0; b < METRICS_HIST_BUCKETS; b++)
+			s->buckets[b] +=
+				__atomic_load_n(&shard->buckets[b], __ATOMIC_RELAXED);
+	}
+	for (u32 b = 0; b < METRICS_HIST_BUCKETS; b++) s->count += s->buckets[b];
+}
+
+void metrics_snapshot_merge(MetricsSnapshot *dst, const MetricsSnapshot *src) {
+	dst->count += src->count;
+	dst->sum += src->sum;
+	for (u32 b = 0; b < METRICS_HIST_BUCKETS; b++)
+		dst->buckets[b] += src->buckets[b];
+}
+
+u64 metrics_snapshot_quantile(const MetricsSnapshot *s, double quantile) {
+	if (!s->count) return 0;
+	if (quantile < 0) quantile = 0;
+	double target = quantile * s->count;
+	u64 rank = (u64)target;
+	if (rank < target) rank++;
+	if (rank == 0) rank = 1;
+	if (rank > s->count) rank = s->count;
+	u64 seen = 0;
+	for (u32 b = 0; b < METRICS_HIST_BUCKETS; b++) {
+		seen += s->buckets[b];
+		if (seen >= rank) return metrics_hist_bucket_max(b);
+	}
+	return metrics_hist_bucket_max(METRICS_HIST_BUCKETS - 1);
+}
+
+typedef struct MetricsWriter {
+	int fd;
+	int err;
+	u64 len;
+	char buf[METRICS_DUMP_BUFFER];
+} MetricsWriter;
+
+static void metrics_flush(MetricsWriter *w) {
+	u64 off = 0;
+	while (off < w->len && !w->err) {
+		i64 n = write(w->fd, w->buf + off, w->len - off);
+		if (n <= 0)
+			w->err = -1;
+		else
+			off += n;
+	}
+	w->len = 0;
+}
+
+// Append one formatted line (lines are far shorter than the buffer).
+#define metrics_printf(w, ...)                                           \
+	({                                                                   \
+		if ((w)->len + 256 > METRICS_DUMP_BUFFER) metrics_flush(w);      \
+		(w)->len += snprintf((w)->buf + (w)->len, 256, __VA_ARGS__);     \
+	})
+
+static void metrics_write_entry(MetricsWriter *w, MetricsEntry *e,
+								MetricsSnapshot *snap) {
+	static const char *labels[] = {"0.5", "0.9", "0.99", "0.999"};
+	static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+	void *data = metrics_entry_data(e);
+	if (e->kind == METRICS_COUNTER) {
+		metrics_printf(w, "# TYPE %s counter\n", e->name);
+		metrics_printf(w, "%s %llu\n", e->name,
+					   (unsigned long long)metrics_counter_read(data));
+	} else if (e->kind == METRICS_GAUGE) {
+		metrics_printf(w, "# TYPE %s gauge\n", e->name);
+		metrics_printf(w, "%s %lld\n", e->name,
+					   (long long)metrics_gauge_read(data));
+	} else {
+		metrics_snapshot(snap, data);
+		metrics_printf(w, "# TYPE %s summary\n", e->name);
+		for (u32 i = 0; i < 4; i++) {
+			u64 v = metrics_snapshot_quantile(snap, quantiles[i]);
+			metrics_printf(w, "%s{quantile=\"%s\"} %llu\n", e->name,
+						   labels[i], (unsigned long long)v);
+		}
+		metrics_printf(w, "%s_sum %llu\n", e->name,
+					   (unsigned long long)snap->sum);
+		metrics_printf(w, "%s_count %llu\n", e->name,
+					   (unsigned long long)snap->count);
+	}
+}
+
+int metrics_dump(Metrics *m, int fd) {
+	u64 pages = bytes_to_pages(sizeof(MetricsWriter) + sizeof(MetricsSnapshot));
+	MetricsWriter *w = map(pages);
+	if (!w) return -1;
+	MetricsSnapshot *snap = (MetricsSnapshot *)(w + 1);
+	w->fd = fd;
+	// entries are only ever prepended, so the list can be walked unlocked
+	MetricsEntry *e = __atomic_load_n(&m->entries, __ATOMIC_ACQUIRE);
+	for (; e; e = e->next) metrics_write_entry(w, e, snap);
+	metrics_flush(w);
+	int ret = w->err;
+	unmap(w, pages);
+	return ret;
+}
+
+int metrics_dump_file(Metrics *m, const char *path) {
+	char tmp[METRICS_PATH_MAX + 8];
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+		return -1;
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) return -1;
+	int ret = metrics_dump(m, fd);
+	if (close(fd)) ret = -1;
+	if (!ret) ret = rename(tmp, path) ? -1 : 0;
+	return ret;
+}
+
+static void *metrics_dump_thread(void *arg) {
+	MetricsDumper *d = arg;
+	for (;;) {
+		// sleep in short steps so cleanup doesn't wait a whole period
+		for (u64 t = 0; t < d->millis; t += 10) {
+			if (__atomic_load_n(&d->stop, __ATOMIC_ACQUIRE)) return NULL;
+			os_sleep(d->millis - t < 10 ? d->millis - t : 10);
+		}
+		if (__atomic_load_n(&d->stop, __ATOMIC_ACQUIRE)) return NULL;
+		if (d->fd >= 0)
+			metrics_dump(d->m, d->fd);
+		else
+			metrics_dump_file(d->m, d->path);
+	}
+}
+
+int metrics_dump_periodic(Metrics *m, int fd, const char *path, u64 millis) {
+	if (m->dumper || millis == 0) return -1;
+	if (fd < 0 && (!path || cstring_len(path) >= METRICS_PATH_MAX)) return -1;
+	MetricsDumper *d = map(bytes_to_pages(sizeof(MetricsDumper)));
+	if (!d) return -1;
+	d->m = m;
+	d->fd = fd;
+	d->millis = millis;
+	if (fd < 0)
+		copy_bytes((byte *)d->path, (const byte *)path, cstring_len(path));
+	if (pthread_create(&d->thread, NULL, metrics_dump_thread, d)) {
+		unmap(d, bytes_to_pages(sizeof(MetricsDumper)));
+		return -1;
+	}
+	m->dumper = d;
+	return 0;
+}
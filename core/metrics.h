@@ -0,0 +1,121 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _CORE_METRICS__
+#define _CORE_METRICS__
+
+#include <base/types.h>
+
+// Counters, gauges and latency histograms for hot paths. Every metric is
+// split into METRICS_SHARDS cache line aligned shards and each thread
+// records into its own shard (threads are assigned shards round robin), so
+// recording is one uncontended relaxed atomic add and never allocates.
+// Readers sum the shards.
+//
+// Histograms are HDR style log-linear: values below 2^METRICS_HIST_BITS have
+// a bucket each, and every power of two above that is split into
+// 2^(METRICS_HIST_BITS - 1) equal buckets, so a bucket is never wider than
+// 1/32 of its values (percentiles are within about 3%). Values of
+// 2^METRICS_HIST_MAX_LOG (about 18 minutes in nanoseconds) and above land in
+// the last bucket.
+//
+// Metrics are registered by name in a Metrics registry, which owns them and
+// can write them all out in the Prometheus text exposition format, once or
+// periodically from a background thread.
+
+#define METRICS_SHARDS 16
+#define METRICS_NAME_MAX 64
+#define METRICS_HIST_BITS 6
+#define METRICS_HIST_MAX_LOG 40
+#define METRICS_HIST_BUCKETS \
+	((METRICS_HIST_MAX_LOG - METRICS_HIST_BITS + 2) << (METRICS_HIST_BITS - 1))
+
+typedef struct MetricsShard {
+	u64 value;
+} __attribute__((aligned(64))) MetricsShard;
+
+typedef struct MetricsCounter {
+	MetricsShard shards[METRICS_SHARDS];
+} MetricsCounter;
+
+typedef struct MetricsGauge {
+	MetricsShard shards[METRICS_SHARDS];
+} MetricsGauge;
+
+// No count: metrics_snapshot sums the buckets, so a snapshot's count always
+// agrees with its buckets, even while values are being recorded.
+typedef struct MetricsHistogramShard {
+	u64 sum;
+	u64 buckets[METRICS_HIST_BUCKETS];
+} __attribute__((aligned(64))) MetricsHistogramShard;
+
+typedef struct MetricsHistogram {
+	MetricsHistogramShard shards[METRICS_SHARDS];
+} MetricsHistogram;
+
+// Point in time totals of a histogram. Snapshots of the same metric from
+// different processes or periods can be merged.
+typedef struct MetricsSnapshot {
+	u64 count;
+	u64 sum;
+	u64 buckets[METRICS_HIST_BUCKETS];
+} MetricsSnapshot;
+
+typedef struct MetricsEntry MetricsEntry;
+typedef struct MetricsDumper MetricsDumper;
+
+typedef struct Metrics {
+	MetricsEntry *entries;
+	MetricsDumper *dumper;
+	bool lock;
+} Metrics;
+
+int metrics_init(Metrics *m);
+// Stops a periodic dump and unmaps every metric.
+void metrics_cleanup(Metrics *m);
+
+// Find or register a metric. Names should be valid Prometheus names
+// ([a-zA-Z_:][a-zA-Z0-9_:]*, shorter than METRICS_NAME_MAX). Returns NULL if
+// memory can't be mapped, or the name is taken by a metric of another kind.
+MetricsCounter *metrics_counter(Metrics *m, const char *name);
+MetricsGauge *metrics_gauge(Metrics *m, const char *name);
+MetricsHistogram *metrics_histogram(Metrics *m, const char *name);
+
+void metrics_counter_add(MetricsCounter *c, u64 n);
+u64 metrics_counter_read(const MetricsCounter *c);
+void metrics_gauge_add(MetricsGauge *g, i64 n);
+i64 metrics_gauge_read(const MetricsGauge *g);
+void metrics_histogram_record(MetricsHistogram *h, u64 value);
+
+// Bucket of a histogram value, and the largest value that maps to bucket.
+u32 metrics_hist_bucket(u64 value);
+u64 metrics_hist_bucket_max(u32 bucket);
+
+void metrics_snapshot(MetricsSnapshot *s, const MetricsHistogram *h);
+void metrics_snapshot_merge(MetricsSnapshot *dst, const MetricsSnapshot *src);
+// Smallest bucket bound that at least 'quantile' (0 to 1) of the values are
+// at or below; 0 for an empty snapshot.
+u64 metrics_snapshot_quantile(const MetricsSnapshot *s, double quantile);
+
+// Write every metric to 'fd' (or the file at 'path', replaced atomically by
+// a rename). Histograms are written as summaries with 0.5, 0.9, 0.99 and
+// 0.999 quantiles, a _sum and a _count.
+int metrics_dump(Metrics *m, int fd);
+int metrics_dump_file(Metrics *m, const char *path);
+// Dump to 'fd', or to 'path' if fd is negative, every 'millis' from a
+// background thread until metrics_cleanup. Returns -1 if one is running
+// already or the thread can't be started.
+int metrics_dump_periodic(Metrics *m, int fd, const char *path, u64 millis);
+
+#endif	// _CORE_METRICS__
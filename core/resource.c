@@ -0,0 +1,405 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <base/lib.h>
+#include <core/resource.h>
+
+// Seeds tried per bucket before the whole build is retried with a new salt.
+#define RESOURCE_MAX_SEED (1 << 16)
+#define RESOURCE_MAX_SALT 64
+
+static u64 resource_mix(u64 x) {
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+static u64 resource_reduce(u64 x, u64 n) {
+	return ((u128)x * n) >> 64;
+}
+
+static u64 resource_hash(const char *name, u64 len, u64 salt) {
+	u64 h = 0xcbf29ce484222325ULL ^ salt;
+	for (u64 i = 0; i < len; i++) {
+		h ^= (byte)name[i];
+		h *= 0x100000001b3ULL;
+	}
+	return resource_mix(h);
+}
+
+static u32 resource_slot(u64 hash, u32 seed, u32 count) {
+	return resource_reduce(
+		resource_mix(hash ^ ((u64)seed * 0x9E3779B97F4A7C15ULL + 1)), count);
+}
+
+static u32 resource_bucket_count(u32 count) {
+	return count / 2 + 1;
+}
+
+static u64 resource_align(u64 v, u64 alignment) {
+	return (v + alignment - 1) & ~(alignment - 1);
+}
+
+u32 resource_checksum(u16 type, const byte *data, u64 len) {
+	if (type == RESOURCE_CHECKSUM_CRC32C) return crc32c(0, data, len);
+	if (type != RESOURCE_CHECKSUM_FNV1A) return 0;
+	u32 h = 0x811c9dc5;
+	for (u64 i = 0; i < len; i++) {
+		h ^= data[i];
+		h *= 0x01000193;
+	}
+	return h;
+}
+
+int resource_pack_open(ResourcePack *pack, const void *data, u64 size) {
+	const ResourcePackHeader *header = data;
+	if (data == NULL || ((u64)data & 7) || size < sizeof(ResourcePackHeader))
+		return -1;
+	if (header->magic != RESOURCE_PACK_MAGIC ||
+		header->version != RESOURCE_PACK_VERSION)
+		return -1;
+	if (header->total_size > size || header->bucket_count == 0 ||
+		header->alignment == 0 ||
+		(header->alignment & (header->alignment - 1)))
+		return -1;
+	if (header->seeds_offset + (u64)header->bucket_count * sizeof(u32) >
+			header->entries_offset ||
+		header->entries_offset + (u64)header->count * sizeof(ResourceEntry) >
+			header->names_offset ||
+		header->names_offset > header->data_offset ||
+		header->data_offset > header->total_size ||
+		(header->entries_offset & 7))
+		return -1;
+
+	pack->base = data;
+	pack->size = header->total_size;
+	pack->mapped = false;
+	return 0;
+}
+
+int resource_pack_open_file(ResourcePack *pack, const char *path) {
+	u64 size;
+	void *data = map_file(path, &size);
+	if (data == NULL) return -1;
+	if (resource_pack_open(pack, data, size)) {
+		unmap_file(data, size);
+		return -1;
+	}
+	// keep the full mapping length so unmap_file releases all of it
+	pack->size = size;
+	pack->mapped = true;
+	return 0;
+}
+
+void resource_pack_close(ResourcePack *pack) {
+	if (pack->mapped) unmap_file((void *)pack->base, pack->size);
+	pack->base = NULL;
+	pack->size = 0;
+	pack->mapped = false;
+}
+
+u32 resource_count(const ResourcePack *pack) {
+	return ((const ResourcePackHeader *)pack->base)->count;
+}
+
+const ResourceEntry *resource_find(const ResourcePack *pack, const char *name) {
+	const ResourcePackHeader *header = (const ResourcePackHeader *)pack->base;
+	if (header->count == 0) return NULL;
+
+	u64 len = cstring_len(name);
+	u64 hash = resource_hash(name, len, header->salt);
+	const u32 *seeds = (const u32 *)(pack->base + header->seeds_offset);
+	const ResourceEntry *entries =
+		(const ResourceEntry *)(pack->base + header->entries_offset);
+
+	u32 seed = seeds[resource_reduce(hash, header->bucket_count)];
+	const ResourceEntry *entry =
+		&entries[resource_slot(hash, seed, header->count)];
+	if (entry->name_hash != hash || entry->name_len != len) return NULL;
+	if (header->names_offset + (u64)entry->name_offset + len >=
+		header->data_offset)
+		return NULL;
+	const char *entry_name =
+		(const char *)pack->base + header->names_offset + entry->name_offset;
+	if (len && cstring_compare_n(entry_name, name, len)) return NULL;
+	if (entry->offset + entry->size > header->total_size) return NULL;
+	return entry;
+}
+
+const byte *resource_get(const ResourcePack *pack, const char *name,
+						 u64 *size) {
+	const ResourceEntry *entry = resource_find(pack, name);
+	if (entry == NULL || entry->compression != RESOURCE_COMPRESSION_NONE)
+		return NULL;
+	*size = entry->size;
+	return pack->base + entry->offset;
+}
+
+// Write the entry's uncompressed bytes to 'buf' (at least raw_size bytes)
+// and check them against the stored checksum.
+static int resource_unpack(const ResourcePack *pack,
+						   const ResourceEntry *entry, byte *buf) {
+	const ResourcePackHeader *header = (const ResourcePackHeader *)pack->base;
+	const byte *data = pack->base + entry->offset;
+	if (entry->compression == RESOURCE_COMPRESSION_NONE) {
+		if (entry->size != entry->raw_size) return -1;
+		copy_bytes(buf, data, entry->size);
+	} else if (entry->compression == RESOURCE_COMPRESSION_LZ) {
+		if (lz_decompress(data, entry->size, buf, entry->raw_size) !=
+			entry->raw_size)
+			return -1;
+	} else
+		return -1;
+	u32 checksum =
+		resource_checksum(header->checksum_type, buf, entry->raw_size);
+	return checksum == entry->checksum ? 0 : -1;
+}
+
+int resource_verify(const ResourcePack *pack, const ResourceEntry *entry) {
+	const ResourcePackHeader *header = (const ResourcePackHeader *)pack->base;
+	if (entry->compression == RESOURCE_COMPRESSION_NONE) {
+		u32 checksum = resource_checksum(
+			header->checksum_type, pack->base + entry->offset, entry->size);
+		return checksum == entry->checksum ? 0 : -1;
+	}
+	u64 pages = bytes_to_pages(entry->raw_size);
+	byte *buf = map(pages ? pages : 1);
+	if (buf == NULL) return -1;
+	int ret = resource_unpack(pack, entry, buf);
+	unmap(buf, pages ? pages : 1);
+	return ret;
+}
+
+i64 resource_read(const ResourcePack *pack, const char *name, byte *buf,
+				  u64 capacity) {
+	const ResourceEntry *entry = resource_find(pack, name);
+	if (entry == NULL) return -1;
+	if (entry->raw_size > capacity) return entry->raw_size;
+	if (resource_unpack(pack, entry, buf)) return -1;
+	return entry->raw_size;
+}
+
+static void resource_layout(ResourcePackHeader *header, u32 count,
+							u32 alignment) {
+	header->magic = RESOURCE_PACK_MAGIC;
+	header->version = RESOURCE_PACK_VERSION;
+	header->checksum_type = RESOURCE_CHECKSUM_CRC32C;
+	header->count = count;
+	header->bucket_count = resource_bucket_count(count);
+	header->salt = 0;
+	header->seeds_offset = resource_align(sizeof(ResourcePackHeader), 8);
+	header->entries_offset = resource_align(
+		header->seeds_offset + (u64)header->bucket_count * sizeof(u32), 8);
+	header->names_offset =
+		header->entries_offset + (u64)count * sizeof(ResourceEntry);
+	header->alignment = alignment;
+	header->reserved = 0;
+}
+
+static u64 resource_stored_bound(const ResourceInput *input) {
+	if (input->compression == RESOURCE_COMPRESSION_LZ)
+		return lz_compress_bound(input->size);
+	return input->size;
+}
+
+i64 resource_pack_size(const ResourceInput *inputs, u32 count, u32 alignment) {
+	ResourcePackHeader header;
+	if (alignment == 0 || (alignment & (alignment - 1))) return -1;
+	resource_layout(&header, count, alignment);
+	u64 offset = header.names_offset;
+	for (u32 i = 0; i < count; i++) offset += cstring_len(inputs[i].name) + 1;
+	// every entry is padded to the alignment so the total doesn't depend on
+	// the order entries end up in
+	offset = resource_align(offset, alignment);
+	for (u32 i = 0; i < count; i++) {
+		if (inputs[i].compression != RESOURCE_COMPRESSION_NONE &&
+			inputs[i].compression != RESOURCE_COMPRESSION_LZ)
+			return -1;
+		offset += resource_align(resource_stored_bound(&inputs[i]), alignment);
+	}
+	return offset;
+}
+
+// Hash-and-displace construction: keys are grouped into buckets by hash and
+// the buckets are placed largest first, each searching for a seed that sends
+// all of its keys to free slots. About two keys per bucket keeps the search
+// short while the seed table stays at ~2 bytes per key. Returns -1 if this
+// salt doesn't work and -2 if two inputs have the same name.
+static int resource_build_mph(const ResourceInput *inputs, u32 count,
+							  u32 bucket_count, u64 salt, u64 *hashes,
+							  u32 *seeds, u32 *slots) {
+	u64 scratch_bytes = (u64)count * sizeof(u32) * 3 +
+						(u64)bucket_count * sizeof(u32) * 3 + count +
+						sizeof(u32);
+	u64 pages = bytes_to_pages(scratch_bytes);
+	byte *scratch = map(pages);
+	u32 *keys = (u32 *)scratch;
+	u32 *key_bucket = keys + count;
+	u32 *size_start = key_bucket + count;
+	u32 *bucket_start = size_start + count + 1;
+	u32 *bucket_size = bucket_start + bucket_count;
+	u32 *order = bucket_size + bucket_count;
+	byte *taken = (byte *)(order + bucket_count);
+	int ret = 0;
+
+	for (u32 i = 0; i < count; i++) {
+		hashes[i] = resource_hash(inputs[i].name, cstring_len(inputs[i].name),
+								  salt);
+		key_bucket[i] = resource_reduce(hashes[i], bucket_count);
+		bucket_size[key_bucket[i]]++;
+	}
+
+	// group key indices by bucket
+	u32 sum = 0;
+	for (u32 b = 0; b < bucket_count; b++) {
+		bucket_start[b] = sum;
+		sum += bucket_size[b];
+		bucket_size[b] = 0;
+	}
+	for (u32 i = 0; i < count; i++) {
+		u32 b = key_bucket[i];
+		keys[bucket_start[b] + bucket_size[b]++] = i;
+	}
+
+	// keys with equal hashes always share a bucket and can't be separated
+	for (u32 b = 0; b < bucket_count && ret == 0; b++) {
+		u32 *bkeys = keys + bucket_start[b];
+		for (u32 i = 0; i < bucket_size[b]; i++)
+			for (u32 j = i + 1; j < bucket_size[b]; j++)
+				if (hashes[bkeys[i]] == hashes[bkeys[j]])
+					ret = cstring_compare(inputs[bkeys[i]].name,
+										  inputs[bkeys[j]].name)
+							  ? -1
+							  : -2;
+	}
+
+	// order buckets by size, largest first (counting sort, sizes <= count)
+	for (u32 b = 0; b < bucket_count; b++) size_start[bucket_size[b]]++;
+	sum = 0;
+	for (u32 size = count + 1; size-- > 0;) {
+		u32 n = size_start[size];
+		size_start[size] = sum;
+		sum += n;
+	}
+	for (u32 b = 0; b < bucket_count; b++)
+		order[size_start[bucket_size[b]]++] = b;
+
+	for (u32 o = 0; o < bucket_count && ret == 0; o++) {
+		u32 b = order[o];
+		u32 *bkeys = keys + bucket_start[b];
+		u32 seed;
+		if (bucket_size[b] == 0) break;
+		for (seed = 0; seed < RESOURCE_MAX_SEED; seed++) {
+			u32 placed = 0;
+			for (; placed < bucket_size[b]; placed++) {
+				u32 slot = resource_slot(hashes[bkeys[placed]], seed, count);
+				if (taken[slot]) break;
+				taken[slot] = 1;
+				slots[bkeys[placed]] = slot;
+			}
+			if (placed == bucket_size[b]) break;
+			while (placed--) taken[slots[bkeys[placed]]] = 0;
+		}
+		if (seed == RESOURCE_MAX_SEED) ret = -1;
+		seeds[b] = seed;
+	}
+
+	unmap(scratch, pages);
+	return ret;
+}
+
+i64 resource_pack_build(const ResourceInput *inputs, u32 count, u32 alignment,
+						byte *out, u64 capacity) {
+	i64 size = resource_pack_size(inputs, count, alignment);
+	if (size < 0 || (u64)size > capacity || ((u64)out & 7)) return -1;
+
+	ResourcePackHeader *header = (ResourcePackHeader *)out;
+	set_bytes(out, 0, size);
+	resource_layout(header, count, alignment);
+
+	u32 *seeds = (u32 *)(out + header->seeds_offset);
+	ResourceEntry *entries = (ResourceEntry *)(out + header->entries_offset);
+
+	u64 pages = ((u64)count * (sizeof(u64) + sizeof(u32) * 2) + PAGE_SIZE -
+				 1) / PAGE_SIZE;
+	byte *scratch = map(pages);
+	u64 *hashes = (u64 *)scratch;
+	u32 *slots = (u32 *)(hashes + count);
+	u32 *key_of_slot = slots + count;
+
+	// Two different names with the same salted hash can never be separated,
+	// so a collision (or a failed seed search) retries with the next salt.
+	int ret = -1;
+	u64 salt = 0;
+	for (; salt < RESOURCE_MAX_SALT && ret == -1; salt++) {
+		set_bytes((byte *)seeds, 0, header->bucket_count * sizeof(u32));
+		ret = resource_build_mph(inputs, count, header->bucket_count, salt,
+								 hashes, seeds, slots);
+	}
+	if (ret) {
+		unmap(scratch, pages);
+		return -1;
+	}
+	header->salt = salt - 1;
+
+	// names and data are written in slot order so a scan of the entry table
+	// walks the data sequentially
+	for (u32 i = 0; i < count; i++) key_of_slot[slots[i]] = i;
+
+	u64 offset = header->names_offset;
+	for (u32 s = 0; s < count; s++) {
+		const ResourceInput *input = &inputs[key_of_slot[s]];
+		ResourceEntry *entry = &entries[s];
+		entry->name_hash = hashes[key_of_slot[s]];
+		entry->name_len = cstring_len(input->name);
+		entry->name_offset = offset - header->names_offset;
+		copy_bytes(out + offset, input->name, entry->name_len);
+		offset += entry->name_len + 1;
+	}
+	offset = resource_align(offset, alignment);
+	header->data_offset = offset;
+
+	for (u32 s = 0; s < count; s++) {
+		const ResourceInput *input = &inputs[key_of_slot[s]];
+		ResourceEntry *entry = &entries[s];
+		entry->offset = offset;
+		entry->size = input->size;
+		entry->raw_size = input->size;
+		entry->compression = RESOURCE_COMPRESSION_NONE;
+		entry->checksum = resource_checksum(header->checksum_type, input->data,
+											input->size);
+		if (input->compression == RESOURCE_COMPRESSION_LZ) {
+			i64 stored = lz_compress_hc(input->data, input->size, out + offset,
+										resource_stored_bound(input),
+										LZ_HC_DEFAULT_LEVEL);
+			if (stored > 0 && (u64)stored < input->size) {
+				entry->size = stored;
+				entry->compression = RESOURCE_COMPRESSION_LZ;
+			}
+		}
+		if (entry->compression == RESOURCE_COMPRESSION_NONE)
+			copy_bytes(out + offset, input->data, input->size);
+		// a rejected compression attempt may have left bytes in the padding
+		u64 padded = resource_align(entry->size, alignment);
+		set_bytes(out + offset + entry->size, 0, padded - entry->size);
+		offset += padded;
+	}
+	header->total_size = offset;
+
+	unmap(scratch, pages);
+	return offset;
+}
@@ -0,0 +1,120 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _CORE_RESOURCE__
+#define _CORE_RESOURCE__
+
+#include <base/types.h>
+
+// Resource pack layout (all integers little endian, offsets from pack start):
+//
+//   ResourcePackHeader
+//   u32 seeds[bucket_count]           minimal perfect hash displacements
+//   ResourceEntry entries[count]      entry i is the key that hashes to i
+//   names                             NUL terminated entry names
+//   data                              each entry aligned to 'alignment'
+//
+// A lookup hashes the name, picks a bucket, and uses the bucket's seed to
+// compute the entry index, so it touches a constant number of cache lines
+// regardless of how many resources the pack holds. Opening a pack only
+// validates the header; entries are never parsed up front.
+
+#define RESOURCE_PACK_MAGIC 0x4B505246	// "FRPK"
+#define RESOURCE_PACK_VERSION 1
+#define RESOURCE_DEFAULT_ALIGN 16
+
+// Packs record which checksum their entries use. New packs use CRC32C, which
+// runs at memory speed with hardware support; FNV-1a packs still verify.
+#define RESOURCE_CHECKSUM_FNV1A 1
+#define RESOURCE_CHECKSUM_CRC32C 2
+
+#define RESOURCE_COMPRESSION_NONE 0
+#define RESOURCE_COMPRESSION_LZ 1
+
+typedef struct ResourcePackHeader {
+	u32 magic;
+	u16 version;
+	u16 checksum_type;
+	u32 count;
+	u32 bucket_count;
+	u64 salt;
+	u64 seeds_offset;
+	u64 entries_offset;
+	u64 names_offset;
+	u64 data_offset;
+	u64 total_size;
+	u32 alignment;
+	u32 reserved;
+} ResourcePackHeader;
+
+typedef struct ResourceEntry {
+	u64 name_hash;
+	u64 offset;
+	u64 size;
+	u64 raw_size;
+	u32 name_offset;
+	u32 name_len;
+	u32 checksum;
+	u16 compression;
+	u16 reserved;
+} ResourceEntry;
+
+typedef struct ResourcePack {
+	const byte *base;
+	u64 size;
+	bool mapped;
+} ResourcePack;
+
+typedef struct ResourceInput {
+	const char *name;
+	const byte *data;
+	u64 size;
+	// RESOURCE_COMPRESSION_LZ stores the entry as an lz block (see
+	// base/lz.h) unless that doesn't make it smaller
+	u16 compression;
+} ResourceInput;
+
+// Open a pack that is already in memory (for instance embedded with
+// 'xxdir --pack --asm'). The memory must outlive the pack.
+int resource_pack_open(ResourcePack *pack, const void *data, u64 size);
+// Open a pack file by mapping it read-only.
+int resource_pack_open_file(ResourcePack *pack, const char *path);
+void resource_pack_close(ResourcePack *pack);
+u32 resource_count(const ResourcePack *pack);
+
+const ResourceEntry *resource_find(const ResourcePack *pack, const char *name);
+// Returns the stored bytes of an uncompressed entry without copying, or NULL
+// if there is no such entry or it is compressed.
+const byte *resource_get(const ResourcePack *pack, const char *name,
+						 u64 *size);
+// Copy (decompressing if needed) an entry into 'buf' and check its checksum.
+// Returns the entry's uncompressed size, or -1 on error. If 'capacity' is too
+// small nothing is written and the required size is returned.
+i64 resource_read(const ResourcePack *pack, const char *name, byte *buf,
+				  u64 capacity);
+// Check an entry's checksum. Returns 0 if it matches, -1 otherwise.
+int resource_verify(const ResourcePack *pack, const ResourceEntry *entry);
+
+u32 resource_checksum(u16 type, const byte *data, u64 len);
+
+// Building a pack: resource_pack_size returns the number of bytes
+// resource_pack_build needs (or -1 if the inputs are invalid, for example
+// because of a duplicate name). With compressed inputs this is an upper bound
+// and resource_pack_build returns the actual size of the pack. 'alignment'
+// must be a power of two.
+i64 resource_pack_size(const ResourceInput *inputs, u32 count, u32 alignment);
+i64 resource_pack_build(const ResourceInput *inputs, u32 count, u32 alignment,
+						byte *out, u64 capacity);
+
+#endif	// _CORE_RESOURCE__
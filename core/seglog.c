@@ -0,0 +1,530 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <base/crc32c.h>
+#include <base/sort.h>
+#include <base/sys.h>
+#include <base/util.h>
+#include <core/seglog.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SEGLOG_HEADER 16
+// segments synced per round of a group commit
+#define SEGLOG_RANGES 8
+// segment file names: 20 digit base sequence number and ".log"
+#define SEGLOG_NAME_DIGITS 20
+// longest sleep of the group syncer, so closing the log doesn't wait long
+#define SEGLOG_SYNCER_STEP 10
+
+int fsync(int fd);
+int ftruncate(int fd, long length);
+int unlink(const char *path);
+
+// The CRC covers 'len', 'seq' and the payload; records are padded to 8
+// bytes so headers stay aligned.
+typedef struct SeglogHeader {
+	u32 crc;
+	u32 len;
+	u64 seq;
+} SeglogHeader;
+
+typedef struct SeglogIndexEntry {
+	u64 seq;
+	u64 pos;
+} SeglogIndexEntry;
+
+struct SeglogShared {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;  // a sync round finished
+	// SEGLOG_SYNC_GROUP: the thread syncing records that reach sync_millis
+	// with no append to notice, woken when records become pending
+	pthread_t syncer;
+	pthread_cond_t pending;
+	bool syncer_running;
+	bool stop;
+};
+
+typedef struct SeglogRange {
+	byte *start;
+	u64 len;
+} SeglogRange;
+
+static u64 seglog_record_size(u32 len) {
+	return (SEGLOG_HEADER + (u64)len + 7) & ~7ULL;
+}
+
+static u32 seglog_crc(const SeglogHeader *h, const void *payload) {
+	u32 crc = crc32c(0, &h->len, sizeof(h->len) + sizeof(h->seq));
+	return crc32c(crc, payload, h->len);
+}
+
+static SeglogSegment *seglog_segment(Seglog *log, u64 i) {
+	return vec_at(&log->segments, i);
+}
+
+static int seglog_path(const Seglog *log, u64 base, char *path, u64 size) {
+	int n = snprintf(path, size, "%s/%020llu.log", log->dir,
+					 (unsigned long long)base);
+	return n > 0 && (u64)n < size ? 0 : -1;
+}
+
+static int seglog_allocate(int fd, u64 size) {
+#ifdef __linux__
+	return posix_fallocate(fd, 0, size) ? -1 : 0;
+#else
+	return ftruncate(fd, size);
+#endif	// __linux__
+}
+
+static int seglog_map(SeglogSegment *s) {
+	void *data =
+		mmap(NULL, s->size, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+	if (data == MAP_FAILED) return -1;
+	s->data = data;
+	return 0;
+}
+
+static void seglog_segment_close(SeglogSegment *s) {
+	if (s->data) munmap(s->data, s->size);
+	if (s->fd >= 0) close(s->fd);
+	vec_cleanup(&s->index);
+	s->data = NULL;
+	s->fd = -1;
+}
+
+// Index a record if it is SEGLOG_INDEX_BYTES past the last indexed one.
+static int seglog_index(SeglogSegment *s, u64 seq, u64 pos) {
+	if (s->index.len) {
+		SeglogIndexEntry *last = vec_at(&s->index, s->index.len - 1);
+		if (pos < last->pos + SEGLOG_INDEX_BYTES) return 0;
+	}
+	SeglogIndexEntry e = {seq, pos};
+	return vec_push(&s->index, &e);
+}
+
+// Find the valid records of a segment: a run of consecutive sequence numbers
+// starting at the base, each with a matching CRC.
+static int seglog_scan(SeglogSegment *s) {
+	u64 pos = 0, seq = s->base;
+	while (pos + SEGLOG_HEADER <= s->size) {
+		const SeglogHeader *h = (const SeglogHeader *)(s->data + pos);
+		if (h->seq != seq || h->len > s->size - pos - SEGLOG_HEADER) break;
+		if (h->crc != seglog_crc(h, h + 1)) break;
+		if (seglog_index(s, seq, pos)) return -1;
+		pos += seglog_record_size(h->len);
+		seq++;
+	}
+	s->used = pos;
+	s->end = seq;
+	return 0;
+}
+
+// Open the segment starting at 'base', creating and preallocating it if
+// 'create' is set.
+static int seglog_segment_open(Seglog *log, SeglogSegment *s, u64 base,
+							   bool create) {
+	char path[SEGLOG_PATH_MAX + 32];
+	struct stat st;
+	s->base = s->end = base;
+	s->used = 0;
+	s->data = NULL;
+	s->fd = -1;
+	vec_init(&s->index, sizeof(SeglogIndexEntry), 0);
+	if (seglog_path(log, base, path, sizeof(path))) return -1;
+	s->fd = open(path, create ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR, 0644);
+	if (s->fd < 0) return -1;
+
+	bool allocate = create || fstat(s->fd, &st) || st.st_size < PAGE_SIZE;
+	s->size = allocate ? log->options.segment_size : (u64)st.st_size;
+	if ((allocate && seglog_allocate(s->fd, s->size)) || seglog_map(s)) {
+		seglog_segment_close(s);
+		return -1;
+	}
+	return 0;
+}
+
+// Discard everything after the valid records of the last segment. A torn
+// write can leave a stale but well formed record beyond the cut that a
+// later append would line up with again, so the tail is zeroed by
+// truncating the file and preallocating it again.
+static int seglog_cut(SeglogSegment *s) {
+	munmap(s->data, s->size);
+	s->data = NULL;
+	if (ftruncate(s->fd, s->used) || seglog_allocate(s->fd, s->size)) return -1;
+	return seglog_map(s);
+}
+
+// New segment files are only durable once the directory is synced.
+static int seglog_sync_dir(const Seglog *log) {
+	int fd = open(log->dir, O_RDONLY);
+	if (fd < 0) return -1;
+	int ret = fsync(fd);
+	close(fd);
+	return ret ? -1 : 0;
+}
+
+static bool seglog_parse_name(const char *name, u64 *base) {
+	u64 value = 0;
+	for (u32 i = 0; i < SEGLOG_NAME_DIGITS; i++) {
+		if (name[i] < '0' || name[i] > '9') return false;
+		value = value * 10 + (name[i] - '0');
+	}
+	if (cstring_compare(name + SEGLOG_NAME_DIGITS, ".log")) return false;
+	*base = value;
+	return true;
+}
+
+// Sorted base sequence numbers of the segment files in the directory.
+static int seglog_list(Seglog *log, Vec *bases) {
+	DIR *dir = opendir(log->dir);
+	if (!dir) return -1;
+	struct dirent *entry;
+	int ret = 0;
+	u64 base;
+	while (!ret && (entry = readdir(dir)))
+		if (seglog_parse_name(entry->d_name, &base))
+			ret = vec_push(bases, &base);
+	closedir(dir);
+	sort_u64((u64 *)bases->data, bases->len);
+	return ret;
+}
+
+static int seglog_recover(Seglog *log) {
+	Vec bases;
+	char path[SEGLOG_PATH_MAX + 32];
+	vec_init(&bases, sizeof(u64), 0);
+	int ret = seglog_list(log, &bases);
+	for (u64 i = 0; !ret && i < bases.len; i++) {
+		u64 base = vec_get(&bases, u64, i);
+		// a segment that doesn't continue the log follows a torn tail
+		if (i > 0 && base != log->next_seq) {
+			if (!seglog_path(log, base, path, sizeof(path))) unlink(path);
+			continue;
+		}
+		SeglogSegment s;
+		if (seglog_segment_open(log, &s, base, false)) {
+			ret = -1;
+			break;
+		}
+		if (seglog_scan(&s) || vec_push(&log->segments, &s)) {
+			seglog_segment_close(&s);
+			ret = -1;
+			break;
+		}
+		log->next_seq = s.end;
+	}
+	vec_cleanup(&bases);
+	if (ret || !log->segments.len) return ret;
+
+	SeglogSegment *last = seglog_segment(log, log->segments.len - 1);
+	if (seglog_cut(last)) return -1;
+	log->synced = log->next_seq;
+	log->synced_segment = log->segments.len - 1;
+	log->synced_pos = last->used;
+	return 0;
+}
+
+static void *seglog_syncer(void *arg);
+
+int seglog_open(Seglog *log, const char *dir, const SeglogOptions *options) {
+	set_bytes((byte *)log, 0, sizeof(Seglog));
+	vec_init(&log->segments, sizeof(SeglogSegment), 0);
+	u64 len = cstring_len(dir);
+	if (len >= SEGLOG_PATH_MAX) return -1;
+	copy_bytes((byte *)log->dir, (const byte *)dir, len);
+
+	if (options) log->options = *options;
+	if (!log->options.segment_size)
+		log->options.segment_size = SEGLOG_DEFAULT_SEGMENT_SIZE;
+	log->options.segment_size =
+		bytes_to_pages(log->options.segment_size) * PAGE_SIZE;
+	if (!log->options.sync_bytes) log->options.sync_bytes = 1024 * 1024;
+	if (!log->options.sync_millis) log->options.sync_millis = 10;
+
+	log->shared = map(bytes_to_pages(sizeof(SeglogShared)));
+	if (!log->shared) return -1;
+	pthread_mutex_init(&log->shared->lock, NULL);
+	pthread_cond_init(&log->shared->cond, NULL);
+	pthread_cond_init(&log->shared->pending, NULL);
+
+	mkdir(dir, 0755);
+	if (seglog_recover(log)) {
+		seglog_close(log);
+		return -1;
+	}
+	if (log->options.sync == SEGLOG_SYNC_GROUP) {
+		if (pthread_create(&log->shared->syncer, NULL, seglog_syncer, log)) {
+			seglog_close(log);
+			return -1;
+		}
+		log->shared->syncer_running = true;
+	}
+	return 0;
+}
+
+void seglog_close(Seglog *log) {
+	if (log->shared && log->shared->syncer_running) {
+		pthread_mutex_lock(&log->shared->lock);
+		log->shared->stop = true;
+		pthread_cond_signal(&log->shared->pending);
+		pthread_mutex_unlock(&log->shared->lock);
+		pthread_join(log->shared->syncer, NULL);
+		log->shared->syncer_running = false;
+	}
+	if (log->shared && log->options.sync != SEGLOG_SYNC_NONE)
+		seglog_sync(log);
+	for (u64 i = 0; i < log->segments.len; i++)
+		seglog_segment_close(seglog_segment(log, i));
+	vec_cleanup(&log->segments);
+	if (log->shared) {
+		pthread_mutex_destroy(&log->shared->lock);
+		pthread_cond_destroy(&log->shared->cond);
+		pthread_cond_destroy(&log->shared->pending);
+		unmap(log->shared, bytes_to_pages(sizeof(SeglogShared)));
+		log->shared = NULL;
+	}
+}
+
+// Start a segment at the next sequence number (called with the lock held).
+static SeglogSegment *seglog_roll(Seglog *log) {
+	SeglogSegment s;
+	if (seglog_segment_open(log, &s, log->next_seq, true)) return NULL;
+	if (seglog_sync_dir(log) || vec_push(&log->segments, &s)) {
+		seglog_segment_close(&s);
+		return NULL;
+	}
+	return seglog_segment(log, log->segments.len - 1);
+}
+
+int seglog_append(Seglog *log, const void *data, u32 len, u64 *seq) {
+	u64 size = seglog_record_size(len);
+	if (size > log->options.segment_size) return -1;
+	pthread_mutex_lock(&log->shared->lock);
+	u64 count = log->segments.len;
+	SeglogSegment *s = count ? seglog_segment(log, count - 1) : NULL;
+	if (!s || s->used + size > s->size) s = seglog_roll(log);
+	if (!s || seglog_index(s, log->next_seq, s->used)) {
+		pthread_mutex_unlock(&log->shared->lock);
+		return -1;
+	}
+
+	SeglogHeader *h = (SeglogHeader *)(s->data + s->used);
+	h->len = len;
+	h->seq = log->next_seq;
+	copy_bytes((byte *)(h + 1), data, len);
+	h->crc = seglog_crc(h, data);
+	s->used += size;
+	s->end = ++log->next_seq;
+	u64 appended = h->seq;
+
+	bool sync = log->options.sync == SEGLOG_SYNC_ALWAYS;
+	if (log->options.sync == SEGLOG_SYNC_GROUP) {
+		i128 now = getnanos();
+		if (!log->pending_bytes) {
+			log->pending_since = now;
+			pthread_cond_signal(&log->shared->pending);
+		}
+		log->pending_bytes += size;
+		sync = log->pending_bytes >= log->options.sync_bytes ||
+			   now - log->pending_since >=
+				   (i128)log->options.sync_millis * 1000000;
+	}
+	pthread_mutex_unlock(&log->shared->lock);
+
+	if (seq) *seq = appended;
+	return sync ? seglog_commit(log, appended) : 0;
+}
+
+// One round of group commit (called with the lock held): msync everything
+// appended since the last sync with the lock released, so appends go on
+// and other committers wait for this round instead of syncing themselves.
+static int seglog_sync_round(Seglog *log) {
+	SeglogRange ranges[SEGLOG_RANGES];
+	u32 n = 0;
+	u64 seg = log->synced_segment, target = log->synced, end_pos = 0;
+	for (; seg < log->segments.len && n < SEGLOG_RANGES; seg++) {
+		SeglogSegment *s = seglog_segment(log, seg);
+		u64 start = seg == log->synced_segment ? log->synced_pos : 0;
+		start &= ~((u64)PAGE_SIZE - 1);
+		ranges[n].start = s->data + start;
+		ranges[n++].len = s->used - start;
+		target = s->end;
+		end_pos = s->used;
+	}
+	u64 pending = log->pending_bytes;
+	log->syncing = true;
+	pthread_mutex_unlock(&log->shared->lock);
+
+	int ret = 0;
+	for (u32 i = 0; i < n; i++)
+		if (ranges[i].len && msync(ranges[i].start, ranges[i].len, MS_SYNC))
+			ret = -1;
+
+	pthread_mutex_lock(&log->shared->lock);
+	log->syncing = false;
+	if (!ret && n) {
+		log->synced = target;
+		log->synced_segment = seg - 1;
+		log->synced_pos = end_pos;
+		log->pending_bytes -= pending;
+		log->pending_since = getnanos();
+	}
+	pthread_cond_broadcast(&log->shared->cond);
+	return ret;
+}
+
+int seglog_commit(Seglog *log, u64 seq) {
+	int ret = 0;
+	pthread_mutex_lock(&log->shared->lock);
+	if (seq >= log->next_seq) ret = -1;
+	while (!ret && log->synced <= seq) {
+		if (log->syncing)
+			pthread_cond_wait(&log->shared->cond, &log->shared->lock);
+		else
+			ret = seglog_sync_round(log);
+	}
+	pthread_mutex_unlock(&log->shared->lock);
+	return ret;
+}
+
+// SEGLOG_SYNC_GROUP: appends only check the age of the pending records when
+// they come, so this thread syncs them once the oldest is sync_millis old.
+static void *seglog_syncer(void *arg) {
+	Seglog *log = arg;
+	SeglogShared *shared = log->shared;
+	i128 period = (i128)log->options.sync_millis * 1000000;
+	pthread_mutex_lock(&shared->lock);
+	while (!shared->stop) {
+		if (!log->pending_bytes) {
+			pthread_cond_wait(&shared->pending, &shared->lock);
+			continue;
+		}
+		i128 left = period - (getnanos() - log->pending_since);
+		if (left <= 0 && log->syncing) {
+			// a committer is syncing already
+			pthread_cond_wait(&shared->cond, &shared->lock);
+			continue;
+		}
+		// after a failed round, try again a step later
+		if (left <= 0 && !seglog_sync_round(log)) continue;
+		u64 millis = left > 0 ? (u64)(left / 1000000) + 1 : SEGLOG_SYNCER_STEP;
+		pthread_mutex_unlock(&shared->lock);
+		os_sleep(millis < SEGLOG_SYNCER_STEP ? millis : SEGLOG_SYNCER_STEP);
+		pthread_mutex_lock(&shared->lock);
+	}
+	pthread_mutex_unlock(&shared->lock);
+	return NULL;
+}
+
+int seglog_sync(Seglog *log) {
+	u64 end = seglog_end(log);
+	return end ? seglog_commit(log, end - 1) : 0;
+}
+
+u64 seglog_end(Seglog *log) {
+	pthread_mutex_lock(&log->shared->lock);
+	u64 end = log->next_seq;
+	pthread_mutex_unlock(&log->shared->lock);
+	return end;
+}
+
+// Position of record 'seq' (called with the lock held): binary search for
+// the segment, then for the closest index entry, then scan forward.
+static int seglog_find(Seglog *log, u64 seq, u64 *segment, u64 *pos) {
+	u64 lo = 0, hi = log->segments.len;
+	if (!hi || seq >= log->next_seq) return -1;
+	while (hi - lo > 1) {
+		u64 mid = lo + (hi - lo) / 2;
+		if (seglog_segment(log, mid)->base <= seq)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	SeglogSegment *s = seglog_segment(log, lo);
+	if (seq < s->base || seq >= s->end) return -1;
+
+	const SeglogIndexEntry *index = (const SeglogIndexEntry *)s->index.data;
+	u64 ilo = 0, ihi = s->index.len;
+	while (ihi - ilo > 1) {
+		u64 mid = ilo + (ihi - ilo) / 2;
+		if (index[mid].seq <= seq)
+			ilo = mid;
+		else
+			ihi = mid;
+	}
+	u64 at = index[ilo].pos;
+	for (u64 cur = index[ilo].seq; cur < seq; cur++) {
+		const SeglogHeader *h = (const SeglogHeader *)(s->data + at);
+		at += seglog_record_size(h->len);
+	}
+	*segment = lo;
+	*pos = at;
+	return 0;
+}
+
+int seglog_read(Seglog *log, u64 seq, const void **data, u32 *len) {
+	u64 segment, pos;
+	pthread_mutex_lock(&log->shared->lock);
+	int ret = seglog_find(log, seq, &segment, &pos);
+	if (!ret) {
+		SeglogHeader *h =
+			(SeglogHeader *)(seglog_segment(log, segment)->data + pos);
+		*data = h + 1;
+		*len = h->len;
+	}
+	pthread_mutex_unlock(&log->shared->lock);
+	return ret;
+}
+
+int seglog_iter_init(SeglogIter *it, Seglog *log, u64 seq) {
+	int ret = 0;
+	it->log = log;
+	pthread_mutex_lock(&log->shared->lock);
+	if (seq == log->next_seq) {
+		// at the end: the iterator picks up later appends
+		it->segment = log->segments.len ? log->segments.len - 1 : 0;
+		it->pos = log->segments.len ? seglog_segment(log, it->segment)->used
+									: 0;
+	} else
+		ret = seglog_find(log, seq, &it->segment, &it->pos);
+	pthread_mutex_unlock(&log->shared->lock);
+	return ret;
+}
+
+int seglog_iter_next(SeglogIter *it, const void **data, u32 *len, u64 *seq) {
+	Seglog *log = it->log;
+	int ret = -1;
+	pthread_mutex_lock(&log->shared->lock);
+	while (it->segment < log->segments.len) {
+		SeglogSegment *s = seglog_segment(log, it->segment);
+		if (it->pos < s->used) {
+			SeglogHeader *h = (SeglogHeader *)(s->data + it->pos);
+			*data = h + 1;
+			*len = h->len;
+			if (seq) *seq = h->seq;
+			it->pos += seglog_record_size(h->len);
+			ret = 0;
+			break;
+		}
+		if (it->segment + 1 == log->segments.len) break;
+		it->segment++;
+		it->pos = 0;
+	}
+	pthread_mutex_unlock(&log->shared->lock);
+	return ret;
+}
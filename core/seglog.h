@@ -0,0 +1,118 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _CORE_SEGLOG__
+#define _CORE_SEGLOG__
+
+#include <base/types.h>
+#include <core/vec.h>
+
+// Append only record log stored in a directory of fixed size segment files,
+// each named after the sequence number of its first record. Segments are
+// preallocated and written through a shared mapping, so an append is a copy
+// into memory; durability comes from msync according to the sync mode:
+//
+//   SEGLOG_SYNC_NONE    never synced by the log (the OS writes back)
+//   SEGLOG_SYNC_GROUP   synced once sync_bytes are pending or the oldest
+//                       pending record is sync_millis old (checked on
+//                       append and by a background thread)
+//   SEGLOG_SYNC_ALWAYS  every append waits until it is durable
+//
+// Waiting for durability is group commit: one thread syncs everything
+// appended so far while the others wait for it, so concurrent appenders
+// share syncs.
+//
+// Records have a 16 byte header carrying the length, the sequence number
+// and a CRC32C of both and the payload. Opening a log scans the segments
+// and stops at the first record that doesn't check out; the torn tail is cut
+// off (and any later segments removed), so a crash loses at most the
+// records that weren't synced. The sparse seek index (a position every
+// SEGLOG_INDEX_BYTES) is rebuilt by the same scan and is never stored.
+
+#define SEGLOG_SYNC_NONE 0
+#define SEGLOG_SYNC_GROUP 1
+#define SEGLOG_SYNC_ALWAYS 2
+
+#define SEGLOG_DEFAULT_SEGMENT_SIZE (64 * 1024 * 1024)
+#define SEGLOG_INDEX_BYTES 4096
+#define SEGLOG_PATH_MAX 256
+
+typedef struct SeglogOptions {
+	u64 segment_size;  // rounded up to whole pages
+	u32 sync;
+	u64 sync_bytes;
+	u64 sync_millis;
+} SeglogOptions;
+
+typedef struct SeglogSegment {
+	u64 base;  // sequence number of the first record
+	u64 end;   // sequence number after the last record
+	u64 size;
+	u64 used;
+	byte *data;
+	int fd;
+	Vec index;	// SeglogIndexEntry every SEGLOG_INDEX_BYTES
+} SeglogSegment;
+
+typedef struct SeglogShared SeglogShared;
+
+typedef struct Seglog {
+	char dir[SEGLOG_PATH_MAX];
+	SeglogOptions options;
+	Vec segments;  // SeglogSegment in sequence order
+	u64 next_seq;
+	// records before 'synced' are durable; 'synced_segment' and
+	// 'synced_pos' are where they end
+	u64 synced;
+	u64 synced_segment;
+	u64 synced_pos;
+	u64 pending_bytes;
+	i128 pending_since;
+	bool syncing;
+	SeglogShared *shared;
+} Seglog;
+
+typedef struct SeglogIter {
+	Seglog *log;
+	u64 segment;
+	u64 pos;
+} SeglogIter;
+
+// Open (creating if needed) the log in directory 'dir'. NULL options use a
+// 64 MiB segment size and SEGLOG_SYNC_NONE. With SEGLOG_SYNC_GROUP a thread
+// runs until the log is closed, and 'log' must not move. Returns -1 on I/O
+// errors.
+int seglog_open(Seglog *log, const char *dir, const SeglogOptions *options);
+// Syncs pending records (unless the mode is SEGLOG_SYNC_NONE) and unmaps.
+void seglog_close(Seglog *log);
+
+// Append a record of 'len' bytes, storing its sequence number in 'seq'
+// (if not NULL). Thread safe. Returns -1 if the record doesn't fit in a
+// segment or the next segment can't be created.
+int seglog_append(Seglog *log, const void *data, u32 len, u64 *seq);
+// Wait until every record up to and including 'seq' is durable.
+int seglog_commit(Seglog *log, u64 seq);
+// Make everything appended so far durable.
+int seglog_sync(Seglog *log);
+// Sequence number the next append will get (the number of records).
+u64 seglog_end(Seglog *log);
+
+// Find record 'seq' in O(log n): the payload stays valid until the log is
+// closed. Returns -1 if there is no such record.
+int seglog_read(Seglog *log, u64 seq, const void **data, u32 *len);
+// Iterate from record 'seq' on; next returns -1 after the last record.
+int seglog_iter_init(SeglogIter *it, Seglog *log, u64 seq);
+int seglog_iter_next(SeglogIter *it, const void **data, u32 *len, u64 *seq);
+
+#endif	// _CORE_SEGLOG__
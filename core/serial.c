@@ -0,0 +1,316 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <base/cpu.h>
+#include <base/util.h>
+#include <core/serial.h>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif	// __x86_64__
+
+typedef u64 SerialU64u __attribute__((aligned(1), may_alias));
+
+u64 serial_zigzag(i64 v) {
+	return (u64)v << 1 ^ (u64)(v >> 63);
+}
+
+i64 serial_unzigzag(u64 v) {
+	return (i64)(v >> 1) ^ -(i64)(v & 1);
+}
+
+static u32 serial_varint_len(u64 v) {
+	u32 bits = 64 - __builtin_clzll(v | 1);
+	return (bits + 6) / 7;
+}
+
+u32 serial_varint_put(byte *out, u64 v) {
+	u32 n = 0;
+	while (v >= 0x80) {
+		out[n++] = (byte)v | 0x80;
+		v >>= 7;
+	}
+	out[n++] = v;
+	return n;
+}
+
+u32 serial_varint_get(const byte *p, u64 len, u64 *v) {
+	u64 r = 0;
+	u32 max = len < SERIAL_VARINT_MAX ? len : SERIAL_VARINT_MAX;
+	for (u32 i = 0; i < max; i++) {
+		r |= (u64)(p[i] & 0x7F) << (7 * i);
+		if (!(p[i] & 0x80)) {
+			*v = r;
+			return i + 1;
+		}
+	}
+	return 0;
+}
+
+#ifdef __x86_64__
+
+// One load and movemask mark where every varint in the next 32 bytes ends
+// (a clear top bit); each value of up to 8 bytes is then one unaligned load
+// and a pext of its 7 bit groups. Stops at the first longer varint, within
+// 40 bytes of the end of the input or once 'count' values are decoded, and
+// returns the bytes consumed with the values decoded in *decoded.
+static __attribute__((target("avx2,bmi,bmi2,popcnt"))) u64
+serial_varints_avx2(const byte *p, u64 len, u64 *out, u64 count,
+					u64 *decoded) {
+	const byte *start = p, *end = p + len;
+	u64 n = 0;
+	while (n < count && end - p >= 40) {
+		__m256i bytes = _mm256_loadu_si256((const __m256i *)p);
+		u32 ends = ~(u32)_mm256_movemask_epi8(bytes);
+		u32 pos = 0;
+		while (ends && n < count) {
+			u32 last = _tzcnt_u32(ends);
+			u32 vlen = last + 1 - pos;
+			if (vlen > 8) break;
+			u64 word = *(const SerialU64u *)(p + pos);
+			u64 groups = 0x7F7F7F7F7F7F7F7FULL >> (64 - 8 * vlen);
+			out[n++] = _pext_u64(word, groups);
+			ends = _blsr_u32(ends);
+			pos = last + 1;
+		}
+		p += pos;
+		if (!pos) break;
+	}
+	*decoded = n;
+	return p - start;
+}
+
+#endif	// __x86_64__
+
+// Decode up to 'count' varints, stopping early at the end of the input.
+// Returns the number decoded (bytes consumed in *used), or -1 if a varint is
+// truncated or too long.
+static i64 serial_varints(const byte *p, u64 len, u64 *out, u64 count,
+						  u64 *used) {
+	u64 n = 0, pos = 0;
+#ifdef __x86_64__
+	bool simd = cpu_has(CPU_AVX2 | CPU_BMI2 | CPU_POPCNT);
+#endif	// __x86_64__
+	for (;;) {
+#ifdef __x86_64__
+		if (simd) {
+			u64 decoded;
+			pos += serial_varints_avx2(p + pos, len - pos, out + n, count - n,
+									   &decoded);
+			n += decoded;
+		}
+#endif	// __x86_64__
+		if (n == count || pos == len) break;
+		// every varint without SIMD, else one it stopped at (too long or
+		// near the end of the input)
+		u32 vlen = serial_varint_get(p + pos, len - pos, out + n);
+		if (!vlen) return -1;
+		pos += vlen;
+		n++;
+	}
+	*used = pos;
+	return n;
+}
+
+i64 serial_varint_get_n(const byte *p, u64 len, u64 *out, u64 count) {
+	u64 used;
+	if (serial_varints(p, len, out, count, &used) != (i64)count) return -1;
+	return used;
+}
+
+int serial_builder_init(SerialBuilder *b) {
+	b->depth = 0;
+	return vec_init(&b->buf, 1, 0);
+}
+
+void serial_builder_cleanup(SerialBuilder *b) {
+	vec_cleanup(&b->buf);
+	b->depth = 0;
+}
+
+void serial_builder_clear(SerialBuilder *b) {
+	vec_clear(&b->buf);
+	b->depth = 0;
+}
+
+// Room for 'n' more bytes, or NULL if the buffer can't grow.
+static byte *serial_room(SerialBuilder *b, u64 n) {
+	if (n > ~0ULL - b->buf.len || vec_reserve(&b->buf, b->buf.len + n))
+		return NULL;
+	return b->buf.data + b->buf.len;
+}
+
+// Reserve 'n' bytes past the key and write the key; returns where the
+// value goes.
+static byte *serial_field(SerialBuilder *b, u32 field, u32 type, u64 n) {
+	if (field == 0 || field > SERIAL_FIELD_MAX) return NULL;
+	byte *p = serial_room(b, SERIAL_VARINT_MAX + n);
+	if (!p) return NULL;
+	return p + serial_varint_put(p, (u64)field << 3 | type);
+}
+
+static void serial_fixed(byte *p, u64 v, u32 bytes) {
+	for (u32 i = 0; i < bytes; i++) p[i] = v >> (8 * i);
+}
+
+int serial_put_uint(SerialBuilder *b, u32 field, u64 v) {
+	byte *p = serial_field(b, field, SERIAL_VARINT, SERIAL_VARINT_MAX);
+	if (!p) return -1;
+	p += serial_varint_put(p, v);
+	b->buf.len = p - b->buf.data;
+	return 0;
+}
+
+int serial_put_int(SerialBuilder *b, u32 field, i64 v) {
+	return serial_put_uint(b, field, serial_zigzag(v));
+}
+
+int serial_put_fixed64(SerialBuilder *b, u32 field, u64 v) {
+	byte *p = serial_field(b, field, SERIAL_FIXED64, 8);
+	if (!p) return -1;
+	serial_fixed(p, v, 8);
+	b->buf.len = p + 8 - b->buf.data;
+	return 0;
+}
+
+int serial_put_fixed32(SerialBuilder *b, u32 field, u32 v) {
+	byte *p = serial_field(b, field, SERIAL_FIXED32, 4);
+	if (!p) return -1;
+	serial_fixed(p, v, 4);
+	b->buf.len = p + 4 - b->buf.data;
+	return 0;
+}
+
+int serial_put_f64(SerialBuilder *b, u32 field, f64 v) {
+	union {
+		f64 f;
+		u64 u;
+	} bits = {.f = v};
+	return serial_put_fixed64(b, field, bits.u);
+}
+
+int serial_put_bytes(SerialBuilder *b, u32 field, const void *data, u64 len) {
+	if (len > ~0ULL - SERIAL_VARINT_MAX) return -1;
+	byte *p = serial_field(b, field, SERIAL_BYTES, SERIAL_VARINT_MAX + len);
+	if (!p) return -1;
+	p += serial_varint_put(p, len);
+	copy_bytes(p, data, len);
+	b->buf.len = p + len - b->buf.data;
+	return 0;
+}
+
+int serial_put_str(SerialBuilder *b, u32 field, const char *s) {
+	return serial_put_bytes(b, field, s, cstring_len(s));
+}
+
+int serial_put_uints(SerialBuilder *b, u32 field, const u64 *v, u64 count) {
+	u64 size = 0;
+	for (u64 i = 0; i < count; i++) size += serial_varint_len(v[i]);
+	byte *p = serial_field(b, field, SERIAL_BYTES, SERIAL_VARINT_MAX + size);
+	if (!p) return -1;
+	p += serial_varint_put(p, size);
+	for (u64 i = 0; i < count; i++) p += serial_varint_put(p, v[i]);
+	b->buf.len = p - b->buf.data;
+	return 0;
+}
+
+int serial_begin(SerialBuilder *b, u32 field) {
+	if (b->depth == SERIAL_MAX_DEPTH) return -1;
+	// one byte for the length for now; serial_end makes room for more
+	byte *p = serial_field(b, field, SERIAL_BYTES, 1);
+	if (!p) return -1;
+	b->open[b->depth++] = p - b->buf.data;
+	*p = 0;
+	b->buf.len = p + 1 - b->buf.data;
+	return 0;
+}
+
+int serial_end(SerialBuilder *b) {
+	static const byte zeros[SERIAL_VARINT_MAX] = {0};
+	if (!b->depth) return -1;
+	u64 at = b->open[b->depth - 1];
+	u64 len = b->buf.len - at - 1;
+	u32 prefix = serial_varint_len(len);
+	if (prefix > 1 && vec_insert(&b->buf, at + 1, zeros, prefix - 1))
+		return -1;
+	serial_varint_put(b->buf.data + at, len);
+	b->depth--;
+	return 0;
+}
+
+void serial_reader_init(SerialReader *r, const void *data, u64 len) {
+	r->p = data;
+	r->end = r->p + len;
+}
+
+int serial_next(SerialReader *r, SerialField *f) {
+	if (r->p == r->end) return 0;
+	u64 key, len;
+	u32 n = serial_varint_get(r->p, r->end - r->p, &key);
+	if (!n || key >> 3 == 0 || key >> 3 > SERIAL_FIELD_MAX) return -1;
+	const byte *p = r->p + n;
+	u64 left = r->end - p;
+	f->id = key >> 3;
+	f->type = key & 7;
+	f->value = 0;
+	f->data = NULL;
+	f->len = 0;
+	switch (f->type) {
+		case SERIAL_VARINT:
+			n = serial_varint_get(p, left, &f->value);
+			if (!n) return -1;
+			p += n;
+			break;
+		case SERIAL_FIXED64:
+		case SERIAL_FIXED32:
+			n = f->type == SERIAL_FIXED64 ? 8 : 4;
+			if (left < n) return -1;
+			for (u32 i = 0; i < n; i++) f->value |= (u64)p[i] << (8 * i);
+			p += n;
+			break;
+		case SERIAL_BYTES:
+			n = serial_varint_get(p, left, &len);
+			if (!n || len > left - n) return -1;
+			f->data = p + n;
+			f->len = len;
+			p += n + len;
+			break;
+		default:
+			return -1;
+	}
+	r->p = p;
+	return 1;
+}
+
+void serial_reader_sub(SerialReader *sub, const SerialField *f) {
+	serial_reader_init(sub, f->data, f->len);
+}
+
+i64 serial_field_int(const SerialField *f) {
+	return serial_unzigzag(f->value);
+}
+
+f64 serial_field_f64(const SerialField *f) {
+	union {
+		u64 u;
+		f64 f;
+	} bits = {.u = f->value};
+	return bits.f;
+}
+
+i64 serial_field_uints(const SerialField *f, u64 *out, u64 capacity) {
+	u64 used;
+	i64 n = serial_varints(f->data, f->len, out, capacity, &used);
+	return n < 0 || used != f->len ? -1 : n;
+}
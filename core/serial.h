@@ -0,0 +1,123 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _CORE_SERIAL__
+#define _CORE_SERIAL__
+
+#include <base/types.h>
+#include <core/vec.h>
+
+// Compact binary records. A record is a sequence of fields, each a varint key
+// (field id << 3 | wire type) followed by its value: a LEB128 varint, 8 or 4
+// little endian bytes, or a varint length and that many bytes (strings,
+// packed arrays and nested records). This is the protobuf wire format, so
+// readers skip fields they don't know and fields can be added freely.
+//
+// Signed integers are zigzag encoded so small negative numbers stay short.
+// The reader never copies: a bytes field points into the input buffer, which
+// can come straight from map_file or a pipe. Packed varint arrays decode
+// with AVX2 and BMI2 when available, finding every varint end in 32 bytes
+// with one movemask and gathering each value's 7 bit groups with pext.
+//
+//   SerialBuilder b;
+//   serial_builder_init(&b);
+//   serial_put_uint(&b, 1, id);
+//   serial_put_str(&b, 2, name);
+//   serial_begin(&b, 3);  // nested record
+//   serial_put_int(&b, 1, -5);
+//   serial_end(&b);
+//   // b.buf.data, b.buf.len
+//
+//   SerialReader r;
+//   SerialField f;
+//   serial_reader_init(&r, data, len);
+//   while ((ret = serial_next(&r, &f)) > 0)
+//       if (f.id == 2) use(f.data, f.len);
+
+// wire types
+#define SERIAL_VARINT 0
+#define SERIAL_FIXED64 1
+#define SERIAL_BYTES 2
+#define SERIAL_FIXED32 5
+
+#define SERIAL_VARINT_MAX 10
+#define SERIAL_FIELD_MAX ((1U << 29) - 1)
+#define SERIAL_MAX_DEPTH 32
+
+u64 serial_zigzag(i64 v);
+i64 serial_unzigzag(u64 v);
+// Write 'v' to 'out' (room for SERIAL_VARINT_MAX bytes); returns its length.
+u32 serial_varint_put(byte *out, u64 v);
+// Read a varint from the 'len' bytes at 'p'; returns its length, or 0 if it
+// is truncated or longer than SERIAL_VARINT_MAX bytes.
+u32 serial_varint_get(const byte *p, u64 len, u64 *v);
+// Read 'count' consecutive varints into 'out'; returns the bytes consumed or
+// -1 if the input ends early or is malformed.
+i64 serial_varint_get_n(const byte *p, u64 len, u64 *out, u64 count);
+
+typedef struct SerialBuilder {
+	Vec buf;  // the encoded bytes so far
+	// offsets of the length prefixes of open nested records
+	u32 depth;
+	u64 open[SERIAL_MAX_DEPTH];
+} SerialBuilder;
+
+// Functions returning int return 0 on success and -1 on failure (the buffer
+// could not grow, a field id is 0 or over SERIAL_FIELD_MAX, records are
+// nested too deeply or serial_end has no serial_begin); the encoded bytes are
+// unchanged on failure.
+int serial_builder_init(SerialBuilder *b);
+void serial_builder_cleanup(SerialBuilder *b);
+// Drop the contents, keeping the buffer.
+void serial_builder_clear(SerialBuilder *b);
+int serial_put_uint(SerialBuilder *b, u32 field, u64 v);
+int serial_put_int(SerialBuilder *b, u32 field, i64 v);
+int serial_put_fixed64(SerialBuilder *b, u32 field, u64 v);
+int serial_put_fixed32(SerialBuilder *b, u32 field, u32 v);
+int serial_put_f64(SerialBuilder *b, u32 field, f64 v);
+int serial_put_bytes(SerialBuilder *b, u32 field, const void *data, u64 len);
+int serial_put_str(SerialBuilder *b, u32 field, const char *s);
+// A packed array: one bytes field holding 'count' varints.
+int serial_put_uints(SerialBuilder *b, u32 field, const u64 *v, u64 count);
+// Fields put between begin and end form a nested record in field 'field'.
+int serial_begin(SerialBuilder *b, u32 field);
+int serial_end(SerialBuilder *b);
+
+typedef struct SerialReader {
+	const byte *p;
+	const byte *end;
+} SerialReader;
+
+typedef struct SerialField {
+	u32 id;
+	u32 type;
+	u64 value;	// SERIAL_VARINT, SERIAL_FIXED64 and SERIAL_FIXED32
+	// SERIAL_BYTES: the contents, in place in the input
+	const byte *data;
+	u64 len;
+} SerialField;
+
+void serial_reader_init(SerialReader *r, const void *data, u64 len);
+// Read the next field: returns 1, 0 at the end of the input or -1 if the
+// input is malformed.
+int serial_next(SerialReader *r, SerialField *f);
+// Read a nested record (a bytes field).
+void serial_reader_sub(SerialReader *sub, const SerialField *f);
+i64 serial_field_int(const SerialField *f);
+f64 serial_field_f64(const SerialField *f);
+// Decode a packed array (a bytes field) into 'out'; returns the number of
+// values, or -1 if it is malformed or has more than 'capacity' values.
+i64 serial_field_uints(const SerialField *f, u64 *out, u64 capacity);
+
+#endif	// _CORE_SERIAL__
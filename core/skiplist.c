@@ -0,0 +1,336 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <base/random.h>
+#include <base/sys.h>
+#include <base/util.h>
+#include <core/skiplist.h>
+
+// 'refs' counts the inserter (until the tower is built) and the list (until
+// the node is deleted); whoever drops the last one retires the node, so a
+// tower level linked after the deletion is always unlinked first.
+struct SkipListNode {
+	u64 key;
+	u64 value;
+	u32 height;
+	u32 refs;
+	SkipListNode *next[];
+};
+
+struct SkipListChunk {
+	SkipListChunk *next;
+};
+
+#define SKIPLIST_CHUNK_PAGES 16
+
+static bool skiplist_marked(SkipListNode *p) {
+	return (u64)p & 1;
+}
+
+static SkipListNode *skiplist_mark(SkipListNode *p) {
+	return (SkipListNode *)((u64)p | 1);
+}
+
+static SkipListNode *skiplist_unmark(SkipListNode *p) {
+	return (SkipListNode *)((u64)p & ~1ULL);
+}
+
+static SkipListNode *skiplist_next(SkipListNode *node, u32 level) {
+	return __atomic_load_n(&node->next[level], __ATOMIC_ACQUIRE);
+}
+
+static bool skiplist_cas(SkipListNode **p, SkipListNode *expect,
+						 SkipListNode *value) {
+	return __atomic_compare_exchange_n(p, &expect, value, false,
+									   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+static u32 skiplist_height(void) {
+	// a trailing zero pair per extra level, capped at SKIPLIST_MAX_HEIGHT
+	u64 cap = 1ULL << (2 * SKIPLIST_MAX_HEIGHT - 2);
+	return 1 + __builtin_ctzll(random_u64() | cap) / 2;
+}
+
+static SkipListNode *skiplist_alloc(SkipList *s, u32 height) {
+	u64 size = sizeof(SkipListNode) + height * sizeof(SkipListNode *);
+	SkipListNode *node;
+
+	spin_lock(&s->free_lock[height - 1]);
+	if ((node = s->free[height - 1])) s->free[height - 1] = node->next[0];
+	spin_unlock(&s->free_lock[height - 1]);
+	if (node) return node;
+
+	spin_lock(&s->chunk_lock);
+	if (s->bump_left < size) {
+		SkipListChunk *chunk = map(SKIPLIST_CHUNK_PAGES);
+		if (!chunk) {
+			spin_unlock(&s->chunk_lock);
+			return NULL;
+		}
+		chunk->next = s->chunks;
+		s->chunks = chunk;
+		s->bump = (byte *)(chunk + 1);
+		s->bump_left =
+			SKIPLIST_CHUNK_PAGES * PAGE_SIZE - sizeof(SkipListChunk);
+	}
+	node = (SkipListNode *)s->bump;
+	s->bump += size;
+	s->bump_left -= size;
+	spin_unlock(&s->chunk_lock);
+	return node;
+}
+
+static void skiplist_free(SkipList *s, SkipListNode *node) {
+	u32 h = node->height - 1;
+	spin_lock(&s->free_lock[h]);
+	node->next[0] = s->free[h];
+	s->free[h] = node;
+	spin_unlock(&s->free_lock[h]);
+}
+
+static void skiplist_reclaim(void *ptr, void *ctx) {
+	skiplist_free(ctx, ptr);
+}
+
+static void skiplist_unref(SkipList *s, EbrThread *t, SkipListNode *node) {
+	if (__atomic_sub_fetch(&node->refs, 1, __ATOMIC_ACQ_REL)) return;
+	// if no batch can be mapped the node stays in its chunk until cleanup
+	ebr_retire(t, node, skiplist_reclaim, s);
+}
+
+int skiplist_init(SkipList *s) {
+	s->chunks = NULL;
+	s->bump = NULL;
+	s->bump_left = 0;
+	s->chunk_lock = false;
+	for (u32 i = 0; i < SKIPLIST_MAX_HEIGHT; i++) {
+		s->free[i] = NULL;
+		s->free_lock[i] = false;
+	}
+	if (ebr_init(&s->ebr, EBR_MODE_EPOCH)) return -1;
+	if (!(s->head = skiplist_alloc(s, SKIPLIST_MAX_HEIGHT))) return -1;
+	s->head->key = 0;
+	s->head->height = SKIPLIST_MAX_HEIGHT;
+	for (u32 i = 0; i < SKIPLIST_MAX_HEIGHT; i++) s->head->next[i] = NULL;
+	s->levels = 1;
+	s->count = 0;
+	return 0;
+}
+
+void skiplist_cleanup(SkipList *s) {
+	ebr_cleanup(&s->ebr);
+	for (SkipListChunk *c = s->chunks, *next; c; c = next) {
+		next = c->next;
+		unmap(c, SKIPLIST_CHUNK_PAGES);
+	}
+	s->chunks = NULL;
+	s->head = NULL;
+}
+
+EbrThread *skiplist_register(SkipList *s) {
+	return ebr_register(&s->ebr);
+}
+
+void skiplist_unregister(EbrThread *t) {
+	ebr_unregister(t);
+}
+
+// Predecessor and successor of 'key' at every level, unlinking deleted
+// nodes on the way. Returns whether succs[0] holds 'key'.
+static bool skiplist_find(SkipList *s, u64 key, SkipListNode **preds,
+						  SkipListNode **succs) {
+retry:;
+	SkipListNode *pred = s->head;
+	u32 levels = __atomic_load_n(&s->levels, __ATOMIC_ACQUIRE);
+	for (i32 level = SKIPLIST_MAX_HEIGHT - 1; level >= 0; level--) {
+		SkipListNode *curr = NULL;
+		if ((u32)level < levels)
+			curr = skiplist_unmark(skiplist_next(pred, level));
+		while (curr) {
+			SkipListNode *succ = skiplist_next(curr, level);
+			if (skiplist_marked(succ)) {
+				succ = skiplist_unmark(succ);
+				// fails if 'pred' is deleted or changed under us
+				if (!skiplist_cas(&pred->next[level], curr, succ)) goto retry;
+				curr = succ;
+				continue;
+			}
+			if (curr->key >= key) break;
+			pred = curr;
+			curr = succ;
+		}
+		preds[level] = pred;
+		succs[level] = curr;
+	}
+	return succs[0] && succs[0]->key == key;
+}
+
+// First live node with a key >= 'key'; read only.
+static SkipListNode *skiplist_seek(SkipList *s, u64 key) {
+	SkipListNode *pred = s->head, *curr = NULL;
+	u32 levels = __atomic_load_n(&s->levels, __ATOMIC_ACQUIRE);
+	for (i32 level = levels - 1; level >= 0; level--) {
+		curr = skiplist_unmark(skiplist_next(pred, level));
+		while (curr) {
+			SkipListNode *succ = skiplist_next(curr, level);
+			if (skiplist_marked(succ))
+				curr = skiplist_unmark(succ);
+			else if (curr->key >= key)
+				break;
+			else {
+				pred = curr;
+				curr = succ;
+			}
+		}
+	}
+	return curr;
+}
+
+int skiplist_put(SkipList *s, EbrThread *t, u64 key, u64 value) {
+	SkipListNode *preds[SKIPLIST_MAX_HEIGHT], *succs[SKIPLIST_MAX_HEIGHT];
+	SkipListNode *node = NULL;
+	u32 height = skiplist_height();
+	int ret = 0;
+
+	ebr_pin(t);
+	for (;;) {
+		if (skiplist_find(s, key, preds, succs)) {
+			__atomic_store_n(&succs[0]->value, value, __ATOMIC_RELEASE);
+			if (node) skiplist_free(s, node);
+			ret = 1;
+			goto done;
+		}
+		if (!node) {
+			if (!(node = skiplist_alloc(s, height))) {
+				ret = -1;
+				goto done;
+			}
+			node->key = key;
+			node->value = value;
+			node->height = height;
+			node->refs = 2;
+			u32 levels = __atomic_load_n(&s->levels, __ATOMIC_RELAXED);
+			while (levels < height &&
+				   !__atomic_compare_exchange_n(&s->levels, &levels, height,
+												false, __ATOMIC_RELEASE,
+												__ATOMIC_RELAXED));
+		}
+		for (u32 i = 0; i < height; i++)
+			__atomic_store_n(&node->next[i], succs[i], __ATOMIC_RELAXED);
+		if (skiplist_cas(&preds[0]->next[0], succs[0], node)) break;
+	}
+	__atomic_fetch_add(&s->count, 1, __ATOMIC_RELAXED);
+
+	// the node is in the map; the upper levels are only shortcuts
+	for (u32 i = 1; i < height; i++) {
+		for (;;) {
+			SkipListNode *next = skiplist_next(node, i);
+			if (skiplist_marked(next)) goto built;
+			if (next != succs[i] &&
+				!skiplist_cas(&node->next[i], next, succs[i]))
+				goto built;
+			if (skiplist_cas(&preds[i]->next[i], succs[i], node)) break;
+			skiplist_find(s, key, preds, succs);
+			if (succs[0] != node) goto built;
+		}
+	}
+built:
+	// a level linked after a concurrent delete marked it must be unlinked
+	if (skiplist_marked(skiplist_next(node, 0)))
+		skiplist_find(s, key, preds, succs);
+	skiplist_unref(s, t, node);
+done:
+	ebr_unpin(t);
+	return ret;
+}
+
+int skiplist_get(SkipList *s, EbrThread *t, u64 key, u64 *value) {
+	int ret = -1;
+	ebr_pin(t);
+	SkipListNode *node = skiplist_seek(s, key);
+	if (node && node->key == key) {
+		*value = __atomic_load_n(&node->value, __ATOMIC_ACQUIRE);
+		ret = 0;
+	}
+	ebr_unpin(t);
+	return ret;
+}
+
+int skiplist_delete(SkipList *s, EbrThread *t, u64 key, u64 *value) {
+	SkipListNode *preds[SKIPLIST_MAX_HEIGHT], *succs[SKIPLIST_MAX_HEIGHT];
+	int ret = -1;
+
+	ebr_pin(t);
+	if (!skiplist_find(s, key, preds, succs)) goto done;
+	SkipListNode *node = succs[0];
+	for (u32 i = node->height - 1; i > 0; i--) {
+		SkipListNode *next = skiplist_next(node, i);
+		while (!skiplist_marked(next) &&
+			   !skiplist_cas(&node->next[i], next, skiplist_mark(next)))
+			next = skiplist_next(node, i);
+	}
+	// whoever marks level 0 deleted the node
+	for (;;) {
+		SkipListNode *next = skiplist_next(node, 0);
+		if (skiplist_marked(next)) goto done;
+		if (skiplist_cas(&node->next[0], next, skiplist_mark(next))) break;
+	}
+	if (value) *value = __atomic_load_n(&node->value, __ATOMIC_ACQUIRE);
+	__atomic_fetch_sub(&s->count, 1, __ATOMIC_RELAXED);
+	skiplist_find(s, key, preds, succs);
+	skiplist_unref(s, t, node);
+	ret = 0;
+done:
+	ebr_unpin(t);
+	return ret;
+}
+
+u64 skiplist_count(const SkipList *s) {
+	return __atomic_load_n(&s->count, __ATOMIC_RELAXED);
+}
+
+void skiplist_iter_init(SkipListIter *it, SkipList *s, EbrThread *t, u64 lo,
+						u64 hi) {
+	it->s = s;
+	it->t = t;
+	it->lo = lo;
+	it->hi = hi;
+	it->done = lo > hi;
+	ebr_pin(t);
+	it->node = it->done ? NULL : skiplist_seek(s, lo);
+}
+
+int skiplist_iter_next(SkipListIter *it, u64 *key, u64 *value) {
+	SkipListNode *node = it->node;
+	// a deleted node's next pointers are frozen, so following them is safe
+	while (node &&
+		   (skiplist_marked(skiplist_next(node, 0)) || node->key < it->lo))
+		node = skiplist_unmark(skiplist_next(node, 0));
+	if (it->done || !node || node->key > it->hi) {
+		it->done = true;
+		return -1;
+	}
+	*key = node->key;
+	*value = __atomic_load_n(&node->value, __ATOMIC_ACQUIRE);
+	it->node = skiplist_unmark(skiplist_next(node, 0));
+	if (node->key == ~0ULL)
+		it->done = true;
+	else
+		it->lo = node->key + 1;
+	return 0;
+}
+
+void skiplist_iter_done(SkipListIter *it) {
+	ebr_unpin(it->t);
+}
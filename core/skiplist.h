@@ -0,0 +1,87 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _CORE_SKIPLIST__
+#define _CORE_SKIPLIST__
+
+#include <base/types.h>
+#include <core/ebr.h>
+
+// Lock free ordered map from u64 keys to u64 values, shared between threads.
+//
+// A node is deleted by marking the low bit of each of its next pointers (top
+// level first, level 0 last: marking level 0 is the deletion), after which
+// any thread passing it unlinks it. Unlinked nodes are retired to the list's
+// epoch domain, so every thread using the list registers with
+// skiplist_register and passes its record to each call.
+//
+// Nodes carry their tower inline (key, value and next[0] share the first 32
+// bytes) and come from per height free lists carved out of 64 KiB chunks, so
+// nodes are exactly as large as their height needs. Heights are geometric
+// with p = 1/4.
+
+#define SKIPLIST_MAX_HEIGHT 16
+
+typedef struct SkipListNode SkipListNode;
+typedef struct SkipListChunk SkipListChunk;
+
+typedef struct SkipList {
+	SkipListNode *head;
+	u32 levels;	 // levels in use (only grows)
+	u64 count;
+	Ebr ebr;
+	SkipListNode *free[SKIPLIST_MAX_HEIGHT];
+	bool free_lock[SKIPLIST_MAX_HEIGHT];
+	SkipListChunk *chunks;
+	byte *bump;
+	u64 bump_left;
+	bool chunk_lock;
+} SkipList;
+
+typedef struct SkipListIter {
+	SkipList *s;
+	EbrThread *t;
+	SkipListNode *node;
+	u64 lo;	 // keys below 'lo' were seen already
+	u64 hi;
+	bool done;
+} SkipListIter;
+
+int skiplist_init(SkipList *s);
+// No thread may be registered.
+void skiplist_cleanup(SkipList *s);
+
+EbrThread *skiplist_register(SkipList *s);
+void skiplist_unregister(EbrThread *t);
+
+// Insert or replace. Returns 1 if the key was present (its value is
+// replaced), 0 if it was added and -1 if memory can't be mapped.
+int skiplist_put(SkipList *s, EbrThread *t, u64 key, u64 value);
+// Returns -1 if the key is absent.
+int skiplist_get(SkipList *s, EbrThread *t, u64 key, u64 *value);
+// Remove the key, storing its last value in 'value' (if not NULL). Returns
+// -1 if the key is absent (or another thread removed it first).
+int skiplist_delete(SkipList *s, EbrThread *t, u64 key, u64 *value);
+u64 skiplist_count(const SkipList *s);
+
+// Iterate over keys in [lo, hi] in order. Entries inserted or deleted during
+// the scan may or may not be seen; every key is seen at most once. The
+// thread stays pinned until skiplist_iter_done, holding back reclamation.
+void skiplist_iter_init(SkipListIter *it, SkipList *s, EbrThread *t, u64 lo,
+						u64 hi);
+// Returns -1 after the last key.
+int skiplist_iter_next(SkipListIter *it, u64 *key, u64 *value);
+void skiplist_iter_done(SkipListIter *it);
+
+#endif	// _CORE_SKIPLIST__
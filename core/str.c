@@ -0,0 +1,607 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <base/crc32c.h>
+#include <base/sys.h>
+#include <base/util.h>
+#include <core/str.h>
+
+#define STR_FLAT 1
+#define STR_CONCAT 2
+#define STR_HASHED 1
+// An AVL tree of height h has at least fib(h + 2) - 1 nodes, so 96 levels is
+// far more than any string that fits in memory.
+#define STR_MAX_HEIGHT 96
+
+#define STR_SLAB_PAGES 16
+#define STR_CLASSES 6
+
+// Flat buffers hold 'len' bytes and a NUL after the header; concat nodes hold
+// their two children (each covering its whole node or buffer slice). A Str
+// pointing at a concat node always covers all of it.
+struct StrNode {
+	u64 refs;
+	u64 len;
+	u32 kind;
+	u32 height;
+};
+
+// Every allocation is preceded by a block header: the slab it was cut from,
+// or NULL and the page count for a mapping of its own. Free cells reuse
+// 'pages' as the free list link.
+typedef struct StrSlab StrSlab;
+
+typedef struct StrBlock {
+	StrSlab *slab;
+	u64 pages;
+} StrBlock;
+
+struct StrSlab {
+	StrSlab *next;
+	StrSlab *prev;
+	StrBlock *free;
+	u32 used;
+	u32 cls;
+};
+
+// Slabs with free cells are kept on their class's list. One slab that empties
+// is kept as a spare while the class has live cells, so a string that is
+// rebuilt in a loop doesn't map and unmap a slab on every step; everything is
+// unmapped once the last cell is freed.
+typedef struct StrClass {
+	StrSlab *partial;
+	StrSlab *spare;
+	u64 live;
+	bool lock;
+} StrClass;
+
+static const u32 str_class_size[STR_CLASSES] = {64, 128, 256, 512, 1024, 2048};
+static StrClass str_classes[STR_CLASSES];
+
+static void str_slab_unlink(StrClass *c, StrSlab *slab) {
+	if (slab->prev)
+		slab->prev->next = slab->next;
+	else
+		c->partial = slab->next;
+	if (slab->next) slab->next->prev = slab->prev;
+}
+
+static void str_slab_link(StrClass *c, StrSlab *slab) {
+	slab->prev = NULL;
+	slab->next = c->partial;
+	if (c->partial) c->partial->prev = slab;
+	c->partial = slab;
+}
+
+static StrSlab *str_slab_new(u32 cls) {
+	StrSlab *slab = map(STR_SLAB_PAGES);
+	if (!slab) return NULL;
+	slab->cls = cls;
+	slab->used = 0;
+	slab->free = NULL;
+	u64 cell = sizeof(StrBlock) + str_class_size[cls];
+	byte *p = (byte *)(slab + 1);
+	byte *end = (byte *)slab + STR_SLAB_PAGES * PAGE_SIZE;
+	for (; p + cell <= end; p += cell) {
+		StrBlock *b = (StrBlock *)p;
+		b->slab = slab;
+		b->pages = (u64)slab->free;
+		slab->free = b;
+	}
+	return slab;
+}
+
+static void *str_alloc(u64 size) {
+	u32 cls = 0;
+	while (cls < STR_CLASSES && str_class_size[cls] < size) cls++;
+	if (cls == STR_CLASSES) {
+		u64 pages = bytes_to_pages(size + sizeof(StrBlock));
+		StrBlock *b = map(pages);
+		if (!b) return NULL;
+		b->slab = NULL;
+		b->pages = pages;
+		return b + 1;
+	}
+
+	StrClass *c = &str_classes[cls];
+	spin_lock(&c->lock);
+	StrSlab *slab = c->partial;
+	if (!slab) {
+		if ((slab = c->spare))
+			c->spare = NULL;
+		else if (!(slab = str_slab_new(cls))) {
+			spin_unlock(&c->lock);
+			return NULL;
+		}
+		str_slab_link(c, slab);
+	}
+	StrBlock *b = slab->free;
+	slab->free = (StrBlock *)b->pages;
+	slab->used++;
+	c->live++;
+	if (!slab->free) str_slab_unlink(c, slab);
+	spin_unlock(&c->lock);
+	return b + 1;
+}
+
+static void str_free(void *ptr) {
+	StrBlock *b = (StrBlock *)ptr - 1;
+	StrSlab *slab = b->slab;
+	if (!slab) {
+		unmap(b, b->pages);
+		return;
+	}
+
+	StrClass *c = &str_classes[slab->cls];
+	spin_lock(&c->lock);
+	bool full = !slab->free;
+	b->pages = (u64)slab->free;
+	slab->free = b;
+	c->live--;
+	if (--slab->used == 0) {
+		if (!full) str_slab_unlink(c, slab);
+		if (c->live && !c->spare)
+			c->spare = slab;
+		else
+			unmap(slab, STR_SLAB_PAGES);
+	} else if (full)
+		str_slab_link(c, slab);
+	if (!c->live && c->spare) {
+		unmap(c->spare, STR_SLAB_PAGES);
+		c->spare = NULL;
+	}
+	spin_unlock(&c->lock);
+}
+
+static bool str_is_small(const Str *s) {
+	return s->len <= STR_SMALL_MAX;
+}
+
+static bool str_is_concat(const Str *s) {
+	return !str_is_small(s) && s->node->kind == STR_CONCAT;
+}
+
+static char *str_node_data(StrNode *n) {
+	return (char *)(n + 1);
+}
+
+static Str *str_node_children(StrNode *n) {
+	return (Str *)(n + 1);
+}
+
+static u32 str_height(const Str *s) {
+	return str_is_concat(s) ? s->node->height : 0;
+}
+
+static void str_node_release(StrNode *n) {
+	if (__atomic_sub_fetch(&n->refs, 1, __ATOMIC_ACQ_REL)) return;
+	if (n->kind == STR_CONCAT) {
+		Str *c = str_node_children(n);
+		str_release(&c[0]);
+		str_release(&c[1]);
+	}
+	str_free(n);
+}
+
+static void str_set_empty(Str *s) {
+	s->len = 0;
+	s->hash = 0;
+	s->flags = 0;
+	s->small[0] = 0;
+}
+
+static void str_set_node(Str *s, StrNode *n, u64 offset, u64 len) {
+	s->len = len;
+	s->hash = 0;
+	s->flags = 0;
+	s->node = n;
+	s->offset = offset;
+}
+
+// Copy 'n' bytes starting at 'start' out of 's'. Recurses only into left
+// children, so the depth is bounded by the rope height.
+static void str_read(const Str *s, u64 start, u64 n, char *out) {
+	while (n) {
+		if (str_is_small(s)) {
+			copy_bytes((byte *)out, (byte *)s->small + start, n);
+			return;
+		}
+		if (s->node->kind == STR_FLAT) {
+			char *data = str_node_data(s->node) + s->offset;
+			copy_bytes((byte *)out, (byte *)data + start, n);
+			return;
+		}
+		const Str *c = str_node_children(s->node);
+		if (start < c[0].len) {
+			u64 k = c[0].len - start < n ? c[0].len - start : n;
+			str_read(&c[0], start, k, out);
+			out += k;
+			n -= k;
+			start = 0;
+		} else
+			start -= c[0].len;
+		s = &c[1];
+	}
+}
+
+static StrNode *str_flat_new(u64 len, u64 capacity) {
+	StrNode *n = str_alloc(sizeof(StrNode) + capacity + 1);
+	if (!n) return NULL;
+	n->refs = 1;
+	n->len = len;
+	n->kind = STR_FLAT;
+	n->height = 0;
+	str_node_data(n)[len] = 0;
+	return n;
+}
+
+// 'dst' gets a copy of a and b (either may be NULL) as a small or flat
+// string. The buffer is sized for at least 'capacity' bytes.
+static int str_copy_pair(Str *dst, const Str *a, const Str *b, u64 capacity) {
+	u64 alen = a ? a->len : 0, blen = b ? b->len : 0;
+	u64 len = alen + blen;
+	char *out;
+	if (len <= STR_SMALL_MAX) {
+		str_set_empty(dst);
+		dst->len = len;
+		out = dst->small;
+		out[len] = 0;
+	} else {
+		StrNode *n = str_flat_new(len, len > capacity ? len : capacity);
+		if (!n) {
+			str_set_empty(dst);
+			return -1;
+		}
+		str_set_node(dst, n, 0, len);
+		out = str_node_data(n);
+	}
+	if (alen) str_read(a, 0, alen, out);
+	if (blen) str_read(b, 0, blen, out + alen);
+	return 0;
+}
+
+// New concat node over 'a' and 'b', which both gain a reference.
+static int str_node(Str *dst, const Str *a, const Str *b) {
+	StrNode *n = str_alloc(sizeof(StrNode) + 2 * sizeof(Str));
+	if (!n) {
+		str_set_empty(dst);
+		return -1;
+	}
+	u32 ha = str_height(a), hb = str_height(b);
+	n->refs = 1;
+	n->len = a->len + b->len;
+	n->kind = STR_CONCAT;
+	n->height = 1 + (ha > hb ? ha : hb);
+	Str *c = str_node_children(n);
+	str_share(&c[0], a);
+	str_share(&c[1], b);
+	str_set_node(dst, n, 0, n->len);
+	return 0;
+}
+
+// Two leaves that fit in one buffer are merged, so appending small pieces
+// builds leaves of up to STR_FLAT_MAX bytes instead of a node per piece.
+// Merged leaves always take the largest size class: a leaf growing by
+// appends would otherwise step through every class, emptying (and
+// unmapping) each slab it leaves behind.
+static int str_pair(Str *dst, const Str *a, const Str *b) {
+	if (!str_height(a) && !str_height(b) && a->len + b->len <= STR_FLAT_MAX)
+		return str_copy_pair(dst, a, b, STR_FLAT_MAX);
+	return str_node(dst, a, b);
+}
+
+// node(node(a, b), c), releasing nothing.
+static int str_node3_left(Str *dst, const Str *a, const Str *b,
+						  const Str *c) {
+	Str t;
+	if (str_node(&t, a, b)) return -1;
+	int ret = str_node(dst, &t, c);
+	str_release(&t);
+	return ret;
+}
+
+static int str_node3_right(Str *dst, const Str *a, const Str *b,
+						   const Str *c) {
+	Str t;
+	if (str_node(&t, b, c)) return -1;
+	int ret = str_node(dst, a, &t);
+	str_release(&t);
+	return ret;
+}
+
+// node(node(a, b), node(c, d)).
+static int str_node4(Str *dst, const Str *a, const Str *b, const Str *c,
+					 const Str *d) {
+	Str l, r;
+	if (str_node(&l, a, b)) return -1;
+	if (str_node(&r, c, d)) {
+		str_release(&l);
+		return -1;
+	}
+	int ret = str_node(dst, &l, &r);
+	str_release(&l);
+	str_release(&r);
+	return ret;
+}
+
+// Join where 'a' is at least two levels higher than 'b': descend the right
+// spine of 'a' to a subtree about as high as 'b', join there and rebalance
+// on the way back up with single or double rotations.
+static int str_join_right(Str *dst, const Str *a, const Str *b) {
+	const Str *ch = str_node_children(a->node);
+	const Str *l = &ch[0], *c = &ch[1];
+	Str t;
+	int ret;
+	if (str_height(c) <= str_height(b) + 1)
+		ret = str_pair(&t, c, b);
+	else
+		ret = str_join_right(&t, c, b);
+	if (ret) return -1;
+
+	if (str_height(&t) <= str_height(l) + 1)
+		ret = str_node(dst, l, &t);
+	else {
+		const Str *tc = str_node_children(t.node);
+		if (str_height(&tc[0]) > str_height(&tc[1])) {
+			const Str *inner = str_node_children(tc[0].node);
+			ret = str_node4(dst, l, &inner[0], &inner[1], &tc[1]);
+		} else
+			ret = str_node3_left(dst, l, &tc[0], &tc[1]);
+	}
+	str_release(&t);
+	return ret;
+}
+
+static int str_join_left(Str *dst, const Str *a, const Str *b) {
+	const Str *ch = str_node_children(b->node);
+	const Str *c = &ch[0], *r = &ch[1];
+	Str t;
+	int ret;
+	if (str_height(c) <= str_height(a) + 1)
+		ret = str_pair(&t, a, c);
+	else
+		ret = str_join_left(&t, a, c);
+	if (ret) return -1;
+
+	if (str_height(&t) <= str_height(r) + 1)
+		ret = str_node(dst, &t, r);
+	else {
+		const Str *tc = str_node_children(t.node);
+		if (str_height(&tc[1]) > str_height(&tc[0])) {
+			const Str *inner = str_node_children(tc[1].node);
+			ret = str_node4(dst, &tc[0], &inner[0], &inner[1], r);
+		} else
+			ret = str_node3_right(dst, &tc[0], &tc[1], r);
+	}
+	str_release(&t);
+	return ret;
+}
+
+static int str_join(Str *dst, const Str *a, const Str *b) {
+	if (!a->len) {
+		str_share(dst, b);
+		return 0;
+	}
+	if (!b->len) {
+		str_share(dst, a);
+		return 0;
+	}
+	if (a->len + b->len <= STR_FLAT_MAX) return str_copy_pair(dst, a, b, 0);
+	u32 ha = str_height(a), hb = str_height(b);
+	if (ha > hb + 1) return str_join_right(dst, a, b);
+	if (hb > ha + 1) return str_join_left(dst, a, b);
+	return str_node(dst, a, b);
+}
+
+// Slicing a rope splits it along the paths to 'start' and 'end' and joins
+// the pieces back, so the result is balanced and takes O(log n) new nodes.
+static int str_sub(Str *dst, const Str *s, u64 start, u64 end) {
+	u64 len = end - start;
+	if (len == s->len) {
+		str_share(dst, s);
+		return 0;
+	}
+	if (len <= STR_SMALL_MAX) {
+		str_set_empty(dst);
+		dst->len = len;
+		str_read(s, start, len, dst->small);
+		dst->small[len] = 0;
+		return 0;
+	}
+	if (s->node->kind == STR_FLAT) {
+		__atomic_add_fetch(&s->node->refs, 1, __ATOMIC_RELAXED);
+		str_set_node(dst, s->node, s->offset + start, len);
+		return 0;
+	}
+
+	const Str *c = str_node_children(s->node);
+	u64 split = c[0].len;
+	if (end <= split) return str_sub(dst, &c[0], start, end);
+	if (start >= split) return str_sub(dst, &c[1], start - split, end - split);
+	Str l, r;
+	if (str_sub(&l, &c[0], start, split)) return -1;
+	if (str_sub(&r, &c[1], 0, end - split)) {
+		str_release(&l);
+		return -1;
+	}
+	int ret = str_join(dst, &l, &r);
+	str_release(&l);
+	str_release(&r);
+	return ret;
+}
+
+// Walks the contiguous chunks of a string from left to right.
+typedef struct StrIter {
+	const Str *stack[STR_MAX_HEIGHT];
+	u32 depth;
+} StrIter;
+
+static void str_iter_init(StrIter *it, const Str *s) {
+	it->depth = 0;
+	if (s->len) it->stack[it->depth++] = s;
+}
+
+static bool str_iter_next(StrIter *it, const char **data, u64 *len) {
+	if (!it->depth) return false;
+	const Str *s = it->stack[--it->depth];
+	while (str_is_concat(s)) {
+		const Str *c = str_node_children(s->node);
+		it->stack[it->depth++] = &c[1];
+		s = &c[0];
+	}
+	if (str_is_small(s))
+		*data = s->small;
+	else
+		*data = str_node_data(s->node) + s->offset;
+	*len = s->len;
+	return true;
+}
+
+int str_init(Str *s, const char *bytes, u64 len) {
+	if (len <= STR_SMALL_MAX) {
+		str_set_empty(s);
+		s->len = len;
+		copy_bytes((byte *)s->small, (byte *)bytes, len);
+		s->small[len] = 0;
+		return 0;
+	}
+	StrNode *n = str_flat_new(len, len);
+	if (!n) {
+		str_set_empty(s);
+		return -1;
+	}
+	copy_bytes((byte *)str_node_data(n), (byte *)bytes, len);
+	str_set_node(s, n, 0, len);
+	return 0;
+}
+
+int str_init_cstr(Str *s, const char *cstr) {
+	return str_init(s, cstr, cstring_len(cstr));
+}
+
+void str_share(Str *dst, const Str *src) {
+	*dst = *src;
+	if (!str_is_small(src))
+		__atomic_add_fetch(&src->node->refs, 1, __ATOMIC_RELAXED);
+}
+
+void str_release(Str *s) {
+	if (!str_is_small(s)) str_node_release(s->node);
+	str_set_empty(s);
+}
+
+u64 str_len(const Str *s) {
+	return s->len;
+}
+
+char str_at(const Str *s, u64 i) {
+	while (str_is_concat(s)) {
+		const Str *c = str_node_children(s->node);
+		if (i < c[0].len)
+			s = &c[0];
+		else {
+			i -= c[0].len;
+			s = &c[1];
+		}
+	}
+	if (str_is_small(s)) return s->small[i];
+	return str_node_data(s->node)[s->offset + i];
+}
+
+u32 str_hash(Str *s) {
+	if (s->flags & STR_HASHED) return s->hash;
+	StrIter it;
+	const char *data;
+	u64 len;
+	u32 crc = 0;
+	str_iter_init(&it, s);
+	while (str_iter_next(&it, &data, &len)) crc = crc32c(crc, data, len);
+	s->hash = crc;
+	s->flags |= STR_HASHED;
+	return crc;
+}
+
+bool str_equal(Str *a, Str *b) {
+	if (a->len != b->len) return false;
+	if ((a->flags & b->flags & STR_HASHED) && a->hash != b->hash) return false;
+	return str_compare(a, b) == 0;
+}
+
+int str_compare(const Str *a, const Str *b) {
+	StrIter ia, ib;
+	const char *pa = NULL, *pb = NULL;
+	u64 na = 0, nb = 0;
+	str_iter_init(&ia, a);
+	str_iter_init(&ib, b);
+	for (;;) {
+		if (!na && !str_iter_next(&ia, &pa, &na)) break;
+		if (!nb && !str_iter_next(&ib, &pb, &nb)) break;
+		u64 n = na < nb ? na : nb;
+		for (u64 i = 0; i < n; i++)
+			if (pa[i] != pb[i]) return (byte)pa[i] < (byte)pb[i] ? -1 : 1;
+		pa += n;
+		pb += n;
+		na -= n;
+		nb -= n;
+	}
+	return a->len < b->len ? -1 : a->len > b->len;
+}
+
+int str_slice(Str *dst, const Str *s, u64 start, u64 end) {
+	if (start > end || end > s->len) {
+		str_set_empty(dst);
+		return -1;
+	}
+	Str r;
+	if (str_sub(&r, s, start, end)) {
+		str_set_empty(dst);
+		return -1;
+	}
+	*dst = r;
+	return 0;
+}
+
+int str_concat(Str *dst, const Str *a, const Str *b) {
+	Str r;
+	if (str_join(&r, a, b)) {
+		str_set_empty(dst);
+		return -1;
+	}
+	*dst = r;
+	return 0;
+}
+
+u64 str_copy_to(const Str *s, char *out, u64 capacity) {
+	u64 n = s->len < capacity ? s->len : capacity;
+	str_read(s, 0, n, out);
+	return n;
+}
+
+const char *str_cstr(Str *s) {
+	if (str_is_small(s)) return s->small;
+	StrNode *n = s->node;
+	if (n->kind == STR_FLAT && s->offset + s->len == n->len)
+		return str_node_data(n) + s->offset;
+	Str flat;
+	if (str_copy_pair(&flat, s, NULL, 0)) return NULL;
+	flat.hash = s->hash;
+	flat.flags = s->flags;
+	str_node_release(n);
+	*s = flat;
+	return str_node_data(flat.node);
+}
+
+u32 str_depth(const Str *s) {
+	return str_height(s);
+}
@@ -0,0 +1,86 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _CORE_STR__
+#define _CORE_STR__
+
+#include <base/types.h>
+
+// Immutable byte strings with a cached length and hash, in one of three
+// representations:
+//
+//   small  up to STR_SMALL_MAX bytes stored inline (NUL terminated)
+//   flat   a reference counted buffer; slices share it with an offset
+//   rope   a reference counted concatenation node over two strings
+//
+// Concatenations longer than STR_FLAT_MAX become rope nodes, which are kept
+// height balanced (AVL join), so indexing and slicing a rope are O(log n)
+// and repeated appends never copy the text. Shorter results are copied into
+// a flat buffer, which also keeps rope leaves from getting too small.
+//
+// Buffers and nodes come from size class slabs in mapped pages, or a mapping
+// of their own when large, and are shared between threads with atomic
+// reference counts. A slice keeps its whole buffer (or rope) alive.
+
+#define STR_SMALL_MAX 15
+#define STR_FLAT_MAX 1024
+
+typedef struct StrNode StrNode;
+
+typedef struct Str {
+	u64 len;
+	u32 hash;
+	u32 flags;
+	union {
+		char small[STR_SMALL_MAX + 1];
+		struct {
+			StrNode *node;
+			u64 offset;
+		};
+	};
+} Str;
+
+// Functions returning int return 0 on success and -1 if memory can't be
+// mapped (or a range is invalid), leaving the destination empty. Every Str
+// they initialize must be released with str_release. The destination is
+// overwritten without being released, after the inputs have been read.
+int str_init(Str *s, const char *bytes, u64 len);
+int str_init_cstr(Str *s, const char *cstr);
+// 'dst' shares the contents of 'src' (no copy).
+void str_share(Str *dst, const Str *src);
+void str_release(Str *s);
+
+u64 str_len(const Str *s);
+// Byte at 'i' (< len); O(log n) for ropes.
+char str_at(const Str *s, u64 i);
+// CRC32C of the contents, computed on first use and cached.
+u32 str_hash(Str *s);
+bool str_equal(Str *a, Str *b);
+// Bytewise comparison: < 0, 0 or > 0.
+int str_compare(const Str *a, const Str *b);
+
+// Bytes [start, end) of 's': shares the buffer of a flat string and takes
+// O(log n) new nodes from a rope.
+int str_slice(Str *dst, const Str *s, u64 start, u64 end);
+int str_concat(Str *dst, const Str *a, const Str *b);
+
+// Copy up to 'capacity' bytes to 'out'; returns the number copied.
+u64 str_copy_to(const Str *s, char *out, u64 capacity);
+// Contiguous NUL terminated contents. Ropes and slices that don't end their
+// buffer are flattened into a new buffer first; returns NULL if that fails.
+const char *str_cstr(Str *s);
+// Height of the rope (0 for small and flat strings).
+u32 str_depth(const Str *s);
+
+#endif	// _CORE_STR__
@@ -13,5 +13,2127 @@
 // limitations under the License.
 
 #include <base/test.h>
+#include <core/lib.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#ifdef __linux__
+// deprecated, and unavailable without _XOPEN_SOURCE, on macOS
+#include <ucontext.h>
+#endif	// __linux__
+
+int unlink(const char *path);
 
 Suite(core);
+
+#define RESOURCE_TEST_COUNT 1000
+
+// Build a pack of 'count' generated resources. Names and contents are stored in
+// 'names' and 'data', the pack itself is returned and must be unmapped.
+static byte *resource_test_build(ResourceInput *inputs, char (*names)[32],
+								 byte *data, u32 count, i64 *size) {
+	u64 offset = 0;
+	for (u32 i = 0; i < count; i++) {
+		snprintf(names[i], 32, "dir%u/file_%u.txt", i % 7, i);
+		inputs[i].name = names[i];
+		inputs[i].data = data + offset;
+		inputs[i].size = i % 37;
+		inputs[i].compression = RESOURCE_COMPRESSION_NONE;
+		for (u64 j = 0; j < inputs[i].size; j++) data[offset + j] = i + j;
+		offset += inputs[i].size;
+	}
+	*size = resource_pack_size(inputs, count, RESOURCE_DEFAULT_ALIGN);
+	byte *pack = map(bytes_to_pages(*size));
+	assert_eq(resource_pack_build(inputs, count, RESOURCE_DEFAULT_ALIGN, pack,
+								  *size),
+			  *size);
+	return pack;
+}
+
+Test(resource_pack) {
+	ResourceInput inputs[RESOURCE_TEST_COUNT];
+	char names[RESOURCE_TEST_COUNT][32];
+	byte *data = map(bytes_to_pages(RESOURCE_TEST_COUNT * 37));
+	i64 size;
+	byte *bytes =
+		resource_test_build(inputs, names, data, RESOURCE_TEST_COUNT, &size);
+
+	ResourcePack pack;
+	assert(!resource_pack_open(&pack, bytes, size));
+	assert_eq(resource_count(&pack), RESOURCE_TEST_COUNT);
+	assert_eq(((ResourcePackHeader *)bytes)->checksum_type,
+			  RESOURCE_CHECKSUM_CRC32C);
+	assert_eq(resource_checksum(RESOURCE_CHECKSUM_CRC32C, "123456789", 9),
+			  0xE3069283);
+	for (u32 i = 0; i < RESOURCE_TEST_COUNT; i++) {
+		u64 len = 0;
+		const byte *res = resource_get(&pack, names[i], &len);
+		assert(res != NULL);
+		assert_eq(len, inputs[i].size);
+		assert_eq((u64)res % RESOURCE_DEFAULT_ALIGN, 0);
+		for (u64 j = 0; j < len; j++) assert_eq(res[j], inputs[i].data[j]);
+		assert(!resource_verify(&pack, resource_find(&pack, names[i])));
+	}
+	u64 len;
+	assert(resource_get(&pack, "dir0/file_1000.txt", &len) == NULL);
+	assert(resource_get(&pack, "", &len) == NULL);
+	assert(resource_find(&pack, "dir0/file_0.tx") == NULL);
+
+	byte buf[64];
+	assert_eq(resource_read(&pack, names[36], buf, sizeof(buf)), 36);
+	assert_eq(buf[35], (byte)(36 + 35));
+	assert_eq(resource_read(&pack, names[36], buf, 10), 36);
+	assert_eq(resource_read(&pack, "missing", buf, sizeof(buf)), -1);
+
+	// corrupt one byte of a resource's data
+	const ResourceEntry *entry = resource_find(&pack, names[36]);
+	bytes[entry->offset] ^= 1;
+	assert(resource_verify(&pack, entry));
+	assert_eq(resource_read(&pack, names[36], buf, sizeof(buf)), -1);
+
+	resource_pack_close(&pack);
+	unmap(bytes, bytes_to_pages(size));
+	unmap(data, bytes_to_pages(RESOURCE_TEST_COUNT * 37));
+}
+
+Test(resource_pack_invalid) {
+	ResourceInput inputs[3] = {
+		{"a", "1", 1}, {"b", "2", 1}, {"a", "3", 1}};
+	byte buf[1024] __attribute__((aligned(8)));
+	assert_eq(resource_pack_build(inputs, 3, 16, buf, sizeof(buf)), -1);
+	assert_eq(resource_pack_size(inputs, 2, 3), -1);
+	assert_eq(resource_pack_build(inputs, 2, 16, buf, 10), -1);
+
+	i64 size = resource_pack_build(inputs, 2, 16, buf, sizeof(buf));
+	assert(size > 0);
+	ResourcePack pack;
+	assert(resource_pack_open(&pack, buf, size - 1));
+	buf[0] ^= 1;
+	assert(resource_pack_open(&pack, buf, size));
+	buf[0] ^= 1;
+	assert(!resource_pack_open(&pack, buf, size));
+	ResourcePackHeader *header = (ResourcePackHeader *)buf;
+	u32 alignment = header->alignment;
+	header->alignment = 0;
+	assert(resource_pack_open(&pack, buf, size));
+	header->alignment = alignment;
+
+	// an empty pack is valid
+	size = resource_pack_build(inputs, 0, 16, buf, sizeof(buf));
+	assert(size > 0);
+	assert(!resource_pack_open(&pack, buf, size));
+	assert_eq(resource_count(&pack), 0);
+	assert(resource_find(&pack, "a") == NULL);
+}
+
+Test(resource_pack_file) {
+	ResourceInput inputs[RESOURCE_TEST_COUNT];
+	char names[RESOURCE_TEST_COUNT][32];
+	byte *data = map(bytes_to_pages(RESOURCE_TEST_COUNT * 37));
+	i64 size;
+	byte *bytes =
+		resource_test_build(inputs, names, data, RESOURCE_TEST_COUNT, &size);
+
+	int fd = open(test_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	assert(fd >= 0);
+	assert_eq(write(fd, bytes, size), size);
+	close(fd);
+
+	ResourcePack pack;
+	assert(!resource_pack_open_file(&pack, test_file));
+	for (u32 i = 0; i < RESOURCE_TEST_COUNT; i += 13) {
+		u64 len;
+		const byte *res = resource_get(&pack, names[i], &len);
+		assert(res != NULL);
+		assert_eq(len, inputs[i].size);
+		assert(!resource_verify(&pack, resource_find(&pack, names[i])));
+	}
+	resource_pack_close(&pack);
+	assert(resource_pack_open_file(&pack, "./.does_not_exist.fam"));
+
+	unlink(test_file);
+	unmap(bytes, bytes_to_pages(size));
+	unmap(data, bytes_to_pages(RESOURCE_TEST_COUNT * 37));
+}
+
+Test(resource_pack_compressed) {
+	static byte text[20000], noise[3000];
+	u64 state = 1;
+	for (u64 i = 0; i < sizeof(text); i++)
+		text[i] = "spirit body family "[(i * 7 + i / 100) % 19];
+	for (u64 i = 0; i < sizeof(noise); i++) {
+		state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+		noise[i] = state >> 56;
+	}
+	ResourceInput inputs[4] = {
+		{"text", text, sizeof(text), RESOURCE_COMPRESSION_LZ},
+		{"noise", noise, sizeof(noise), RESOURCE_COMPRESSION_LZ},
+		{"empty", text, 0, RESOURCE_COMPRESSION_LZ},
+		{"plain", text, 100, RESOURCE_COMPRESSION_NONE}};
+
+	i64 bound = resource_pack_size(inputs, 4, RESOURCE_DEFAULT_ALIGN);
+	assert(bound > (i64)(sizeof(text) + sizeof(noise)));
+	byte *bytes = map(bytes_to_pages(bound));
+	i64 size =
+		resource_pack_build(inputs, 4, RESOURCE_DEFAULT_ALIGN, bytes, bound);
+	assert(size > 0);
+	assert(size < (i64)(sizeof(text) / 4 + sizeof(noise) + 1024));
+
+	ResourcePack pack;
+	assert(!resource_pack_open(&pack, bytes, size));
+	// incompressible data is stored as is and stays directly accessible
+	assert_eq(resource_find(&pack, "text")->compression,
+			  RESOURCE_COMPRESSION_LZ);
+	assert_eq(resource_find(&pack, "noise")->compression,
+			  RESOURCE_COMPRESSION_NONE);
+	u64 len;
+	assert(resource_get(&pack, "text", &len) == NULL);
+	assert(resource_get(&pack, "noise", &len) != NULL);
+
+	static byte buf[sizeof(text)];
+	for (int i = 0; i < 4; i++) {
+		assert(!resource_verify(&pack, resource_find(&pack, inputs[i].name)));
+		assert_eq(resource_read(&pack, inputs[i].name, buf, sizeof(buf)),
+				  (i64)inputs[i].size);
+		for (u64 j = 0; j < inputs[i].size; j++)
+			assert_eq(buf[j], inputs[i].data[j]);
+	}
+	assert_eq(resource_read(&pack, "text", buf, 100), (i64)sizeof(text));
+
+	const ResourceEntry *entry = resource_find(&pack, "text");
+	bytes[entry->offset + entry->size / 2] ^= 0x10;
+	assert(resource_verify(&pack, entry));
+	assert_eq(resource_read(&pack, "text", buf, sizeof(buf)), -1);
+
+	inputs[3].compression = 7;
+	assert_eq(resource_pack_size(inputs, 4, RESOURCE_DEFAULT_ALIGN), -1);
+
+	resource_pack_close(&pack);
+	unmap(bytes, bytes_to_pages(bound));
+}
+
+#define RESOURCE_BENCH_COUNT 10000
+
+Bench(resource_get) {
+	static ResourceInput inputs[RESOURCE_BENCH_COUNT];
+	static char names[RESOURCE_BENCH_COUNT][32];
+	byte *data = map(bytes_to_pages(RESOURCE_BENCH_COUNT * 37));
+	i64 size;
+	byte *bytes =
+		resource_test_build(inputs, names, data, RESOURCE_BENCH_COUNT, &size);
+	ResourcePack pack;
+	assert(!resource_pack_open(&pack, bytes, size));
+
+	u64 i = 0;
+	bench_loop {
+		u64 len;
+		const byte *res = resource_get(&pack, names[i], &len);
+		do_not_optimize(res);
+		if (++i == RESOURCE_BENCH_COUNT) i = 0;
+	}
+
+	resource_pack_close(&pack);
+	unmap(bytes, bytes_to_pages(size));
+	unmap(data, bytes_to_pages(RESOURCE_BENCH_COUNT * 37));
+}
+
+typedef struct VecTestElem {
+	u32 a;
+	u32 b;
+	u32 c;
+} VecTestElem;
+
+Test(vec) {
+	Vec v;
+	assert(!vec_init_type(&v, u64));
+	assert_eq(v.pages, 0);
+	assert(!vec_at(&v, 0));
+	assert_eq(vec_pop(&v, NULL), -1);
+	for (u64 i = 0; i < 100000; i++) assert(!vec_push_value(&v, u64, i * 3));
+	assert_eq(v.len, 100000);
+	assert(v.capacity >= v.len);
+	for (u64 i = 0; i < 100000; i++) assert_eq(vec_get(&v, u64, i), i * 3);
+
+	u64 last;
+	assert(!vec_pop(&v, &last));
+	assert_eq(last, 99999 * 3);
+	assert(!vec_erase(&v, 10, 50000));
+	assert_eq(v.len, 49999);
+	assert_eq(vec_get(&v, u64, 9), 27);
+	assert_eq(vec_get(&v, u64, 10), 50010 * 3);
+	assert_eq(vec_erase(&v, 49999, 1), -1);
+	assert_eq(vec_erase(&v, 50000, 0), -1);
+
+	u64 ins[3] = {1, 2, 3};
+	assert(!vec_insert(&v, 0, ins, 3));
+	assert(!vec_insert(&v, v.len, ins, 3));
+	assert(!vec_insert(&v, 5, ins, 2));
+	assert_eq(v.len, 50007);
+	assert_eq(vec_get(&v, u64, 0), 1);
+	assert_eq(vec_get(&v, u64, 3), 0);
+	assert_eq(vec_get(&v, u64, 5), 1);
+	assert_eq(vec_get(&v, u64, 6), 2);
+	assert_eq(vec_get(&v, u64, 7), 6);
+	assert_eq(vec_get(&v, u64, v.len - 1), 3);
+	assert_eq(vec_insert(&v, v.len + 1, ins, 1), -1);
+
+	// resize zeroes the elements it adds, even over old contents
+	assert(!vec_resize(&v, 4));
+	assert(!vec_resize(&v, 10));
+	assert_eq(vec_get(&v, u64, 4), 0);
+	assert_eq(vec_get(&v, u64, 9), 0);
+	vec_clear(&v);
+	assert_eq(v.len, 0);
+	vec_cleanup(&v);
+
+	// elements that don't divide the page size, against a plain array
+	VecTestElem ref[3000];
+	u64 ref_len = 0;
+	assert(!vec_init(&v, sizeof(VecTestElem), 10));
+	for (u32 i = 0; i < 5000; i++) {
+		u64 r = (u64)i * 2654435761U;
+		VecTestElem e = {i, (u32)r, i ^ 0xABCD};
+		u64 at = ref_len ? r % (ref_len + 1) : 0;
+		if (r % 3 == 0 && ref_len) {
+			at = r % ref_len;
+			assert(!vec_erase(&v, at, 1));
+			for (u64 k = at; k + 1 < ref_len; k++) ref[k] = ref[k + 1];
+			ref_len--;
+		} else if (ref_len < 3000) {
+			assert(!vec_insert(&v, at, &e, 1));
+			for (u64 k = ref_len; k > at; k--) ref[k] = ref[k - 1];
+			ref[at] = e;
+			ref_len++;
+		}
+		assert_eq(v.len, ref_len);
+	}
+	for (u64 k = 0; k < ref_len; k++) {
+		VecTestElem *e = vec_at(&v, k);
+		assert_eq(e->a, ref[k].a);
+		assert_eq(e->b, ref[k].b);
+		assert_eq(e->c, ref[k].c);
+	}
+	vec_cleanup(&v);
+}
+
+#define VEC_BENCH_CHUNK (1 << 20)
+#define VEC_BENCH_SIZE (2ULL << 30)
+
+// Append 1 MiB chunks up to 2 GiB, doubling capacity either through remap
+// or by mapping a new region and copying into it. Copying needs the old and
+// the new region at once, 3 GiB at the last doubling.
+static void vec_bench_grow(u64 bench_iterations, bool copy) {
+	byte *chunk = map(bytes_to_pages(VEC_BENCH_CHUNK));
+	set_bytes(chunk, 'x', VEC_BENCH_CHUNK);
+	bench_set_bytes(VEC_BENCH_SIZE);
+	bench_loop {
+		Vec v;
+		vec_init(&v, 1, 0);
+		for (u64 len = 0; len < VEC_BENCH_SIZE; len += VEC_BENCH_CHUNK) {
+			if (copy && len + VEC_BENCH_CHUNK > v.capacity) {
+				u64 pages = v.pages ? v.pages * 2
+									: bytes_to_pages(VEC_BENCH_CHUNK);
+				byte *data = map(pages);
+				copy_bytes(data, v.data, v.len);
+				if (v.data) unmap(v.data, v.pages);
+				v.data = data;
+				v.pages = pages;
+				v.capacity = pages * PAGE_SIZE;
+			}
+			vec_append(&v, chunk, VEC_BENCH_CHUNK);
+		}
+		do_not_optimize(v.data);
+		vec_cleanup(&v);
+	}
+	unmap(chunk, bytes_to_pages(VEC_BENCH_CHUNK));
+}
+
+Bench(vec_grow_remap) {
+	vec_bench_grow(bench_iterations, false);
+}
+
+Bench(vec_grow_copy) {
+	vec_bench_grow(bench_iterations, true);
+}
+
+#define STR_TEST_SLOTS 8
+#define STR_TEST_CAP 65536
+
+static u64 str_test_state = 0x2545F4914F6CDD1DULL;
+
+static u64 str_test_rand() {
+	str_test_state ^= str_test_state << 13;
+	str_test_state ^= str_test_state >> 7;
+	str_test_state ^= str_test_state << 17;
+	return str_test_state;
+}
+
+static int str_test_sign(int v) {
+	return v < 0 ? -1 : v > 0;
+}
+
+static int str_test_ref_compare(const char *a, u64 alen, const char *b,
+								u64 blen) {
+	for (u64 i = 0; i < alen && i < blen; i++)
+		if (a[i] != b[i]) return (byte)a[i] < (byte)b[i] ? -1 : 1;
+	return alen < blen ? -1 : alen > blen;
+}
+
+static void str_test_check(Str *s, const char *ref, u64 len, char *buf) {
+	assert_eq(str_len(s), len);
+	assert_eq(str_copy_to(s, buf, STR_TEST_CAP), len);
+	for (u64 i = 0; i < len; i++) assert_eq(buf[i], ref[i]);
+	for (u32 k = 0; k < 8 && len; k++) {
+		u64 i = str_test_rand() % len;
+		assert_eq(str_at(s, i), ref[i]);
+	}
+	assert_eq(str_hash(s), crc32c(0, ref, len));
+}
+
+Test(str) {
+	Str a, b, c;
+	assert(!str_init_cstr(&a, "hello"));
+	assert(!str_init_cstr(&b, ", world"));
+	assert(!str_concat(&c, &a, &b));
+	assert_eq(str_len(&c), 12);
+	assert(!cstring_compare(str_cstr(&c), "hello, world"));
+	assert_eq(str_depth(&c), 0);
+	assert(str_compare(&a, &b) > 0);
+	assert_eq(str_slice(&a, &c, 5, 13), -1);
+	assert_eq(str_len(&a), 0);
+	str_release(&b);
+	str_release(&c);
+
+	// random concats and slices against plain arrays
+	u64 pages = bytes_to_pages(STR_TEST_CAP * (STR_TEST_SLOTS + 1));
+	char *mem = map(pages);
+	char *refs[STR_TEST_SLOTS], *buf = mem + STR_TEST_SLOTS * STR_TEST_CAP;
+	u64 lens[STR_TEST_SLOTS];
+	Str slots[STR_TEST_SLOTS];
+	for (u32 i = 0; i < STR_TEST_SLOTS; i++) {
+		refs[i] = mem + i * STR_TEST_CAP;
+		lens[i] = str_test_rand() % 2000;
+		for (u64 j = 0; j < lens[i]; j++)
+			refs[i][j] = 'a' + str_test_rand() % 3;
+		assert(!str_init(&slots[i], refs[i], lens[i]));
+	}
+	for (u32 op = 0; op < 3000; op++) {
+		u32 x = str_test_rand() % STR_TEST_SLOTS;
+		u32 y = str_test_rand() % STR_TEST_SLOTS;
+		u32 z = str_test_rand() % STR_TEST_SLOTS;
+		Str r;
+		if (str_test_rand() % 3 && lens[x] + lens[y] <= STR_TEST_CAP) {
+			assert(!str_concat(&r, &slots[x], &slots[y]));
+			copy_bytes((byte *)buf, (byte *)refs[x], lens[x]);
+			copy_bytes((byte *)buf + lens[x], (byte *)refs[y], lens[y]);
+			lens[z] = lens[x] + lens[y];
+		} else {
+			u64 start = str_test_rand() % (lens[x] + 1);
+			u64 end = start + str_test_rand() % (lens[x] - start + 1);
+			assert(!str_slice(&r, &slots[x], start, end));
+			copy_bytes((byte *)buf, (byte *)refs[x] + start, end - start);
+			lens[z] = end - start;
+		}
+		copy_bytes((byte *)refs[z], (byte *)buf, lens[z]);
+		str_release(&slots[z]);
+		slots[z] = r;
+		str_test_check(&slots[z], refs[z], lens[z], buf);
+
+		int expect =
+			str_test_ref_compare(refs[z], lens[z], refs[x], lens[x]);
+		assert_eq(str_test_sign(str_compare(&slots[z], &slots[x])), expect);
+		assert_eq(str_equal(&slots[z], &slots[x]), expect == 0);
+	}
+	for (u32 i = 0; i < STR_TEST_SLOTS; i++) {
+		const char *cstr = str_cstr(&slots[i]);
+		assert(cstr);
+		for (u64 j = 0; j < lens[i]; j++) assert_eq(cstr[j], refs[i][j]);
+		assert_eq(cstr[lens[i]], 0);
+		assert_eq(str_hash(&slots[i]), crc32c(0, refs[i], lens[i]));
+		str_release(&slots[i]);
+	}
+
+	// appending and prepending small pieces keeps the rope balanced
+	Str piece, rope;
+	assert(!str_init(&piece, mem, 100));
+	str_share(&rope, &piece);
+	for (u32 i = 0; i < 5000; i++) {
+		Str next;
+		if (i & 1) {
+			assert(!str_concat(&next, &piece, &rope));
+		} else {
+			assert(!str_concat(&next, &rope, &piece));
+		}
+		str_release(&rope);
+		rope = next;
+	}
+	assert_eq(str_len(&rope), 5001 * 100);
+	// 500 KB in leaves of at least ~512 bytes: an AVL tree over ~1000 leaves
+	assert(str_depth(&rope) > 0);
+	assert(str_depth(&rope) <= 16);
+	for (u32 i = 0; i < 1000; i++) {
+		u64 start = str_test_rand() % str_len(&rope);
+		u64 end = start + str_test_rand() % (str_len(&rope) - start + 1);
+		assert(!str_slice(&b, &rope, start, end));
+		assert(str_depth(&b) <= str_depth(&rope) + 1);
+		for (u32 k = 0; k < 4 && end > start; k++) {
+			u64 j = start + str_test_rand() % (end - start);
+			assert_eq(str_at(&b, j - start), mem[j % 100]);
+		}
+		str_release(&b);
+	}
+	str_release(&rope);
+	str_release(&piece);
+	unmap(mem, pages);
+}
+
+#define STR_BENCH_SIZE (256 * 1024)
+#define STR_BENCH_PIECE 100
+
+// Build a 256 KB string from 100 byte appends, either as a rope or by
+// copying into a new flat string each time.
+static void str_bench_append(u64 bench_iterations, bool copy) {
+	u64 pages = bytes_to_pages(STR_BENCH_SIZE + STR_BENCH_PIECE);
+	char *text = map(pages);
+	for (u64 i = 0; i < STR_BENCH_SIZE + STR_BENCH_PIECE; i++)
+		text[i] = 'a' + i % 26;
+	Str piece;
+	str_init(&piece, text, STR_BENCH_PIECE);
+	bench_set_bytes(STR_BENCH_SIZE);
+	bench_loop {
+		Str s, next;
+		str_init(&s, NULL, 0);
+		for (u64 len = 0; len < STR_BENCH_SIZE; len += STR_BENCH_PIECE) {
+			if (copy)
+				str_init(&next, text, len + STR_BENCH_PIECE);
+			else
+				str_concat(&next, &s, &piece);
+			str_release(&s);
+			s = next;
+		}
+		do_not_optimize(&s);
+		str_release(&s);
+	}
+	str_release(&piece);
+	unmap(text, pages);
+}
+
+Bench(str_append_rope) {
+	str_bench_append(bench_iterations, false);
+}
+
+Bench(str_append_copy) {
+	str_bench_append(bench_iterations, true);
+}
+
+// Random slices of up to 4 KB from a 1 MB rope or flat string, hashed.
+static void str_bench_slice(u64 bench_iterations, bool rope) {
+	u64 size = 1 << 20;
+	char *text = map(bytes_to_pages(size));
+	for (u64 i = 0; i < size; i++) text[i] = 'a' + i % 26;
+	Str s, piece;
+	if (rope) {
+		str_init(&s, NULL, 0);
+		for (u64 off = 0; off < size; off += 1000) {
+			Str next;
+			str_init(&piece, text + off, off + 1000 > size ? size - off : 1000);
+			str_concat(&next, &s, &piece);
+			str_release(&piece);
+			str_release(&s);
+			s = next;
+		}
+	} else
+		str_init(&s, text, size);
+	bench_set_bytes(1000 * 2048);
+	bench_loop {
+		for (u32 i = 0; i < 1000; i++) {
+			u64 start = str_test_rand() % (size - 4096);
+			str_slice(&piece, &s, start, start + str_test_rand() % 4096);
+			do_not_optimize(str_hash(&piece));
+			str_release(&piece);
+		}
+	}
+	str_release(&s);
+	unmap(text, bytes_to_pages(size));
+}
+
+Bench(str_slice_rope) {
+	str_bench_slice(bench_iterations, true);
+}
+
+Bench(str_slice_flat) {
+	str_bench_slice(bench_iterations, false);
+}
+
+#define INTERN_TEST_COUNT 100000
+#define INTERN_TEST_THREADS 4
+
+Test(intern) {
+	Intern in;
+	u32 id, id2;
+	assert(!intern_init(&in));
+	assert_eq(intern_find(&in, "abc", 3, &id), -1);
+	assert(!intern_cstr(&in, "abc", &id));
+	assert_eq(id, 0);
+	assert(!intern(&in, "abcd", 3, &id2));
+	assert_eq(id2, 0);
+	assert(!intern(&in, "", 0, &id));
+	assert_eq(id, 1);
+	assert_eq(intern_len(&in, 1), 0);
+	assert(!intern(&in, "a\0b", 3, &id));
+	assert_eq(id, 2);
+	assert_eq(intern_len(&in, 2), 3);
+	assert_eq(intern_get(&in, 2)[2], 'b');
+	const char *abc = intern_get(&in, 0);
+	assert(!cstring_compare(abc, "abc"));
+
+	// growth keeps IDs and canonical pointers
+	char name[32];
+	for (u32 i = 0; i < INTERN_TEST_COUNT; i++) {
+		snprintf(name, sizeof(name), "metric.%u", i);
+		assert(!intern_cstr(&in, name, &id));
+		assert_eq(id, i + 3);
+	}
+	assert_eq(intern_count(&in), INTERN_TEST_COUNT + 3);
+	assert(intern_get(&in, 0) == abc);
+	for (u32 i = 0; i < INTERN_TEST_COUNT; i += 7) {
+		snprintf(name, sizeof(name), "metric.%u", i);
+		assert(!intern_find(&in, name, cstring_len(name), &id));
+		assert_eq(id, i + 3);
+		assert(!cstring_compare(intern_get(&in, id), name));
+		assert(!intern_cstr(&in, name, &id2));
+		assert_eq(id2, id);
+	}
+	assert_eq(intern_count(&in), INTERN_TEST_COUNT + 3);
+	intern_cleanup(&in);
+}
+
+typedef struct InternTestTask {
+	Intern *in;
+	u32 seed;
+	u32 count;
+	u32 *ids;
+	u64 rounds;
+} InternTestTask;
+
+// Intern names 0..count-1 in an order that depends on the seed, recording
+// the ID each one got.
+static void *intern_test_worker(void *arg) {
+	InternTestTask *task = arg;
+	char name[32];
+	for (u64 r = 0; r < task->rounds; r++)
+		for (u32 i = 0; i < task->count; i++) {
+			u32 k = (u32)((i * 2654435761ULL + task->seed) % task->count);
+			snprintf(name, sizeof(name), "resource/path/%u.txt", k);
+			if (intern_cstr(task->in, name, &task->ids[k])) return NULL;
+		}
+	return task;
+}
+
+static void intern_test_threads(Intern *in, InternTestTask *tasks, u32 *ids,
+								u32 count, u64 rounds) {
+	pthread_t threads[INTERN_TEST_THREADS];
+	for (u32 t = 0; t < INTERN_TEST_THREADS; t++) {
+		tasks[t].in = in;
+		tasks[t].seed = t * 7919;
+		tasks[t].count = count;
+		tasks[t].ids = ids + t * count;
+		tasks[t].rounds = rounds;
+		pthread_create(&threads[t], NULL, intern_test_worker, &tasks[t]);
+	}
+	for (u32 t = 0; t < INTERN_TEST_THREADS; t++) {
+		void *ret;
+		pthread_join(threads[t], &ret);
+		tasks[t].ids = ret ? tasks[t].ids : NULL;
+	}
+}
+
+Test(intern_threads) {
+	Intern in;
+	InternTestTask tasks[INTERN_TEST_THREADS];
+	u64 pages = bytes_to_pages(INTERN_TEST_THREADS * INTERN_TEST_COUNT *
+							   sizeof(u32));
+	u32 *ids = map(pages);
+	assert(!intern_init(&in));
+	intern_test_threads(&in, tasks, ids, INTERN_TEST_COUNT, 1);
+	for (u32 t = 0; t < INTERN_TEST_THREADS; t++) assert(tasks[t].ids);
+
+	// every thread saw the same ID for each name, and IDs are dense
+	assert_eq(intern_count(&in), INTERN_TEST_COUNT);
+	char name[32];
+	for (u32 k = 0; k < INTERN_TEST_COUNT; k++) {
+		for (u32 t = 1; t < INTERN_TEST_THREADS; t++)
+			assert_eq(ids[t * INTERN_TEST_COUNT + k], ids[k]);
+		assert(ids[k] < INTERN_TEST_COUNT);
+		snprintf(name, sizeof(name), "resource/path/%u.txt", k);
+		assert(!cstring_compare(intern_get(&in, ids[k]), name));
+	}
+	intern_cleanup(&in);
+	unmap(ids, pages);
+}
+
+#define INTERN_BENCH_COUNT 10000
+
+// Four threads interning the same 10000 names, which are all present after
+// the first round, so this measures concurrent lock free lookups.
+Bench(intern_threads) {
+	Intern in;
+	InternTestTask tasks[INTERN_TEST_THREADS];
+	u64 pages = bytes_to_pages(INTERN_TEST_THREADS * INTERN_BENCH_COUNT *
+							   sizeof(u32));
+	u32 *ids = map(pages);
+	intern_init(&in);
+	intern_test_threads(&in, tasks, ids, INTERN_BENCH_COUNT, 1);
+	bench_set_bytes(INTERN_TEST_THREADS * INTERN_BENCH_COUNT * 10);
+	bench_loop {
+		intern_test_threads(&in, tasks, ids, INTERN_BENCH_COUNT, 10);
+	}
+	intern_cleanup(&in);
+	unmap(ids, pages);
+}
+
+// Equality of 1000 name pairs by cstring_compare versus by interned ID.
+static void intern_bench_compare(u64 bench_iterations, bool interned) {
+	Intern in;
+	char names[1000][32];
+	u32 ids[1000];
+	intern_init(&in);
+	for (u32 i = 0; i < 1000; i++) {
+		snprintf(names[i], 32, "etc/resources/file_%u.txt", i % 500);
+		intern_cstr(&in, names[i], &ids[i]);
+	}
+	bench_set_bytes(1000);
+	bench_loop {
+		u64 equal = 0;
+		for (u32 i = 0; i < 1000; i++) {
+			u32 j = (i * 7 + 500) % 1000;
+			if (interned)
+				equal += ids[i] == ids[j];
+			else
+				equal += !cstring_compare(names[i], names[j]);
+		}
+		do_not_optimize(equal);
+	}
+	intern_cleanup(&in);
+}
+
+Bench(intern_compare_id) {
+	intern_bench_compare(bench_iterations, true);
+}
+
+Bench(intern_compare_cstring) {
+	intern_bench_compare(bench_iterations, false);
+}
+
+typedef struct CoroTestState {
+	u64 value;
+	u64 steps;
+	Coro *other;
+	char *log;
+	u32 *log_len;
+} CoroTestState;
+
+static void coro_test_counter(void *arg) {
+	CoroTestState *state = arg;
+	for (u64 i = 0; i < state->steps; i++) {
+		state->value += i;
+		coro_yield();
+	}
+}
+
+// Resumes another coroutine from inside a coroutine.
+static void coro_test_nested(void *arg) {
+	CoroTestState *state = arg;
+	while (coro_resume(state->other) == 0) {
+		state->value++;
+		coro_yield();
+	}
+}
+
+Test(coro) {
+	Coro a, b;
+	CoroTestState sa = {0}, sb = {0};
+	sa.steps = 5;
+	assert(!coro_init(&a, coro_test_counter, &sa, 0));
+	assert(!coro_self());
+	u64 expect = 0;
+	for (u64 i = 0; i < 5; i++) {
+		assert_eq(coro_resume(&a), 0);
+		expect += i;
+		assert_eq(sa.value, expect);
+		assert(!coro_done(&a));
+	}
+	assert_eq(coro_resume(&a), 1);
+	assert(coro_done(&a));
+	assert_eq(coro_resume(&a), -1);
+	coro_cleanup(&a);
+
+	sa.value = 0;
+	sa.steps = 3;
+	sb.other = &a;
+	assert(!coro_init(&a, coro_test_counter, &sa, 4096));
+	assert(!coro_init(&b, coro_test_nested, &sb, 0));
+	u32 resumes = 0;
+	while (coro_resume(&b) == 0) resumes++;
+	assert_eq(resumes, 3);
+	assert_eq(sb.value, 3);
+	assert_eq(sa.value, 0 + 1 + 2);
+	assert(coro_done(&a));
+	coro_cleanup(&a);
+	coro_cleanup(&b);
+}
+
+// Logs its letter 'steps' times, yielding after each, then awaits 'other'
+// if set and logs its capital letter.
+static void coro_test_logger(void *arg) {
+	CoroTestState *state = arg;
+	for (u64 i = 0; i < state->steps; i++) {
+		state->log[(*state->log_len)++] = 'a' + state->value;
+		coro_yield();
+	}
+	if (state->other) {
+		coro_await(state->other);
+		state->log[(*state->log_len)++] = 'A' + state->value;
+	}
+}
+
+int pipe(int fds[2]);
+
+static void coro_test_reader(void *arg) {
+	CoroTestState *state = arg;
+	int fd = (int)state->value;
+	char buf[8];
+	u32 events = coro_wait_fd(fd, CORO_READABLE);
+	assert(events & CORO_READABLE);
+	assert_eq(read(fd, buf, sizeof(buf)), 3);
+	state->steps = buf[0] + buf[1] + buf[2];
+}
+
+static void coro_test_writer(void *arg) {
+	CoroTestState *state = arg;
+	// let the reader block in poll first
+	for (u32 i = 0; i < 3; i++) coro_yield();
+	assert_eq(write((int)state->value, "\1\2\3", 3), 3);
+}
+
+Test(coro_sched) {
+	CoroSched s;
+	Coro c[3];
+	CoroTestState st[3] = {0};
+	char log[32] = {0};
+	u32 log_len = 0;
+
+	// round robin, with 'a' awaiting 'c', which finishes last
+	coro_sched_init(&s);
+	for (u32 i = 0; i < 3; i++) {
+		st[i].value = i;
+		st[i].steps = i + 1;
+		st[i].log = log;
+		st[i].log_len = &log_len;
+		assert(!coro_init(&c[i], coro_test_logger, &st[i], 0));
+	}
+	st[0].other = &c[2];
+	for (u32 i = 0; i < 3; i++) coro_spawn(&s, &c[i]);
+	assert(!coro_sched_run(&s));
+	assert(!cstring_compare(log, "abcbccA"));
+	for (u32 i = 0; i < 3; i++) {
+		assert(coro_done(&c[i]));
+		coro_cleanup(&c[i]);
+	}
+
+	// waiting on a pipe until another coroutine writes to it
+	int fds[2];
+	assert(!pipe(fds));
+	CoroTestState reader = {0}, writer = {0};
+	reader.value = fds[0];
+	writer.value = fds[1];
+	coro_sched_init(&s);
+	assert(!coro_init(&c[0], coro_test_reader, &reader, 0));
+	assert(!coro_init(&c[1], coro_test_writer, &writer, 0));
+	coro_spawn(&s, &c[0]);
+	coro_spawn(&s, &c[1]);
+	assert(!coro_sched_run(&s));
+	assert_eq(reader.steps, 6);
+	coro_cleanup(&c[0]);
+	coro_cleanup(&c[1]);
+	close(fds[0]);
+	close(fds[1]);
+
+	// two coroutines awaiting each other can't finish
+	coro_sched_init(&s);
+	st[0] = (CoroTestState){0, 0, &c[1], log, &log_len};
+	st[1] = (CoroTestState){1, 0, &c[0], log, &log_len};
+	assert(!coro_init(&c[0], coro_test_logger, &st[0], 0));
+	assert(!coro_init(&c[1], coro_test_logger, &st[1], 0));
+	coro_spawn(&s, &c[0]);
+	coro_spawn(&s, &c[1]);
+	assert_eq(coro_sched_run(&s), -1);
+	coro_cleanup(&c[0]);
+	coro_cleanup(&c[1]);
+}
+
+static void coro_bench_yield(void *arg) {
+	for (;;) coro_yield();
+}
+
+// One resume and one yield per iteration: two context switches.
+Bench(coro_switch) {
+	Coro c;
+	coro_init(&c, coro_bench_yield, NULL, 0);
+	bench_loop {
+		for (u32 i = 0; i < 1000; i++) coro_resume(&c);
+	}
+	coro_cleanup(&c);
+}
+
+#ifdef __linux__
+
+static ucontext_t coro_bench_main, coro_bench_ctx;
+
+static void coro_bench_swap() {
+	for (;;) swapcontext(&coro_bench_ctx, &coro_bench_main);
+}
+
+// The same round trip with swapcontext, which also saves and restores the
+// signal mask (a system call each way).
+Bench(coro_swapcontext) {
+	u64 size = CORO_DEFAULT_STACK;
+	void *stack = map(bytes_to_pages(size));
+	getcontext(&coro_bench_ctx);
+	coro_bench_ctx.uc_stack.ss_sp = stack;
+	coro_bench_ctx.uc_stack.ss_size = size;
+	coro_bench_ctx.uc_link = NULL;
+	makecontext(&coro_bench_ctx, coro_bench_swap, 0);
+	bench_loop {
+		for (u32 i = 0; i < 1000; i++)
+			swapcontext(&coro_bench_main, &coro_bench_ctx);
+	}
+	unmap(stack, bytes_to_pages(size));
+}
+
+#endif	// __linux__
+
+#define METRICS_TEST_THREADS 4
+#define METRICS_TEST_ADDS 100000
+
+typedef struct MetricsTestTask {
+	MetricsCounter *counter;
+	MetricsGauge *gauge;
+	MetricsHistogram *histogram;
+	u64 *shared;
+	u64 count;
+} MetricsTestTask;
+
+static void *metrics_test_worker(void *arg) {
+	MetricsTestTask *task = arg;
+	for (u64 i = 0; i < task->count; i++) {
+		if (task->counter) metrics_counter_add(task->counter, 1);
+		if (task->gauge) metrics_gauge_add(task->gauge, i & 1 ? 1 : -1);
+		if (task->histogram) metrics_histogram_record(task->histogram, i);
+		if (task->shared)
+			__atomic_fetch_add(task->shared, 1, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+static void metrics_test_threads(MetricsTestTask *task) {
+	pthread_t threads[METRICS_TEST_THREADS];
+	for (u32 t = 0; t < METRICS_TEST_THREADS; t++)
+		pthread_create(&threads[t], NULL, metrics_test_worker, task);
+	for (u32 t = 0; t < METRICS_TEST_THREADS; t++)
+		pthread_join(threads[t], NULL);
+}
+
+Test(metrics) {
+	Metrics m;
+	assert(!metrics_init(&m));
+	MetricsCounter *requests = metrics_counter(&m, "requests_total");
+	MetricsGauge *inflight = metrics_gauge(&m, "requests_inflight");
+	MetricsHistogram *latency = metrics_histogram(&m, "latency_ns");
+	assert(requests && inflight && latency);
+	assert(metrics_counter(&m, "requests_total") == requests);
+	assert(!metrics_gauge(&m, "requests_total"));
+	assert(!metrics_counter(&m, ""));
+
+	metrics_counter_add(requests, 5);
+	metrics_gauge_add(inflight, 3);
+	metrics_gauge_add(inflight, -7);
+	assert_eq(metrics_counter_read(requests), 5);
+	assert_eq(metrics_gauge_read(inflight), -4);
+
+	MetricsTestTask task = {requests, inflight, NULL, NULL,
+							METRICS_TEST_ADDS};
+	metrics_test_threads(&task);
+	assert_eq(metrics_counter_read(requests),
+			  5 + METRICS_TEST_THREADS * METRICS_TEST_ADDS);
+	assert_eq(metrics_gauge_read(inflight), -4);
+
+	// every value lies in its bucket, and buckets are at most 1/32 wide
+	for (u32 b = 1; b < METRICS_HIST_BUCKETS; b++) {
+		u64 lo = metrics_hist_bucket_max(b - 1) + 1;
+		u64 hi = metrics_hist_bucket_max(b);
+		assert(hi >= lo);
+		assert_eq(metrics_hist_bucket(lo), b);
+		assert_eq(metrics_hist_bucket(hi), b);
+		assert(hi - lo <= lo / 32);
+	}
+	assert_eq(metrics_hist_bucket(~0ULL), METRICS_HIST_BUCKETS - 1);
+
+	// quantiles of 1..10000
+	for (u64 v = 1; v <= 10000; v++) metrics_histogram_record(latency, v);
+	MetricsSnapshot *a = map(bytes_to_pages(2 * sizeof(MetricsSnapshot)));
+	MetricsSnapshot *b = a + 1;
+	metrics_snapshot(a, latency);
+	assert_eq(a->count, 10000);
+	assert_eq(a->sum, 10000 * 10001 / 2);
+	u64 p50 = metrics_snapshot_quantile(a, 0.5);
+	u64 p99 = metrics_snapshot_quantile(a, 0.99);
+	assert(p50 >= 5000 && p50 <= 5000 + 5000 / 32);
+	assert(p99 >= 9900 && p99 <= 9900 + 9900 / 32);
+	assert_eq(metrics_snapshot_quantile(a, 0), 1);
+	// 10000 is in the bucket [39 << 8, 40 << 8)
+	assert_eq(metrics_snapshot_quantile(a, 1), (40 << 8) - 1);
+
+	// merging snapshots matches recording into one histogram
+	MetricsHistogram *other = metrics_histogram(&m, "other_ns");
+	for (u64 v = 20000; v < 30000; v++) metrics_histogram_record(other, v);
+	metrics_snapshot(b, other);
+	metrics_snapshot_merge(a, b);
+	for (u64 v = 20000; v < 30000; v++) metrics_histogram_record(latency, v);
+	metrics_snapshot(b, latency);
+	assert_eq(a->count, b->count);
+	assert_eq(a->sum, b->sum);
+	for (u32 i = 0; i < METRICS_HIST_BUCKETS; i++)
+		assert_eq(a->buckets[i], b->buckets[i]);
+	unmap(a, bytes_to_pages(2 * sizeof(MetricsSnapshot)));
+
+	assert(!metrics_dump_file(&m, test_file));
+	u64 size;
+	char *text = map_file(test_file, &size);
+	assert(text);
+	assert(cstring_strstr(text, "# TYPE requests_total counter\n"));
+	assert(cstring_strstr(text, "requests_total 400005\n"));
+	assert(cstring_strstr(text, "requests_inflight -4\n"));
+	assert(cstring_strstr(text, "# TYPE latency_ns summary\n"));
+	assert(cstring_strstr(text, "latency_ns{quantile=\"0.999\"} "));
+	assert(cstring_strstr(text, "latency_ns_count 20000\n"));
+	unmap_file(text, size);
+	unlink(test_file);
+
+	// the periodic dump rewrites the file until cleanup
+	assert(!metrics_dump_periodic(&m, -1, test_file, 10));
+	assert_eq(metrics_dump_periodic(&m, -1, test_file, 10), -1);
+	for (u32 i = 0; i < 200 && !(text = map_file(test_file, &size)); i++)
+		os_sleep(5);
+	assert(text);
+	assert(cstring_strstr(text, "requests_total 400005\n"));
+	unmap_file(text, size);
+	metrics_cleanup(&m);
+	unlink(test_file);
+}
+
+#define METRICS_BENCH_RECORDS 100000
+
+// Four threads recording into the same metric; 'shared' is the unsharded
+// baseline of one atomic counter.
+static void metrics_bench(u64 bench_iterations, MetricsTestTask *task) {
+	bench_set_bytes(METRICS_TEST_THREADS * METRICS_BENCH_RECORDS);
+	bench_loop {
+		metrics_test_threads(task);
+	}
+}
+
+Bench(metrics_counter_threads) {
+	Metrics m;
+	metrics_init(&m);
+	MetricsTestTask task = {metrics_counter(&m, "c"), NULL, NULL, NULL,
+							METRICS_BENCH_RECORDS};
+	metrics_bench(bench_iterations, &task);
+	metrics_cleanup(&m);
+}
+
+Bench(metrics_shared_counter_threads) {
+	u64 shared = 0;
+	MetricsTestTask task = {NULL, NULL, NULL, &shared, METRICS_BENCH_RECORDS};
+	metrics_bench(bench_iterations, &task);
+}
+
+Bench(metrics_histogram_threads) {
+	Metrics m;
+	metrics_init(&m);
+	MetricsTestTask task = {NULL, NULL, metrics_histogram(&m, "h"), NULL,
+							METRICS_BENCH_RECORDS};
+	metrics_bench(bench_iterations, &task);
+	metrics_cleanup(&m);
+}
+
+int rmdir(const char *path);
+
+// Remove a log directory and its segment files.
+static void seglog_test_remove(const char *dir) {
+	char path[SEGLOG_PATH_MAX + 32];
+	DIR *d = opendir(dir);
+	struct dirent *entry;
+	while (d && (entry = readdir(d)))
+		if (entry->d_name[0] != '.') {
+			snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+			unlink(path);
+		}
+	if (d) closedir(d);
+	rmdir(dir);
+}
+
+// Record 'seq' is 'seq % 200' bytes derived from 'seq'.
+static u32 seglog_test_fill(u64 seq, byte *buf) {
+	u32 len = seq % 200;
+	for (u32 i = 0; i < len; i++) buf[i] = (byte)(seq * 31 + i);
+	return len;
+}
+
+static void seglog_test_verify(Seglog *log, u64 seq) {
+	byte expect[256];
+	const void *data;
+	u32 len;
+	assert(!seglog_read(log, seq, &data, &len));
+	assert_eq(len, seglog_test_fill(seq, expect));
+	for (u32 i = 0; i < len; i++) assert_eq(((byte *)data)[i], expect[i]);
+}
+
+typedef struct SeglogTestTask {
+	Seglog *log;
+	u32 count;
+} SeglogTestTask;
+
+static void *seglog_test_worker(void *arg) {
+	SeglogTestTask *task = arg;
+	// with SEGLOG_SYNC_ALWAYS an append only returns once it is durable
+	for (u32 i = 0; i < task->count; i++)
+		if (seglog_append(task->log, "committed", 9, NULL)) return NULL;
+	return task;
+}
+
+Test(seglog) {
+	Seglog log;
+	SeglogOptions options = {64 * 1024, SEGLOG_SYNC_GROUP, 16 * 1024, 5};
+	byte buf[256];
+	const void *data;
+	u32 len;
+	u64 seq;
+	seglog_test_remove(test_file);
+	assert(!seglog_open(&log, test_file, &options));
+	assert_eq(seglog_end(&log), 0);
+	assert_eq(seglog_read(&log, 0, &data, &len), -1);
+	for (u64 i = 0; i < 5000; i++) {
+		assert(!seglog_append(&log, buf, seglog_test_fill(i, buf), &seq));
+		assert_eq(seq, i);
+	}
+	assert(log.segments.len > 5);
+	assert_eq(seglog_append(&log, buf, 64 * 1024, NULL), -1);
+	for (u64 i = 0; i < 5000; i += 7) seglog_test_verify(&log, i);
+	seglog_test_verify(&log, 4999);
+	assert_eq(seglog_read(&log, 5000, &data, &len), -1);
+
+	SeglogIter it;
+	assert(!seglog_iter_init(&it, &log, 1234));
+	u64 expect = 1234;
+	while (!seglog_iter_next(&it, &data, &len, &seq)) {
+		assert_eq(seq, expect);
+		assert_eq(len, seglog_test_fill(seq, buf));
+		expect++;
+	}
+	assert_eq(expect, 5000);
+	assert(!seglog_sync(&log));
+	assert_eq(log.synced, 5000);
+	seglog_close(&log);
+
+	// reopening recovers every record and the index
+	assert(!seglog_open(&log, test_file, &options));
+	assert_eq(seglog_end(&log), 5000);
+	for (u64 i = 0; i < 5000; i += 13) seglog_test_verify(&log, i);
+
+	// a torn record in the last segment cuts the log there, and segment
+	// files after the cut are removed
+	assert(!seglog_read(&log, 4990, &data, &len));
+	((byte *)data)[0] ^= 1;
+	seglog_close(&log);
+	char path[SEGLOG_PATH_MAX + 32];
+	snprintf(path, sizeof(path), "%s/%020llu.log", test_file, 9999ULL);
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	assert(fd >= 0);
+	close(fd);
+	assert(!seglog_open(&log, test_file, &options));
+	assert_eq(seglog_end(&log), 4990);
+	assert(open(path, O_RDONLY) < 0);
+	seglog_test_verify(&log, 4989);
+
+	// appends continue from the cut; stale records past it stay dead
+	for (u64 i = 4990; i < 6000; i++)
+		assert(!seglog_append(&log, buf, seglog_test_fill(i, buf), NULL));
+	seglog_close(&log);
+	assert(!seglog_open(&log, test_file, &options));
+	assert_eq(seglog_end(&log), 6000);
+	for (u64 i = 4980; i < 6000; i++) seglog_test_verify(&log, i);
+
+	// a pending record is synced once it is sync_millis old, with no later
+	// append or commit to notice
+	assert(!seglog_append(&log, buf, seglog_test_fill(6000, buf), &seq));
+	assert_eq(seq, 6000);
+	for (u32 i = 0; i < 2000; i++) {
+		if (__atomic_load_n(&log.synced, __ATOMIC_ACQUIRE) > seq) break;
+		os_sleep(1);
+	}
+	assert_eq(__atomic_load_n(&log.synced, __ATOMIC_ACQUIRE), 6001);
+
+	// group commit from several threads: every append returns durable
+	seglog_close(&log);
+	options.sync = SEGLOG_SYNC_ALWAYS;
+	assert(!seglog_open(&log, test_file, &options));
+	SeglogTestTask task = {&log, 50};
+	pthread_t threads[4];
+	void *ret[4];
+	for (u32 t = 0; t < 4; t++)
+		pthread_create(&threads[t], NULL, seglog_test_worker, &task);
+	for (u32 t = 0; t < 4; t++) pthread_join(threads[t], &ret[t]);
+	for (u32 t = 0; t < 4; t++) assert(ret[t]);
+	assert_eq(seglog_end(&log), 6201);
+	assert_eq(log.synced, 6201);
+	seglog_close(&log);
+	seglog_test_remove(test_file);
+}
+
+#define SEGLOG_BENCH_DIR "./.seglog_bench.fam"
+#define SEGLOG_BENCH_RECORD 100
+
+// Append 100 byte records to a fresh log with 16 MiB segments.
+static void seglog_bench(u64 bench_iterations, u32 sync, u64 count) {
+	SeglogOptions options = {16 * 1024 * 1024, sync, 1024 * 1024, 10};
+	byte record[SEGLOG_BENCH_RECORD];
+	set_bytes(record, 'r', sizeof(record));
+	seglog_test_remove(SEGLOG_BENCH_DIR);
+	bench_set_bytes(count * SEGLOG_BENCH_RECORD);
+	bench_loop {
+		Seglog log;
+		seglog_open(&log, SEGLOG_BENCH_DIR, &options);
+		for (u64 i = 0; i < count; i++)
+			seglog_append(&log, record, sizeof(record), NULL);
+		seglog_close(&log);
+		seglog_test_remove(SEGLOG_BENCH_DIR);
+	}
+}
+
+Bench(seglog_append_nosync) {
+	seglog_bench(bench_iterations, SEGLOG_SYNC_NONE, 100000);
+}
+
+Bench(seglog_append_group) {
+	seglog_bench(bench_iterations, SEGLOG_SYNC_GROUP, 100000);
+}
+
+Bench(seglog_append_always) {
+	seglog_bench(bench_iterations, SEGLOG_SYNC_ALWAYS, 1000);
+}
+
+#define EBR_TEST_THREADS 4
+#define EBR_TEST_OPS 20000
+
+// Treiber stack over a pool of nodes that are never reused, so a node read
+// after being freed shows up as 'freed' set.
+typedef struct EbrTestNode {
+	struct EbrTestNode *next;
+	u64 freed;
+} EbrTestNode;
+
+typedef struct EbrTestStack {
+	Ebr ebr;
+	EbrTestNode *head;
+	EbrTestNode *pool;
+	u64 used;
+	u64 popped;
+	u64 freed;
+	u64 stale;
+} EbrTestStack;
+
+static void ebr_test_free(void *ptr, void *ctx) {
+	EbrTestNode *node = ptr;
+	EbrTestStack *s = ctx;
+	__atomic_store_n(&node->freed, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&s->freed, 1, __ATOMIC_RELAXED);
+}
+
+static void ebr_test_push(EbrTestStack *s) {
+	EbrTestNode *node =
+		&s->pool[__atomic_fetch_add(&s->used, 1, __ATOMIC_RELAXED)];
+	node->next = __atomic_load_n(&s->head, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&s->head, &node->next, node, true,
+										__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static void ebr_test_pop(EbrTestStack *s, EbrThread *t) {
+	ebr_pin(t);
+	for (;;) {
+		EbrTestNode *node = ebr_protect(t, 0, (void *const *)&s->head);
+		if (!node) break;
+		if (__atomic_load_n(&node->freed, __ATOMIC_RELAXED))
+			__atomic_fetch_add(&s->stale, 1, __ATOMIC_RELAXED);
+		EbrTestNode *next = __atomic_load_n(&node->next, __ATOMIC_RELAXED);
+		if (__atomic_compare_exchange_n(&s->head, &node, next, false,
+										__ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			__atomic_fetch_add(&s->popped, 1, __ATOMIC_RELAXED);
+			ebr_retire(t, node, ebr_test_free, s);
+			break;
+		}
+	}
+	ebr_clear(t, 0);
+	ebr_unpin(t);
+}
+
+static void *ebr_test_worker(void *arg) {
+	EbrTestStack *s = arg;
+	EbrThread *t = ebr_register(&s->ebr);
+	for (u32 i = 0; i < EBR_TEST_OPS; i++) {
+		ebr_test_push(s);
+		ebr_test_pop(s, t);
+	}
+	ebr_unregister(t);
+	return NULL;
+}
+
+static void ebr_test_stress(u32 mode) {
+	u64 pages = bytes_to_pages(EBR_TEST_THREADS * EBR_TEST_OPS *
+							   sizeof(EbrTestNode));
+	EbrTestStack s = {0};
+	assert(!ebr_init(&s.ebr, mode));
+	s.pool = map(pages);
+	assert(s.pool);
+
+	pthread_t threads[EBR_TEST_THREADS];
+	for (u32 i = 0; i < EBR_TEST_THREADS; i++)
+		pthread_create(&threads[i], NULL, ebr_test_worker, &s);
+	for (u32 i = 0; i < EBR_TEST_THREADS; i++)
+		pthread_join(threads[i], NULL);
+	assert_eq(s.stale, 0);
+	assert_eq(s.used, EBR_TEST_THREADS * EBR_TEST_OPS);
+	assert(s.freed <= s.popped);
+
+	// what the workers left behind is freed by later flushes
+	EbrThread *t = ebr_register(&s.ebr);
+	for (u32 i = 0; i < 3; i++) ebr_flush(t);
+	assert_eq(s.freed, s.popped);
+	ebr_unregister(t);
+	ebr_cleanup(&s.ebr);
+	unmap(s.pool, pages);
+}
+
+Test(ebr) {
+	EbrTestStack s = {0};
+	u64 pages = bytes_to_pages(4 * sizeof(EbrTestNode));
+	s.pool = map(pages);
+	assert_eq(ebr_init(&s.ebr, 2), -1);
+
+	// epoch mode: a pinned reader holds back reclamation
+	assert(!ebr_init(&s.ebr, EBR_MODE_EPOCH));
+	EbrThread *writer = ebr_register(&s.ebr);
+	EbrThread *reader = ebr_register(&s.ebr);
+	assert(writer && reader && writer != reader);
+	ebr_pin(reader);
+	ebr_pin(reader);
+	ebr_unpin(reader);
+	assert(!ebr_retire(writer, &s.pool[0], ebr_test_free, &s));
+	assert_eq(ebr_pending(writer), 1);
+	for (u32 i = 0; i < 10; i++) ebr_flush(writer);
+	assert_eq(s.freed, 0);
+	assert_eq(s.pool[0].freed, 0);
+	ebr_unpin(reader);
+	for (u32 i = 0; i < 3; i++) ebr_flush(writer);
+	assert_eq(s.freed, 1);
+	assert_eq(ebr_pending(writer), 0);
+
+	// a record given up is reused; its pending nodes go to the domain
+	assert(!ebr_retire(writer, &s.pool[1], ebr_test_free, &s));
+	ebr_unregister(writer);
+	assert(ebr_register(&s.ebr) == writer);
+	assert_eq(ebr_pending(writer), 0);
+	for (u32 i = 0; i < 3; i++) ebr_flush(writer);
+	assert_eq(s.freed, 2);
+
+	// retiring more than a batch reclaims without explicit flushes
+	EbrTestNode *nodes = map(bytes_to_pages(1000 * sizeof(EbrTestNode)));
+	for (u32 i = 0; i < 1000; i++)
+		assert(!ebr_retire(writer, &nodes[i], ebr_test_free, &s));
+	assert(ebr_pending(writer) < EBR_BATCH * 3);
+	ebr_unregister(writer);
+	ebr_unregister(reader);
+	ebr_cleanup(&s.ebr);
+	assert_eq(s.freed, 1002);
+	unmap(nodes, bytes_to_pages(1000 * sizeof(EbrTestNode)));
+
+	// hazard mode: only protected nodes are kept, even while pinned
+	assert(!ebr_init(&s.ebr, EBR_MODE_HAZARD));
+	writer = ebr_register(&s.ebr);
+	reader = ebr_register(&s.ebr);
+	s.freed = 0;
+	s.head = &s.pool[2];
+	ebr_pin(reader);
+	assert(ebr_protect(reader, 1, (void *const *)&s.head) == &s.pool[2]);
+	s.head = NULL;
+	assert(!ebr_retire(writer, &s.pool[2], ebr_test_free, &s));
+	assert(!ebr_retire(writer, &s.pool[3], ebr_test_free, &s));
+	ebr_flush(writer);
+	assert_eq(s.freed, 1);
+	assert_eq(s.pool[2].freed, 0);
+	assert_eq(ebr_pending(writer), 1);
+	ebr_clear(reader, 1);
+	ebr_flush(writer);
+	assert_eq(s.freed, 2);
+	ebr_unpin(reader);
+	ebr_unregister(writer);
+	ebr_unregister(reader);
+	ebr_cleanup(&s.ebr);
+	unmap(s.pool, pages);
+}
+
+Test(ebr_threads) {
+	ebr_test_stress(EBR_MODE_EPOCH);
+	ebr_test_stress(EBR_MODE_HAZARD);
+}
+
+#define EBR_BENCH_OPS 1000
+
+static void ebr_bench_nop(void *ptr, void *ctx) {
+	(*(u64 *)ctx)++;
+}
+
+static void ebr_bench_retire(u64 bench_iterations, u32 mode) {
+	Ebr e;
+	u64 freed = 0;
+	ebr_init(&e, mode);
+	EbrThread *t = ebr_register(&e);
+	bench_set_bytes(EBR_BENCH_OPS);
+	bench_loop {
+		for (u64 i = 0; i < EBR_BENCH_OPS; i++) {
+			ebr_pin(t);
+			ebr_retire(t, (void *)(i + 1), ebr_bench_nop, &freed);
+			ebr_unpin(t);
+		}
+	}
+	ebr_unregister(t);
+	ebr_cleanup(&e);
+	do_not_optimize(freed);
+}
+
+Bench(ebr_retire_epoch) {
+	ebr_bench_retire(bench_iterations, EBR_MODE_EPOCH);
+}
+
+Bench(ebr_retire_hazard) {
+	ebr_bench_retire(bench_iterations, EBR_MODE_HAZARD);
+}
+
+Bench(ebr_pin) {
+	Ebr e;
+	ebr_init(&e, EBR_MODE_EPOCH);
+	EbrThread *t = ebr_register(&e);
+	bench_set_bytes(EBR_BENCH_OPS);
+	bench_loop {
+		for (u64 i = 0; i < EBR_BENCH_OPS; i++) {
+			ebr_pin(t);
+			ebr_unpin(t);
+		}
+	}
+	ebr_unregister(t);
+	ebr_cleanup(&e);
+}
+
+#define SKIPLIST_TEST_THREADS 4
+#define SKIPLIST_TEST_KEYS 4000
+
+typedef struct SkipListTestTask {
+	SkipList *s;
+	u32 id;
+	u64 scans;
+	u64 errors;
+} SkipListTestTask;
+
+// Each worker owns the keys congruent to its id: it inserts them all,
+// deletes the odd ones and checks its own keys while the others run. Scans
+// must stay in order whatever the other threads do.
+static void *skiplist_test_worker(void *arg) {
+	SkipListTestTask *task = arg;
+	SkipList *s = task->s;
+	EbrThread *t = skiplist_register(s);
+	u64 value = 0;
+	for (u64 k = task->id; k < SKIPLIST_TEST_KEYS; k += SKIPLIST_TEST_THREADS)
+		if (skiplist_put(s, t, k, k * 3)) task->errors++;
+	for (u64 k = task->id; k < SKIPLIST_TEST_KEYS; k += SKIPLIST_TEST_THREADS) {
+		if (k & 1 && skiplist_delete(s, t, k, &value)) task->errors++;
+		if (k & 1 && value != k * 3) task->errors++;
+		if (k % 64 == task->id) {
+			SkipListIter it;
+			u64 key, prev = 0, n = 0;
+			skiplist_iter_init(&it, s, t, 0, ~0ULL);
+			while (!skiplist_iter_next(&it, &key, &value)) {
+				if ((n++ && key <= prev) || value != key * 3) task->errors++;
+				prev = key;
+			}
+			skiplist_iter_done(&it);
+			task->scans++;
+		}
+	}
+	for (u64 k = task->id; k < SKIPLIST_TEST_KEYS; k += SKIPLIST_TEST_THREADS) {
+		int ret = skiplist_get(s, t, k, &value);
+		if (k & 1 ? ret != -1 : ret || value != k * 3) task->errors++;
+	}
+	skiplist_unregister(t);
+	return NULL;
+}
+
+Test(skiplist) {
+	SkipList s;
+	assert(!skiplist_init(&s));
+	EbrThread *t = skiplist_register(&s);
+	u64 key, value;
+
+	assert_eq(skiplist_get(&s, t, 5, &value), -1);
+	assert_eq(skiplist_delete(&s, t, 5, NULL), -1);
+	// insert in a scrambled order
+	for (u64 i = 0; i < 1000; i++)
+		assert_eq(skiplist_put(&s, t, (i * 7919) % 1000 * 2, i), 0);
+	assert_eq(skiplist_count(&s), 1000);
+	assert_eq(skiplist_put(&s, t, 10, 123), 1);
+	assert_eq(skiplist_count(&s), 1000);
+	assert(!skiplist_get(&s, t, 10, &value));
+	assert_eq(value, 123);
+	assert_eq(skiplist_get(&s, t, 11, &value), -1);
+	assert(!skiplist_delete(&s, t, 10, &value));
+	assert_eq(value, 123);
+	assert_eq(skiplist_delete(&s, t, 10, &value), -1);
+	assert_eq(skiplist_get(&s, t, 10, &value), -1);
+	assert_eq(skiplist_count(&s), 999);
+
+	// range scans see exactly the live keys in order
+	SkipListIter it;
+	u64 n = 0;
+	skiplist_iter_init(&it, &s, t, 5, 21);
+	u64 expect[] = {6, 8, 12, 14, 16, 18, 20};
+	while (!skiplist_iter_next(&it, &key, &value)) {
+		assert(n < sizeof(expect) / sizeof(expect[0]));
+		assert_eq(key, expect[n++]);
+	}
+	skiplist_iter_done(&it);
+	assert_eq(n, 7);
+	skiplist_iter_init(&it, &s, t, 30, 20);
+	assert_eq(skiplist_iter_next(&it, &key, &value), -1);
+	skiplist_iter_done(&it);
+
+	// extreme keys
+	assert(!skiplist_put(&s, t, ~0ULL, 1));
+	assert_eq(skiplist_put(&s, t, 0, 2), 1);
+	skiplist_iter_init(&it, &s, t, 1990, ~0ULL);
+	assert(!skiplist_iter_next(&it, &key, &value));
+	assert_eq(key, 1990);
+	assert(!skiplist_iter_next(&it, &key, &value));
+	assert_eq(key, 1992);
+	while (!skiplist_iter_next(&it, &key, &value)) n = key;
+	assert_eq(n, ~0ULL);
+	skiplist_iter_done(&it);
+
+	// deleting everything recycles nodes for later inserts
+	for (u64 i = 0; i < 2000; i += 2) skiplist_delete(&s, t, i, NULL);
+	assert(!skiplist_delete(&s, t, ~0ULL, NULL));
+	assert_eq(skiplist_count(&s), 0);
+	for (u64 i = 0; i < 1000; i++) assert(!skiplist_put(&s, t, i, i));
+	assert_eq(skiplist_count(&s), 1000);
+	skiplist_unregister(t);
+	skiplist_cleanup(&s);
+}
+
+Test(skiplist_threads) {
+	SkipList s;
+	assert(!skiplist_init(&s));
+	pthread_t threads[SKIPLIST_TEST_THREADS];
+	SkipListTestTask tasks[SKIPLIST_TEST_THREADS];
+	for (u32 i = 0; i < SKIPLIST_TEST_THREADS; i++) {
+		tasks[i] = (SkipListTestTask){&s, i, 0, 0};
+		pthread_create(&threads[i], NULL, skiplist_test_worker, &tasks[i]);
+	}
+	for (u32 i = 0; i < SKIPLIST_TEST_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+		assert_eq(tasks[i].errors, 0);
+		assert(tasks[i].scans);
+	}
+	assert_eq(skiplist_count(&s), SKIPLIST_TEST_KEYS / 2);
+
+	EbrThread *t = skiplist_register(&s);
+	SkipListIter it;
+	u64 key, value, n = 0;
+	skiplist_iter_init(&it, &s, t, 0, ~0ULL);
+	while (!skiplist_iter_next(&it, &key, &value)) {
+		assert_eq(key, n * 2);
+		n++;
+	}
+	skiplist_iter_done(&it);
+	assert_eq(n, SKIPLIST_TEST_KEYS / 2);
+	skiplist_unregister(t);
+	skiplist_cleanup(&s);
+}
+
+#define SKIPLIST_BENCH_KEYS 100000
+#define SKIPLIST_BENCH_OPS 20000
+
+typedef struct SkipListBenchTask {
+	SkipList *s;
+	u32 writes;	 // percent
+	u64 seed;
+} SkipListBenchTask;
+
+static void *skiplist_bench_worker(void *arg) {
+	SkipListBenchTask *task = arg;
+	EbrThread *t = skiplist_register(task->s);
+	u64 x = task->seed, value;
+	for (u32 i = 0; i < SKIPLIST_BENCH_OPS; i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		u64 key = x % (2 * SKIPLIST_BENCH_KEYS);
+		if (x % 100 >= task->writes)
+			skiplist_get(task->s, t, key, &value);
+		else if (x & 0x100)
+			skiplist_put(task->s, t, key, key);
+		else
+			skiplist_delete(task->s, t, key, NULL);
+	}
+	skiplist_unregister(t);
+	return NULL;
+}
+
+// 'threads' threads doing SKIPLIST_BENCH_OPS random operations each on a
+// list of about SKIPLIST_BENCH_KEYS keys, 'writes' percent of them updates.
+static void skiplist_bench(u64 bench_iterations, u32 threads, u32 writes) {
+	SkipList s;
+	skiplist_init(&s);
+	EbrThread *t = skiplist_register(&s);
+	for (u64 k = 0; k < 2 * SKIPLIST_BENCH_KEYS; k += 2)
+		skiplist_put(&s, t, k, k);
+	skiplist_unregister(t);
+
+	pthread_t pt[8];
+	SkipListBenchTask tasks[8];
+	bench_set_bytes(threads * SKIPLIST_BENCH_OPS);
+	bench_loop {
+		for (u32 i = 0; i < threads; i++) {
+			tasks[i] = (SkipListBenchTask){&s, writes, 0x9E3779B9 * (i + 1)};
+			pthread_create(&pt[i], NULL, skiplist_bench_worker, &tasks[i]);
+		}
+		for (u32 i = 0; i < threads; i++) pthread_join(pt[i], NULL);
+	}
+	skiplist_cleanup(&s);
+}
+
+Bench(skiplist_1t_10w) {
+	skiplist_bench(bench_iterations, 1, 10);
+}
+
+Bench(skiplist_4t_10w) {
+	skiplist_bench(bench_iterations, 4, 10);
+}
+
+Bench(skiplist_8t_10w) {
+	skiplist_bench(bench_iterations, 8, 10);
+}
+
+Bench(skiplist_1t_50w) {
+	skiplist_bench(bench_iterations, 1, 50);
+}
+
+Bench(skiplist_4t_50w) {
+	skiplist_bench(bench_iterations, 4, 50);
+}
+
+Bench(skiplist_8t_50w) {
+	skiplist_bench(bench_iterations, 8, 50);
+}
+
+#define FILTER_TEST_KEYS 20000
+#define FILTER_TEST_PROBES 200000
+
+static u64 filter_test_key(u64 i) {
+	return filter_hash(&i, sizeof(i));
+}
+
+// Fraction of keys never added that the filter reports; keys from
+// FILTER_TEST_KEYS on are never added.
+static f64 filter_test_fpr(const void *filter, bool cuckoo) {
+	u64 hits = 0;
+	for (u64 i = 0; i < FILTER_TEST_PROBES; i++) {
+		u64 key = filter_test_key(FILTER_TEST_KEYS + i);
+		hits += cuckoo ? cuckoo_contains(filter, key)
+					   : bloom_contains(filter, key);
+	}
+	return (f64)hits / FILTER_TEST_PROBES;
+}
+
+static void *filter_test_reload(const char *path, const void *buf, u64 len,
+								u64 *size) {
+	int fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+	assert(fd >= 0);
+	assert_eq(write(fd, buf, len), len);
+	close(fd);
+	return map_file(path, size);
+}
+
+Test(filter_bloom) {
+	f64 targets[] = {0.1, 0.01, 0.001};
+	Bloom b, generic, view;
+	assert_eq(bloom_init(&b, 10, 0), -1);
+	assert_eq(bloom_init(&b, 10, 1), -1);
+
+	for (u32 t = 0; t < 3; t++) {
+		cpu_override(~0U);
+		assert(!bloom_init(&b, FILTER_TEST_KEYS, targets[t]));
+		assert(!bloom_init(&generic, FILTER_TEST_KEYS, targets[t]));
+		assert(bloom_fpr(&b, FILTER_TEST_KEYS) <= targets[t]);
+		for (u64 i = 0; i < FILTER_TEST_KEYS; i++)
+			bloom_add(&b, filter_test_key(i));
+		for (u64 i = 0; i < FILTER_TEST_KEYS; i++)
+			assert(bloom_contains(&b, filter_test_key(i)));
+		f64 fpr = filter_test_fpr(&b, false);
+		assert(fpr <= targets[t] * 1.2);
+		assert(fpr >= targets[t] / 4);
+
+		// the portable path builds the same bits and agrees on lookups
+		cpu_override(0);
+		for (u64 i = 0; i < FILTER_TEST_KEYS; i++)
+			bloom_add(&generic, filter_test_key(i));
+		for (u64 i = 0; i < b.blocks * 8; i++)
+			assert_eq(b.words[i], generic.words[i]);
+		assert_eq(filter_test_fpr(&generic, false), fpr);
+		cpu_override(~0U);
+		bloom_cleanup(&generic);
+
+		// serialized, written out and mapped back
+		u64 len = bloom_size(&b), size;
+		byte *buf = map(bytes_to_pages(len));
+		assert_eq(bloom_serialize(&b, buf, len - 1), -1);
+		assert(!bloom_serialize(&b, buf, len));
+		void *mapped = filter_test_reload(test_file, buf, len, &size);
+		assert(mapped);
+		assert(!bloom_view(&view, mapped, size));
+		assert_eq(view.blocks, b.blocks);
+		for (u64 i = 0; i < FILTER_TEST_KEYS; i++)
+			assert(bloom_contains(&view, filter_test_key(i)));
+		assert_eq(filter_test_fpr(&view, false), fpr);
+		bloom_cleanup(&view);
+		assert_eq(bloom_view(&view, mapped, 63), -1);
+		assert_eq(bloom_view(&view, mapped, size - 64), -1);
+		unmap_file(mapped, size);
+		buf[0] ^= 1;
+		assert_eq(bloom_view(&view, buf, len), -1);
+		unmap(buf, bytes_to_pages(len));
+		unlink(test_file);
+		bloom_cleanup(&b);
+	}
+}
+
+Test(filter_cuckoo) {
+	f64 targets[] = {0.05, 0.001, 0.00001};
+	u32 fp_bytes[] = {1, 2, 4};
+	Cuckoo c, view;
+	assert_eq(cuckoo_init(&c, 10, 0), -1);
+
+	for (u32 t = 0; t < 3; t++) {
+		assert(!cuckoo_init(&c, FILTER_TEST_KEYS, targets[t]));
+		assert_eq(c.fp_bytes, fp_bytes[t]);
+		for (u64 i = 0; i < FILTER_TEST_KEYS; i++)
+			assert(!cuckoo_add(&c, filter_test_key(i)));
+		assert_eq(cuckoo_count(&c), FILTER_TEST_KEYS);
+		for (u64 i = 0; i < FILTER_TEST_KEYS; i++)
+			assert(cuckoo_contains(&c, filter_test_key(i)));
+		f64 fpr = filter_test_fpr(&c, true);
+		assert(fpr <= targets[t]);
+
+		u64 len = cuckoo_size(&c), size;
+		byte *buf = map(bytes_to_pages(len));
+		assert(!cuckoo_serialize(&c, buf, len));
+		void *mapped = filter_test_reload(test_file, buf, len, &size);
+		assert(!cuckoo_view(&view, mapped, size));
+		assert_eq(cuckoo_count(&view), FILTER_TEST_KEYS);
+		for (u64 i = 0; i < FILTER_TEST_KEYS; i++)
+			assert(cuckoo_contains(&view, filter_test_key(i)));
+		assert_eq(filter_test_fpr(&view, true), fpr);
+		cuckoo_cleanup(&view);
+		unmap_file(mapped, size);
+		unmap(buf, bytes_to_pages(len));
+		unlink(test_file);
+
+		// removing the even keys keeps every odd one
+		u64 stale = 0;
+		for (u64 i = 0; i < FILTER_TEST_KEYS; i += 2)
+			assert(!cuckoo_remove(&c, filter_test_key(i)));
+		assert_eq(cuckoo_count(&c), FILTER_TEST_KEYS / 2);
+		for (u64 i = 0; i < FILTER_TEST_KEYS; i++) {
+			bool found = cuckoo_contains(&c, filter_test_key(i));
+			if (i & 1) {
+				assert(found);
+			} else
+				stale += found;
+		}
+		assert(stale <= FILTER_TEST_KEYS * targets[t]);
+		cuckoo_cleanup(&c);
+	}
+
+	// filling up: inserts stop only when the table is nearly full
+	assert(!cuckoo_init(&c, 1000, 0.01));
+	u64 added = 0;
+	while (!cuckoo_add(&c, filter_test_key(added))) added++;
+	assert(added >= c.buckets * 4 * 90 / 100);
+	for (u64 i = 0; i < added; i++)
+		assert(cuckoo_contains(&c, filter_test_key(i)));
+	// a removal makes room again
+	assert(!cuckoo_remove(&c, filter_test_key(0)));
+	assert(!cuckoo_add(&c, filter_test_key(0)));
+	for (u64 i = 0; i < added; i++)
+		assert(cuckoo_contains(&c, filter_test_key(i)));
+	cuckoo_cleanup(&c);
+}
+
+#define FILTER_BENCH_KEYS 1000000
+#define FILTER_BENCH_LOOKUPS 100000
+
+// Lookups in a filter of FILTER_BENCH_KEYS keys (a few MiB, past L2), half
+// of them for keys that were added.
+static void filter_bench(u64 bench_iterations, u32 kind, f64 fpr) {
+	Bloom b;
+	Cuckoo c;
+	u64 hits = 0;
+	if (kind == 2)
+		cuckoo_init(&c, FILTER_BENCH_KEYS, fpr);
+	else
+		bloom_init(&b, FILTER_BENCH_KEYS, fpr);
+	for (u64 i = 0; i < FILTER_BENCH_KEYS; i++) {
+		if (kind == 2)
+			cuckoo_add(&c, filter_test_key(i * 2));
+		else
+			bloom_add(&b, filter_test_key(i * 2));
+	}
+	cpu_override(kind == 1 ? 0 : ~0U);
+	bench_set_bytes(FILTER_BENCH_LOOKUPS);
+	bench_loop {
+		for (u64 i = 0; i < FILTER_BENCH_LOOKUPS; i++) {
+			u64 key = filter_test_key(i);
+			hits += kind == 2 ? cuckoo_contains(&c, key)
+							  : bloom_contains(&b, key);
+		}
+	}
+	do_not_optimize(hits);
+	cpu_override(~0U);
+	if (kind == 2)
+		cuckoo_cleanup(&c);
+	else
+		bloom_cleanup(&b);
+}
+
+Bench(filter_bloom) {
+	filter_bench(bench_iterations, 0, 0.01);
+}
+
+Bench(filter_bloom_generic) {
+	filter_bench(bench_iterations, 1, 0.01);
+}
+
+Bench(filter_cuckoo) {
+	filter_bench(bench_iterations, 2, 0.001);
+}
+
+static void serial_test_varint(u64 v, const byte *bytes, u32 len) {
+	byte buf[SERIAL_VARINT_MAX];
+	u64 got;
+	assert_eq(serial_varint_put(buf, v), len);
+	for (u32 i = 0; i < len; i++) assert_eq(buf[i], bytes[i]);
+	assert_eq(serial_varint_get(buf, len, &got), len);
+	assert_eq(got, v);
+	assert_eq(serial_varint_get(buf, len - 1, &got), 0);
+}
+
+// 'count' varints of random bit lengths; returns the encoded length.
+static u64 serial_test_varints(Rng *rng, u64 *values, u64 count, byte *out) {
+	u64 len = 0;
+	for (u64 i = 0; i < count; i++) {
+		values[i] = rng_next(rng) >> rng_bounded(rng, 64);
+		len += serial_varint_put(out + len, values[i]);
+	}
+	return len;
+}
+
+Test(serial_varint) {
+	serial_test_varint(0, (const byte[]){0x00}, 1);
+	serial_test_varint(1, (const byte[]){0x01}, 1);
+	serial_test_varint(127, (const byte[]){0x7F}, 1);
+	serial_test_varint(128, (const byte[]){0x80, 0x01}, 2);
+	serial_test_varint(300, (const byte[]){0xAC, 0x02}, 2);
+	serial_test_varint(~0ULL,
+					   (const byte[]){0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+									  0xFF, 0xFF, 0x01},
+					   10);
+
+	assert_eq(serial_zigzag(0), 0);
+	assert_eq(serial_zigzag(-1), 1);
+	assert_eq(serial_zigzag(1), 2);
+	assert_eq(serial_zigzag(-2), 3);
+	assert_eq(serial_zigzag(-0x7FFFFFFFFFFFFFFFLL - 1), ~0ULL);
+	assert_eq(serial_zigzag(0x7FFFFFFFFFFFFFFFLL), ~0ULL - 1);
+	for (i64 v = -1000; v <= 1000; v++)
+		assert_eq(serial_unzigzag(serial_zigzag(v)), v);
+
+	byte overlong[12];
+	u64 v;
+	set_bytes(overlong, 0x80, 11);
+	overlong[11] = 0;
+	assert_eq(serial_varint_get(overlong, 12, &v), 0);
+
+	u64 max = 5000;
+	u64 *values = map(bytes_to_pages(max * sizeof(u64)));
+	u64 *got = map(bytes_to_pages(max * sizeof(u64)));
+	byte *enc = map(bytes_to_pages(max * SERIAL_VARINT_MAX + 64));
+	Rng rng;
+	rng_seed(&rng, 50);
+	for (int path = 0; path < 2; path++) {
+		cpu_override(path ? ~0U : 0);
+		for (int iter = 0; iter < 300; iter++) {
+			u64 count = rng_bounded(&rng, iter < 200 ? 64 : max);
+			u64 len = serial_test_varints(&rng, values, count, enc);
+			// trailing bytes are not consumed
+			set_bytes(enc + len, 0x80, 64);
+			assert_eq(serial_varint_get_n(enc, len + 64, got, count), len);
+			for (u64 i = 0; i < count; i++) assert_eq(got[i], values[i]);
+			if (!count) continue;
+			assert_eq(serial_varint_get_n(enc, len - 1, got, count), -1);
+			assert_eq(serial_varint_get_n(enc, len + 64, got, count + 1), -1);
+			// an overlong varint somewhere in the middle
+			u64 at = rng_bounded(&rng, len);
+			set_bytes(enc + at, 0x80, 11);
+			assert_eq(serial_varint_get_n(enc, len + 64, got, count), -1);
+		}
+	}
+	cpu_override(~0U);
+	unmap(values, bytes_to_pages(max * sizeof(u64)));
+	unmap(got, bytes_to_pages(max * sizeof(u64)));
+	unmap(enc, bytes_to_pages(max * SERIAL_VARINT_MAX + 64));
+}
+
+Test(serial) {
+	SerialBuilder b;
+	char long_str[201];
+	u64 packed[] = {1, 300, ~0ULL, 0}, unpacked[4];
+	set_bytes(long_str, 'x', 200);
+	long_str[200] = 0;
+
+	assert(!serial_builder_init(&b));
+	assert(!serial_put_uint(&b, 1, 42));
+	assert(!serial_put_int(&b, 2, -7));
+	assert(!serial_put_str(&b, 3, "hello"));
+	assert(!serial_put_fixed64(&b, 4, 0x0102030405060708ULL));
+	assert(!serial_put_fixed32(&b, 5, 0xDEADBEEF));
+	assert(!serial_put_f64(&b, 6, 1.5));
+	assert(!serial_put_uints(&b, 7, packed, 4));
+	assert(!serial_begin(&b, 8));
+	assert(!serial_put_uint(&b, 1, 5));
+	assert(!serial_begin(&b, 2));
+	assert(!serial_put_str(&b, 1, long_str));
+	assert(!serial_end(&b));
+	assert(!serial_end(&b));
+	assert(!serial_put_uint(&b, SERIAL_FIELD_MAX, 9));
+
+	u64 len = b.buf.len;
+	assert_eq(serial_put_uint(&b, 0, 1), -1);
+	assert_eq(serial_put_uint(&b, SERIAL_FIELD_MAX + 1, 1), -1);
+	assert_eq(serial_end(&b), -1);
+	assert_eq(b.buf.len, len);
+
+	// the wire format for the first three fields
+	const byte head[] = {0x08, 0x2A, 0x10, 0x0D, 0x1A, 0x05,
+						 'h',  'e',	 'l',  'l',	 'o'};
+	for (u64 i = 0; i < sizeof(head); i++) assert_eq(b.buf.data[i], head[i]);
+
+	SerialReader r, sub, sub2;
+	SerialField f;
+	// top level field boundaries, for the truncation checks below
+	u64 ends[9], fields = 0;
+	serial_reader_init(&r, b.buf.data, b.buf.len);
+	while (serial_next(&r, &f) > 0) {
+		ends[fields++] = r.p - b.buf.data;
+		if (f.type == SERIAL_BYTES) {
+			assert(f.data > b.buf.data);
+			assert(f.data + f.len <= b.buf.data + b.buf.len);
+		}
+		switch (f.id) {
+			case 1:
+				assert_eq(f.value, 42);
+				break;
+			case 2:
+				assert_eq(serial_field_int(&f), -7);
+				break;
+			case 3:
+				assert_eq(f.len, 5);
+				assert(!cstring_compare_n((const char *)f.data, "hello", 5));
+				break;
+			case 4:
+				assert_eq(f.type, SERIAL_FIXED64);
+				assert_eq(f.value, 0x0102030405060708ULL);
+				break;
+			case 5:
+				assert_eq(f.type, SERIAL_FIXED32);
+				assert_eq(f.value, 0xDEADBEEF);
+				break;
+			case 6:
+				assert_eq(serial_field_f64(&f), 1.5);
+				break;
+			case 7:
+				assert_eq(serial_field_uints(&f, unpacked, 4), 4);
+				for (int i = 0; i < 4; i++) assert_eq(unpacked[i], packed[i]);
+				assert_eq(serial_field_uints(&f, unpacked, 3), -1);
+				break;
+			case 8:
+				serial_reader_sub(&sub, &f);
+				assert_eq(serial_next(&sub, &f), 1);
+				assert_eq(f.id, 1);
+				assert_eq(f.value, 5);
+				assert_eq(serial_next(&sub, &f), 1);
+				assert_eq(f.id, 2);
+				serial_reader_sub(&sub2, &f);
+				assert_eq(serial_next(&sub2, &f), 1);
+				assert_eq(f.len, 200);
+				assert_eq(f.data[199], 'x');
+				assert_eq(serial_next(&sub2, &f), 0);
+				assert_eq(serial_next(&sub, &f), 0);
+				break;
+			case SERIAL_FIELD_MAX:
+				assert_eq(f.value, 9);
+				break;
+			default:
+				assert(false);
+		}
+	}
+	assert_eq(fields, 9);
+	assert_eq(ends[fields - 1], b.buf.len);
+
+	// every cut between field boundaries is malformed
+	for (u64 cut = 0, next = 0; cut < b.buf.len; cut++) {
+		int ret = 1;
+		serial_reader_init(&r, b.buf.data, cut);
+		while (ret > 0) ret = serial_next(&r, &f);
+		if (cut == 0 || (next < fields && ends[next] == cut)) {
+			assert_eq(ret, 0);
+		} else {
+			assert_eq(ret, -1);
+		}
+		if (next < fields && ends[next] == cut) next++;
+	}
+	byte bad_type[] = {0x0B, 0x00};
+	serial_reader_init(&r, bad_type, 2);
+	assert_eq(serial_next(&r, &f), -1);
+	byte zero_field[] = {0x00, 0x00};
+	serial_reader_init(&r, zero_field, 2);
+	assert_eq(serial_next(&r, &f), -1);
+
+	serial_builder_clear(&b);
+	assert_eq(b.buf.len, 0);
+	for (int i = 0; i < SERIAL_MAX_DEPTH; i++) assert(!serial_begin(&b, 1));
+	assert_eq(serial_begin(&b, 1), -1);
+	for (int i = 0; i < SERIAL_MAX_DEPTH; i++) assert(!serial_end(&b));
+	assert_eq(serial_end(&b), -1);
+	assert_eq(b.buf.len, 2 * SERIAL_MAX_DEPTH);
+	serial_builder_cleanup(&b);
+}
+
+#define SERIAL_BENCH_RECORDS 1000
+
+// A log-like record: ids, a timestamp, a name, a score, tags and a nested
+// location.
+static void serial_bench_encode(SerialBuilder *b, u64 i) {
+	static const char *names[] = {"alice", "bob", "carol_the_admin",
+								  "dave.smith@example.com"};
+	u64 tags[6] = {i % 7, i % 300, 1, 2, i, 40};
+	serial_begin(b, 1);
+	serial_put_uint(b, 1, i);
+	serial_put_fixed64(b, 2, 1700000000000000000ULL + i * 1000);
+	serial_put_int(b, 3, (i64)(i % 100) - 50);
+	serial_put_str(b, 4, names[i % 4]);
+	serial_put_f64(b, 5, (f64)i * 0.25);
+	serial_put_uints(b, 6, tags, 6);
+	serial_begin(b, 7);
+	serial_put_str(b, 1, "Amsterdam");
+	serial_put_uint(b, 2, 1011 + i % 50);
+	serial_end(b);
+	serial_end(b);
+}
+
+Bench(serial_encode) {
+	SerialBuilder b;
+	serial_builder_init(&b);
+	for (u64 i = 0; i < SERIAL_BENCH_RECORDS; i++) serial_bench_encode(&b, i);
+	bench_set_bytes(b.buf.len);
+	bench_loop {
+		serial_builder_clear(&b);
+		for (u64 i = 0; i < SERIAL_BENCH_RECORDS; i++)
+			serial_bench_encode(&b, i);
+		do_not_optimize(b.buf.data);
+	}
+	serial_builder_cleanup(&b);
+}
+
+Bench(serial_decode) {
+	SerialBuilder b;
+	serial_builder_init(&b);
+	for (u64 i = 0; i < SERIAL_BENCH_RECORDS; i++) serial_bench_encode(&b, i);
+	bench_set_bytes(b.buf.len);
+	u64 sum = 0, tags[16];
+	bench_loop {
+		SerialReader r, rec;
+		SerialField f;
+		serial_reader_init(&r, b.buf.data, b.buf.len);
+		while (serial_next(&r, &f) > 0) {
+			serial_reader_sub(&rec, &f);
+			while (serial_next(&rec, &f) > 0) {
+				if (f.id == 4 || f.id == 7)
+					sum += f.len;
+				else if (f.id == 6)
+					sum += serial_field_uints(&f, tags, 16);
+				else
+					sum += f.value;
+			}
+		}
+		do_not_optimize(sum);
+	}
+	serial_builder_cleanup(&b);
+}
+
+static void serial_bench_varints(u64 bench_iterations, bool simd) {
+	u64 count = 1 << 16;
+	u64 *values = map(bytes_to_pages(count * sizeof(u64)));
+	byte *enc = map(bytes_to_pages(count * SERIAL_VARINT_MAX));
+	Rng rng;
+	rng_seed(&rng, 500);
+	// mostly short values, as counts and ids usually are
+	u64 len = 0;
+	for (u64 i = 0; i < count; i++) {
+		u32 bits = rng_bounded(&rng, 16) ? 7 * (1 + rng_bounded(&rng, 3)) : 64;
+		len += serial_varint_put(enc + len, rng_next(&rng) >> (64 - bits));
+	}
+	cpu_override(simd ? ~0U : 0);
+	bench_set_bytes(len);
+	bench_loop {
+		serial_varint_get_n(enc, len, values, count);
+		do_not_optimize(values);
+	}
+	cpu_override(~0U);
+	unmap(values, bytes_to_pages(count * sizeof(u64)));
+	unmap(enc, bytes_to_pages(count * SERIAL_VARINT_MAX));
+}
+
+Bench(serial_varints) {
+	serial_bench_varints(bench_iterations, true);
+}
+
+Bench(serial_varints_generic) {
+	serial_bench_varints(bench_iterations, false);
+}
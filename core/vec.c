@@ -0,0 +1,111 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <base/sys.h>
+#include <base/util.h>
+#include <core/vec.h>
+
+// Overlapping copy for shifting elements.
+static void vec_move(byte *dst, const byte *src, u64 n) {
+	if (dst < src)
+		copy_bytes(dst, src, n);
+	else
+		while (n--) dst[n] = src[n];
+}
+
+int vec_init(Vec *v, u64 elem_size, u64 capacity) {
+	v->data = NULL;
+	v->len = v->capacity = v->pages = 0;
+	v->elem_size = elem_size ? elem_size : 1;
+	return vec_reserve(v, capacity);
+}
+
+void vec_cleanup(Vec *v) {
+	if (v->data) unmap(v->data, v->pages);
+	v->data = NULL;
+	v->len = v->capacity = v->pages = 0;
+}
+
+int vec_reserve(Vec *v, u64 capacity) {
+	if (capacity <= v->capacity) return 0;
+	if (capacity > ~0ULL / v->elem_size) return -1;
+	u64 needed = bytes_to_pages(capacity * v->elem_size);
+	u64 pages = needed > v->pages * 2 ? needed : v->pages * 2;
+	byte *data = remap(v->data, v->pages, pages);
+	if (!data && pages > needed) {
+		// the doubled size may not fit where the exact one does
+		pages = needed;
+		data = remap(v->data, v->pages, pages);
+	}
+	if (!data) return -1;
+	v->data = data;
+	v->pages = pages;
+	v->capacity = pages * PAGE_SIZE / v->elem_size;
+	return 0;
+}
+
+int vec_resize(Vec *v, u64 len) {
+	if (vec_reserve(v, len)) return -1;
+	if (len > v->len)
+		set_bytes(v->data + v->len * v->elem_size, 0,
+				  (len - v->len) * v->elem_size);
+	v->len = len;
+	return 0;
+}
+
+void vec_clear(Vec *v) {
+	v->len = 0;
+}
+
+void *vec_at(const Vec *v, u64 i) {
+	return i < v->len ? v->data + i * v->elem_size : NULL;
+}
+
+int vec_push(Vec *v, const void *elem) {
+	if (v->len == v->capacity && vec_reserve(v, v->len + 1)) return -1;
+	copy_bytes(v->data + v->len * v->elem_size, elem, v->elem_size);
+	v->len++;
+	return 0;
+}
+
+int vec_append(Vec *v, const void *elems, u64 count) {
+	return vec_insert(v, v->len, elems, count);
+}
+
+int vec_pop(Vec *v, void *elem) {
+	if (v->len == 0) return -1;
+	v->len--;
+	if (elem) copy_bytes(elem, v->data + v->len * v->elem_size, v->elem_size);
+	return 0;
+}
+
+int vec_insert(Vec *v, u64 i, const void *elems, u64 count) {
+	if (i > v->len || count > ~0ULL - v->len) return -1;
+	if (vec_reserve(v, v->len + count)) return -1;
+	u64 size = v->elem_size;
+	byte *at = v->data + i * size;
+	vec_move(at + count * size, at, (v->len - i) * size);
+	copy_bytes(at, elems, count * size);
+	v->len += count;
+	return 0;
+}
+
+int vec_erase(Vec *v, u64 i, u64 count) {
+	if (i > v->len || count > v->len - i) return -1;
+	u64 size = v->elem_size;
+	byte *at = v->data + i * size;
+	vec_move(at, at + count * size, (v->len - i - count) * size);
+	v->len -= count;
+	return 0;
+}
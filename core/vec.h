@@ -0,0 +1,68 @@
+// Copyright (c) 2024, The MyFamily Developers
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _CORE_VEC__
+#define _CORE_VEC__
+
+#include <base/types.h>
+
+// Growable array of fixed size elements in mapped pages. Capacity doubles
+// (amortized O(1) push) and growth goes through remap, so on Linux a larger
+// vector takes over the same physical pages instead of copying them. The
+// smallest allocation is one page; an empty vector maps nothing.
+//
+// Pointers into 'data' are invalidated by anything that may grow the vector.
+typedef struct Vec {
+	byte *data;
+	u64 len;
+	u64 capacity;
+	u64 elem_size;
+	u64 pages;
+} Vec;
+
+// Functions returning int return 0 on success and -1 on failure (the pages
+// could not be mapped, or an index is out of range); the vector is unchanged
+// on failure.
+int vec_init(Vec *v, u64 elem_size, u64 capacity);
+void vec_cleanup(Vec *v);
+// Ensure room for at least 'capacity' elements.
+int vec_reserve(Vec *v, u64 capacity);
+// Set the length; new elements are zeroed.
+int vec_resize(Vec *v, u64 len);
+void vec_clear(Vec *v);
+
+// Pointer to element 'i', or NULL if it is out of range.
+void *vec_at(const Vec *v, u64 i);
+int vec_push(Vec *v, const void *elem);
+// Append 'count' elements from 'elems'.
+int vec_append(Vec *v, const void *elems, u64 count);
+// Copy the last element to 'elem' (if not NULL) and remove it.
+int vec_pop(Vec *v, void *elem);
+// Insert 'count' elements before index 'i' (i <= len), shifting the rest.
+int vec_insert(Vec *v, u64 i, const void *elems, u64 count);
+// Remove 'count' elements starting at 'i', shifting the rest down.
+int vec_erase(Vec *v, u64 i, u64 count);
+
+// Typed access: Vec v; vec_init_type(&v, u32); vec_push_value(&v, u32, 7);
+// u32 x = vec_get(&v, u32, 0);
+#define vec_init_type(v, type) vec_init(v, sizeof(type), 0)
+#define vec_data(v, type) ((type *)(v)->data)
+#define vec_get(v, type, i) (((type *)(v)->data)[i])
+#define vec_push_value(v, type, value)     \
+	({                                     \
+		type __vec_value = (value);        \
+		vec_push((v), &__vec_value);       \
+	})
+
+#endif	// _CORE_VEC__
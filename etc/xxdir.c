@@ -14,131 +14,393 @@
 
 // This utility is used to build a header for resource directories which can be
 // included in binaries.
+//
+// By default every file is written into the header as a C array. With --asm
+// the header only declares the arrays and a second file, '<header>.S', pulls
+// the raw bytes in with the assembler's .incbin directive. That file must be
+// compiled and linked with the binary (cc -c resources.h.S), but generation
+// and compilation no longer scale with the size of the resources.
+//
+// With --pack the output is a resource pack (see core/resource.h) which can be
+// opened with resource_pack_open_file. Combined with --asm the pack is written
+// to '<header>.pack' and embedded as '<namespace>xxdir_pack' so that it can be
+// opened in place with resource_pack_open. --compress stores each file of the
+// pack lz compressed (base/lz.h) when that makes it smaller; resource_read
+// decompresses such entries.
+//
+// --pack uses the pack builder from core, so xxdir is built from the
+// repository root with:
+//   cc -I. -o xxdir etc/xxdir.c core/resource.c base/lz.c base/crc32c.c \
+//      base/cpu.c base/dirscan.c base/encode.c base/sys.c base/util.c \
+//      -lpthread
 
-#include <dirent.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/stat.h>
 
+#include <base/dirscan.h>
+#include <base/encode.h>
+#include <core/resource.h>
+
+typedef struct StrBuf {
+	char *data;
+	size_t len;
+	size_t capacity;
+} StrBuf;
+
+typedef struct Entry {
+	char *path;
+	char *name;
+	unsigned long long size;
+} Entry;
+
+Entry *entries = NULL;
 int file_count = 0;
-#define MAX_FILES 4096
-int file_sizes[MAX_FILES];
+int entry_capacity = 0;
+
+void *xrealloc(void *ptr, size_t size) {
+	void *ret = realloc(ptr, size);
+	if (ret == NULL) {
+		perror("Failed to allocate memory");
+		exit(-1);
+	}
+	return ret;
+}
+
+char *xstrdup(const char *s) {
+	size_t len = strlen(s);
+	char *ret = xrealloc(NULL, len + 1);
+	memcpy(ret, s, len + 1);
+	return ret;
+}
+
+void strbuf_append_n(StrBuf *sb, const char *s, size_t n) {
+	if (sb->len + n + 1 > sb->capacity) {
+		size_t ncap = sb->capacity ? sb->capacity * 2 : 1024;
+		while (ncap < sb->len + n + 1) ncap *= 2;
+		sb->data = xrealloc(sb->data, ncap);
+		sb->capacity = ncap;
+	}
+	memcpy(sb->data + sb->len, s, n);
+	sb->len += n;
+	sb->data[sb->len] = 0;
+}
+
+void strbuf_append(StrBuf *sb, const char *s) {
+	strbuf_append_n(sb, s, strlen(s));
+}
+
+// append 's' as the contents of a C (or assembler) string literal
+void strbuf_append_escaped(StrBuf *sb, const char *s) {
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\') strbuf_append_n(sb, "\\", 1);
+		strbuf_append_n(sb, s, 1);
+	}
+}
+
+void add_entry(const char *path, const char *name, unsigned long long size) {
+	if (file_count == entry_capacity) {
+		entry_capacity = entry_capacity ? entry_capacity * 2 : 256;
+		entries = xrealloc(entries, entry_capacity * sizeof(Entry));
+	}
+	entries[file_count].path = xstrdup(path);
+	entries[file_count].name = xstrdup(name);
+	entries[file_count].size = size;
+	file_count++;
+}
 
 void print_hex(const unsigned char *data, unsigned long long size, FILE *out,
-			   const char *file, const char *namespace) {
-	char buf[strlen(namespace) + 100];
-	snprintf(buf, strlen(namespace) + 100,
-			 "static unsigned char %sxxdir_file_%i[] = {\n", namespace,
-			 file_count);
-	for (int i = 0; i < strlen(buf); i++)
-		if (buf[i] == '.') buf[i] = '_';
-	fprintf(out, "%s", buf);
-	for (unsigned long long i = 0; i < size; i++) {
-		fprintf(out, "0x%02x, ", data[i]);
-		if ((i + 1) % 16 == 0) {
-			fprintf(out, "\n");
-		} else {
-			fprintf(out, " ");
+			   int index, const char *namespace) {
+	fprintf(out, "static unsigned char %sxxdir_file_%i[] = {\n", namespace,
+			index);
+	// "0xNN, " and a space or, after every 16th byte, a newline
+	char digits[2 * 4096], line[7 * 4096];
+	for (unsigned long long i = 0; i < size; i += 4096) {
+		unsigned long long n = size - i < 4096 ? size - i : 4096;
+		hex_encode(digits, data + i, n);
+		for (unsigned long long j = 0; j < n; j++) {
+			char *p = line + 7 * j;
+			p[0] = '0';
+			p[1] = 'x';
+			p[2] = digits[2 * j];
+			p[3] = digits[2 * j + 1];
+			p[4] = ',';
+			p[5] = ' ';
+			p[6] = (i + j + 1) % 16 == 0 ? '\n' : ' ';
 		}
+		fwrite(line, 1, 7 * n, out);
 	}
-	file_sizes[file_count] = size;
 	fprintf(out,
 			"0x00};\nstatic unsigned long long %sxxdir_file_size_%i = %llu;\n",
-			namespace, file_count, size);
+			namespace, index, size);
 }
 
-void proc_file(const char *file_path, const char *output_header, FILE *out,
-			   const char *namespace) {
-	FILE *file = fopen(file_path, "rb");
+unsigned char *read_entry(int index) {
+	FILE *file = fopen(entries[index].path, "rb");
 	if (file == NULL) {
 		perror("Failed to open file");
 		exit(-1);
 	}
 
-	// Determine the file size
-	fseek(file, 0, SEEK_END);
-	long file_size = ftell(file);
-	fseek(file, 0, SEEK_SET);
+	unsigned long long file_size = entries[index].size;
 
 	// Read the file into memory
-	unsigned char *data = malloc(file_size);
+	unsigned char *data = malloc(file_size ? file_size : 1);
 	if (data == NULL) {
 		perror("Failed to allocate memory");
 		fclose(file);
 		exit(-1);
 	}
-	fread(data, 1, file_size, file);
+	if (fread(data, 1, file_size, file) != file_size) {
+		perror("Failed to read file");
+		exit(-1);
+	}
 	fclose(file);
+	return data;
+}
+
+void proc_file(int index, FILE *out, const char *namespace) {
+	unsigned char *data = read_entry(index);
 
 	// Print the hexadecimal representation
-	print_hex(data, file_size, out, file_path, namespace);
-	file_count++;
+	print_hex(data, entries[index].size, out, index, namespace);
 
 	// Clean up
 	free(data);
 }
 
-void include_dir(const char *dir_path, const char *base, char *buf,
-				 const char *output_header, FILE *out, const char *namespace) {
-	DIR *dir = opendir(dir_path);
-	if (dir == NULL) {
-		perror("Error opening directory");
+pthread_mutex_t entries_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int include_entry(const DirscanEntry *entry, void *dir_path) {
+	char full_path[strlen(dir_path) + entry->path_len + 2];
+	strcpy(full_path, dir_path);
+	strcat(full_path, "/");
+	strcat(full_path, entry->path);
+
+	pthread_mutex_lock(&entries_lock);
+	add_entry(full_path, entry->path, entry->size);
+	pthread_mutex_unlock(&entries_lock);
+	return 0;
+}
+
+int compare_entries(const void *a, const void *b) {
+	return strcmp(((const Entry *)a)->name, ((const Entry *)b)->name);
+}
+
+// Subdirectories are read in parallel (see base/dirscan.h), so the entries
+// are sorted by name to keep the output the same from one run to the next.
+void include_dir(const char *dir_path) {
+	if (dirscan(dir_path, DIRSCAN_STAT | DIRSCAN_FOLLOW, 0, include_entry,
+				(void *)dir_path)) {
+		perror("Error reading directory");
 		exit(-1);
 	}
+	qsort(entries, file_count, sizeof(Entry), compare_entries);
+}
 
-	struct dirent *entry;
-	while ((entry = readdir(dir)) != NULL) {
-		// Skip the "." and ".." entries
-		if (strcmp(entry->d_name, ".") == 0 ||
-			strcmp(entry->d_name, "..") == 0) {
-			continue;
-		}
+void print_index(FILE *out, const char *namespace, const char *qualifier) {
+	StrBuf buf = {0};
+	strbuf_append(&buf, "static char *");
+	strbuf_append(&buf, namespace);
+	strbuf_append(&buf, "xxdir_file_names[] = {");
+	for (int i = 0; i < file_count; i++) {
+		strbuf_append(&buf, "\"");
+		strbuf_append_escaped(&buf, entries[i].name);
+		strbuf_append(&buf, "\", ");
+	}
+	strbuf_append(&buf, "(void*)0};");
+	fprintf(out, "%s", buf.data);
+	free(buf.data);
 
-		char full_path[strlen(entry->d_name) + strlen(dir_path) + 100];
-		strcpy(full_path, dir_path);
-		strcat(full_path, "/");
-		strcat(full_path, entry->d_name);
-
-		struct stat s;
-		if (stat(full_path, &s) == 0 && s.st_mode & S_IFDIR) {
-			char next_level[PATH_MAX];
-			strcpy(next_level, base);
-			if (strlen(base) > 0) strcat(next_level, "/");
-			strcat(next_level, entry->d_name);
-			include_dir(full_path, next_level, buf, output_header, out,
-						namespace);
-		} else {
-			proc_file(full_path, output_header, out, namespace);
-
-			strcat(buf, "\"");
-			if (strlen(base) > 0) {
-				// it's in a subdirectory
-				strcat(buf, base);
-				strcat(buf, "/");
-			}
-			strcat(buf, entry->d_name);
-			strcat(buf, "\", ");
-		}
+	fprintf(out, "\nstatic int %sxxdir_file_count=%i;\n", namespace,
+			file_count);
+
+	fprintf(out, "static unsigned char %s*%sxxdir_files[] = {", qualifier,
+			namespace);
+	for (int i = 0; i < file_count; i++)
+		fprintf(out, "%sxxdir_file_%i,", namespace, i);
+	fprintf(out, "(void*)0};\n");
+	fprintf(out, "static unsigned long long %sxxdir_file_sizes[] = { ",
+			namespace);
+	for (int i = 0; i < file_count; i++)
+		fprintf(out, "%llu, ", entries[i].size);
+	fprintf(out, "0};\n");
+}
+
+void write_hex(FILE *out, const char *namespace) {
+	for (int i = 0; i < file_count; i++) proc_file(i, out, namespace);
+	print_index(out, namespace, "");
+}
+
+FILE *open_output(const char *path, const char *suffix) {
+	char full_path[strlen(path) + strlen(suffix) + 1];
+	strcpy(full_path, path);
+	strcat(full_path, suffix);
+	FILE *out = fopen(full_path, "w");
+	if (out == NULL) {
+		fprintf(stderr, "Could not open output file '%s'", full_path);
+		exit(-1);
+	}
+	return out;
+}
+
+// absolute, escaped path for an .incbin directive (caller frees)
+char *incbin_path(const char *file) {
+	char *real = realpath(file, NULL);
+	if (real == NULL) {
+		perror("Failed to resolve path");
+		exit(-1);
+	}
+	StrBuf path = {0};
+	strbuf_append_escaped(&path, real);
+	free(real);
+	return path.data;
+}
+
+// The assembler source is run through the C preprocessor (.S) so that the
+// Mach-O symbol prefix and section names can be chosen at build time.
+FILE *open_asm(const char *output_header) {
+	FILE *asm_out = open_output(output_header, ".S");
+	fprintf(asm_out,
+			"#ifdef __APPLE__\n"
+			"#define XXDIR_SYM(x) _##x\n"
+			"\t.section __TEXT,__const\n"
+			"#else\n"
+			"#define XXDIR_SYM(x) x\n"
+			"\t.section .note.GNU-stack,\"\",@progbits\n"
+			"\t.section .rodata\n"
+			"#endif\n");
+	return asm_out;
+}
+
+void write_asm(FILE *out, const char *output_header, const char *namespace,
+			   unsigned int align) {
+	FILE *asm_out = open_asm(output_header);
+	for (int i = 0; i < file_count; i++) {
+		char *path = incbin_path(entries[i].path);
+		fprintf(asm_out,
+				"\t.globl XXDIR_SYM(%sxxdir_file_%i)\n"
+				"\t.balign %u\n"
+				"XXDIR_SYM(%sxxdir_file_%i):\n"
+				"\t.incbin \"%s\"\n"
+				"\t.byte 0\n",
+				namespace, i, align, namespace, i, path);
+		free(path);
+
+		fprintf(out,
+				"extern const unsigned char %sxxdir_file_%i[];\n"
+				"static unsigned long long %sxxdir_file_size_%i = %llu;\n",
+				namespace, i, namespace, i, entries[i].size);
+	}
+	fclose(asm_out);
+
+	print_index(out, namespace, "const ");
+}
+
+void write_pack(FILE *out, const char *output, const char *namespace,
+				unsigned int align, int asm_mode, int compress) {
+	ResourceInput *inputs = xrealloc(NULL, (file_count + 1) * sizeof(*inputs));
+	for (int i = 0; i < file_count; i++) {
+		inputs[i].name = entries[i].name;
+		inputs[i].data = read_entry(i);
+		inputs[i].size = entries[i].size;
+		inputs[i].compression =
+			compress ? RESOURCE_COMPRESSION_LZ : RESOURCE_COMPRESSION_NONE;
+	}
+
+	// with compression the size is only known once the pack is built
+	i64 bound = resource_pack_size(inputs, file_count, align);
+	byte *pack = bound < 0 ? NULL : xrealloc(NULL, bound);
+	i64 size = bound < 0 ? -1
+						 : resource_pack_build(inputs, file_count, align,
+											   pack, bound);
+	if (size < 0) {
+		fprintf(stderr, "Failed to build resource pack\n");
+		exit(-1);
 	}
+	for (int i = 0; i < file_count; i++) free((void *)inputs[i].data);
+	free(inputs);
+
+	FILE *pack_out = asm_mode ? open_output(output, ".pack") : out;
+	if (fwrite(pack, 1, size, pack_out) != size) {
+		perror("Failed to write resource pack");
+		exit(-1);
+	}
+	free(pack);
+	if (!asm_mode) return;
+	fclose(pack_out);
+
+	char pack_path[strlen(output) + 6];
+	strcpy(pack_path, output);
+	strcat(pack_path, ".pack");
+	char *path = incbin_path(pack_path);
+	FILE *asm_out = open_asm(output);
+	fprintf(asm_out,
+			"\t.globl XXDIR_SYM(%sxxdir_pack)\n"
+			"\t.globl XXDIR_SYM(%sxxdir_pack_end)\n"
+			"\t.balign %u\n"
+			"XXDIR_SYM(%sxxdir_pack):\n"
+			"\t.incbin \"%s\"\n"
+			"XXDIR_SYM(%sxxdir_pack_end):\n",
+			namespace, namespace, align < 8 ? 8 : align, namespace, path,
+			namespace);
+	fclose(asm_out);
+	free(path);
+
+	fprintf(out,
+			"extern const unsigned char %sxxdir_pack[];\n"
+			"extern const unsigned char %sxxdir_pack_end[];\n",
+			namespace, namespace);
+}
+
+void usage() {
+	fprintf(stderr,
+			"Usage: xxdir [--asm] [--pack] [--compress] [--align=<bytes>] "
+			"<resource_directory> <header name> <optional namespace>\n");
+	exit(-1);
 }
 
 int main(int argc, char **argv) {
-	if (argc != 3 && argc != 4) {
-		fprintf(stderr,
-				"Usage: xxdir <resource_directory> <header name> <optional "
-				"namespace>");
+	int asm_mode = 0, pack_mode = 0, compress = 0;
+	unsigned int align = 16;
+	int argi = 1;
+	for (; argi < argc && !strncmp(argv[argi], "--", 2); argi++) {
+		if (!strcmp(argv[argi], "--asm"))
+			asm_mode = 1;
+		else if (!strcmp(argv[argi], "--pack"))
+			pack_mode = 1;
+		else if (!strcmp(argv[argi], "--compress"))
+			compress = 1;
+		else if (!strncmp(argv[argi], "--align=", 8)) {
+			align = strtoul(argv[argi] + 8, NULL, 10);
+			if (align == 0 || (align & (align - 1))) {
+				fprintf(stderr, "alignment must be a power of two\n");
+				exit(-1);
+			}
+		} else
+			usage();
+	}
+	if (argc - argi != 2 && argc - argi != 3) usage();
+	if (compress && !pack_mode) {
+		fprintf(stderr, "--compress requires --pack\n");
 		exit(-1);
 	}
 
-	const char *dir_path = argv[1];
-	const char *output_header = argv[2];
+	const char *dir_path = argv[argi];
+	const char *output_header = argv[argi + 1];
 
 	char namespace[1000];
-	if (argc == 4) {
-		strcpy(namespace, argv[3]);
+	if (argc - argi == 3) {
+		if (strlen(argv[argi + 2]) > 128) {
+			fprintf(stderr, "namespace is too long. Max len = 128 bytes.");
+			exit(-1);
+		}
+		strcpy(namespace, argv[argi + 2]);
 		strcat(namespace, "_");
+		for (int i = 0; namespace[i]; i++)
+			if (namespace[i] == '.') namespace[i] = '_';
 	} else {
 		strcpy(namespace, "");
 	}
@@ -149,33 +411,15 @@ int main(int argc, char **argv) {
 		exit(-1);
 	}
 
-	char initial_text[1024];
-	if (strlen(namespace) > 128) {
-		fprintf(stderr, "namespace is too long. Max len = 128 bytes.");
-		exit(-1);
-	}
-	strcpy(initial_text, "static char *");
-	strcat(initial_text, namespace);
-	strcat(initial_text, "xxdir_file_names[] = {");
-	char buf[1024 * 1024];
-	strcpy(buf, initial_text);
-
-	include_dir(dir_path, "", buf, output_header, out, namespace);
-
-	strcat(buf, "(void*)0};");
-	fprintf(out, "%s", buf);
-
-	fprintf(out, "\nstatic int %sxxdir_file_count=%i;\n", namespace,
-			file_count);
+	include_dir(dir_path);
 
-	fprintf(out, "static unsigned char *%sxxdir_files[] = {", namespace);
-	for (int i = 0; i < file_count; i++)
-		fprintf(out, "%sxxdir_file_%i,", namespace, i);
-	fprintf(out, "(void*)0};\n");
-	fprintf(out, "static unsigned long long %sxxdir_file_sizes[] = { ",
-			namespace);
-	for (int i = 0; i < file_count; i++) fprintf(out, "%i, ", file_sizes[i]);
-	fprintf(out, "0};\n");
+	if (pack_mode)
+		write_pack(out, output_header, namespace, align, asm_mode,
+				   compress);
+	else if (asm_mode)
+		write_asm(out, output_header, namespace, align);
+	else
+		write_hex(out, namespace);
 
 	fclose(out);
 
@@ -1,6 +1,6 @@
 #!/bin/sh
 
-usage="Usage: fam [ all | test ] [options]";
+usage="Usage: fam [ all | test | fasttest | bench ] [options]";
 
 for var in "$@"; do
 	case "$var" in
@@ -28,8 +28,17 @@ for var in "$@"; do
 	--target=*)
 		target=${var#*=}
 		;;
+	--baseline=*)
+		baseline=${var#*=}
+		;;
+	--bench-output=*)
+		bench_output=${var#*=}
+		;;
+	--threshold=*)
+		threshold=${var#*=}
+		;;
 	all)
-		if [ "$test" = "1" ] || [ "$clean" = "1" ] || [ "$coverage" = "1" ] || [ "$fasttest" = "1" ]; then
+		if [ "$test" = "1" ] || [ "$clean" = "1" ] || [ "$coverage" = "1" ] || [ "$fasttest" = "1" ] || [ "$bench" = "1" ]; then
                         echo "Multiple options specified";
                         echo $usage;
                         exit;
@@ -44,8 +53,16 @@ for var in "$@"; do
                 fi
 		fasttest=1;
 		;;
+	bench)
+		if [ "$all" = "1" ] || [ "$clean" = "1" ] || [ "$coverage" = "1" ] || [ "$test" = "1" ] || [ "$fasttest" = "1" ]; then
+                        echo "Multiple options specified";
+                        echo $usage;
+                        exit;
+                fi
+		bench=1;
+		;;
 	clean)
-	if [ "$all" = "1" ] || [ "$test" = "1" ] || [ "$coverage" = "1" ] || [ "$fasttest" = "1" ]; then
+	if [ "$all" = "1" ] || [ "$test" = "1" ] || [ "$coverage" = "1" ] || [ "$fasttest" = "1" ] || [ "$bench" = "1" ]; then
                         echo "Multiple options specified";
                         echo $usage;
                         exit;
@@ -53,7 +70,7 @@ for var in "$@"; do
 		clean=1;
 		;;
 	coverage)
-		if [ "$all" = "1" ] || [ "$clean" = "1" ] || [ "$test" = "1" ] || [ "$fasttest" = "1" ]; then
+		if [ "$all" = "1" ] || [ "$clean" = "1" ] || [ "$test" = "1" ] || [ "$fasttest" = "1" ] || [ "$bench" = "1" ]; then
                         echo "Multiple options specified";
                         echo $usage;
                         exit;
@@ -61,7 +78,7 @@ for var in "$@"; do
 		coverage=1;
 		;;
 	test)
-		if [ "$all" = "1" ] || [ "$clean" = "1" ] || [ "$coverage" = "1" ] || [ "$fasttest" = "1" ]; then
+		if [ "$all" = "1" ] || [ "$clean" = "1" ] || [ "$coverage" = "1" ] || [ "$fasttest" = "1" ] || [ "$bench" = "1" ]; then
 			echo "Multiple options specified";
 			echo $usage;
 			exit;
@@ -75,7 +92,7 @@ for var in "$@"; do
 	esac
 done
 
-if [ "$test" != "1" ] && [ "$clean" != "1" ] && [ "$coverage" != "1" ] && [ "$fasttest" != "1" ]; then
+if [ "$test" != "1" ] && [ "$clean" != "1" ] && [ "$coverage" != "1" ] && [ "$fasttest" != "1" ] && [ "$bench" != "1" ]; then
 	all=1;
 fi
 